@@ -26,13 +26,20 @@
  *
  *  \brief Checksum calculation
  *
- *  This file contains routines for CRC-32 and ADLER-32 checksum
- *  calculation. At the moment program uses only CRC-32 algorithm.
+ *  This file contains routines for CRC-32, CRC-32C and ADLER-32
+ *  checksum calculation. CRC-32 is the default block checksum,
+ *  other algorithms can be selected by the encoder.
+ *
+ *  CRC routines use slicing-by-8 tables. PCLMULQDQ and SSE4.2
+ *  instructions are used when CPU supports them (checked at
+ *  runtime), ARMv8 CRC instructions are used when compiler
+ *  targets them. Result is always the same.
  *
  *  \section References
  *
  *  <a href="http://www.ross.net/crc/">A Painless Guide to CRC Error Detection Algorithms</a><br>
  *  <a href="http://en.wikipedia.org/wiki/CRC32">Wikipedia: CRC-32</a><br>
+ *  <a href="http://www.intel.com/content/dam/www/public/us/en/documents/white-papers/fast-crc-computation-generic-polynomials-pclmulqdq-paper.pdf">Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction</a><br>
  *  <a href="http://en.wikipedia.org/wiki/Adler-32">Wikipedia: ADLER-32</a> */
 
 #ifndef __CHECKSUM_H__
@@ -68,6 +75,16 @@ crc32_t epsilon_adler32(unsigned char *data, int length);
  *  \return Checksum */
 crc32_t epsilon_crc32(unsigned char *data, int length);
 
+/** Compute CRC-32C checksum
+ *
+ *  This function computes CRC-32C (Castagnoli) checksum.
+ *
+ *  \param data Data to sum
+ *  \param length Data length
+ *
+ *  \return Checksum */
+crc32_t epsilon_crc32c(unsigned char *data, int length);
+
 /*@}*/
 
 #ifdef __cplusplus
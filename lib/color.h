@@ -67,6 +67,29 @@ void convert_RGB_to_YCbCr(coeff_t **R, coeff_t **G, coeff_t **B,
                           coeff_t **Y, coeff_t **Cb, coeff_t **Cr,
                           int width, int height);
 
+/** 8-bit RGB to YCbCr conversion
+ *
+ *  This function is the same as \ref convert_RGB_to_YCbCr,
+ *  but takes 8-bit input directly. On x86 it uses SSE2 or
+ *  AVX2 instructions for contiguous rows. Results do not
+ *  depend on the code path.
+ *
+ *  \note All input channels must have the same pixel step.
+ *
+ *  \param R Red channel
+ *  \param G Green channel
+ *  \param B Blue channel
+ *  \param Y Luma channel
+ *  \param Cb Chroma-blue channel
+ *  \param Cr Chroma-red channel
+ *  \param width Image width
+ *  \param height Image height
+ *
+ *  \return \c VOID */
+void convert_RGB8_to_YCbCr(pixmap_t *R, pixmap_t *G, pixmap_t *B,
+                           coeff_t **Y, coeff_t **Cb, coeff_t **Cr,
+                           int width, int height);
+
 /** YCbCr to RGB conversion
  *
  *  This function converts image from YCbCr to RGB color space.
@@ -87,6 +110,29 @@ void convert_YCbCr_to_RGB(coeff_t **Y, coeff_t **Cb, coeff_t **Cr,
                           coeff_t **R, coeff_t **G, coeff_t **B,
                           int width, int height);
 
+/** YCbCr to 8-bit RGB conversion
+ *
+ *  This function is the same as \ref convert_YCbCr_to_RGB,
+ *  but stores clipped values as 8-bit output. On x86 it uses
+ *  SSE2 or AVX2 instructions for contiguous rows. Results do
+ *  not depend on the code path.
+ *
+ *  \note All output channels must have the same pixel step.
+ *
+ *  \param Y Luma channel
+ *  \param Cb Chroma-blue channel
+ *  \param Cr Chroma-red channel
+ *  \param R Red channel
+ *  \param G Green channel
+ *  \param B Blue channel
+ *  \param width Image width
+ *  \param height Image height
+ *
+ *  \return \c VOID */
+void convert_YCbCr_to_RGB8(coeff_t **Y, coeff_t **Cb, coeff_t **Cr,
+                           pixmap_t *R, pixmap_t *G, pixmap_t *B,
+                           int width, int height);
+
 /** Channel clipping
  *
  *  This function encloses (clips) each \a channel value within [0..255] interval
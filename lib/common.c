@@ -47,3 +47,11 @@ int is_power_of_two(int value)
 {
     return (value == (1 << (number_of_bits(value) - 1)));
 }
+
+void pixmap_from_rows(pixmap_t *pixmap, unsigned char **rows)
+{
+    pixmap->rows = rows;
+    pixmap->base = NULL;
+    pixmap->stride = 0;
+    pixmap->step = 1;
+}
@@ -49,6 +49,7 @@ extern "C" {
 #endif
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <assert.h>
 #include <sys/types.h>
@@ -92,6 +93,28 @@ local int number_of_bits_table[256] = {
 /** Type definition for filter coefficients */
 typedef double coeff_t;
 
+/** 8-bit channel
+ *
+ *  Pixel (\a x, \a y) is either \a rows[y][x] or, if \a rows
+ *  is \c NULL, \a base[y * stride + x * step]. The latter form
+ *  describes caller's memory, e.g. a packed interleaved image. */
+typedef struct pixmap_tag {
+    /** Row pointers or \c NULL */
+    unsigned char **rows;
+    /** First pixel */
+    unsigned char *base;
+    /** Distance between adjacent rows in bytes */
+    ptrdiff_t stride;
+    /** Distance between adjacent pixels in bytes */
+    int step;
+} pixmap_t;
+
+/** Channel refers to no memory */
+#define PIXMAP_IS_NULL(_p)      (!(_p)->rows && !(_p)->base)
+/** First pixel of the row */
+#define PIXMAP_ROW(_p, _y)      ((_p)->rows ? (_p)->rows[(_y)] : \
+                                 (_p)->base + (ptrdiff_t) (_y) * (_p)->stride)
+
 /** Number of bits in the value
  *
  *  This function computes the number of bits in the \a value
@@ -112,6 +135,17 @@ int number_of_bits(int value);
  *  \return \c 1 if \a value is a power of two and \c 0 otherwise */
 int is_power_of_two(int value);
 
+/** Describe a channel held as row pointers
+ *
+ *  This function fills the \a pixmap for the array of
+ *  row pointers \a rows.
+ *
+ *  \param pixmap Channel
+ *  \param rows Row pointers
+ *
+ *  \return \c VOID */
+void pixmap_from_rows(pixmap_t *pixmap, unsigned char **rows);
+
 /*@}*/
 
 #ifdef __cplusplus
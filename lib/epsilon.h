@@ -139,6 +139,31 @@ extern "C" {
 /** Resample image according to the 4:2:0 scheme */
 #define EPS_RESAMPLE_420        1
 
+/** Write compact binary block header
+ *
+ *  By default block header is a human-readable ASCII string.
+ *  This flag tells encoder to write a compact binary header
+ *  instead: it is several times shorter and cheaper to parse.
+ *  Both header forms are recognized by \ref eps_read_block_header
+ *  and \ref eps_truncate_block. See also \ref eps_encode_grayscale_block_ex
+ *  and \ref eps_encode_truecolor_block_ex. */
+#define EPS_BINARY_HEADER       0x01
+
+/** Protect block data with CRC-32 (default) */
+#define EPS_CHECKSUM_CRC32      0x00
+/** Protect block data with CRC-32C
+ *
+ *  CRC-32C (Castagnoli) is computed by a dedicated instruction
+ *  on modern CPUs and is several times cheaper than CRC-32 there.
+ *  Checksum type is recorded in the block header, so decoder
+ *  and \ref eps_truncate_block pick it up automatically. */
+#define EPS_CHECKSUM_CRC32C     0x02
+/** Protect block data with ADLER-32
+ *
+ *  ADLER-32 is weaker than CRC but cheap on any CPU.
+ *  See also \ref EPS_CHECKSUM_CRC32C. */
+#define EPS_CHECKSUM_ADLER32    0x04
+
 /** Successful operation */
 #define EPS_OK                  0
 /** Incorrect function parameter */
@@ -239,8 +264,155 @@ typedef struct eps_block_header_tag {
         /** Special information for TRUECOLOR blocks */
         tc_hdr tc;
     } hdr_data;
+
+    /** Data checksum type
+     *
+     *  Either \ref EPS_CHECKSUM_CRC32 or \ref EPS_CHECKSUM_CRC32C
+     *  or \ref EPS_CHECKSUM_ADLER32 */
+    int crc_type;
 } eps_block_header;
 
+/** Maximal number of rate-distortion points per block */
+#define EPS_MAX_RD_POINTS       128
+
+/** Block rate-distortion curve
+ *
+ *  This structure describes how reconstruction error of
+ *  an encoded block decreases as the block grows. Points are
+ *  sorted by size, the last point is the complete block.
+ *
+ *  \note Distortion is estimated in the wavelet domain, so
+ *  it is only comparable between blocks encoded with the same
+ *  filterbank and mode. */
+typedef struct eps_rd_info_tag {
+    /** Number of points */
+    int n_points;
+    /** Block size in bytes (header included) at each point */
+    int size[EPS_MAX_RD_POINTS];
+    /** Squared reconstruction error at each point */
+    double dist[EPS_MAX_RD_POINTS];
+} eps_rd_info;
+
+/** Image in caller's memory
+ *
+ *  This structure describes 8-bit image data held by the caller
+ *  in a plain buffer. Channel \a k pixel (\a x, \a y) is stored at
+ *  \a data[k] + \a y * \a stride + \a x * \a step. Thus the same
+ *  structure covers:
+ *
+ *  <ul>
+ *  <li>Grayscale images: \a data[0] only, \a step = 1</li>
+ *  <li>Interleaved RGB images: \a data[k] = base + k, \a step = 3</li>
+ *  <li>Planar RGB images: three planes, \a step = 1</li>
+ *  </ul>
+ *
+ *  Blocks are encoded from and decoded into this memory directly,
+ *  see \ref eps_encode_grayscale_block_strided and friends.
+ *  Functions \ref eps_image_gray, \ref eps_image_rgb and
+ *  \ref eps_image_planar fill the structure for common layouts. */
+typedef struct eps_image_tag {
+    /** Channel origins: Y or R, G, B */
+    unsigned char *data[3];
+    /** Image width in pixels */
+    int width;
+    /** Image height in pixels */
+    int height;
+    /** Distance between adjacent rows in bytes (may be negative) */
+    int stride;
+    /** Distance between adjacent pixels in bytes */
+    int step;
+} eps_image;
+
+/** Encode a GRAYSCALE block, see \ref eps_encode_grayscale_block_ex */
+#define EPS_JOB_ENCODE_GS       1
+/** Encode a TRUECOLOR block, see \ref eps_encode_truecolor_block_ex */
+#define EPS_JOB_ENCODE_TC       2
+/** Decode a block of any type, see \ref eps_decode_grayscale_block
+ *  and \ref eps_decode_truecolor_block */
+#define EPS_JOB_DECODE          3
+
+/** Batch job structure */
+typedef struct eps_job_tag eps_job;
+
+/** Batch job structure
+ *
+ *  This structure describes a single block to be processed
+ *  by the worker pool. Fields have the same meaning as the
+ *  parameters of the corresponding single-block function.
+ *  The structure is owned by the caller and should not be
+ *  modified or released until the job is completed. */
+struct eps_job_tag {
+    /** Either \ref EPS_JOB_ENCODE_GS or \ref EPS_JOB_ENCODE_TC
+     *  or \ref EPS_JOB_DECODE */
+    int type;
+
+    /** Block channels
+     *
+     *  Only the first channel is used for GRAYSCALE blocks,
+     *  TRUECOLOR blocks use R, G and B channels. */
+    unsigned char **block[3];
+
+    /** Image width (encoding only) */
+    int W;
+    /** Image height (encoding only) */
+    int H;
+    /** Block width (encoding only) */
+    int w;
+    /** Block height (encoding only) */
+    int h;
+    /** Block X coordinate (encoding only) */
+    int x;
+    /** Block Y coordinate (encoding only) */
+    int y;
+
+    /** Encoded data buffer */
+    unsigned char *buf;
+    /** Buffer size (encoding only)
+     *
+     *  On completion it holds real amount of bytes used. */
+    int buf_size;
+
+    /** Filterbank ID (encoding only) */
+    char *fb_id;
+    /** Either \ref EPS_MODE_NORMAL or \ref EPS_MODE_OTLPF (encoding only) */
+    int mode;
+    /** Either \ref EPS_RESAMPLE_444 or \ref EPS_RESAMPLE_420
+     *  (TRUECOLOR encoding only) */
+    int resample;
+    /** Bit-budget percent for the Y channel (TRUECOLOR encoding only) */
+    int Y_rt;
+    /** Bit-budget percent for the Cb channel (TRUECOLOR encoding only) */
+    int Cb_rt;
+    /** Bit-budget percent for the Cr channel (TRUECOLOR encoding only) */
+    int Cr_rt;
+    /** Encoding flags, see \ref eps_encode_grayscale_block_ex */
+    int flags;
+    /** Rate-distortion curve, may be \c NULL (encoding only) */
+    eps_rd_info *rd;
+
+    /** Block header (decoding only)
+     *
+     *  Should be filled by \ref eps_read_block_header. */
+    eps_block_header hdr;
+
+    /** Completion callback
+     *
+     *  If not \c NULL, this function is called from a worker
+     *  thread right after the job is completed. Otherwise
+     *  completed job is returned by \ref eps_pool_poll.
+     *
+     *  The callback may release the job or submit it again. */
+    void (*callback)(eps_job *job);
+    /** Arbitrary user data */
+    void *user_data;
+
+    /** Result code of the single-block function */
+    int rc;
+};
+
+/** Worker pool structure (opaque) */
+typedef struct eps_pool_tag eps_pool;
+
 /** Query available filterbanks
  *
  *  Depending on the \a type parameter this function
@@ -306,6 +478,57 @@ void **eps_malloc_2D(int width, int height, int size);
  *  \return \c VOID */
 void eps_free_2D(void **ptr, int width, int height);
 
+/** Describe grayscale image
+ *
+ *  This function fills the \a image structure for a grayscale
+ *  image of \a width by \a height pixels with rows \a stride
+ *  bytes apart.
+ *
+ *  \param image Image structure
+ *  \param data Top-left pixel
+ *  \param width Image width
+ *  \param height Image height
+ *  \param stride Row stride
+ *
+ *  \return \c VOID */
+void eps_image_gray(eps_image *image, unsigned char *data,
+                    int width, int height, int stride);
+
+/** Describe interleaved RGB image
+ *
+ *  This function fills the \a image structure for an image of
+ *  \a width by \a height pixels stored as R, G, B byte triplets
+ *  with rows \a stride bytes apart (e.g. PPM raster).
+ *
+ *  \param image Image structure
+ *  \param data Top-left pixel
+ *  \param width Image width
+ *  \param height Image height
+ *  \param stride Row stride
+ *
+ *  \return \c VOID */
+void eps_image_rgb(eps_image *image, unsigned char *data,
+                   int width, int height, int stride);
+
+/** Describe planar RGB image
+ *
+ *  This function fills the \a image structure for an image of
+ *  \a width by \a height pixels stored as three separate planes
+ *  with the same row \a stride.
+ *
+ *  \param image Image structure
+ *  \param data_R Top-left pixel of the red plane
+ *  \param data_G Top-left pixel of the green plane
+ *  \param data_B Top-left pixel of the blue plane
+ *  \param width Image width
+ *  \param height Image height
+ *  \param stride Row stride
+ *
+ *  \return \c VOID */
+void eps_image_planar(eps_image *image, unsigned char *data_R,
+                      unsigned char *data_G, unsigned char *data_B,
+                      int width, int height, int stride);
+
 /** Read block header
  *
  *  This function performes a broad range of tasks:
@@ -399,6 +622,59 @@ int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h
                                int x, int y, unsigned char *buf, int *buf_size,
                                char *fb_id, int mode);
 
+/** Encode a GRAYSCALE block (extended version)
+ *
+ *  This function is identical to \ref eps_encode_grayscale_block
+ *  except for the additional \a flags parameter.
+ *
+ *  \param block Image block
+ *  \param W Image width
+ *  \param H Image height
+ *  \param w Block width
+ *  \param h Block height
+ *  \param x Block X coordinate
+ *  \param y Block Y coordinate
+ *  \param buf Buffer
+ *  \param buf_size Buffer size
+ *  \param fb_id Filterbank ID
+ *  \param mode Either \ref EPS_MODE_NORMAL or \ref EPS_MODE_OTLPF
+ *  \param flags Combination of \ref EPS_BINARY_HEADER and either
+ *  \ref EPS_CHECKSUM_CRC32C or \ref EPS_CHECKSUM_ADLER32
+ *
+ *  \return Same as \ref eps_encode_grayscale_block */
+int eps_encode_grayscale_block_ex(unsigned char **block, int W, int H,
+                                  int w, int h, int x, int y,
+                                  unsigned char *buf, int *buf_size,
+                                  char *fb_id, int mode, int flags);
+
+/** Encode a GRAYSCALE block and collect rate-distortion points
+ *
+ *  This function is identical to \ref eps_encode_grayscale_block_ex,
+ *  but also fills the \a rd structure. The curve can be used to
+ *  truncate a set of blocks optimally, see \ref eps_allocate_rate.
+ *
+ *  \param block Image block
+ *  \param W Image width
+ *  \param H Image height
+ *  \param w Block width
+ *  \param h Block height
+ *  \param x Block X coordinate
+ *  \param y Block Y coordinate
+ *  \param buf Buffer
+ *  \param buf_size Buffer size
+ *  \param fb_id Filterbank ID
+ *  \param mode Either \ref EPS_MODE_NORMAL or \ref EPS_MODE_OTLPF
+ *  \param flags Combination of \ref EPS_BINARY_HEADER and either
+ *  \ref EPS_CHECKSUM_CRC32C or \ref EPS_CHECKSUM_ADLER32
+ *  \param rd Rate-distortion curve
+ *
+ *  \return Same as \ref eps_encode_grayscale_block */
+int eps_encode_grayscale_block_rd(unsigned char **block, int W, int H,
+                                  int w, int h, int x, int y,
+                                  unsigned char *buf, int *buf_size,
+                                  char *fb_id, int mode, int flags,
+                                  eps_rd_info *rd);
+
 /** Decode a GRAYSCALE block
  *
  *  This function decodes a GRAYSCALE image \a block from
@@ -425,6 +701,55 @@ int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h
 int eps_decode_grayscale_block(unsigned char **block, unsigned char *buf,
                                eps_block_header *hdr);
 
+/** Encode a GRAYSCALE block from caller's memory
+ *
+ *  This function is identical to \ref eps_encode_grayscale_block_rd,
+ *  but the block is read straight from the whole \a image of size
+ *  \a W by \a H pixels at position (\a x, \a y), without copying
+ *  it into a separate array.
+ *
+ *  \note The block should lie within the \a image, otherwise
+ *  \ref EPS_PARAM_ERROR is returned.
+ *
+ *  \param image Image
+ *  \param W Image width
+ *  \param H Image height
+ *  \param w Block width
+ *  \param h Block height
+ *  \param x Block X coordinate
+ *  \param y Block Y coordinate
+ *  \param buf Buffer
+ *  \param buf_size Buffer size
+ *  \param fb_id Filterbank ID
+ *  \param mode Either \ref EPS_MODE_NORMAL or \ref EPS_MODE_OTLPF
+ *  \param flags Combination of \ref EPS_BINARY_HEADER and either
+ *  \ref EPS_CHECKSUM_CRC32C or \ref EPS_CHECKSUM_ADLER32
+ *  \param rd Rate-distortion curve or \c NULL
+ *
+ *  \return Same as \ref eps_encode_grayscale_block */
+int eps_encode_grayscale_block_strided(eps_image *image, int W, int H,
+                                       int w, int h, int x, int y,
+                                       unsigned char *buf, int *buf_size,
+                                       char *fb_id, int mode, int flags,
+                                       eps_rd_info *rd);
+
+/** Decode a GRAYSCALE block into caller's memory
+ *
+ *  This function is identical to \ref eps_decode_grayscale_block,
+ *  but the block is stored straight into the whole \a image at
+ *  position taken from the \a hdr structure.
+ *
+ *  \note The block should lie within the \a image, otherwise
+ *  \ref EPS_PARAM_ERROR is returned.
+ *
+ *  \param image Image
+ *  \param buf Buffer
+ *  \param hdr Block header
+ *
+ *  \return Same as \ref eps_decode_grayscale_block */
+int eps_decode_grayscale_block_strided(eps_image *image, unsigned char *buf,
+                                       eps_block_header *hdr);
+
 /** Encode a TRUECOLOR block
  *
  *  This function encodes a generic RGB truecolor image block.
@@ -504,6 +829,79 @@ int eps_encode_truecolor_block(unsigned char **block_R,
                                int Y_rt, int Cb_rt, int Cr_rt,
                                char *fb_id, int mode);
 
+/** Encode a TRUECOLOR block (extended version)
+ *
+ *  This function is identical to \ref eps_encode_truecolor_block
+ *  except for the additional \a flags parameter.
+ *
+ *  \param block_R Red component
+ *  \param block_G Green component
+ *  \param block_B Blue component
+ *  \param W Image width
+ *  \param H Image height
+ *  \param w Block width
+ *  \param h Block height
+ *  \param x Block X coordinate
+ *  \param y Block Y coordinate
+ *  \param resample Resampling scheme: either \ref EPS_RESAMPLE_444 or \ref EPS_RESAMPLE_420
+ *  \param buf Buffer
+ *  \param buf_size Buffer size
+ *  \param Y_rt Bit-budget percent for the Y channel
+ *  \param Cb_rt Bit-budget percent for the Cb channel
+ *  \param Cr_rt Bit-budget percent for the Cr channel
+ *  \param fb_id Filterbank ID
+ *  \param mode Either \ref EPS_MODE_NORMAL or \ref EPS_MODE_OTLPF
+ *  \param flags Combination of \ref EPS_BINARY_HEADER and either
+ *  \ref EPS_CHECKSUM_CRC32C or \ref EPS_CHECKSUM_ADLER32
+ *
+ *  \return Same as \ref eps_encode_truecolor_block */
+int eps_encode_truecolor_block_ex(unsigned char **block_R,
+                                  unsigned char **block_G,
+                                  unsigned char **block_B,
+                                  int W, int H, int w, int h,
+                                  int x, int y, int resample,
+                                  unsigned char *buf, int *buf_size,
+                                  int Y_rt, int Cb_rt, int Cr_rt,
+                                  char *fb_id, int mode, int flags);
+
+/** Encode a TRUECOLOR block and collect rate-distortion points
+ *
+ *  This function is identical to \ref eps_encode_truecolor_block_ex,
+ *  but also fills the \a rd structure. The curve can be used to
+ *  truncate a set of blocks optimally, see \ref eps_allocate_rate.
+ *
+ *  \param block_R Red component
+ *  \param block_G Green component
+ *  \param block_B Blue component
+ *  \param W Image width
+ *  \param H Image height
+ *  \param w Block width
+ *  \param h Block height
+ *  \param x Block X coordinate
+ *  \param y Block Y coordinate
+ *  \param resample Resampling scheme: either \ref EPS_RESAMPLE_444 or \ref EPS_RESAMPLE_420
+ *  \param buf Buffer
+ *  \param buf_size Buffer size
+ *  \param Y_rt Bit-budget percent for the Y channel
+ *  \param Cb_rt Bit-budget percent for the Cb channel
+ *  \param Cr_rt Bit-budget percent for the Cr channel
+ *  \param fb_id Filterbank ID
+ *  \param mode Either \ref EPS_MODE_NORMAL or \ref EPS_MODE_OTLPF
+ *  \param flags Combination of \ref EPS_BINARY_HEADER and either
+ *  \ref EPS_CHECKSUM_CRC32C or \ref EPS_CHECKSUM_ADLER32
+ *  \param rd Rate-distortion curve
+ *
+ *  \return Same as \ref eps_encode_truecolor_block */
+int eps_encode_truecolor_block_rd(unsigned char **block_R,
+                                  unsigned char **block_G,
+                                  unsigned char **block_B,
+                                  int W, int H, int w, int h,
+                                  int x, int y, int resample,
+                                  unsigned char *buf, int *buf_size,
+                                  int Y_rt, int Cb_rt, int Cr_rt,
+                                  char *fb_id, int mode, int flags,
+                                  eps_rd_info *rd);
+
 /** Decode a TRUECOLOR block
  *
  *  This function decodes a TRUECOLOR image block from
@@ -538,6 +936,60 @@ int eps_decode_truecolor_block(unsigned char **block_R,
                                unsigned char *buf,
                                eps_block_header *hdr);
 
+/** Encode a TRUECOLOR block from caller's memory
+ *
+ *  This function is identical to \ref eps_encode_truecolor_block_rd,
+ *  but the block is read straight from the whole \a image of size
+ *  \a W by \a H pixels at position (\a x, \a y). Interleaved RGB
+ *  data is not split into separate planes.
+ *
+ *  \note The block should lie within the \a image, otherwise
+ *  \ref EPS_PARAM_ERROR is returned.
+ *
+ *  \param image Image
+ *  \param W Image width
+ *  \param H Image height
+ *  \param w Block width
+ *  \param h Block height
+ *  \param x Block X coordinate
+ *  \param y Block Y coordinate
+ *  \param resample Resampling scheme: either \ref EPS_RESAMPLE_444 or \ref EPS_RESAMPLE_420
+ *  \param buf Buffer
+ *  \param buf_size Buffer size
+ *  \param Y_rt Bit-budget percent for the Y channel
+ *  \param Cb_rt Bit-budget percent for the Cb channel
+ *  \param Cr_rt Bit-budget percent for the Cr channel
+ *  \param fb_id Filterbank ID
+ *  \param mode Either \ref EPS_MODE_NORMAL or \ref EPS_MODE_OTLPF
+ *  \param flags Combination of \ref EPS_BINARY_HEADER and either
+ *  \ref EPS_CHECKSUM_CRC32C or \ref EPS_CHECKSUM_ADLER32
+ *  \param rd Rate-distortion curve or \c NULL
+ *
+ *  \return Same as \ref eps_encode_truecolor_block */
+int eps_encode_truecolor_block_strided(eps_image *image, int W, int H,
+                                       int w, int h, int x, int y,
+                                       int resample, unsigned char *buf,
+                                       int *buf_size, int Y_rt, int Cb_rt,
+                                       int Cr_rt, char *fb_id, int mode,
+                                       int flags, eps_rd_info *rd);
+
+/** Decode a TRUECOLOR block into caller's memory
+ *
+ *  This function is identical to \ref eps_decode_truecolor_block,
+ *  but the block is stored straight into the whole \a image at
+ *  position taken from the \a hdr structure.
+ *
+ *  \note The block should lie within the \a image, otherwise
+ *  \ref EPS_PARAM_ERROR is returned.
+ *
+ *  \param image Image
+ *  \param buf Buffer
+ *  \param hdr Block header
+ *
+ *  \return Same as \ref eps_decode_truecolor_block */
+int eps_decode_truecolor_block_strided(eps_image *image, unsigned char *buf,
+                                       eps_block_header *hdr);
+
 /** Truncate block
  *
  *  This function truncates already encoded GRAYSCALE
@@ -563,6 +1015,111 @@ int eps_decode_truecolor_block(unsigned char **block_R,
 int eps_truncate_block(unsigned char *buf_in, unsigned char *buf_out,
                        eps_block_header *hdr, int *truncate_size);
 
+/** Allocate bit-budget between blocks
+ *
+ *  This function chooses truncation sizes for \a n_blocks
+ *  encoded blocks so that their total size equals to \a budget
+ *  bytes and overall distortion is minimal. Block curves \a rd
+ *  are collected by \ref eps_encode_grayscale_block_rd or
+ *  \ref eps_encode_truecolor_block_rd. Resulting sizes are stored
+ *  in the \a sizes array and are ready to be passed to the
+ *  \ref eps_truncate_block function.
+ *
+ *  \note The algorithm follows post-compression rate-distortion
+ *  optimization (PCRD-opt) from JPEG2000: blocks are truncated at
+ *  points of equal slope on their convex hulls.
+ *
+ *  \note Each block gets at least MAX(\ref EPS_MIN_GRAYSCALE_BUF,
+ *  \ref EPS_MIN_TRUECOLOR_BUF) bytes (or its complete size if it
+ *  is smaller). If the \a budget is below that or above total
+ *  size of all blocks, the total will not match the \a budget.
+ *
+ *  \note If the curves do not promise lower distortion than the
+ *  uniform split of the \a budget, uniform sizes are returned.
+ *
+ *  \param rd Array of block curves
+ *  \param n_blocks Number of blocks
+ *  \param budget Total size of truncated blocks in bytes
+ *  \param sizes Array of resulting block sizes
+ *
+ *  \return The function returns either \ref EPS_OK or
+ *  \ref EPS_PARAM_ERROR (one or more parameters are incorrect). */
+int eps_allocate_rate(eps_rd_info *rd, int n_blocks, double budget,
+                      int *sizes);
+
+/** Create a worker pool
+ *
+ *  This function creates a pool of \a n_threads worker threads
+ *  for batch block processing. Each thread keeps its own
+ *  workspace, so that temporary arrays are reused between jobs.
+ *
+ *  \note If the library is built without thread support, jobs
+ *  are processed by the calling thread inside \ref eps_pool_submit.
+ *
+ *  \param n_threads Number of worker threads
+ *
+ *  \return Pool pointer or \c NULL if \a n_threads is incorrect */
+eps_pool *eps_pool_create(int n_threads);
+
+/** Number of worker threads
+ *
+ *  This function returns the number of threads actually started
+ *  for the \a pool. It is zero if the library is built without
+ *  thread support and jobs are processed inside
+ *  \ref eps_pool_submit.
+ *
+ *  \param pool Pool pointer
+ *
+ *  \return Number of worker threads */
+int eps_pool_threads(eps_pool *pool);
+
+/** Submit a job
+ *
+ *  This function puts a \a job into the pool queue and returns
+ *  immediately. Jobs are processed in submission order, but may
+ *  complete in any order.
+ *
+ *  \param pool Pool pointer
+ *  \param job Job to process
+ *
+ *  \return The function returns either \ref EPS_OK (the job is
+ *  queued) or \ref EPS_PARAM_ERROR (one or more parameters are
+ *  incorrect). Block processing result is stored in the job \c rc
+ *  field. */
+int eps_pool_submit(eps_pool *pool, eps_job *job);
+
+/** Get a completed job
+ *
+ *  This function returns a completed job which has no callback.
+ *  Each job is returned only once.
+ *
+ *  \param pool Pool pointer
+ *  \param block If non-zero, wait until a job is completed
+ *
+ *  \return Job pointer or \c NULL if no job is completed yet
+ *  (or there are no such jobs at all) */
+eps_job *eps_pool_poll(eps_pool *pool, int block);
+
+/** Wait for all jobs
+ *
+ *  This function waits until all submitted jobs are completed
+ *  and their callbacks are returned.
+ *
+ *  \param pool Pool pointer
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_PARAM_ERROR */
+int eps_pool_wait(eps_pool *pool);
+
+/** Destroy a worker pool
+ *
+ *  This function waits for all submitted jobs, stops worker
+ *  threads and releases the \a pool.
+ *
+ *  \param pool Pool pointer
+ *
+ *  \return \c VOID */
+void eps_pool_destroy(eps_pool *pool);
+
 /*@}*/
 
 #ifdef __cplusplus
@@ -113,7 +113,9 @@ typedef struct filterbank_t_tag {
 /** External array of all available filter banks
  *
  *  This array hold pointers to all available filter banks.
- *  Last element is always \c NULL. */
+ *  Last element is always \c NULL. Binary block headers refer
+ *  to filter banks by position in this array, so new entries
+ *  should be appended to the end. */
 extern filterbank_t *filterbanks[];
 
 /*@}*/
@@ -36,6 +36,8 @@
 #include <pad.h>
 #include <merge_split.h>
 #include <speck.h>
+#include <pool.h>
+#include <rate.h>
 #include <string.h>
 
 local void round_channel(coeff_t **in_channel, int **out_channel,
@@ -63,27 +65,26 @@ local void copy_channel(int **in_channel, coeff_t **out_channel,
     }
 }
 
-local void reset_RGB(unsigned char **block_R, unsigned char **block_G,
-                     unsigned char **block_B, int width, int height)
+local void reset_RGB(pixmap_t *block_R, pixmap_t *block_G,
+                     pixmap_t *block_B, int width, int height)
 {
-    int i, j;
-
-    /* Reset everything to zero */
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            block_R[i][j] = block_G[i][j] = block_B[i][j] = 0;
-        }
-    }
+    reset_Y(block_R, width, height);
+    reset_Y(block_G, width, height);
+    reset_Y(block_B, width, height);
 }
 
-local void reset_Y(unsigned char **block_Y, int width, int height)
+local void reset_Y(pixmap_t *block_Y, int width, int height)
 {
+    unsigned char *row;
+    int step = block_Y->step;
     int i, j;
 
     /* Reset everything to zero */
     for (i = 0; i < height; i++) {
+        row = PIXMAP_ROW(block_Y, i);
+
         for (j = 0; j < width; j++) {
-            block_Y[i][j] = 0;
+            row[j * step] = 0;
         }
     }
 }
@@ -105,6 +106,20 @@ local filterbank_t *get_fb(char *id)
     return NULL;
 }
 
+local int get_fb_index(filterbank_t *fb)
+{
+    int i;
+
+    /* Find filterbank position in the list */
+    for (i = 0; filterbanks[i]; i++) {
+        if (filterbanks[i] == fb) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 local int get_block_size(int w, int h, int mode, int min)
 {
     int max = MAX(MAX(w, h), min);
@@ -129,138 +144,295 @@ local int get_block_size(int w, int h, int mode, int min)
     }
 }
 
-local int terminate_header(unsigned char *buf, int buf_size, int n_fields)
+local int parse_key(unsigned char *buf, int buf_size, int *pos, char *key)
 {
-    int field, i;
+    int i;
 
-    /* Report an error if data contains at least one zero byte */
-    for (i = 0; i < buf_size; i++) {
-        if (!buf[i]) {
+    /* Match literal text */
+    for (i = *pos; *key; i++, key++) {
+        if ((i >= buf_size) || (buf[i] != (unsigned char) *key)) {
             return EPS_FORMAT_ERROR;
         }
     }
 
-    /* Find n-th occurence of ';' symbol and replace it with zero */
-    for (i = 0, field = 1; i < buf_size; i++) {
-        if (buf[i] == ';') {
-            if (field == n_fields) {
-                buf[i] = 0;
-                return EPS_OK;
-            }
+    *pos = i;
+
+    return EPS_OK;
+}
+
+local int parse_dec(unsigned char *buf, int buf_size, int *pos, int *value)
+{
+    unsigned int v;
+    int negative;
+    int i;
+
+    i = *pos;
+
+    /* Optional minus sign */
+    negative = (i < buf_size) && (buf[i] == '-');
+    i += negative;
+
+    /* At least one digit is mandatory */
+    if ((i >= buf_size) || (buf[i] < '0') || (buf[i] > '9')) {
+        return EPS_FORMAT_ERROR;
+    }
 
-            field++;
+    for (v = 0; (i < buf_size) && (buf[i] >= '0') && (buf[i] <= '9'); i++) {
+        /* Reject values that do not fit into int */
+        if (v > (unsigned int) (0x7fffffff - (buf[i] - '0')) / 10) {
+            return EPS_FORMAT_ERROR;
         }
+
+        v = v * 10 + (buf[i] - '0');
     }
 
-    return EPS_FORMAT_ERROR;
+    *value = negative ? -(int) v : (int) v;
+    *pos = i;
+
+    return EPS_OK;
 }
 
-local void unterminate_header(unsigned char *buf)
+local int parse_hex(unsigned char *buf, int buf_size, int *pos,
+                    crc32_t *value)
 {
-    buf[strlen((char *) buf)] = ';';
+    crc32_t v;
+    int digit;
+    int i;
+
+    for (i = *pos, v = 0; i < buf_size; i++) {
+        if ((buf[i] >= '0') && (buf[i] <= '9')) {
+            digit = buf[i] - '0';
+        } else if ((buf[i] >= 'a') && (buf[i] <= 'f')) {
+            digit = buf[i] - 'a' + 10;
+        } else if ((buf[i] >= 'A') && (buf[i] <= 'F')) {
+            digit = buf[i] - 'A' + 10;
+        } else {
+            break;
+        }
+
+        /* Reject values that do not fit into 32 bits */
+        if (v > 0x0fffffff) {
+            return EPS_FORMAT_ERROR;
+        }
+
+        v = (v << 4) | digit;
+    }
+
+    /* At least one digit is mandatory */
+    if (i == *pos) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    *value = v;
+    *pos = i;
+
+    return EPS_OK;
 }
 
-local int header_sanity_check(unsigned char *buf)
+local int parse_id(unsigned char *buf, int buf_size, int *pos,
+                   char *id, int id_size)
 {
-    int i, len;
+    int i, n;
 
-    len = strlen((char *) buf);
+    for (i = *pos, n = 0; i < buf_size; i++, n++) {
+        if (!(((buf[i] >= 'a') && (buf[i] <= 'z')) ||
+              ((buf[i] >= '0') && (buf[i] <= '9'))))
+        {
+            break;
+        }
 
-    /* Check header for malicious symbols */
-    for (i = 0; i < len; i++) {
-        if ((buf[i] >= 'A') && (buf[i] <= 'Z')) {
-            continue;
+        /* Leave room for terminating zero */
+        if (n == id_size - 1) {
+            return EPS_FORMAT_ERROR;
         }
 
-        if ((buf[i] >= 'a') && (buf[i] <= 'z')) {
-            continue;
+        id[n] = buf[i];
+    }
+
+    /* Empty ID is not allowed */
+    if (!n) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    id[n] = 0;
+    *pos = i;
+
+    return EPS_OK;
+}
+
+local char *crc_key(int crc_type)
+{
+    switch (crc_type) {
+        case EPS_CHECKSUM_CRC32C:
+        {
+            return ";crc32c=";
         }
 
-        if ((buf[i] >= '0') && (buf[i] <= '9')) {
-            continue;
+        case EPS_CHECKSUM_ADLER32:
+        {
+            return ";adler32=";
         }
 
-        if ((buf[i] == ';') || (buf[i] == '=') ||
-            (buf[i] == '-') || (buf[i] == ':'))
+        default:
         {
-            continue;
+            return ";crc=";
         }
+    }
+}
 
-        return EPS_FORMAT_ERROR;
+local int parse_crc_key(unsigned char *buf, int buf_size, int *pos,
+                        int *crc_type)
+{
+    int types[3] = { EPS_CHECKSUM_CRC32, EPS_CHECKSUM_CRC32C,
+                     EPS_CHECKSUM_ADLER32 };
+    int i;
+
+    /* Key name tells checksum type */
+    for (i = 0; i < 3; i++) {
+        if (parse_key(buf, buf_size, pos, crc_key(types[i])) == EPS_OK) {
+            *crc_type = types[i];
+            return EPS_OK;
+        }
     }
 
-    return EPS_OK;
+    return EPS_FORMAT_ERROR;
 }
 
-local int read_gs_header(unsigned char *buf, int buf_size,
-                         eps_block_header *hdr)
+local crc32_t data_checksum(int crc_type, unsigned char *data, int length)
 {
-    filterbank_t *fb;
+    switch (crc_type) {
+        case EPS_CHECKSUM_CRC32C:
+        {
+            return epsilon_crc32c(data, length);
+        }
 
-    char fb_id[32];
+        case EPS_CHECKSUM_ADLER32:
+        {
+            return epsilon_adler32(data, length);
+        }
 
-    crc32_t hdr_crc;
-    crc32_t data_crc;
+        default:
+        {
+            return epsilon_crc32(data, length);
+        }
+    }
+}
 
-    int result;
-    int len;
+local int put_bin_value(unsigned char *buf, int value)
+{
+    unsigned int v;
     int n;
 
-    char *chk_pos;
-    char *str;
+    /* Value is biased by one, so the last byte is never zero */
+    v = (unsigned int) value + 1;
 
-    /* Sanity checks */
-    if (!buf || !hdr) {
-        return EPS_PARAM_ERROR;
+    /* Seven bits per byte, high bit marks continuation */
+    for (n = 0; v >= 0x80; v >>= 7) {
+        buf[n++] = (unsigned char) (0x80 | (v & 0x7f));
     }
 
-    if (buf_size < 1) {
-        return EPS_PARAM_ERROR;
+    buf[n++] = (unsigned char) v;
+
+    return n;
+}
+
+local int get_bin_value(unsigned char *buf, int buf_size, int *pos,
+                        int *value)
+{
+    unsigned int v;
+    int shift;
+    int i;
+
+    for (i = *pos, v = 0, shift = 0; i < buf_size; i++, shift += 7) {
+        /* Longer values never appear in valid headers */
+        if (shift > 28) {
+            return EPS_FORMAT_ERROR;
+        }
+
+        v |= (unsigned int) (buf[i] & 0x7f) << shift;
+
+        if (!(buf[i] & 0x80)) {
+            /* Reject zero bytes and out of range values */
+            if ((v == 0) || (v - 1 > 0x7fffffff)) {
+                return EPS_FORMAT_ERROR;
+            }
+
+            *value = (int) (v - 1);
+            *pos = i + 1;
+
+            return EPS_OK;
+        }
     }
 
-    /* Terminate header for ease of processing */
-    if (terminate_header(buf, buf_size, 12) != EPS_OK) {
-        return EPS_FORMAT_ERROR;
+    return EPS_FORMAT_ERROR;
+}
+
+local void put_bin_fixed(unsigned char *buf, crc32_t value, int n_bytes)
+{
+    int i;
+
+    /* Seven bits per byte, high bit is always set */
+    for (i = 0; i < n_bytes; i++, value >>= 7) {
+        buf[i] = (unsigned char) (0x80 | (value & 0x7f));
     }
+}
 
-    /* Check for maliciuos symbols */
-    if (header_sanity_check(buf) != EPS_OK) {
-        unterminate_header(buf);
-        return EPS_FORMAT_ERROR;
+local int get_bin_fixed(unsigned char *buf, int n_bytes, crc32_t *value)
+{
+    int i;
+
+    for (i = n_bytes - 1, *value = 0; i >= 0; i--) {
+        if (!(buf[i] & 0x80)) {
+            return EPS_FORMAT_ERROR;
+        }
+
+        *value = (*value << 7) | (buf[i] & 0x7f);
     }
 
-    /* Handle header as a regular null-terminated string */
-    str = (char *) buf;
-    len = strlen(str);
+    return EPS_OK;
+}
 
-    /* Mark the position of header CRC field */
-    chk_pos = strstr(str, "chk=");
+local void set_data_crc(unsigned char *buf, int hdr_size, crc32_t data_crc)
+{
+    /* Data CRC is always the last header field */
+    if (buf[0] == EPS_BIN_MAGIC) {
+        put_bin_fixed(buf + hdr_size - EPS_BIN_CRC_BYTES,
+                      data_crc, EPS_BIN_CRC_BYTES);
+    } else {
+        snprintf((char *) (buf + hdr_size - 9), 9, "%08x", data_crc);
+        buf[hdr_size - 1] = ';';
+    }
+}
 
-    /* Parse header fields */
-    result = sscanf(str,
-        "type=gs;W=%d;H=%d;w=%d;h=%d;x=%d;y=%d;"
-        "m=%d;dc=%d;fb=%31[a-z0-9];chk=%x;crc=%x%n",
-        &hdr->hdr_data.gs.W, &hdr->hdr_data.gs.H,
-        &hdr->hdr_data.gs.w, &hdr->hdr_data.gs.h,
-        &hdr->hdr_data.gs.x, &hdr->hdr_data.gs.y,
-        &hdr->hdr_data.gs.mode, &hdr->hdr_data.gs.dc,
-        fb_id, &hdr->chk, &hdr->crc, &n);
-
-    unterminate_header(buf);
-
-    /* Check for parsing errors (see also sscanf(3)) */
-    if ((result < 11) || (n != len)) {
-        return EPS_FORMAT_ERROR;
+local void check_block_crc(unsigned char *buf, int chk_len,
+                           eps_block_header *hdr)
+{
+    crc32_t hdr_crc;
+    crc32_t data_crc;
+
+    /* Compute header CRC and compare it against stored one */
+    hdr_crc = epsilon_crc32(buf, chk_len);
+    hdr_crc = (hdr_crc ^ (hdr_crc >> 16)) & 0xffff;
+
+    if (hdr_crc == hdr->chk) {
+        hdr->chk_flag = EPS_GOOD_CRC;
+    } else {
+        hdr->chk_flag = EPS_BAD_CRC;
     }
 
-    /* Compute header & data size */
-    hdr->hdr_size = len + 1;
-    hdr->data_size = buf_size - hdr->hdr_size;
+    /* Compute data CRC and compare it against stored one */
+    data_crc = data_checksum(hdr->crc_type, buf + hdr->hdr_size,
+                             hdr->data_size);
 
-    /* Sanity checks */
-    assert(hdr->data_size >= 0);
-    assert(hdr->hdr_size + hdr->data_size == buf_size);
+    if (data_crc == hdr->crc) {
+        hdr->crc_flag = EPS_GOOD_CRC;
+    } else {
+        hdr->crc_flag = EPS_BAD_CRC;
+    }
+}
 
+local int check_gs_header(eps_block_header *hdr, filterbank_t *fb)
+{
     /* Check transform mode */
     if ((hdr->hdr_data.gs.mode != EPS_MODE_NORMAL) &&
         (hdr->hdr_data.gs.mode != EPS_MODE_OTLPF)) {
@@ -301,59 +473,189 @@ local int read_gs_header(unsigned char *buf, int buf_size,
         return EPS_FORMAT_ERROR;
     }
 
-    /* Find filterbank by id */
-    fb = get_fb(fb_id);
-    if (fb) {
-        hdr->hdr_data.gs.fb_id = fb->id;
-    } else {
+    /* Unknown filterbank is reported by the decoder */
+    if (!fb) {
         hdr->hdr_data.gs.fb_id = NULL;
+        return EPS_OK;
     }
 
+    hdr->hdr_data.gs.fb_id = fb->id;
+
     /* EPS_MODE_NORMAL is the only valid choise for orthogonal filters */
     if ((fb->type == ORTHOGONAL) && (hdr->hdr_data.gs.mode != EPS_MODE_NORMAL)) {
         return EPS_FORMAT_ERROR;
     }
 
-    assert(chk_pos);
+    return EPS_OK;
+}
 
-    /* Compute header CRC and compare it against stored one */
-    hdr_crc = epsilon_crc32(buf, chk_pos - (char *) buf);
-    hdr_crc = (hdr_crc ^ (hdr_crc >> 16)) & 0xffff;
+local int check_tc_header(eps_block_header *hdr, filterbank_t *fb)
+{
+    /* Check transform mode */
+    if ((hdr->hdr_data.tc.mode != EPS_MODE_NORMAL) &&
+        (hdr->hdr_data.tc.mode != EPS_MODE_OTLPF))
+    {
+        return EPS_FORMAT_ERROR;
+    }
 
-    if (hdr_crc == hdr->chk) {
-        hdr->chk_flag = EPS_GOOD_CRC;
-    } else {
-        hdr->chk_flag = EPS_BAD_CRC;
+    /* Check image (W, H) and block (w, y, w, h) parameters for consistency */
+    if ((hdr->hdr_data.tc.W <= 0) || (hdr->hdr_data.tc.H <= 0)) {
+        return EPS_FORMAT_ERROR;
     }
 
-    /* Compute data CRC and compare it against stored one */
-    data_crc = epsilon_crc32(buf + hdr->hdr_size, hdr->data_size);
+    if ((hdr->hdr_data.tc.w < 1) || (hdr->hdr_data.tc.h < 1)) {
+        return EPS_FORMAT_ERROR;
+    }
 
-    if (data_crc == hdr->crc) {
-        hdr->crc_flag = EPS_GOOD_CRC;
-    } else {
-        hdr->crc_flag = EPS_BAD_CRC;
+    if (hdr->hdr_data.tc.w > EPS_MAX_BLOCK_SIZE + (hdr->hdr_data.tc.mode == EPS_MODE_OTLPF)) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    if (hdr->hdr_data.tc.h > EPS_MAX_BLOCK_SIZE + (hdr->hdr_data.tc.mode == EPS_MODE_OTLPF)) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    if ((hdr->hdr_data.tc.x < 0) || (hdr->hdr_data.tc.y < 0)) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    if (hdr->hdr_data.tc.x + hdr->hdr_data.tc.w > hdr->hdr_data.tc.W) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    if (hdr->hdr_data.tc.y + hdr->hdr_data.tc.h > hdr->hdr_data.tc.H) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    /* Check resampling mode */
+    if ((hdr->hdr_data.tc.resample != EPS_RESAMPLE_444) &&
+        (hdr->hdr_data.tc.resample != EPS_RESAMPLE_420))
+    {
+        return EPS_FORMAT_ERROR;
+    }
+
+    /* Check DC level for Y, Cb and Cr channels */
+    if ((hdr->hdr_data.tc.dc_Y < 0) || (hdr->hdr_data.tc.dc_Y > 255)) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    if ((hdr->hdr_data.tc.dc_Cb < 0) || (hdr->hdr_data.tc.dc_Cb > 255)) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    if ((hdr->hdr_data.tc.dc_Cr < 0) || (hdr->hdr_data.tc.dc_Cr > 255)) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    if ((hdr->hdr_data.tc.Y_rt <= 0)  ||
+        (hdr->hdr_data.tc.Cb_rt <= 0) ||
+        (hdr->hdr_data.tc.Cr_rt <= 0))
+    {
+        return EPS_FORMAT_ERROR;
+    }
+
+    /* Unknown filterbank is reported by the decoder */
+    if (!fb) {
+        hdr->hdr_data.tc.fb_id = NULL;
+        return EPS_OK;
+    }
+
+    hdr->hdr_data.tc.fb_id = fb->id;
+
+    /* EPS_MODE_NORMAL is the only valid choise for orthogonal filters */
+    if ((fb->type == ORTHOGONAL) && (hdr->hdr_data.tc.mode != EPS_MODE_NORMAL)) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    return EPS_OK;
+}
+
+local int read_gs_header(unsigned char *buf, int buf_size,
+                         eps_block_header *hdr)
+{
+    char fb_id[32];
+
+    int chk_len;
+    int pos;
+
+    /* Sanity checks */
+    if (!buf || !hdr) {
+        return EPS_PARAM_ERROR;
+    }
+
+    if (buf_size < 1) {
+        return EPS_PARAM_ERROR;
+    }
+
+    pos = 0;
+
+    /* Parse header fields in a single pass */
+    if ((parse_key(buf, buf_size, &pos, "type=gs;W=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.gs.W) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";H=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.gs.H) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";w=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.gs.w) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";h=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.gs.h) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";x=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.gs.x) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";y=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.gs.y) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";m=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.gs.mode) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";dc=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.gs.dc) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";fb=") != EPS_OK) ||
+        (parse_id(buf, buf_size, &pos, fb_id, sizeof(fb_id)) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";") != EPS_OK))
+    {
+        return EPS_FORMAT_ERROR;
+    }
+
+    /* Header CRC covers everything before this point */
+    chk_len = pos;
+
+    if ((parse_key(buf, buf_size, &pos, "chk=") != EPS_OK) ||
+        (parse_hex(buf, buf_size, &pos, &hdr->chk) != EPS_OK) ||
+        (parse_crc_key(buf, buf_size, &pos, &hdr->crc_type) != EPS_OK) ||
+        (parse_hex(buf, buf_size, &pos, &hdr->crc) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";") != EPS_OK))
+    {
+        return EPS_FORMAT_ERROR;
+    }
+
+    /* Compute header & data size */
+    hdr->hdr_size = pos;
+    hdr->data_size = buf_size - hdr->hdr_size;
+
+    /* Sanity checks */
+    assert(hdr->data_size >= 0);
+    assert(hdr->hdr_size + hdr->data_size == buf_size);
+
+    /* Stuffed data never contains zero bytes */
+    if (memchr(buf + hdr->hdr_size, 0, hdr->data_size)) {
+        return EPS_FORMAT_ERROR;
     }
 
+    /* Check header fields for consistency */
+    if (check_gs_header(hdr, get_fb(fb_id)) != EPS_OK) {
+        return EPS_FORMAT_ERROR;
+    }
+
+    /* Check header and data CRC */
+    check_block_crc(buf, chk_len, hdr);
+
     return EPS_OK;
 }
 
 local int read_tc_header(unsigned char *buf, int buf_size,
                          eps_block_header *hdr)
 {
-    filterbank_t *fb;
-
     char fb_id[32];
 
-    crc32_t hdr_crc;
-    crc32_t data_crc;
-
-    int result;
-    int len;
-    int n;
-
-    char *chk_pos;
-    char *str;
+    int chk_len;
+    int pos;
 
     /* Sanity checks */
     if (!buf || !hdr) {
@@ -364,158 +666,223 @@ local int read_tc_header(unsigned char *buf, int buf_size,
         return EPS_PARAM_ERROR;
     }
 
-    /* Terminate header for ease of processing */
-    if (terminate_header(buf, buf_size, 14) != EPS_OK) {
-        return EPS_FORMAT_ERROR;
-    }
-
-    /* Check for maliciuos symbols */
-    if (header_sanity_check(buf) != EPS_OK) {
-        unterminate_header(buf);
+    pos = 0;
+
+    /* Parse header fields in a single pass */
+    if ((parse_key(buf, buf_size, &pos, "type=tc;W=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.W) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";H=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.H) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";w=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.w) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";h=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.h) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";x=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.x) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";y=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.y) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";m=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.mode) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";r=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.resample) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";dc=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.dc_Y) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ":") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.dc_Cb) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ":") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.dc_Cr) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";rt=") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.Y_rt) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ":") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.Cb_rt) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ":") != EPS_OK) ||
+        (parse_dec(buf, buf_size, &pos, &hdr->hdr_data.tc.Cr_rt) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";fb=") != EPS_OK) ||
+        (parse_id(buf, buf_size, &pos, fb_id, sizeof(fb_id)) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";") != EPS_OK))
+    {
         return EPS_FORMAT_ERROR;
     }
 
-    /* Handle header as a regular null-terminated string */
-    str = (char *) buf;
-    len = strlen(str);
-
-    /* Mark the position of header CRC field */
-    chk_pos = strstr(str, "chk=");
+    /* Header CRC covers everything before this point */
+    chk_len = pos;
 
-    /* Parse header fields */
-    result = sscanf(str,
-        "type=tc;W=%d;H=%d;w=%d;h=%d;x=%d;y=%d;m=%d;"
-        "r=%d;dc=%d:%d:%d;rt=%d:%d:%d;fb=%31[a-z0-9];"
-        "chk=%x;crc=%x%n",
-        &hdr->hdr_data.tc.W, &hdr->hdr_data.tc.H,
-        &hdr->hdr_data.tc.w, &hdr->hdr_data.tc.h,
-        &hdr->hdr_data.tc.x, &hdr->hdr_data.tc.y,
-        &hdr->hdr_data.tc.mode, &hdr->hdr_data.tc.resample,
-        &hdr->hdr_data.tc.dc_Y, &hdr->hdr_data.tc.dc_Cb,
-        &hdr->hdr_data.tc.dc_Cr, &hdr->hdr_data.tc.Y_rt,
-        &hdr->hdr_data.tc.Cb_rt, &hdr->hdr_data.tc.Cr_rt,
-        fb_id, &hdr->chk, &hdr->crc, &n);
-
-    unterminate_header(buf);
-
-    /* Check for parsing errors (see also sscanf(3)) */
-    if ((result < 17) || (n != len)) {
+    if ((parse_key(buf, buf_size, &pos, "chk=") != EPS_OK) ||
+        (parse_hex(buf, buf_size, &pos, &hdr->chk) != EPS_OK) ||
+        (parse_crc_key(buf, buf_size, &pos, &hdr->crc_type) != EPS_OK) ||
+        (parse_hex(buf, buf_size, &pos, &hdr->crc) != EPS_OK) ||
+        (parse_key(buf, buf_size, &pos, ";") != EPS_OK))
+    {
         return EPS_FORMAT_ERROR;
     }
 
     /* Compute header & data size */
-    hdr->hdr_size = len + 1;
+    hdr->hdr_size = pos;
     hdr->data_size = buf_size - hdr->hdr_size;
 
     /* Sanity checks */
     assert(hdr->data_size >= 0);
     assert(hdr->hdr_size + hdr->data_size == buf_size);
 
-    /* Check transform mode */
-    if ((hdr->hdr_data.tc.mode != EPS_MODE_NORMAL) &&
-        (hdr->hdr_data.tc.mode != EPS_MODE_OTLPF))
-    {
+    /* Stuffed data never contains zero bytes */
+    if (memchr(buf + hdr->hdr_size, 0, hdr->data_size)) {
         return EPS_FORMAT_ERROR;
     }
 
-    /* Check image (W, H) and block (w, y, w, h) parameters for consistency */
-    if ((hdr->hdr_data.tc.W <= 0) || (hdr->hdr_data.tc.H <= 0)) {
+    /* Check header fields for consistency */
+    if (check_tc_header(hdr, get_fb(fb_id)) != EPS_OK) {
         return EPS_FORMAT_ERROR;
     }
 
-    if ((hdr->hdr_data.tc.w < 1) || (hdr->hdr_data.tc.h < 1)) {
-        return EPS_FORMAT_ERROR;
-    }
+    /* Check header and data CRC */
+    check_block_crc(buf, chk_len, hdr);
 
-    if (hdr->hdr_data.tc.w > EPS_MAX_BLOCK_SIZE + (hdr->hdr_data.tc.mode == EPS_MODE_OTLPF)) {
-        return EPS_FORMAT_ERROR;
-    }
+    return EPS_OK;
+}
 
-    if (hdr->hdr_data.tc.h > EPS_MAX_BLOCK_SIZE + (hdr->hdr_data.tc.mode == EPS_MODE_OTLPF)) {
-        return EPS_FORMAT_ERROR;
+local int read_bin_header(unsigned char *buf, int buf_size,
+                          eps_block_header *hdr)
+{
+    filterbank_t *fb;
+
+    int *fields[EPS_BIN_MAX_FIELDS];
+    int n_fields;
+
+    int fb_idx;
+    int n_fb;
+
+    int chk_len;
+    int pos;
+    int i;
+
+    /* Sanity checks */
+    if (!buf || !hdr) {
+        return EPS_PARAM_ERROR;
     }
 
-    if ((hdr->hdr_data.tc.x < 0) || (hdr->hdr_data.tc.y < 0)) {
+    if (buf_size < 2) {
         return EPS_FORMAT_ERROR;
     }
 
-    if (hdr->hdr_data.tc.x + hdr->hdr_data.tc.w > hdr->hdr_data.tc.W) {
+    /* Check format version */
+    if ((buf[0] != EPS_BIN_MAGIC) || ((buf[1] >> 4) != EPS_BIN_VERSION)) {
         return EPS_FORMAT_ERROR;
     }
 
-    if (hdr->hdr_data.tc.y + hdr->hdr_data.tc.h > hdr->hdr_data.tc.H) {
+    /* Second byte also holds checksum type */
+    hdr->crc_type = (buf[1] & EPS_BIN_CRC_MASK) >> EPS_BIN_CRC_SHIFT;
+
+    if (hdr->crc_type == (EPS_CHECKSUM_CRC32C | EPS_CHECKSUM_ADLER32)) {
         return EPS_FORMAT_ERROR;
     }
 
-    /* Check resampling mode */
-    if ((hdr->hdr_data.tc.resample != EPS_RESAMPLE_444) &&
-        (hdr->hdr_data.tc.resample != EPS_RESAMPLE_420))
-    {
-        return EPS_FORMAT_ERROR;
+    /* Field order is the same as in the ASCII header */
+    hdr->block_type = buf[1] & EPS_BIN_TYPE_MASK;
+
+    switch (hdr->block_type) {
+        case EPS_GRAYSCALE_BLOCK:
+        {
+            fields[0] = &hdr->hdr_data.gs.W;
+            fields[1] = &hdr->hdr_data.gs.H;
+            fields[2] = &hdr->hdr_data.gs.w;
+            fields[3] = &hdr->hdr_data.gs.h;
+            fields[4] = &hdr->hdr_data.gs.x;
+            fields[5] = &hdr->hdr_data.gs.y;
+            fields[6] = &hdr->hdr_data.gs.mode;
+            fields[7] = &hdr->hdr_data.gs.dc;
+            n_fields = 8;
+            break;
+        }
+
+        case EPS_TRUECOLOR_BLOCK:
+        {
+            fields[0] = &hdr->hdr_data.tc.W;
+            fields[1] = &hdr->hdr_data.tc.H;
+            fields[2] = &hdr->hdr_data.tc.w;
+            fields[3] = &hdr->hdr_data.tc.h;
+            fields[4] = &hdr->hdr_data.tc.x;
+            fields[5] = &hdr->hdr_data.tc.y;
+            fields[6] = &hdr->hdr_data.tc.mode;
+            fields[7] = &hdr->hdr_data.tc.resample;
+            fields[8] = &hdr->hdr_data.tc.dc_Y;
+            fields[9] = &hdr->hdr_data.tc.dc_Cb;
+            fields[10] = &hdr->hdr_data.tc.dc_Cr;
+            fields[11] = &hdr->hdr_data.tc.Y_rt;
+            fields[12] = &hdr->hdr_data.tc.Cb_rt;
+            fields[13] = &hdr->hdr_data.tc.Cr_rt;
+            n_fields = 14;
+            break;
+        }
+
+        default:
+        {
+            return EPS_FORMAT_ERROR;
+        }
     }
 
-    /* Check DC level for Y, Cb and Cr channels */
-    if ((hdr->hdr_data.tc.dc_Y < 0) || (hdr->hdr_data.tc.dc_Y > 255)) {
-        return EPS_FORMAT_ERROR;
+    /* Parse header fields */
+    for (i = 0, pos = 2; i < n_fields; i++) {
+        if (get_bin_value(buf, buf_size, &pos, fields[i]) != EPS_OK) {
+            return EPS_FORMAT_ERROR;
+        }
     }
 
-    if ((hdr->hdr_data.tc.dc_Cb < 0) || (hdr->hdr_data.tc.dc_Cb > 255)) {
+    if (get_bin_value(buf, buf_size, &pos, &fb_idx) != EPS_OK) {
         return EPS_FORMAT_ERROR;
     }
 
-    if ((hdr->hdr_data.tc.dc_Cr < 0) || (hdr->hdr_data.tc.dc_Cr > 255)) {
+    chk_len = pos;
+
+    /* Header and data CRC have fixed width */
+    if (pos + EPS_BIN_CHK_BYTES + EPS_BIN_CRC_BYTES > buf_size) {
         return EPS_FORMAT_ERROR;
     }
 
-    if ((hdr->hdr_data.tc.Y_rt <= 0)  ||
-        (hdr->hdr_data.tc.Cb_rt <= 0) ||
-        (hdr->hdr_data.tc.Cr_rt <= 0))
-    {
+    if (get_bin_fixed(buf + pos, EPS_BIN_CHK_BYTES, &hdr->chk) != EPS_OK) {
         return EPS_FORMAT_ERROR;
     }
 
-    /* Find filterbank by id */
-    fb = get_fb(fb_id);
-    if (fb) {
-        hdr->hdr_data.tc.fb_id = fb->id;
-    } else {
-        hdr->hdr_data.tc.fb_id = NULL;
-    }
+    pos += EPS_BIN_CHK_BYTES;
 
-    /* EPS_MODE_NORMAL is the only valid choise for orthogonal filters */
-    if ((fb->type == ORTHOGONAL) && (hdr->hdr_data.tc.mode != EPS_MODE_NORMAL)) {
+    if (get_bin_fixed(buf + pos, EPS_BIN_CRC_BYTES, &hdr->crc) != EPS_OK) {
         return EPS_FORMAT_ERROR;
     }
 
-    assert(chk_pos);
+    pos += EPS_BIN_CRC_BYTES;
 
-    /* Compute header CRC and compare it against stored one */
-    hdr_crc = epsilon_crc32(buf, chk_pos - (char *) buf);
-    hdr_crc = (hdr_crc ^ (hdr_crc >> 16)) & 0xffff;
+    /* Compute header & data size */
+    hdr->hdr_size = pos;
+    hdr->data_size = buf_size - hdr->hdr_size;
 
-    if (hdr_crc == hdr->chk) {
-        hdr->chk_flag = EPS_GOOD_CRC;
-    } else {
-        hdr->chk_flag = EPS_BAD_CRC;
+    /* Stuffed data never contains zero bytes */
+    if (memchr(buf + hdr->hdr_size, 0, hdr->data_size)) {
+        return EPS_FORMAT_ERROR;
     }
 
-    /* Compute data CRC and compare it against stored one */
-    data_crc = epsilon_crc32(buf + hdr->hdr_size, hdr->data_size);
+    /* Find filterbank by index */
+    for (n_fb = 0; filterbanks[n_fb]; n_fb++);
+    fb = fb_idx < n_fb ? filterbanks[fb_idx] : NULL;
 
-    if (data_crc == hdr->crc) {
-        hdr->crc_flag = EPS_GOOD_CRC;
+    /* Check header fields for consistency */
+    if (hdr->block_type == EPS_GRAYSCALE_BLOCK) {
+        if (check_gs_header(hdr, fb) != EPS_OK) {
+            return EPS_FORMAT_ERROR;
+        }
     } else {
-        hdr->crc_flag = EPS_BAD_CRC;
+        if (check_tc_header(hdr, fb) != EPS_OK) {
+            return EPS_FORMAT_ERROR;
+        }
     }
 
+    /* Check header and data CRC */
+    check_block_crc(buf, chk_len, hdr);
+
     return EPS_OK;
 }
 
 int eps_read_block_header(unsigned char *buf, int buf_size,
                           eps_block_header *hdr)
 {
-    char *str;
-
     /* Sanity checks */
     if (!buf || !hdr) {
         return EPS_PARAM_ERROR;
@@ -525,25 +892,20 @@ int eps_read_block_header(unsigned char *buf, int buf_size,
         return EPS_PARAM_ERROR;
     }
 
-    /* Extract first header field: block type */
-    if (terminate_header(buf, buf_size, 1) != EPS_OK) {
-        return EPS_FORMAT_ERROR;
+    /* Binary header can not be mistaken for the ASCII one */
+    if (buf[0] == EPS_BIN_MAGIC) {
+        return read_bin_header(buf, buf_size, hdr);
     }
 
-    str = (char *) buf;
-
-    /* Set block type */
-    if ((strlen(str) == 7) && (strcmp(str, "type=gs") == 0)) {
+    /* Get block type from the first header field */
+    if ((buf_size >= 8) && (memcmp(buf, "type=gs;", 8) == 0)) {
         hdr->block_type = EPS_GRAYSCALE_BLOCK;
-    } else if ((strlen(str) == 7) && (strcmp(str, "type=tc") == 0)) {
+    } else if ((buf_size >= 8) && (memcmp(buf, "type=tc;", 8) == 0)) {
         hdr->block_type = EPS_TRUECOLOR_BLOCK;
     } else {
-        unterminate_header(buf);
         return EPS_FORMAT_ERROR;
     }
 
-    unterminate_header(buf);
-
     /* Process the block using appropriative function */
     switch (hdr->block_type) {
         case EPS_GRAYSCALE_BLOCK:
@@ -609,6 +971,66 @@ void eps_free_fb_info(char **info)
     free(info);
 }
 
+local int image_pixmap(eps_image *image, int k, int x, int y,
+                       int w, int h, pixmap_t *pixmap)
+{
+    /* Sanity checks */
+    if (!image || !image->data[k] || (image->step < 1)) {
+        return EPS_PARAM_ERROR;
+    }
+
+    /* Block should lie within the image */
+    if ((x < 0) || (y < 0) || (w < 1) || (h < 1) ||
+        (w > image->width - x) || (h > image->height - y))
+    {
+        return EPS_PARAM_ERROR;
+    }
+
+    pixmap->rows = NULL;
+    pixmap->base = image->data[k] + (ptrdiff_t) y * image->stride +
+        (ptrdiff_t) x * image->step;
+    pixmap->stride = image->stride;
+    pixmap->step = image->step;
+
+    return EPS_OK;
+}
+
+void eps_image_gray(eps_image *image, unsigned char *data,
+                    int width, int height, int stride)
+{
+    image->data[0] = data;
+    image->data[1] = image->data[2] = NULL;
+    image->width = width;
+    image->height = height;
+    image->stride = stride;
+    image->step = 1;
+}
+
+void eps_image_rgb(eps_image *image, unsigned char *data,
+                   int width, int height, int stride)
+{
+    image->data[0] = data;
+    image->data[1] = data + 1;
+    image->data[2] = data + 2;
+    image->width = width;
+    image->height = height;
+    image->stride = stride;
+    image->step = 3;
+}
+
+void eps_image_planar(eps_image *image, unsigned char *data_R,
+                      unsigned char *data_G, unsigned char *data_B,
+                      int width, int height, int stride)
+{
+    image->data[0] = data_R;
+    image->data[1] = data_G;
+    image->data[2] = data_B;
+    image->width = width;
+    image->height = height;
+    image->stride = stride;
+    image->step = 1;
+}
+
 void **eps_xmalloc(int size)
 {
     return xmalloc(size);
@@ -627,6 +1049,64 @@ void eps_free_2D(void **ptr, int width, int height)
 int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h,
                                int x, int y, unsigned char *buf, int *buf_size,
                                char *fb_id, int mode)
+{
+    return eps_encode_grayscale_block_ex(block, W, H, w, h, x, y,
+                                         buf, buf_size, fb_id, mode, 0);
+}
+
+int eps_encode_grayscale_block_ex(unsigned char **block, int W, int H,
+                                  int w, int h, int x, int y,
+                                  unsigned char *buf, int *buf_size,
+                                  char *fb_id, int mode, int flags)
+{
+    pixmap_t pixmap;
+
+    pixmap_from_rows(&pixmap, block);
+
+    return encode_grayscale_block(NULL, &pixmap, W, H, w, h, x, y,
+                                  buf, buf_size, fb_id, mode, flags, NULL);
+}
+
+int eps_encode_grayscale_block_rd(unsigned char **block, int W, int H,
+                                  int w, int h, int x, int y,
+                                  unsigned char *buf, int *buf_size,
+                                  char *fb_id, int mode, int flags,
+                                  eps_rd_info *rd)
+{
+    pixmap_t pixmap;
+
+    /* Sanity checks */
+    if (!rd) {
+        return EPS_PARAM_ERROR;
+    }
+
+    pixmap_from_rows(&pixmap, block);
+
+    return encode_grayscale_block(NULL, &pixmap, W, H, w, h, x, y,
+                                  buf, buf_size, fb_id, mode, flags, rd);
+}
+
+int eps_encode_grayscale_block_strided(eps_image *image, int W, int H,
+                                       int w, int h, int x, int y,
+                                       unsigned char *buf, int *buf_size,
+                                       char *fb_id, int mode, int flags,
+                                       eps_rd_info *rd)
+{
+    pixmap_t pixmap;
+
+    if (image_pixmap(image, 0, x, y, w, h, &pixmap) != EPS_OK) {
+        return EPS_PARAM_ERROR;
+    }
+
+    return encode_grayscale_block(NULL, &pixmap, W, H, w, h, x, y,
+                                  buf, buf_size, fb_id, mode, flags, rd);
+}
+
+int encode_grayscale_block(workspace_t *ws, pixmap_t *block,
+                           int W, int H, int w, int h, int x, int y,
+                           unsigned char *buf, int *buf_size,
+                           char *fb_id, int mode, int flags,
+                           eps_rd_info *rd)
 {
     filterbank_t *fb;
 
@@ -646,16 +1126,19 @@ int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h
     int block_size;
     int str_len;
 
+    speck_rd ch_rd;
+
     unsigned char dc_int;
     coeff_t dc;
 
     crc32_t hdr_crc;
     crc32_t data_crc;
+    int crc_type;
 
-    unsigned char *crc_pos;
+    int hdr_size;
 
     /* Sanity checks */
-    if (!block || !buf || !buf_size || !fb_id) {
+    if (!block || PIXMAP_IS_NULL(block) || !buf || !buf_size || !fb_id) {
         return EPS_PARAM_ERROR;
     }
 
@@ -692,6 +1175,13 @@ int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h
         return EPS_PARAM_ERROR;
     }
 
+    /* At most one checksum type can be requested */
+    crc_type = flags & EPS_CHECKSUM_MASK;
+
+    if (crc_type == EPS_CHECKSUM_MASK) {
+        return EPS_PARAM_ERROR;
+    }
+
     /* Find filterbank from id */
     if (!(fb = get_fb(fb_id))) {
         return EPS_UNSUPPORTED_FB;
@@ -709,7 +1199,8 @@ int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h
     block_size = get_block_size(w, h, mode, 2);
 
     /* Extend block */
-    pad_block = (coeff_t **) malloc_2D(block_size, block_size, sizeof(coeff_t));
+    pad_block = (coeff_t **) ws_malloc_2D(ws, block_size, block_size,
+                                          sizeof(coeff_t));
     extend_channel(block, pad_block, w, h, block_size, block_size);
 
     /* DC level shift */
@@ -717,20 +1208,37 @@ int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h
     dc_int = (unsigned char) CLIP(dc);
 
     /* Wavelet transform */
-    dwt_block = (coeff_t **) malloc_2D(block_size, block_size, sizeof(coeff_t));
+    dwt_block = (coeff_t **) ws_malloc_2D(ws, block_size, block_size,
+                                          sizeof(coeff_t));
     analysis_2D(pad_block, dwt_block, block_size, mode, fb);
-    free_2D((void *) pad_block, block_size, block_size);
+    ws_free_2D(ws, (void *) pad_block, block_size, block_size);
 
     /* Round coefficients */
-    int_block = (int **) malloc_2D(block_size, block_size, sizeof(int));
+    int_block = (int **) ws_malloc_2D(ws, block_size, block_size, sizeof(int));
     round_channel(dwt_block, int_block, block_size);
-    free_2D((void *) dwt_block, block_size, block_size);
+    ws_free_2D(ws, (void *) dwt_block, block_size, block_size);
 
     /* Write block header */
-    str_len = snprintf((char *) buf_next, bytes_left,
-        "type=gs;W=%d;H=%d;w=%d;h=%d;x=%d;y=%d;"
-        "m=%d;dc=%d;fb=%s;",
-        W, H, w, h, x, y, mode, dc_int, fb_id);
+    if (flags & EPS_BINARY_HEADER) {
+        str_len = 0;
+        buf_next[str_len++] = EPS_BIN_MAGIC;
+        buf_next[str_len++] = (EPS_BIN_VERSION << 4) |
+            (crc_type << EPS_BIN_CRC_SHIFT) | EPS_GRAYSCALE_BLOCK;
+        str_len += put_bin_value(buf_next + str_len, W);
+        str_len += put_bin_value(buf_next + str_len, H);
+        str_len += put_bin_value(buf_next + str_len, w);
+        str_len += put_bin_value(buf_next + str_len, h);
+        str_len += put_bin_value(buf_next + str_len, x);
+        str_len += put_bin_value(buf_next + str_len, y);
+        str_len += put_bin_value(buf_next + str_len, mode);
+        str_len += put_bin_value(buf_next + str_len, dc_int);
+        str_len += put_bin_value(buf_next + str_len, get_fb_index(fb));
+    } else {
+        str_len = snprintf((char *) buf_next, bytes_left,
+            "type=gs;W=%d;H=%d;w=%d;h=%d;x=%d;y=%d;"
+            "m=%d;dc=%d;fb=%s;",
+            W, H, w, h, x, y, mode, dc_int, fb_id);
+    }
 
     assert(str_len < bytes_left);
 
@@ -741,21 +1249,27 @@ int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h
     hdr_crc = epsilon_crc32(buf, str_len);
     hdr_crc = (hdr_crc ^ (hdr_crc >> 16)) & 0xffff;
 
-    str_len = snprintf((char *) buf_next, bytes_left,
-                       "chk=%04x;crc=????????;", hdr_crc);
+    if (flags & EPS_BINARY_HEADER) {
+        put_bin_fixed(buf_next, hdr_crc, EPS_BIN_CHK_BYTES);
+        str_len = EPS_BIN_CHK_BYTES + EPS_BIN_CRC_BYTES;
+    } else {
+        str_len = snprintf((char *) buf_next, bytes_left,
+                           "chk=%04x%s????????;", hdr_crc, crc_key(crc_type));
+    }
 
     assert(str_len < bytes_left);
 
     buf_next += str_len;
     bytes_left -= str_len;
 
-    crc_pos = buf_next - 9;
+    hdr_size = buf_next - buf;
 
     /* Encode coefficients */
-    speck_bytes = speck_encode(int_block, block_size,
-                               buf_next, bytes_left);
+    speck_bytes = speck_encode_rd(int_block, block_size,
+                                  buf_next, bytes_left,
+                                  rd ? &ch_rd : NULL);
 
-    free_2D((void *) int_block, block_size, block_size);
+    ws_free_2D(ws, (void *) int_block, block_size, block_size);
 
     /* Byte stuffing */
     stuff_max = speck_bytes + speck_bytes / 254 + 1;
@@ -771,9 +1285,16 @@ int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h
     free(stuff_buf);
 
     /* Compute and save data CRC */
-    data_crc = epsilon_crc32(buf_next, stuff_cut);
-    snprintf((char *) crc_pos, 9, "%08x", data_crc);
-    crc_pos[8] = ';';
+    data_crc = data_checksum(crc_type, buf_next, stuff_cut);
+    set_data_crc(buf, hdr_size, data_crc);
+
+    /* Rate-distortion curve */
+    if (rd) {
+        double weight = 1.0;
+
+        build_rd_info(rd, &ch_rd, &weight, &speck_bytes, 1,
+                      hdr_size, stuff_bytes, stuff_cut);
+    }
 
     buf_next += stuff_cut;
     bytes_left -= stuff_cut;
@@ -786,6 +1307,31 @@ int eps_encode_grayscale_block(unsigned char **block, int W, int H, int w, int h
 
 int eps_decode_grayscale_block(unsigned char **block, unsigned char *buf,
                                eps_block_header *hdr)
+{
+    pixmap_t pixmap;
+
+    pixmap_from_rows(&pixmap, block);
+
+    return decode_grayscale_block(NULL, &pixmap, buf, hdr);
+}
+
+int eps_decode_grayscale_block_strided(eps_image *image, unsigned char *buf,
+                                       eps_block_header *hdr)
+{
+    pixmap_t pixmap;
+
+    if (!hdr || (image_pixmap(image, 0, hdr->hdr_data.gs.x,
+        hdr->hdr_data.gs.y, hdr->hdr_data.gs.w, hdr->hdr_data.gs.h,
+        &pixmap) != EPS_OK))
+    {
+        return EPS_PARAM_ERROR;
+    }
+
+    return decode_grayscale_block(NULL, &pixmap, buf, hdr);
+}
+
+int decode_grayscale_block(workspace_t *ws, pixmap_t *block,
+                           unsigned char *buf, eps_block_header *hdr)
 {
     filterbank_t *fb;
 
@@ -800,7 +1346,7 @@ int eps_decode_grayscale_block(unsigned char **block, unsigned char *buf,
     int block_size;
 
     /* Sanity checks */
-    if (!block || !buf || !hdr) {
+    if (!block || PIXMAP_IS_NULL(block) || !buf || !hdr) {
         return EPS_PARAM_ERROR;
     }
 
@@ -836,19 +1382,21 @@ int eps_decode_grayscale_block(unsigned char **block, unsigned char *buf,
         hdr->hdr_data.gs.mode, 2);
 
     /* Decode coefficients */
-    int_block = (int **) malloc_2D(block_size, block_size, sizeof(int));
+    int_block = (int **) ws_malloc_2D(ws, block_size, block_size, sizeof(int));
     speck_decode(unstuff_buf, unstuff_bytes, int_block, block_size);
     free(unstuff_buf);
 
     /* Extend values from int to coeff_t */
-    dwt_block = (coeff_t **) malloc_2D(block_size, block_size, sizeof(coeff_t));
+    dwt_block = (coeff_t **) ws_malloc_2D(ws, block_size, block_size,
+                                          sizeof(coeff_t));
     copy_channel(int_block, dwt_block, block_size);
-    free_2D((void *) int_block, block_size, block_size);
+    ws_free_2D(ws, (void *) int_block, block_size, block_size);
 
     /* Inverse wavelet transform */
-    pad_block = (coeff_t **) malloc_2D(block_size, block_size, sizeof(coeff_t));
+    pad_block = (coeff_t **) ws_malloc_2D(ws, block_size, block_size,
+                                          sizeof(coeff_t));
     synthesis_2D(dwt_block, pad_block, block_size, hdr->hdr_data.gs.mode, fb);
-    free_2D((void *) dwt_block, block_size, block_size);
+    ws_free_2D(ws, (void *) dwt_block, block_size, block_size);
 
     dc_int = (unsigned char) hdr->hdr_data.gs.dc;
 
@@ -860,7 +1408,7 @@ int eps_decode_grayscale_block(unsigned char **block, unsigned char *buf,
     extract_channel(pad_block, block, block_size, block_size,
         hdr->hdr_data.gs.w, hdr->hdr_data.gs.h);
 
-    free_2D((void *) pad_block, block_size, block_size);
+    ws_free_2D(ws, (void *) pad_block, block_size, block_size);
 
     return EPS_OK;
 }
@@ -873,6 +1421,92 @@ int eps_encode_truecolor_block(unsigned char **block_R,
                                unsigned char *buf, int *buf_size,
                                int Y_rt, int Cb_rt, int Cr_rt,
                                char *fb_id, int mode)
+{
+    return eps_encode_truecolor_block_ex(block_R, block_G, block_B,
+                                         W, H, w, h, x, y, resample,
+                                         buf, buf_size, Y_rt, Cb_rt, Cr_rt,
+                                         fb_id, mode, 0);
+}
+
+int eps_encode_truecolor_block_ex(unsigned char **block_R,
+                                  unsigned char **block_G,
+                                  unsigned char **block_B,
+                                  int W, int H, int w, int h,
+                                  int x, int y, int resample,
+                                  unsigned char *buf, int *buf_size,
+                                  int Y_rt, int Cb_rt, int Cr_rt,
+                                  char *fb_id, int mode, int flags)
+{
+    pixmap_t pixmap_R, pixmap_G, pixmap_B;
+
+    pixmap_from_rows(&pixmap_R, block_R);
+    pixmap_from_rows(&pixmap_G, block_G);
+    pixmap_from_rows(&pixmap_B, block_B);
+
+    return encode_truecolor_block(NULL, &pixmap_R, &pixmap_G, &pixmap_B,
+                                  W, H, w, h, x, y, resample,
+                                  buf, buf_size, Y_rt, Cb_rt, Cr_rt,
+                                  fb_id, mode, flags, NULL);
+}
+
+int eps_encode_truecolor_block_rd(unsigned char **block_R,
+                                  unsigned char **block_G,
+                                  unsigned char **block_B,
+                                  int W, int H, int w, int h,
+                                  int x, int y, int resample,
+                                  unsigned char *buf, int *buf_size,
+                                  int Y_rt, int Cb_rt, int Cr_rt,
+                                  char *fb_id, int mode, int flags,
+                                  eps_rd_info *rd)
+{
+    pixmap_t pixmap_R, pixmap_G, pixmap_B;
+
+    /* Sanity checks */
+    if (!rd) {
+        return EPS_PARAM_ERROR;
+    }
+
+    pixmap_from_rows(&pixmap_R, block_R);
+    pixmap_from_rows(&pixmap_G, block_G);
+    pixmap_from_rows(&pixmap_B, block_B);
+
+    return encode_truecolor_block(NULL, &pixmap_R, &pixmap_G, &pixmap_B,
+                                  W, H, w, h, x, y, resample,
+                                  buf, buf_size, Y_rt, Cb_rt, Cr_rt,
+                                  fb_id, mode, flags, rd);
+}
+
+int eps_encode_truecolor_block_strided(eps_image *image, int W, int H,
+                                       int w, int h, int x, int y,
+                                       int resample, unsigned char *buf,
+                                       int *buf_size, int Y_rt, int Cb_rt,
+                                       int Cr_rt, char *fb_id, int mode,
+                                       int flags, eps_rd_info *rd)
+{
+    pixmap_t pixmap[3];
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        if (image_pixmap(image, k, x, y, w, h, &pixmap[k]) != EPS_OK) {
+            return EPS_PARAM_ERROR;
+        }
+    }
+
+    return encode_truecolor_block(NULL, &pixmap[0], &pixmap[1], &pixmap[2],
+                                  W, H, w, h, x, y, resample,
+                                  buf, buf_size, Y_rt, Cb_rt, Cr_rt,
+                                  fb_id, mode, flags, rd);
+}
+
+int encode_truecolor_block(workspace_t *ws, pixmap_t *block_R,
+                           pixmap_t *block_G,
+                           pixmap_t *block_B,
+                           int W, int H, int w, int h,
+                           int x, int y, int resample,
+                           unsigned char *buf, int *buf_size,
+                           int Y_rt, int Cb_rt, int Cr_rt,
+                           char *fb_id, int mode, int flags,
+                           eps_rd_info *rd)
 {
     filterbank_t *fb;
 
@@ -896,10 +1530,6 @@ int eps_encode_truecolor_block(unsigned char **block_R,
     int stuff_max;
     int stuff_cut;
 
-    coeff_t **pad_block_R;
-    coeff_t **pad_block_G;
-    coeff_t **pad_block_B;
-
     coeff_t **pad_block_Y;
     coeff_t **pad_block_Cb;
     coeff_t **pad_block_Cr;
@@ -926,6 +1556,10 @@ int eps_encode_truecolor_block(unsigned char **block_R,
 
     int speck_bytes;
 
+    speck_rd ch_rd[3];
+    int ch_bytes[3];
+    double weight[3];
+
     int full_size;
     int half_size;
 
@@ -939,8 +1573,9 @@ int eps_encode_truecolor_block(unsigned char **block_R,
 
     crc32_t hdr_crc;
     crc32_t data_crc;
+    int crc_type;
 
-    unsigned char *crc_pos;
+    int hdr_size;
     int str_len;
 
     /* Sanity checks */
@@ -948,6 +1583,12 @@ int eps_encode_truecolor_block(unsigned char **block_R,
         return EPS_PARAM_ERROR;
     }
 
+    if (PIXMAP_IS_NULL(block_R) || PIXMAP_IS_NULL(block_G) ||
+        PIXMAP_IS_NULL(block_B))
+    {
+        return EPS_PARAM_ERROR;
+    }
+
     if (!buf || !buf_size || !fb_id) {
         return EPS_PARAM_ERROR;
     }
@@ -989,6 +1630,13 @@ int eps_encode_truecolor_block(unsigned char **block_R,
         return EPS_PARAM_ERROR;
     }
 
+    /* At most one checksum type can be requested */
+    crc_type = flags & EPS_CHECKSUM_MASK;
+
+    if (crc_type == EPS_CHECKSUM_MASK) {
+        return EPS_PARAM_ERROR;
+    }
+
     if ((Y_rt < EPS_MIN_RT) || (Cb_rt < EPS_MIN_RT) || (Cr_rt < EPS_MIN_RT)) {
         return EPS_PARAM_ERROR;
     }
@@ -1023,36 +1671,24 @@ int eps_encode_truecolor_block(unsigned char **block_R,
     full_size = get_block_size(w, h, mode, 4);
     half_size = full_size / 2 + (mode == EPS_MODE_OTLPF);
 
-    /* Allocate memory for extended R,G,B channels */
-    pad_block_R = (coeff_t **) malloc_2D(full_size, full_size,
-        sizeof(coeff_t));
-    pad_block_G = (coeff_t **) malloc_2D(full_size, full_size,
-        sizeof(coeff_t));
-    pad_block_B = (coeff_t **) malloc_2D(full_size, full_size,
-        sizeof(coeff_t));
-
-    /* Extend R,G,B channels */
-    extend_channel(block_R, pad_block_R, w, h, full_size, full_size);
-    extend_channel(block_G, pad_block_G, w, h, full_size, full_size);
-    extend_channel(block_B, pad_block_B, w, h, full_size, full_size);
-
     /* Allocate memory for extended Y,Cb,Cr channels */
-    pad_block_Y = (coeff_t **) malloc_2D(full_size, full_size,
+    pad_block_Y = (coeff_t **) ws_malloc_2D(ws, full_size, full_size,
         sizeof(coeff_t));
-    pad_block_Cb = (coeff_t **) malloc_2D(full_size, full_size,
+    pad_block_Cb = (coeff_t **) ws_malloc_2D(ws, full_size, full_size,
         sizeof(coeff_t));
-    pad_block_Cr = (coeff_t **) malloc_2D(full_size, full_size,
+    pad_block_Cr = (coeff_t **) ws_malloc_2D(ws, full_size, full_size,
         sizeof(coeff_t));
 
-    /* Convert from R,G,B to Y,Cb,Cr color space */
-    convert_RGB_to_YCbCr(pad_block_R, pad_block_G, pad_block_B,
-                         pad_block_Y, pad_block_Cb, pad_block_Cr,
-                         full_size, full_size);
+    /* Convert from R,G,B to Y,Cb,Cr color space. Conversion is
+     * point-wise, so it is done before extension. */
+    convert_RGB8_to_YCbCr(block_R, block_G, block_B,
+                          pad_block_Y, pad_block_Cb, pad_block_Cr,
+                          w, h);
 
-    /* No longer needed */
-    free_2D((void *) pad_block_R, full_size, full_size);
-    free_2D((void *) pad_block_G, full_size, full_size);
-    free_2D((void *) pad_block_B, full_size, full_size);
+    /* Extend Y,Cb,Cr channels */
+    mirror_channel(pad_block_Y, w, h, full_size, full_size);
+    mirror_channel(pad_block_Cb, w, h, full_size, full_size);
+    mirror_channel(pad_block_Cr, w, h, full_size, full_size);
 
     if (resample == EPS_RESAMPLE_444) {
         /* No resampling: all channels are full sized */
@@ -1074,9 +1710,9 @@ int eps_encode_truecolor_block(unsigned char **block_R,
         block_Y = pad_block_Y;
 
         /* Allocate memory for resampled Cb and Cr channels */
-        block_Cb = (coeff_t **) malloc_2D(half_size, half_size,
+        block_Cb = (coeff_t **) ws_malloc_2D(ws, half_size, half_size,
             sizeof(coeff_t));
-        block_Cr = (coeff_t **) malloc_2D(half_size, half_size,
+        block_Cr = (coeff_t **) ws_malloc_2D(ws, half_size, half_size,
             sizeof(coeff_t));
 
         /* Resample Cb channel */
@@ -1090,8 +1726,8 @@ int eps_encode_truecolor_block(unsigned char **block_R,
                                   half_size, half_size);
 
         /* No longer needed */
-        free_2D((void *) pad_block_Cb, full_size, full_size);
-        free_2D((void *) pad_block_Cr, full_size, full_size);
+        ws_free_2D(ws, (void *) pad_block_Cb, full_size, full_size);
+        ws_free_2D(ws, (void *) pad_block_Cr, full_size, full_size);
     }
 
     /* DC level shift */
@@ -1105,11 +1741,11 @@ int eps_encode_truecolor_block(unsigned char **block_R,
     dc_Cr_int = (unsigned char) CLIP(dc_Cr);
 
     /* Allocate memory for wavelet coefficients */
-    dwt_block_Y = (coeff_t **) malloc_2D(block_Y_size, block_Y_size,
+    dwt_block_Y = (coeff_t **) ws_malloc_2D(ws, block_Y_size, block_Y_size,
         sizeof(coeff_t));
-    dwt_block_Cb = (coeff_t **) malloc_2D(block_Cb_size, block_Cb_size,
+    dwt_block_Cb = (coeff_t **) ws_malloc_2D(ws, block_Cb_size, block_Cb_size,
         sizeof(coeff_t));
-    dwt_block_Cr = (coeff_t **) malloc_2D(block_Cr_size, block_Cr_size,
+    dwt_block_Cr = (coeff_t **) ws_malloc_2D(ws, block_Cr_size, block_Cr_size,
         sizeof(coeff_t));
 
     /* Wavelet transform */
@@ -1118,16 +1754,16 @@ int eps_encode_truecolor_block(unsigned char **block_R,
     analysis_2D(block_Cr, dwt_block_Cr, block_Cr_size, mode, fb);
 
     /* No longer needed */
-    free_2D((void *) block_Y, block_Y_size, block_Y_size);
-    free_2D((void *) block_Cb, block_Cb_size, block_Cb_size);
-    free_2D((void *) block_Cr, block_Cr_size, block_Cr_size);
+    ws_free_2D(ws, (void *) block_Y, block_Y_size, block_Y_size);
+    ws_free_2D(ws, (void *) block_Cb, block_Cb_size, block_Cb_size);
+    ws_free_2D(ws, (void *) block_Cr, block_Cr_size, block_Cr_size);
 
     /* Allocate memory for rounded wavelet coefficients */
-    int_block_Y = (int **) malloc_2D(block_Y_size, block_Y_size,
+    int_block_Y = (int **) ws_malloc_2D(ws, block_Y_size, block_Y_size,
         sizeof(int));
-    int_block_Cb = (int **) malloc_2D(block_Cb_size, block_Cb_size,
+    int_block_Cb = (int **) ws_malloc_2D(ws, block_Cb_size, block_Cb_size,
         sizeof(int));
-    int_block_Cr = (int **) malloc_2D(block_Cr_size, block_Cr_size,
+    int_block_Cr = (int **) ws_malloc_2D(ws, block_Cr_size, block_Cr_size,
         sizeof(int));
 
     /* Round wavelet coefficients */
@@ -1136,9 +1772,9 @@ int eps_encode_truecolor_block(unsigned char **block_R,
     round_channel(dwt_block_Cr, int_block_Cr, block_Cr_size);
 
     /* No longer needed */
-    free_2D((void *) dwt_block_Y, block_Y_size, block_Y_size);
-    free_2D((void *) dwt_block_Cb, block_Cb_size, block_Cb_size);
-    free_2D((void *) dwt_block_Cr, block_Cr_size, block_Cr_size);
+    ws_free_2D(ws, (void *) dwt_block_Y, block_Y_size, block_Y_size);
+    ws_free_2D(ws, (void *) dwt_block_Cb, block_Cb_size, block_Cb_size);
+    ws_free_2D(ws, (void *) dwt_block_Cr, block_Cr_size, block_Cr_size);
 
     /* Allocate memory for encoded data */
     buf_Y = (unsigned char *) xmalloc(buf_Y_size *
@@ -1149,20 +1785,23 @@ int eps_encode_truecolor_block(unsigned char **block_R,
         sizeof(unsigned char));
 
     /* Encode Y,Cb,Cr channels */
-    speck_bytes_Y = speck_encode(int_block_Y, block_Y_size,
-                                 buf_Y, buf_Y_size);
+    speck_bytes_Y = speck_encode_rd(int_block_Y, block_Y_size,
+                                    buf_Y, buf_Y_size,
+                                    rd ? &ch_rd[0] : NULL);
 
-    speck_bytes_Cb = speck_encode(int_block_Cb, block_Cb_size,
-                                  buf_Cb, buf_Cb_size);
+    speck_bytes_Cb = speck_encode_rd(int_block_Cb, block_Cb_size,
+                                     buf_Cb, buf_Cb_size,
+                                     rd ? &ch_rd[1] : NULL);
 
 
-    speck_bytes_Cr = speck_encode(int_block_Cr, block_Cr_size,
-                                  buf_Cr, buf_Cr_size);
+    speck_bytes_Cr = speck_encode_rd(int_block_Cr, block_Cr_size,
+                                     buf_Cr, buf_Cr_size,
+                                     rd ? &ch_rd[2] : NULL);
 
     /* No longer needed */
-    free_2D((void *) int_block_Y, block_Y_size, block_Y_size);
-    free_2D((void *) int_block_Cb, block_Cb_size, block_Cb_size);
-    free_2D((void *) int_block_Cr, block_Cr_size, block_Cr_size);
+    ws_free_2D(ws, (void *) int_block_Y, block_Y_size, block_Y_size);
+    ws_free_2D(ws, (void *) int_block_Cb, block_Cb_size, block_Cb_size);
+    ws_free_2D(ws, (void *) int_block_Cr, block_Cr_size, block_Cr_size);
 
     /* Total number of encoded bytes */
     speck_bytes = speck_bytes_Y + speck_bytes_Cb + speck_bytes_Cr;
@@ -1200,13 +1839,35 @@ int eps_encode_truecolor_block(unsigned char **block_R,
     free(buf_Y_Cb_Cr);
 
     /* Write block header */
-    str_len = snprintf((char *) buf_next, bytes_left,
-        "type=tc;W=%d;H=%d;w=%d;h=%d;x=%d;y=%d;m=%d;r=%d;"
-        "dc=%d:%d:%d;rt=%d:%d:%d;fb=%s;",
-        W, H, w, h, x, y, mode, resample,
-        dc_Y_int, dc_Cb_int, dc_Cr_int,
-        speck_bytes_Y, speck_bytes_Cb,
-        speck_bytes_Cr, fb_id);
+    if (flags & EPS_BINARY_HEADER) {
+        str_len = 0;
+        buf_next[str_len++] = EPS_BIN_MAGIC;
+        buf_next[str_len++] = (EPS_BIN_VERSION << 4) |
+            (crc_type << EPS_BIN_CRC_SHIFT) | EPS_TRUECOLOR_BLOCK;
+        str_len += put_bin_value(buf_next + str_len, W);
+        str_len += put_bin_value(buf_next + str_len, H);
+        str_len += put_bin_value(buf_next + str_len, w);
+        str_len += put_bin_value(buf_next + str_len, h);
+        str_len += put_bin_value(buf_next + str_len, x);
+        str_len += put_bin_value(buf_next + str_len, y);
+        str_len += put_bin_value(buf_next + str_len, mode);
+        str_len += put_bin_value(buf_next + str_len, resample);
+        str_len += put_bin_value(buf_next + str_len, dc_Y_int);
+        str_len += put_bin_value(buf_next + str_len, dc_Cb_int);
+        str_len += put_bin_value(buf_next + str_len, dc_Cr_int);
+        str_len += put_bin_value(buf_next + str_len, speck_bytes_Y);
+        str_len += put_bin_value(buf_next + str_len, speck_bytes_Cb);
+        str_len += put_bin_value(buf_next + str_len, speck_bytes_Cr);
+        str_len += put_bin_value(buf_next + str_len, get_fb_index(fb));
+    } else {
+        str_len = snprintf((char *) buf_next, bytes_left,
+            "type=tc;W=%d;H=%d;w=%d;h=%d;x=%d;y=%d;m=%d;r=%d;"
+            "dc=%d:%d:%d;rt=%d:%d:%d;fb=%s;",
+            W, H, w, h, x, y, mode, resample,
+            dc_Y_int, dc_Cb_int, dc_Cr_int,
+            speck_bytes_Y, speck_bytes_Cb,
+            speck_bytes_Cr, fb_id);
+    }
 
     assert(str_len < bytes_left);
 
@@ -1217,15 +1878,20 @@ int eps_encode_truecolor_block(unsigned char **block_R,
     hdr_crc = epsilon_crc32(buf, str_len);
     hdr_crc = (hdr_crc ^ (hdr_crc >> 16)) & 0xffff;
 
-    str_len = snprintf((char *) buf_next, bytes_left,
-                       "chk=%04x;crc=????????;", hdr_crc);
+    if (flags & EPS_BINARY_HEADER) {
+        put_bin_fixed(buf_next, hdr_crc, EPS_BIN_CHK_BYTES);
+        str_len = EPS_BIN_CHK_BYTES + EPS_BIN_CRC_BYTES;
+    } else {
+        str_len = snprintf((char *) buf_next, bytes_left,
+                           "chk=%04x%s????????;", hdr_crc, crc_key(crc_type));
+    }
 
     assert(str_len < bytes_left);
 
     buf_next += str_len;
     bytes_left -= str_len;
 
-    crc_pos = buf_next - 9;
+    hdr_size = buf_next - buf;
 
     /* Cut encoded stream to fit it within available space */
     stuff_cut = MIN(bytes_left, stuff_bytes);
@@ -1234,9 +1900,22 @@ int eps_encode_truecolor_block(unsigned char **block_R,
     free(stuff_buf);
 
     /* Compute and save data CRC */
-    data_crc = epsilon_crc32(buf_next, stuff_cut);
-    snprintf((char *) crc_pos, 9, "%08x", data_crc);
-    crc_pos[8] = ';';
+    data_crc = data_checksum(crc_type, buf_next, stuff_cut);
+    set_data_crc(buf, hdr_size, data_crc);
+
+    /* Rate-distortion curve. Each chroma sample of the
+     * resampled block covers four pixels. */
+    if (rd) {
+        ch_bytes[0] = speck_bytes_Y;
+        ch_bytes[1] = speck_bytes_Cb;
+        ch_bytes[2] = speck_bytes_Cr;
+
+        weight[0] = 1.0;
+        weight[1] = weight[2] = (resample == EPS_RESAMPLE_420) ? 4.0 : 1.0;
+
+        build_rd_info(rd, ch_rd, weight, ch_bytes, 3,
+                      hdr_size, stuff_bytes, stuff_cut);
+    }
 
     buf_next += stuff_cut;
     bytes_left -= stuff_cut;
@@ -1252,6 +1931,44 @@ int eps_decode_truecolor_block(unsigned char **block_R,
                                unsigned char **block_B,
                                unsigned char *buf,
                                eps_block_header *hdr)
+{
+    pixmap_t pixmap_R, pixmap_G, pixmap_B;
+
+    pixmap_from_rows(&pixmap_R, block_R);
+    pixmap_from_rows(&pixmap_G, block_G);
+    pixmap_from_rows(&pixmap_B, block_B);
+
+    return decode_truecolor_block(NULL, &pixmap_R, &pixmap_G, &pixmap_B,
+                                  buf, hdr);
+}
+
+int eps_decode_truecolor_block_strided(eps_image *image, unsigned char *buf,
+                                       eps_block_header *hdr)
+{
+    pixmap_t pixmap[3];
+    int k;
+
+    if (!hdr) {
+        return EPS_PARAM_ERROR;
+    }
+
+    for (k = 0; k < 3; k++) {
+        if (image_pixmap(image, k, hdr->hdr_data.tc.x, hdr->hdr_data.tc.y,
+            hdr->hdr_data.tc.w, hdr->hdr_data.tc.h, &pixmap[k]) != EPS_OK)
+        {
+            return EPS_PARAM_ERROR;
+        }
+    }
+
+    return decode_truecolor_block(NULL, &pixmap[0], &pixmap[1], &pixmap[2],
+                                  buf, hdr);
+}
+
+int decode_truecolor_block(workspace_t *ws, pixmap_t *block_R,
+                           pixmap_t *block_G,
+                           pixmap_t *block_B,
+                           unsigned char *buf,
+                           eps_block_header *hdr)
 {
     filterbank_t *fb;
 
@@ -1283,10 +2000,6 @@ int eps_decode_truecolor_block(unsigned char **block_R,
     coeff_t **pad_block_Cb;
     coeff_t **pad_block_Cr;
 
-    coeff_t **pad_block_R;
-    coeff_t **pad_block_G;
-    coeff_t **pad_block_B;
-
     coeff_t **block_Y;
     coeff_t **block_Cb;
     coeff_t **block_Cr;
@@ -1304,6 +2017,12 @@ int eps_decode_truecolor_block(unsigned char **block_R,
         return EPS_PARAM_ERROR;
     }
 
+    if (PIXMAP_IS_NULL(block_R) || PIXMAP_IS_NULL(block_G) ||
+        PIXMAP_IS_NULL(block_B))
+    {
+        return EPS_PARAM_ERROR;
+    }
+
     if (!buf || !hdr) {
         return EPS_PARAM_ERROR;
     }
@@ -1419,11 +2138,11 @@ int eps_decode_truecolor_block(unsigned char **block_R,
     }
 
     /* Allocate memory for Y,Cb,Cr channels */
-    int_block_Y = (int **) malloc_2D(block_Y_size, block_Y_size,
+    int_block_Y = (int **) ws_malloc_2D(ws, block_Y_size, block_Y_size,
         sizeof(int));
-    int_block_Cb = (int **) malloc_2D(block_Cb_size, block_Cb_size,
+    int_block_Cb = (int **) ws_malloc_2D(ws, block_Cb_size, block_Cb_size,
         sizeof(int));
-    int_block_Cr = (int **) malloc_2D(block_Cr_size, block_Cr_size,
+    int_block_Cr = (int **) ws_malloc_2D(ws, block_Cr_size, block_Cr_size,
         sizeof(int));
 
     /* Decode data */
@@ -1437,11 +2156,11 @@ int eps_decode_truecolor_block(unsigned char **block_R,
     free(buf_Cr);
 
     /* Allocate memory for real-valued wavelet coefficients */
-    dwt_block_Y = (coeff_t **) malloc_2D(block_Y_size, block_Y_size,
+    dwt_block_Y = (coeff_t **) ws_malloc_2D(ws, block_Y_size, block_Y_size,
         sizeof(coeff_t));
-    dwt_block_Cb = (coeff_t **) malloc_2D(block_Cb_size, block_Cb_size,
+    dwt_block_Cb = (coeff_t **) ws_malloc_2D(ws, block_Cb_size, block_Cb_size,
         sizeof(coeff_t));
-    dwt_block_Cr = (coeff_t **) malloc_2D(block_Cr_size, block_Cr_size,
+    dwt_block_Cr = (coeff_t **) ws_malloc_2D(ws, block_Cr_size, block_Cr_size,
         sizeof(coeff_t));
 
     /* Copy data with type extension */
@@ -1450,16 +2169,16 @@ int eps_decode_truecolor_block(unsigned char **block_R,
     copy_channel(int_block_Cr, dwt_block_Cr, block_Cr_size);
 
     /* No longer needed */
-    free_2D((void *) int_block_Y, block_Y_size, block_Y_size);
-    free_2D((void *) int_block_Cb, block_Cb_size, block_Cb_size);
-    free_2D((void *) int_block_Cr, block_Cr_size, block_Cr_size);
+    ws_free_2D(ws, (void *) int_block_Y, block_Y_size, block_Y_size);
+    ws_free_2D(ws, (void *) int_block_Cb, block_Cb_size, block_Cb_size);
+    ws_free_2D(ws, (void *) int_block_Cr, block_Cr_size, block_Cr_size);
 
     /* Allocate memory for restored Y,Cb,Cr channels */
-    block_Y = (coeff_t **) malloc_2D(block_Y_size, block_Y_size,
+    block_Y = (coeff_t **) ws_malloc_2D(ws, block_Y_size, block_Y_size,
         sizeof(coeff_t));
-    block_Cb = (coeff_t **) malloc_2D(block_Cb_size, block_Cb_size,
+    block_Cb = (coeff_t **) ws_malloc_2D(ws, block_Cb_size, block_Cb_size,
         sizeof(coeff_t));
-    block_Cr = (coeff_t **) malloc_2D(block_Cr_size, block_Cr_size,
+    block_Cr = (coeff_t **) ws_malloc_2D(ws, block_Cr_size, block_Cr_size,
         sizeof(coeff_t));
 
     /* Inverse wavelet transform */
@@ -1468,9 +2187,9 @@ int eps_decode_truecolor_block(unsigned char **block_R,
     synthesis_2D(dwt_block_Cr, block_Cr, block_Cr_size, hdr->hdr_data.tc.mode, fb);
 
     /* No longer needed */
-    free_2D((void *) dwt_block_Y, block_Y_size, block_Y_size);
-    free_2D((void *) dwt_block_Cb, block_Cb_size, block_Cb_size);
-    free_2D((void *) dwt_block_Cr, block_Cr_size, block_Cr_size);
+    ws_free_2D(ws, (void *) dwt_block_Y, block_Y_size, block_Y_size);
+    ws_free_2D(ws, (void *) dwt_block_Cb, block_Cb_size, block_Cb_size);
+    ws_free_2D(ws, (void *) dwt_block_Cr, block_Cr_size, block_Cr_size);
 
     /* Get DC values */
     dc_Y_int  = (unsigned char) hdr->hdr_data.tc.dc_Y;
@@ -1494,10 +2213,10 @@ int eps_decode_truecolor_block(unsigned char **block_R,
         pad_block_Y = block_Y;
 
         /* Allocate memory for full-sized Cb and Cr channels */
-        pad_block_Cb = (coeff_t **) malloc_2D(full_size, full_size,
+        pad_block_Cb = (coeff_t **) ws_malloc_2D(ws, full_size, full_size,
             sizeof(coeff_t));
 
-        pad_block_Cr = (coeff_t **) malloc_2D(full_size, full_size,
+        pad_block_Cr = (coeff_t **) ws_malloc_2D(ws, full_size, full_size,
             sizeof(coeff_t));
 
         /* Upsample Cb and Cr channels according to 4:2:0 scheme */
@@ -1510,53 +2229,20 @@ int eps_decode_truecolor_block(unsigned char **block_R,
                                   full_size, full_size);
 
         /* No longer needed */
-        free_2D((void *) block_Cb, block_Cb_size, block_Cb_size);
-        free_2D((void *) block_Cr, block_Cr_size, block_Cr_size);
+        ws_free_2D(ws, (void *) block_Cb, block_Cb_size, block_Cb_size);
+        ws_free_2D(ws, (void *) block_Cr, block_Cr_size, block_Cr_size);
     }
 
-    /* Allocate memory for extended R,G,B channels */
-    pad_block_R = (coeff_t **) malloc_2D(full_size, full_size,
-        sizeof(coeff_t));
-    pad_block_G = (coeff_t **) malloc_2D(full_size, full_size,
-        sizeof(coeff_t));
-    pad_block_B = (coeff_t **) malloc_2D(full_size, full_size,
-        sizeof(coeff_t));
-
-    /* Convert from Y,Cb,Cr to R,G,B color space */
-    convert_YCbCr_to_RGB(pad_block_Y, pad_block_Cb, pad_block_Cr,
-                         pad_block_R, pad_block_G, pad_block_B,
-                         full_size, full_size);
-
-    /* No longer needed */
-    free_2D((void *) pad_block_Y, full_size, full_size);
-    free_2D((void *) pad_block_Cb, full_size, full_size);
-    free_2D((void *) pad_block_Cr, full_size, full_size);
-
-    /* Clip R,G,B channels */
-    clip_channel(pad_block_R, full_size, full_size);
-    clip_channel(pad_block_G, full_size, full_size);
-    clip_channel(pad_block_B, full_size, full_size);
-
-    /* Extract original data from R,G,B channels */
-    extract_channel(pad_block_R, block_R,
-                    full_size, full_size,
-                    hdr->hdr_data.tc.w,
-                    hdr->hdr_data.tc.h);
-
-    extract_channel(pad_block_G, block_G,
-                    full_size, full_size,
-                    hdr->hdr_data.tc.w,
-                    hdr->hdr_data.tc.h);
-
-    extract_channel(pad_block_B, block_B,
-                    full_size, full_size,
-                    hdr->hdr_data.tc.w,
-                    hdr->hdr_data.tc.h);
+    /* Convert from Y,Cb,Cr to R,G,B color space
+     * and extract original clipped data */
+    convert_YCbCr_to_RGB8(pad_block_Y, pad_block_Cb, pad_block_Cr,
+                          block_R, block_G, block_B,
+                          hdr->hdr_data.tc.w, hdr->hdr_data.tc.h);
 
     /* No longer needed */
-    free_2D((void *) pad_block_R, full_size, full_size);
-    free_2D((void *) pad_block_G, full_size, full_size);
-    free_2D((void *) pad_block_B, full_size, full_size);
+    ws_free_2D(ws, (void *) pad_block_Y, full_size, full_size);
+    ws_free_2D(ws, (void *) pad_block_Cb, full_size, full_size);
+    ws_free_2D(ws, (void *) pad_block_Cr, full_size, full_size);
 
     return EPS_OK;
 }
@@ -1580,9 +2266,9 @@ int eps_truncate_block(unsigned char *buf_in, unsigned char *buf_out,
     memcpy(buf_out, buf_in, *truncate_size);
 
     /* Recompute data CRC */
-    data_crc = epsilon_crc32(buf_out + hdr->hdr_size, *truncate_size - hdr->hdr_size);
-    snprintf((char *) (buf_out + hdr->hdr_size - 9), 9, "%08x", data_crc);
-    *(buf_out + hdr->hdr_size - 1) = ';';
+    data_crc = data_checksum(hdr->crc_type, buf_out + hdr->hdr_size,
+                             *truncate_size - hdr->hdr_size);
+    set_data_crc(buf_out, hdr->hdr_size, data_crc);
 
     return EPS_OK;
 }
@@ -44,6 +44,30 @@ extern "C" {
 #include <filterbank.h>
 #include <filter.h>
 
+/** First byte of the binary block header
+ *
+ *  ASCII headers always start with \c t, so this value
+ *  is enough to tell one format from another. */
+#define EPS_BIN_MAGIC           0xEB
+/** Binary block header version */
+#define EPS_BIN_VERSION         1
+/** Block type bits of the second binary header byte */
+#define EPS_BIN_TYPE_MASK       0x03
+/** Checksum type bits of the second binary header byte */
+#define EPS_BIN_CRC_MASK        0x0c
+/** Shift of \ref EPS_CHECKSUM_CRC32C and \ref EPS_CHECKSUM_ADLER32
+ *  within the second binary header byte */
+#define EPS_BIN_CRC_SHIFT       1
+/** Width of the header CRC field in the binary header */
+#define EPS_BIN_CHK_BYTES       3
+/** Width of the data CRC field in the binary header */
+#define EPS_BIN_CRC_BYTES       5
+/** Maximal number of variable-width fields in the binary header */
+#define EPS_BIN_MAX_FIELDS      16
+
+/** All data checksum flags */
+#define EPS_CHECKSUM_MASK       (EPS_CHECKSUM_CRC32C | EPS_CHECKSUM_ADLER32)
+
 /** Round a channel
  *
  *  This function rounds each \a in_channel element to the
@@ -81,8 +105,8 @@ local void copy_channel(int **in_channel, coeff_t **out_channel,
  *  \param height Block height
  *
  *  \return \c VOID */
-local void reset_RGB(unsigned char **block_R, unsigned char **block_G,
-                     unsigned char **block_B, int width, int height);
+local void reset_RGB(pixmap_t *block_R, pixmap_t *block_G,
+                     pixmap_t *block_B, int width, int height);
 
 /** Reset Y channel
  *
@@ -93,7 +117,7 @@ local void reset_RGB(unsigned char **block_R, unsigned char **block_G,
  *  \param height Block height
  *
  *  \return \c VOID */
-local void reset_Y(unsigned char **block_Y, int width, int height);
+local void reset_Y(pixmap_t *block_Y, int width, int height);
 
 /** Get filterbank pointer from id
  *
@@ -104,6 +128,17 @@ local void reset_Y(unsigned char **block_Y, int width, int height);
  *  \return Filterbank pointer or \c NULL if not found */
 local filterbank_t *get_fb(char *id);
 
+/** Get filterbank index
+ *
+ *  This function finds position of the filterbank \a fb
+ *  in the \ref filterbanks array. Binary block headers
+ *  refer to filterbanks by this index.
+ *
+ *  \param fb Filterbank pointer
+ *
+ *  \return Filterbank index or \c -1 if not found */
+local int get_fb_index(filterbank_t *fb);
+
 /** Compute required block size
  *
  *  This function computes block size (width=height) required
@@ -119,44 +154,210 @@ local filterbank_t *get_fb(char *id);
  *  \return Block size (width = height) */
 local int get_block_size(int w, int h, int mode, int min);
 
-/** Terminate block header
+/** Match literal header text
+ *
+ *  This function checks that the buffer contains \a key
+ *  at position \a pos. On success \a pos is advanced
+ *  past the \a key.
+ *
+ *  \param buf Data buffer
+ *  \param buf_size Buffer size
+ *  \param pos Current position in the buffer
+ *  \param key Expected text
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_FORMAT_ERROR */
+local int parse_key(unsigned char *buf, int buf_size, int *pos, char *key);
+
+/** Parse decimal header value
+ *
+ *  This function parses optionally signed decimal integer
+ *  at position \a pos. On success \a pos is advanced
+ *  past the value.
+ *
+ *  \param buf Data buffer
+ *  \param buf_size Buffer size
+ *  \param pos Current position in the buffer
+ *  \param value Parsed value
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_FORMAT_ERROR
+ *  (no digits or value does not fit into \c int) */
+local int parse_dec(unsigned char *buf, int buf_size, int *pos, int *value);
+
+/** Parse hexadecimal header value
+ *
+ *  This function parses hexadecimal CRC value at position
+ *  \a pos. On success \a pos is advanced past the value.
+ *
+ *  \param buf Data buffer
+ *  \param buf_size Buffer size
+ *  \param pos Current position in the buffer
+ *  \param value Parsed value
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_FORMAT_ERROR
+ *  (no digits or value does not fit into 32 bits) */
+local int parse_hex(unsigned char *buf, int buf_size, int *pos,
+                    crc32_t *value);
+
+/** Parse filterbank ID
+ *
+ *  This function copies filterbank ID (lowercase letters and
+ *  digits) at position \a pos into the \a id buffer. On success
+ *  \a pos is advanced past the ID.
+ *
+ *  \param buf Data buffer
+ *  \param buf_size Buffer size
+ *  \param pos Current position in the buffer
+ *  \param id Output buffer
+ *  \param id_size Output buffer size
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_FORMAT_ERROR
+ *  (empty or too long ID) */
+local int parse_id(unsigned char *buf, int buf_size, int *pos,
+                   char *id, int id_size);
+
+/** Get data checksum key
+ *
+ *  This function returns ASCII header key (with leading
+ *  separator) that stores data checksum of given type.
+ *
+ *  \param crc_type Checksum type
+ *
+ *  \return Key string */
+local char *crc_key(int crc_type);
+
+/** Parse data checksum key
+ *
+ *  This function matches any of the keys returned by
+ *  \ref crc_key and stores corresponding checksum type.
+ *  Position is advanced only on success.
+ *
+ *  \param buf Data buffer
+ *  \param buf_size Buffer size
+ *  \param pos Current position in the buffer
+ *  \param crc_type Checksum type
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_FORMAT_ERROR */
+local int parse_crc_key(unsigned char *buf, int buf_size, int *pos,
+                        int *crc_type);
+
+/** Compute data checksum
+ *
+ *  This function computes block data checksum using
+ *  algorithm specified by \a crc_type.
+ *
+ *  \param crc_type Either \ref EPS_CHECKSUM_CRC32 or
+ *  \ref EPS_CHECKSUM_CRC32C or \ref EPS_CHECKSUM_ADLER32
+ *  \param data Data to sum
+ *  \param length Data length
+ *
+ *  \return Checksum */
+local crc32_t data_checksum(int crc_type, unsigned char *data, int length);
+
+/** Write variable-width value
+ *
+ *  This function stores non-negative \a value in the binary
+ *  header using seven bits per byte. The value is biased by one,
+ *  so the resulting bytes are never equal to \ref EPS_MARKER.
+ *
+ *  \param buf Data buffer
+ *  \param value Value to store
+ *
+ *  \return Number of bytes written (at most five) */
+local int put_bin_value(unsigned char *buf, int value);
+
+/** Read variable-width value
  *
- *  This function replaces \a n_fields -th occurence of \c ;
- *  symbol with \c 0. In other words, this function zero-terminates
- *  header.
+ *  This function is inverse to the previous one. On success
+ *  \a pos is advanced past the value.
  *
  *  \param buf Data buffer
  *  \param buf_size Buffer size
- *  \param n_fields Number of header fields
+ *  \param pos Current position in the buffer
+ *  \param value Decoded value
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_FORMAT_ERROR */
+local int get_bin_value(unsigned char *buf, int buf_size, int *pos,
+                        int *value);
+
+/** Write fixed-width value
+ *
+ *  This function stores seven bits of \a value per byte
+ *  with the high bit set. Fixed width allows to update CRC
+ *  fields in place, e.g. after block truncation.
+ *
+ *  \param buf Data buffer
+ *  \param value Value to store
+ *  \param n_bytes Field width
+ *
+ *  \return \c VOID */
+local void put_bin_fixed(unsigned char *buf, crc32_t value, int n_bytes);
+
+/** Read fixed-width value
+ *
+ *  This function is inverse to the previous one.
+ *
+ *  \param buf Data buffer
+ *  \param n_bytes Field width
+ *  \param value Decoded value
  *
  *  \return Either \ref EPS_OK or \ref EPS_FORMAT_ERROR */
-local int terminate_header(unsigned char *buf, int buf_size, int n_fields);
+local int get_bin_fixed(unsigned char *buf, int n_bytes, crc32_t *value);
 
-/** Unterminate header
+/** Store data CRC
  *
- *  This function is inverse to the previous one. It
- *  replaces first occurence of \c 0 with \c ; symbol.
+ *  This function stores \a data_crc in the last header
+ *  field. Both ASCII and binary headers are supported.
  *
  *  \param buf Data buffer
+ *  \param hdr_size Header size
+ *  \param data_crc Data CRC
  *
  *  \return \c VOID */
-local void unterminate_header(unsigned char *buf);
+local void set_data_crc(unsigned char *buf, int hdr_size, crc32_t data_crc);
 
-/** Header sanity check
+/** Check header and data CRC
  *
- *  This function ensures that header contains only
- *  legal symbols.
+ *  This function computes header and data CRC and
+ *  sets \a hdr flags accordingly.
  *
  *  \param buf Data buffer
+ *  \param chk_len Number of header bytes covered by header CRC
+ *  \param hdr Block header
+ *
+ *  \return \c VOID */
+local void check_block_crc(unsigned char *buf, int chk_len,
+                           eps_block_header *hdr);
+
+/** Check GRAYSCALE header fields
+ *
+ *  This function checks parsed header fields for consistency
+ *  and sets filterbank ID. Unknown filterbank (\a fb = \c NULL)
+ *  is not an error here, it is reported by the decoder.
+ *
+ *  \param hdr Block header
+ *  \param fb Filterbank pointer
  *
  *  \return Either \ref EPS_OK or \ref EPS_FORMAT_ERROR */
-local int header_sanity_check(unsigned char *buf);
+local int check_gs_header(eps_block_header *hdr, filterbank_t *fb);
+
+/** Check TRUECOLOR header fields
+ *
+ *  This function checks parsed header fields for consistency
+ *  and sets filterbank ID. Unknown filterbank (\a fb = \c NULL)
+ *  is not an error here, it is reported by the decoder.
+ *
+ *  \param hdr Block header
+ *  \param fb Filterbank pointer
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_FORMAT_ERROR */
+local int check_tc_header(eps_block_header *hdr, filterbank_t *fb);
 
 /** Read GRAYSCALE header
  *
  *  This function reads and checks block header of type
- *  \ref EPS_GRAYSCALE_BLOCK. Result is stored in the \a hdr
- *  structure.
+ *  \ref EPS_GRAYSCALE_BLOCK. The header is parsed in a single
+ *  pass and the buffer is not modified. Result is stored in
+ *  the \a hdr structure.
  *
  *  \note Structure \a hdr is undefined unless function
  *  returns \ref EPS_OK.
@@ -173,8 +374,9 @@ local int read_gs_header(unsigned char *buf, int buf_size,
 /** Read TRUECOLOR header
  *
  *  This function reads and checks block header of type
- *  \ref EPS_TRUECOLOR_BLOCK. Result is stored in the \a hdr
- *  structure.
+ *  \ref EPS_TRUECOLOR_BLOCK. The header is parsed in a single
+ *  pass and the buffer is not modified. Result is stored in
+ *  the \a hdr structure.
  *
  *  \note Structure \a hdr is undefined unless function
  *  returns \ref EPS_OK.
@@ -188,6 +390,44 @@ local int read_gs_header(unsigned char *buf, int buf_size,
 local int read_tc_header(unsigned char *buf, int buf_size,
                          eps_block_header *hdr);
 
+/** Read binary header
+ *
+ *  This function reads and checks compact binary header of
+ *  any block type. The header consists of \ref EPS_BIN_MAGIC byte,
+ *  version, checksum and block type byte, variable-width fields in the same
+ *  order as in the ASCII header, filterbank index and fixed-width
+ *  header and data CRC. Result is stored in the \a hdr structure.
+ *
+ *  \note Structure \a hdr is undefined unless function
+ *  returns \ref EPS_OK.
+ *
+ *  \param buf Data buffer
+ *  \param buf_size Buffer size
+ *  \param hdr Block header
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_PARAM_ERROR
+ *  or \ref EPS_FORMAT_ERROR */
+local int read_bin_header(unsigned char *buf, int buf_size,
+                          eps_block_header *hdr);
+
+/** Locate block within caller's image
+ *
+ *  This function fills the \a pixmap for the \a w by \a h block
+ *  of the \a image channel \a k which starts at position (\a x,
+ *  \a y). The block should lie within the image.
+ *
+ *  \param image Image
+ *  \param k Channel number
+ *  \param x Block X coordinate
+ *  \param y Block Y coordinate
+ *  \param w Block width
+ *  \param h Block height
+ *  \param pixmap Block channel
+ *
+ *  \return Either \ref EPS_OK or \ref EPS_PARAM_ERROR */
+local int image_pixmap(eps_image *image, int k, int x, int y,
+                       int w, int h, pixmap_t *pixmap);
+
 /*@}*/
 
 #ifdef __cplusplus
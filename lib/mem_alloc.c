@@ -24,6 +24,7 @@
 
 #include <common.h>
 #include <mem_alloc.h>
+#include <string.h>
 
 void *xmalloc(size_t size)
 {
@@ -62,3 +63,103 @@ void free_2D(void **ptr, int width, int height)
 
     free(ptr);
 }
+
+workspace_t *alloc_workspace(void)
+{
+    workspace_t *ws;
+
+    ws = (workspace_t *) xmalloc(sizeof(workspace_t));
+    memset(ws, 0, sizeof(workspace_t));
+
+    return ws;
+}
+
+void free_workspace(workspace_t *ws)
+{
+    ws_slot *slot;
+    int i;
+
+    for (i = 0; i < WS_MAX_SLOTS; i++) {
+        slot = &ws->slots[i];
+
+        if (slot->ptr) {
+            assert(!slot->busy);
+            free_2D(slot->ptr, slot->width, slot->height);
+        }
+    }
+
+    free(ws);
+}
+
+void **ws_malloc_2D(workspace_t *ws, int width, int height, int size)
+{
+    ws_slot *slot;
+    ws_slot *unused;
+    ws_slot *idle;
+    int i;
+
+    if (!ws) {
+        return malloc_2D(width, height, size);
+    }
+
+    unused = idle = NULL;
+
+    /* Look for an idle array of the same geometry */
+    for (i = 0; i < WS_MAX_SLOTS; i++) {
+        slot = &ws->slots[i];
+
+        if (!slot->ptr) {
+            unused = slot;
+        } else if (!slot->busy) {
+            if ((slot->width == width) && (slot->height == height) &&
+                (slot->size == size))
+            {
+                slot->busy = 1;
+                return slot->ptr;
+            }
+
+            idle = slot;
+        }
+    }
+
+    /* Evict an idle array of different geometry if workspace is full */
+    if (!unused && idle) {
+        free_2D(idle->ptr, idle->width, idle->height);
+        idle->ptr = NULL;
+        unused = idle;
+    }
+
+    /* All slots are busy: fall back to plain allocation */
+    if (!unused) {
+        return malloc_2D(width, height, size);
+    }
+
+    unused->ptr = malloc_2D(width, height, size);
+    unused->width = width;
+    unused->height = height;
+    unused->size = size;
+    unused->busy = 1;
+
+    return unused->ptr;
+}
+
+void ws_free_2D(workspace_t *ws, void **ptr, int width, int height)
+{
+    ws_slot *slot;
+    int i;
+
+    if (ws) {
+        for (i = 0; i < WS_MAX_SLOTS; i++) {
+            slot = &ws->slots[i];
+
+            if (slot->ptr == ptr) {
+                assert(slot->busy);
+                assert((slot->width == width) && (slot->height == height));
+                slot->busy = 0;
+                return;
+            }
+        }
+    }
+
+    free_2D(ptr, width, height);
+}
@@ -77,6 +77,82 @@ void **malloc_2D(int width, int height, int size);
  *  \return \c VOID */
 void free_2D(void **ptr, int width, int height);
 
+/** Maximal number of arrays kept by a workspace */
+#define WS_MAX_SLOTS            32
+
+/** Workspace slot
+ *
+ *  This structure describes a cached two-dimensional array. */
+typedef struct ws_slot_tag {
+    /** Array pointer or \c NULL for unused slot */
+    void **ptr;
+    /** Array width */
+    int width;
+    /** Array height */
+    int height;
+    /** Element size */
+    int size;
+    /** Array is currently in use */
+    int busy;
+} ws_slot;
+
+/** Workspace
+ *
+ *  Workspace caches two-dimensional arrays between calls, so
+ *  that processing of a series of similar blocks does not hit
+ *  memory allocator. Workspace is not thread-safe: each thread
+ *  should use its own one. */
+typedef struct workspace_tag {
+    /** Cached arrays */
+    ws_slot slots[WS_MAX_SLOTS];
+} workspace_t;
+
+/** Allocate new workspace
+ *
+ *  This function allocates new empty workspace.
+ *
+ *  \return Workspace pointer */
+workspace_t *alloc_workspace(void);
+
+/** Release workspace
+ *
+ *  This function releases workspace with all cached arrays.
+ *  All arrays should be returned to the workspace beforehand.
+ *
+ *  \param ws Workspace pointer
+ *
+ *  \return \c VOID */
+void free_workspace(workspace_t *ws);
+
+/** Two-dimensional memory allocation from workspace
+ *
+ *  This function works like #malloc_2D, but reuses an idle array
+ *  of the same geometry from workspace \a ws, if any. Contents of
+ *  the array is undefined. If \a ws is \c NULL, this function is
+ *  equivalent to #malloc_2D.
+ *
+ *  \param ws Workspace pointer
+ *  \param width Array width
+ *  \param height Array height
+ *  \param size Element size
+ *
+ *  \return Array pointer */
+void **ws_malloc_2D(workspace_t *ws, int width, int height, int size);
+
+/** Two-dimensional memory releasing to workspace
+ *
+ *  This function returns array allocated by #ws_malloc_2D back
+ *  to workspace \a ws. Arrays unknown to the workspace are
+ *  released by #free_2D.
+ *
+ *  \param ws Workspace pointer
+ *  \param ptr Array pointer
+ *  \param width Array width
+ *  \param height Array height
+ *
+ *  \return \c VOID */
+void ws_free_2D(workspace_t *ws, void **ptr, int width, int height);
+
 /*@}*/
 
 #ifdef __cplusplus
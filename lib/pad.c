@@ -26,11 +26,13 @@
 #include <pad.h>
 #include <color.h>
 
-void extend_channel(unsigned char **input_channel,
+void extend_channel(pixmap_t *input_channel,
                     coeff_t **output_channel,
                     int input_width, int input_height,
                     int output_width, int output_height)
 {
+    unsigned char *row;
+    int step = input_channel->step;
     int i, j;
 
     /* Sanity checks */
@@ -41,33 +43,52 @@ void extend_channel(unsigned char **input_channel,
 
     /* Copy original */
     for (i = 0; i < input_height; i++) {
+        row = PIXMAP_ROW(input_channel, i);
+
         for (j = 0; j < input_width; j++) {
-            output_channel[i][j] = input_channel[i][j];
+            output_channel[i][j] = row[j * step];
         }
     }
 
+    mirror_channel(output_channel, input_width, input_height,
+                   output_width, output_height);
+}
+
+void mirror_channel(coeff_t **channel,
+                    int input_width, int input_height,
+                    int output_width, int output_height)
+{
+    int i, j;
+
+    /* Sanity checks */
+    assert((input_width > 0) && (input_height > 0));
+    assert(output_width >= input_width);
+    assert(output_height >= input_height);
+
     /* Fill horizontally */
     for (i = 0; i < input_height; i++) {
         for (j = 0; j < output_width - input_width; j++) {
-            output_channel[i][input_width + j] =
-                output_channel[i][ABS(input_width - j - 1)];
+            channel[i][input_width + j] =
+                channel[i][ABS(input_width - j - 1)];
         }
     }
 
     /* Fill vertically */
     for (j = 0; j < output_width; j++) {
         for (i = 0; i < output_height - input_height; i++) {
-            output_channel[i + input_height][j] =
-                output_channel[ABS(input_height - i - 1)][j];
+            channel[i + input_height][j] =
+                channel[ABS(input_height - i - 1)][j];
         }
     }
 }
 
 void extract_channel(coeff_t **input_channel,
-                     unsigned char **output_channel,
+                     pixmap_t *output_channel,
                      int input_width, int input_height,
                      int output_width, int output_height)
 {
+    unsigned char *row;
+    int step = output_channel->step;
     int i, j;
 
     /* Sanity checks */
@@ -78,8 +99,10 @@ void extract_channel(coeff_t **input_channel,
 
     /* Extract & clip original data */
     for (i = 0; i < output_height; i++) {
+        row = PIXMAP_ROW(output_channel, i);
+
         for (j = 0; j < output_width; j++) {
-            output_channel[i][j] = CLIP(input_channel[i][j]);
+            row[j * step] = CLIP(input_channel[i][j]);
         }
     }
 }
@@ -62,11 +62,28 @@ extern "C" {
  *  \param output_height Output channel height
  *
  *  \return \c VOID */
-void extend_channel(unsigned char **input_channel,
+void extend_channel(pixmap_t *input_channel,
                     coeff_t **output_channel,
                     int input_width, int input_height,
                     int output_width, int output_height);
 
+/** In-place channel extension
+ *
+ *  This function fills the \a channel outside of the top-left
+ *  \a input_width by \a input_height area using the same
+ *  mirroring operation as \ref extend_channel.
+ *
+ *  \param channel Channel
+ *  \param input_width Input area width
+ *  \param input_height Input area height
+ *  \param output_width Channel width
+ *  \param output_height Channel height
+ *
+ *  \return \c VOID */
+void mirror_channel(coeff_t **channel,
+                    int input_width, int input_height,
+                    int output_width, int output_height);
+
 /** Channel extraction
  *
  *  This function extracts a block of pixels from the
@@ -84,7 +101,7 @@ void extend_channel(unsigned char **input_channel,
  *
  *  \return \c VOID */
 void extract_channel(coeff_t **input_channel,
-                     unsigned char **output_channel,
+                     pixmap_t *output_channel,
                      int input_width, int input_height,
                      int output_width, int output_height);
 
@@ -0,0 +1,337 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006,2007,2010 Alexander Simakov, <xander@entropyware.info>
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <common.h>
+#include <pool.h>
+
+local void run_job(workspace_t *ws, eps_job *job)
+{
+    pixmap_t block[3];
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        pixmap_from_rows(&block[k], job->block[k]);
+    }
+
+    switch (job->type) {
+        case EPS_JOB_ENCODE_GS:
+        {
+            job->rc = encode_grayscale_block(ws, &block[0],
+                                             job->W, job->H, job->w, job->h,
+                                             job->x, job->y,
+                                             job->buf, &job->buf_size,
+                                             job->fb_id, job->mode,
+                                             job->flags, job->rd);
+            break;
+        }
+
+        case EPS_JOB_ENCODE_TC:
+        {
+            job->rc = encode_truecolor_block(ws, &block[0],
+                                             &block[1], &block[2],
+                                             job->W, job->H, job->w, job->h,
+                                             job->x, job->y, job->resample,
+                                             job->buf, &job->buf_size,
+                                             job->Y_rt, job->Cb_rt, job->Cr_rt,
+                                             job->fb_id, job->mode,
+                                             job->flags, job->rd);
+            break;
+        }
+
+        case EPS_JOB_DECODE:
+        {
+            if (job->hdr.block_type == EPS_GRAYSCALE_BLOCK) {
+                job->rc = decode_grayscale_block(ws, &block[0],
+                                                 job->buf, &job->hdr);
+            } else {
+                job->rc = decode_truecolor_block(ws, &block[0],
+                                                 &block[1], &block[2],
+                                                 job->buf, &job->hdr);
+            }
+            break;
+        }
+
+        default:
+        {
+            assert(0);
+            break;
+        }
+    }
+}
+
+local void complete_job(eps_pool *pool, list_node *node)
+{
+    eps_job *job = *((eps_job **) node->data);
+    void (*callback)(eps_job *job) = job->callback;
+
+    /* Callback is finished before the job is counted as completed.
+     * The job is not touched afterwards: callback may reuse it. */
+    if (callback) {
+        callback(job);
+    }
+
+    POOL_LOCK(pool->lock);
+
+    /* Queue node is reused for the list of completed jobs */
+    if (callback) {
+        free_list_node(node);
+    } else {
+        append_list_node(pool->done, node);
+    }
+
+    pool->n_pending--;
+
+#ifdef ENABLE_PTHREADS
+    pthread_cond_broadcast(&pool->job_done);
+#endif
+
+    POOL_UNLOCK(pool->lock);
+}
+
+#ifdef ENABLE_PTHREADS
+
+local void *pool_worker(void *arg)
+{
+    eps_pool *pool = (eps_pool *) arg;
+    workspace_t *ws;
+    list_node *node;
+
+    ws = alloc_workspace();
+
+    for (;;) {
+        POOL_LOCK(pool->lock);
+
+        while (LIST_IS_EMPTY(pool->queue) && !pool->shutdown) {
+            pthread_cond_wait(&pool->job_queued, &pool->lock);
+        }
+
+        /* Queue is drained before shutdown */
+        if (LIST_IS_EMPTY(pool->queue)) {
+            POOL_UNLOCK(pool->lock);
+            break;
+        }
+
+        node = pool->queue->first;
+        remove_list_node_link(pool->queue, node);
+
+        POOL_UNLOCK(pool->lock);
+
+        run_job(ws, *((eps_job **) node->data));
+        complete_job(pool, node);
+    }
+
+    free_workspace(ws);
+
+    return NULL;
+}
+
+#endif /* ENABLE_PTHREADS */
+
+eps_pool *eps_pool_create(int n_threads)
+{
+    eps_pool *pool;
+#ifdef ENABLE_PTHREADS
+    int i;
+#endif
+
+    if (n_threads < 1) {
+        return NULL;
+    }
+
+    pool = (eps_pool *) xmalloc(sizeof(eps_pool));
+
+    pool->queue = alloc_linked_list();
+    pool->done = alloc_linked_list();
+    pool->n_pending = 0;
+    pool->shutdown = 0;
+
+#ifdef ENABLE_PTHREADS
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_queued, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+
+    pool->threads = (pthread_t *) xmalloc(n_threads * sizeof(pthread_t));
+
+    for (i = 0; i < n_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool)) {
+            break;
+        }
+    }
+
+    /* Run with fewer threads if some of them can not be created */
+    if (i == 0) {
+        pool->n_threads = 0;
+        eps_pool_destroy(pool);
+        return NULL;
+    }
+
+    pool->n_threads = i;
+#else
+    pool->ws = alloc_workspace();
+    pool->n_threads = 0;
+#endif
+
+    return pool;
+}
+
+int eps_pool_threads(eps_pool *pool)
+{
+    if (!pool) {
+        return 0;
+    }
+
+    return pool->n_threads;
+}
+
+int eps_pool_submit(eps_pool *pool, eps_job *job)
+{
+    list_node *node;
+
+    /* Sanity checks */
+    if (!pool || !job) {
+        return EPS_PARAM_ERROR;
+    }
+
+    if ((job->type != EPS_JOB_ENCODE_GS) &&
+        (job->type != EPS_JOB_ENCODE_TC) &&
+        (job->type != EPS_JOB_DECODE))
+    {
+        return EPS_PARAM_ERROR;
+    }
+
+    if ((job->type == EPS_JOB_DECODE) &&
+        (job->hdr.block_type != EPS_GRAYSCALE_BLOCK) &&
+        (job->hdr.block_type != EPS_TRUECOLOR_BLOCK))
+    {
+        return EPS_PARAM_ERROR;
+    }
+
+    node = alloc_list_node(sizeof(eps_job *));
+    *((eps_job **) node->data) = job;
+
+#ifdef ENABLE_PTHREADS
+    POOL_LOCK(pool->lock);
+
+    append_list_node(pool->queue, node);
+    pool->n_pending++;
+
+    pthread_cond_signal(&pool->job_queued);
+
+    POOL_UNLOCK(pool->lock);
+#else
+    /* No threads: process the job right away */
+    pool->n_pending++;
+
+    run_job(pool->ws, job);
+    complete_job(pool, node);
+#endif
+
+    return EPS_OK;
+}
+
+eps_job *eps_pool_poll(eps_pool *pool, int block)
+{
+    list_node *node;
+    eps_job *job;
+
+    if (!pool) {
+        return NULL;
+    }
+
+    POOL_LOCK(pool->lock);
+
+    /* Without threads jobs are completed inside eps_pool_submit,
+     * so nothing is ever pending here */
+    while (block && LIST_IS_EMPTY(pool->done) && pool->n_pending) {
+        POOL_WAIT(pool->job_done, pool->lock);
+    }
+
+    if (LIST_IS_EMPTY(pool->done)) {
+        job = NULL;
+    } else {
+        node = pool->done->first;
+        job = *((eps_job **) node->data);
+        remove_list_node(pool->done, node);
+    }
+
+    POOL_UNLOCK(pool->lock);
+
+    return job;
+}
+
+int eps_pool_wait(eps_pool *pool)
+{
+    if (!pool) {
+        return EPS_PARAM_ERROR;
+    }
+
+    POOL_LOCK(pool->lock);
+
+    while (pool->n_pending) {
+        POOL_WAIT(pool->job_done, pool->lock);
+    }
+
+    POOL_UNLOCK(pool->lock);
+
+    return EPS_OK;
+}
+
+void eps_pool_destroy(eps_pool *pool)
+{
+#ifdef ENABLE_PTHREADS
+    int i;
+#endif
+
+    if (!pool) {
+        return;
+    }
+
+#ifdef ENABLE_PTHREADS
+    /* Let workers drain the queue and exit */
+    POOL_LOCK(pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->job_queued);
+    POOL_UNLOCK(pool->lock);
+
+    for (i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->job_done);
+    pthread_cond_destroy(&pool->job_queued);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->threads);
+#else
+    free_workspace(pool->ws);
+#endif
+
+    free_linked_list(pool->queue);
+    free_linked_list(pool->done);
+    free(pool);
+}
@@ -0,0 +1,189 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006,2007,2010 Alexander Simakov, <xander@entropyware.info>
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+/** \file
+ *
+ *  \brief Worker pool
+ *
+ *  This file contains worker pool for batch block processing.
+ *  Jobs are taken from a shared queue by worker threads; each
+ *  thread uses its own workspace (see #workspace_t), so that
+ *  temporary arrays are reused between jobs. */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup pool Worker pool */
+/*@{*/
+
+#include <common.h>
+#include <epsilon.h>
+#include <mem_alloc.h>
+#include <list.h>
+
+#ifdef ENABLE_PTHREADS
+# include <pthread.h>
+# define POOL_LOCK(_x)          pthread_mutex_lock(&_x)
+# define POOL_UNLOCK(_x)        pthread_mutex_unlock(&_x)
+# define POOL_WAIT(_c, _x)      pthread_cond_wait(&_c, &_x)
+#else
+# define POOL_LOCK(_x)
+# define POOL_UNLOCK(_x)
+# define POOL_WAIT(_c, _x)
+#endif
+
+/** Worker pool structure
+ *
+ *  This structure represents a worker pool. Both job
+ *  lists hold pointers to #eps_job structures. */
+struct eps_pool_tag {
+#ifdef ENABLE_PTHREADS
+    /** Worker threads */
+    pthread_t *threads;
+    /** Pool lock */
+    pthread_mutex_t lock;
+    /** Signaled when a job is queued or pool is shut down */
+    pthread_cond_t job_queued;
+    /** Signaled when a job is completed */
+    pthread_cond_t job_done;
+#else
+    /** Workspace of the calling thread */
+    workspace_t *ws;
+#endif
+    /** Number of worker threads */
+    int n_threads;
+    /** Jobs waiting for a worker */
+    linked_list *queue;
+    /** Completed jobs without callback */
+    linked_list *done;
+    /** Number of submitted but not yet completed jobs */
+    int n_pending;
+    /** Pool is shutting down */
+    int shutdown;
+};
+
+/** Encode a GRAYSCALE block using workspace
+ *
+ *  Same as \ref eps_encode_grayscale_block_rd, but temporary
+ *  arrays are taken from workspace \a ws (may be \c NULL),
+ *  block channels are given as #pixmap_t and \a rd is optional.
+ *  Implemented in libmain.c.
+ *
+ *  \return Same as \ref eps_encode_grayscale_block */
+int encode_grayscale_block(workspace_t *ws, pixmap_t *block,
+                           int W, int H, int w, int h, int x, int y,
+                           unsigned char *buf, int *buf_size,
+                           char *fb_id, int mode, int flags,
+                           eps_rd_info *rd);
+
+/** Encode a TRUECOLOR block using workspace
+ *
+ *  Same as \ref eps_encode_truecolor_block_rd, but temporary
+ *  arrays are taken from workspace \a ws (may be \c NULL),
+ *  block channels are given as #pixmap_t and \a rd is optional.
+ *  Implemented in libmain.c.
+ *
+ *  \return Same as \ref eps_encode_truecolor_block */
+int encode_truecolor_block(workspace_t *ws, pixmap_t *block_R,
+                           pixmap_t *block_G,
+                           pixmap_t *block_B,
+                           int W, int H, int w, int h,
+                           int x, int y, int resample,
+                           unsigned char *buf, int *buf_size,
+                           int Y_rt, int Cb_rt, int Cr_rt,
+                           char *fb_id, int mode, int flags,
+                           eps_rd_info *rd);
+
+/** Decode a GRAYSCALE block using workspace
+ *
+ *  Same as \ref eps_decode_grayscale_block, but temporary
+ *  arrays are taken from workspace \a ws (may be \c NULL)
+ *  and block channels are given as #pixmap_t.
+ *  Implemented in libmain.c.
+ *
+ *  \return Same as \ref eps_decode_grayscale_block */
+int decode_grayscale_block(workspace_t *ws, pixmap_t *block,
+                           unsigned char *buf, eps_block_header *hdr);
+
+/** Decode a TRUECOLOR block using workspace
+ *
+ *  Same as \ref eps_decode_truecolor_block, but temporary
+ *  arrays are taken from workspace \a ws (may be \c NULL)
+ *  and block channels are given as #pixmap_t.
+ *  Implemented in libmain.c.
+ *
+ *  \return Same as \ref eps_decode_truecolor_block */
+int decode_truecolor_block(workspace_t *ws, pixmap_t *block_R,
+                           pixmap_t *block_G,
+                           pixmap_t *block_B,
+                           unsigned char *buf,
+                           eps_block_header *hdr);
+
+/** Run a job
+ *
+ *  This function processes a single \a job using workspace
+ *  \a ws and stores result code in the job.
+ *
+ *  \param ws Workspace pointer
+ *  \param job Job to process
+ *
+ *  \return \c VOID */
+local void run_job(workspace_t *ws, eps_job *job);
+
+/** Complete a job
+ *
+ *  This function runs job callback (if any) and updates
+ *  pool state. Pool lock should not be held by the caller.
+ *
+ *  \param pool Pool pointer
+ *  \param node Unlinked queue node of the completed job
+ *
+ *  \return \c VOID */
+local void complete_job(eps_pool *pool, list_node *node);
+
+#ifdef ENABLE_PTHREADS
+
+/** Worker thread
+ *
+ *  This function takes jobs from the pool queue and
+ *  processes them until the pool is shut down.
+ *
+ *  \param arg Pool pointer
+ *
+ *  \return \c NULL */
+local void *pool_worker(void *arg);
+
+#endif
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __POOL_H__ */
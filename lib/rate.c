@@ -0,0 +1,277 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006,2007,2010 Alexander Simakov, <xander@entropyware.info>
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+#include <common.h>
+#include <rate.h>
+#include <mem_alloc.h>
+
+local double channel_dist(speck_rd *ch_rd, double bytes)
+{
+    int k;
+
+    for (k = 1; k < ch_rd->n_points; k++) {
+        if (bytes <= ch_rd->bytes[k]) {
+            int span = ch_rd->bytes[k] - ch_rd->bytes[k - 1];
+
+            if (span <= 0) {
+                return ch_rd->dist[k];
+            }
+
+            return ch_rd->dist[k - 1] +
+                (ch_rd->dist[k] - ch_rd->dist[k - 1]) *
+                (bytes - ch_rd->bytes[k - 1]) / span;
+        }
+    }
+
+    return ch_rd->dist[ch_rd->n_points - 1];
+}
+
+local double block_dist(eps_rd_info *rd, int size)
+{
+    int k;
+
+    for (k = 1; k < rd->n_points; k++) {
+        if (size <= rd->size[k]) {
+            int span = rd->size[k] - rd->size[k - 1];
+
+            if (span <= 0) {
+                return rd->dist[k];
+            }
+
+            return rd->dist[k - 1] +
+                (rd->dist[k] - rd->dist[k - 1]) *
+                (size - rd->size[k - 1]) / span;
+        }
+    }
+
+    return rd->dist[rd->n_points - 1];
+}
+
+local int block_hull(eps_rd_info *rd, int block, int base, rd_segment *seg)
+{
+    int hull_size[EPS_MAX_RD_POINTS + 1];
+    double hull_dist[EPS_MAX_RD_POINTS + 1];
+    int n_hull;
+    int k;
+
+    /* Hull starts at the minimal block size */
+    hull_size[0] = base;
+    hull_dist[0] = block_dist(rd, base);
+    n_hull = 1;
+
+    for (k = 0; k < rd->n_points; k++) {
+        int size = rd->size[k];
+        double dist = rd->dist[k];
+
+        if (size <= hull_size[n_hull - 1]) {
+            continue;
+        }
+
+        /* Drop points that make the hull concave */
+        while (n_hull > 1) {
+            double s0 = (hull_dist[n_hull - 2] - hull_dist[n_hull - 1]) /
+                (hull_size[n_hull - 1] - hull_size[n_hull - 2]);
+            double s1 = (hull_dist[n_hull - 1] - dist) /
+                (size - hull_size[n_hull - 1]);
+
+            if (s0 > s1) {
+                break;
+            }
+
+            n_hull--;
+        }
+
+        hull_size[n_hull] = size;
+        hull_dist[n_hull] = dist;
+        n_hull++;
+    }
+
+    /* Convert hull into segments */
+    for (k = 1; k < n_hull; k++) {
+        seg[k - 1].block = block;
+        seg[k - 1].size = hull_size[k];
+        seg[k - 1].slope = (hull_dist[k - 1] - hull_dist[k]) /
+            (hull_size[k] - hull_size[k - 1]);
+    }
+
+    return n_hull - 1;
+}
+
+local int compare_segments(const void *a, const void *b)
+{
+    double slope_a = ((rd_segment *) a)->slope;
+    double slope_b = ((rd_segment *) b)->slope;
+
+    if (slope_a > slope_b) {
+        return -1;
+    } else if (slope_a < slope_b) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+void build_rd_info(eps_rd_info *rd, speck_rd *ch_rd, double *weight,
+                   int *ch_bytes, int n_channels, int hdr_size,
+                   int stuff_bytes, int stuff_cut)
+{
+    double frac[EPS_MAX_RD_POINTS];
+    double max_frac;
+    int n_frac;
+    int c, i, k;
+
+    /* Stream may be cut by the buffer end */
+    max_frac = (double) stuff_cut / stuff_bytes;
+
+    /* Map channel points to fractions of the merged stream */
+    n_frac = 0;
+    frac[n_frac++] = max_frac;
+
+    for (c = 0; c < n_channels; c++) {
+        for (k = 0; k < ch_rd[c].n_points; k++) {
+            double f = (double) ch_rd[c].bytes[k] / ch_bytes[c];
+
+            if (f < max_frac) {
+                assert(n_frac < EPS_MAX_RD_POINTS);
+                frac[n_frac++] = f;
+            }
+        }
+    }
+
+    /* Insertion sort, there are just a few dozens of points */
+    for (i = 1; i < n_frac; i++) {
+        double f = frac[i];
+
+        for (k = i; (k > 0) && (frac[k - 1] > f); k--) {
+            frac[k] = frac[k - 1];
+        }
+
+        frac[k] = f;
+    }
+
+    rd->n_points = 0;
+
+    for (i = 0; i < n_frac; i++) {
+        int size = hdr_size + (int) (frac[i] * stuff_bytes + 0.5);
+        double dist = 0.0;
+
+        for (c = 0; c < n_channels; c++) {
+            dist += weight[c] * channel_dist(&ch_rd[c],
+                frac[i] * ch_bytes[c]);
+        }
+
+        /* Points are sorted, so the later one is better */
+        if (rd->n_points && (rd->size[rd->n_points - 1] == size)) {
+            rd->dist[rd->n_points - 1] = dist;
+            continue;
+        }
+
+        rd->size[rd->n_points] = size;
+        rd->dist[rd->n_points] = dist;
+        rd->n_points++;
+    }
+}
+
+int eps_allocate_rate(eps_rd_info *rd, int n_blocks, double budget,
+                      int *sizes)
+{
+    rd_segment *seg;
+    double bytes_left;
+    double alloc_dist;
+    double uniform_dist;
+    int *uniform;
+    int n_seg;
+    int i;
+
+    /* Sanity checks */
+    if (!rd || !sizes || (n_blocks < 1)) {
+        return EPS_PARAM_ERROR;
+    }
+
+    for (i = 0; i < n_blocks; i++) {
+        if ((rd[i].n_points < 1) || (rd[i].n_points > EPS_MAX_RD_POINTS)) {
+            return EPS_PARAM_ERROR;
+        }
+    }
+
+    seg = (rd_segment *) xmalloc(n_blocks * EPS_MAX_RD_POINTS *
+        sizeof(rd_segment));
+
+    bytes_left = budget;
+    n_seg = 0;
+
+    /* Every block gets minimal size first */
+    for (i = 0; i < n_blocks; i++) {
+        sizes[i] = MIN(MAX(EPS_MIN_GRAYSCALE_BUF, EPS_MIN_TRUECOLOR_BUF),
+                       rd[i].size[rd[i].n_points - 1]);
+
+        n_seg += block_hull(&rd[i], i, sizes[i], seg + n_seg);
+        bytes_left -= sizes[i];
+    }
+
+    /* Segments of each block have decreasing slopes, so they
+     * are taken in order. The last one is taken partially to
+     * hit the budget exactly. */
+    qsort(seg, n_seg, sizeof(rd_segment), compare_segments);
+
+    for (i = 0; (i < n_seg) && (bytes_left >= 1.0); i++) {
+        int grow = seg[i].size - sizes[seg[i].block];
+
+        if (grow > bytes_left) {
+            grow = (int) bytes_left;
+        }
+
+        sizes[seg[i].block] += grow;
+        bytes_left -= grow;
+    }
+
+    free(seg);
+
+    /* Hull points are interpolated, so the allocation is only as
+     * good as the curves are. Fall back to the uniform budget of
+     * the CBR encoder unless the allocation promises to beat it. */
+    uniform = (int *) xmalloc(n_blocks * sizeof(int));
+    alloc_dist = uniform_dist = 0.0;
+
+    for (i = 0; i < n_blocks; i++) {
+        int full_size = rd[i].size[rd[i].n_points - 1];
+        int share = (int) (budget / n_blocks);
+
+        uniform[i] = MIN(full_size, MAX(share,
+            MAX(EPS_MIN_GRAYSCALE_BUF, EPS_MIN_TRUECOLOR_BUF)));
+
+        alloc_dist += block_dist(&rd[i], sizes[i]);
+        uniform_dist += block_dist(&rd[i], uniform[i]);
+    }
+
+    if (alloc_dist >= uniform_dist) {
+        for (i = 0; i < n_blocks; i++) {
+            sizes[i] = uniform[i];
+        }
+    }
+
+    free(uniform);
+
+    return EPS_OK;
+}
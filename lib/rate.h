@@ -0,0 +1,137 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006,2007,2010 Alexander Simakov, <xander@entropyware.info>
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+/** \file
+ *
+ *  \brief Rate allocation
+ *
+ *  Blocks are encoded independently, so uniform bit-budget
+ *  wastes bytes on flat blocks and starves detailed ones.
+ *  This file implements post-compression rate-distortion
+ *  optimization: the encoder reports reconstruction error at
+ *  each bit plane, and the whole set of blocks is truncated at
+ *  points of equal slope on their rate-distortion curves. */
+
+#ifndef __RATE_H__
+#define __RATE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup rate Rate allocation */
+/*@{*/
+
+#include <common.h>
+#include <epsilon.h>
+#include <speck.h>
+
+/** Truncation segment
+ *
+ *  This structure represents a segment on the convex
+ *  hull of the block rate-distortion curve. */
+typedef struct rd_segment_tag {
+    /** Block index */
+    int block;
+    /** Block size at the end of the segment */
+    int size;
+    /** Distortion decrease per byte */
+    double slope;
+} rd_segment;
+
+/** Interpolate channel distortion
+ *
+ *  This function computes distortion of the channel truncated
+ *  at \a bytes using linear interpolation between points.
+ *
+ *  \param ch_rd Channel rate-distortion points
+ *  \param bytes Number of bytes
+ *
+ *  \return Estimated distortion */
+local double channel_dist(speck_rd *ch_rd, double bytes);
+
+/** Interpolate block distortion
+ *
+ *  This function computes distortion of the block truncated
+ *  at \a size bytes using linear interpolation between points.
+ *
+ *  \param rd Block rate-distortion curve
+ *  \param size Block size
+ *
+ *  \return Estimated distortion */
+local double block_dist(eps_rd_info *rd, int size);
+
+/** Build block convex hull
+ *
+ *  This function computes lower convex hull of the block
+ *  curve \a rd starting at \a base bytes and stores its
+ *  segments in the \a seg array.
+ *
+ *  \param rd Block rate-distortion curve
+ *  \param block Block index
+ *  \param base Minimal block size
+ *  \param seg Array of segments
+ *
+ *  \return Number of segments */
+local int block_hull(eps_rd_info *rd, int block, int base, rd_segment *seg);
+
+/** Compare segments
+ *
+ *  This function sorts segments by slope in descending order.
+ *
+ *  \param a First segment
+ *  \param b Second segment
+ *
+ *  \return Standard \c qsort comparison result */
+local int compare_segments(const void *a, const void *b);
+
+/** Build block rate-distortion curve
+ *
+ *  This function combines rate-distortion points of \a n_channels
+ *  SPECK channels into the curve of the whole block. Channels are
+ *  merged proportionally (see \ref merge_channels), so the block
+ *  truncated to some fraction of its data keeps the same fraction
+ *  of each channel.
+ *
+ *  \param rd Block rate-distortion curve
+ *  \param ch_rd Array of channel rate-distortion points
+ *  \param weight Array of channel distortion weights
+ *  \param ch_bytes Array of channel sizes
+ *  \param n_channels Number of channels
+ *  \param hdr_size Block header size
+ *  \param stuff_bytes Stuffed data size
+ *  \param stuff_cut Stuffed data size actually stored in the block
+ *
+ *  \return \c VOID */
+void build_rd_info(eps_rd_info *rd, speck_rd *ch_rd, double *weight,
+                   int *ch_bytes, int n_channels, int hdr_size,
+                   int stuff_bytes, int stuff_cut);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RATE_H__ */
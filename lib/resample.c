@@ -24,54 +24,261 @@
 
 #include <common.h>
 #include <resample.h>
+#include <mem_alloc.h>
+
+/* SSE2 is part of the x86-64 baseline, so no runtime check is
+ * needed. All kernels evaluate expressions in the same order as
+ * their scalar counterparts. */
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+# define RESAMPLE_SSE2
+# include <emmintrin.h>
+#endif
+
+/* Compute source positions for one axis. The mapping aligns the
+ * first and the last samples of both grids. */
+local void axis_weights(int input_size, int output_size,
+                        int *index, double *weight)
+{
+    double tmp;
+    int i, l;
+
+    for (i = 0; i < output_size; i++) {
+        tmp = (double) (input_size - 1) *
+            ((double) i / (double) (output_size - 1));
+
+        l = (int) tmp;
+
+        if (l < 0) {
+            l = 0;
+        } else if (l >= input_size - 1) {
+            l = input_size - 2;
+        }
+
+        index[i] = l;
+        weight[i] = tmp - (double) l;
+    }
+}
+
+/* Exact 2:1 decimation: every output sample hits an input sample */
+local void downsample_2to1(coeff_t **input_channel, coeff_t **output_channel,
+                           int output_width, int output_height)
+{
+    coeff_t *in, *out;
+    int i, j;
+
+    for (i = 0; i < output_height; i++) {
+        in = input_channel[2 * i];
+        out = output_channel[i];
+        j = 0;
+
+#ifdef RESAMPLE_SSE2
+        for (; j + 2 <= output_width - 1; j += 2) {
+            __m128d a = _mm_loadu_pd(in + 2 * j);
+            __m128d b = _mm_loadu_pd(in + 2 * j + 2);
+
+            _mm_storeu_pd(out + j, _mm_unpacklo_pd(a, b));
+        }
+#endif
+
+        for (; j < output_width; j++) {
+            out[j] = in[2 * j];
+        }
+    }
+}
+
+/* Exact 1:2 interpolation of a single row: even samples are copied,
+ * odd samples are placed half-way between their neighbours. */
+local void upsample_row(coeff_t *in, coeff_t *out, int input_width)
+{
+    int j = 0;
+
+#ifdef RESAMPLE_SSE2
+    __m128d half = _mm_set1_pd(0.5);
+
+    for (; j + 2 < input_width; j += 2) {
+        __m128d a = _mm_loadu_pd(in + j);
+        __m128d c = _mm_loadu_pd(in + j + 1);
+        __m128d m = _mm_add_pd(_mm_mul_pd(a, half), _mm_mul_pd(c, half));
+
+        _mm_storeu_pd(out + 2 * j, _mm_unpacklo_pd(a, m));
+        _mm_storeu_pd(out + 2 * j + 2, _mm_unpackhi_pd(a, m));
+    }
+#endif
+
+    for (; j < input_width - 1; j++) {
+        out[2 * j] = in[j];
+        out[2 * j + 1] = in[j] * 0.5 + in[j + 1] * 0.5;
+    }
+
+    out[2 * j] = in[j];
+}
+
+/* Exact 1:2 interpolation of a row lying half-way between two
+ * input rows */
+local void upsample_mid_row(coeff_t *in0, coeff_t *in1, coeff_t *out,
+                            int input_width)
+{
+    int j = 0;
+
+#ifdef RESAMPLE_SSE2
+    __m128d half = _mm_set1_pd(0.5);
+    __m128d quarter = _mm_set1_pd(0.25);
+
+    for (; j + 2 < input_width; j += 2) {
+        __m128d a = _mm_loadu_pd(in0 + j);
+        __m128d b = _mm_loadu_pd(in1 + j);
+        __m128d c = _mm_loadu_pd(in0 + j + 1);
+        __m128d d = _mm_loadu_pd(in1 + j + 1);
+        __m128d e, m;
+
+        e = _mm_add_pd(_mm_mul_pd(a, half), _mm_mul_pd(b, half));
+        m = _mm_add_pd(_mm_mul_pd(a, quarter), _mm_mul_pd(b, quarter));
+        m = _mm_add_pd(m, _mm_mul_pd(c, quarter));
+        m = _mm_add_pd(m, _mm_mul_pd(d, quarter));
+
+        _mm_storeu_pd(out + 2 * j, _mm_unpacklo_pd(e, m));
+        _mm_storeu_pd(out + 2 * j + 2, _mm_unpackhi_pd(e, m));
+    }
+#endif
+
+    for (; j < input_width - 1; j++) {
+        out[2 * j] = in0[j] * 0.5 + in1[j] * 0.5;
+        out[2 * j + 1] = in0[j] * 0.25 + in1[j] * 0.25 +
+                         in0[j + 1] * 0.25 + in1[j + 1] * 0.25;
+    }
+
+    out[2 * j] = in0[j] * 0.5 + in1[j] * 0.5;
+}
+
+local void upsample_1to2(coeff_t **input_channel, coeff_t **output_channel,
+                         int input_width, int input_height)
+{
+    int i;
+
+    for (i = 0; i < input_height - 1; i++) {
+        upsample_row(input_channel[i], output_channel[2 * i], input_width);
+        upsample_mid_row(input_channel[i], input_channel[i + 1],
+                         output_channel[2 * i + 1], input_width);
+    }
+
+    upsample_row(input_channel[i], output_channel[2 * i], input_width);
+}
+
+/* Vertical pass: blend two input rows into a temporary row */
+local void blend_rows(coeff_t *in0, coeff_t *in1, coeff_t *out,
+                      double u, int width)
+{
+    double v = 1.0 - u;
+    int j = 0;
+
+#ifdef RESAMPLE_SSE2
+    __m128d vu = _mm_set1_pd(u);
+    __m128d vv = _mm_set1_pd(v);
+
+    for (; j + 2 <= width; j += 2) {
+        __m128d a = _mm_mul_pd(_mm_loadu_pd(in0 + j), vv);
+        __m128d b = _mm_mul_pd(_mm_loadu_pd(in1 + j), vu);
+
+        _mm_storeu_pd(out + j, _mm_add_pd(a, b));
+    }
+#endif
+
+    for (; j < width; j++) {
+        out[j] = in0[j] * v + in1[j] * u;
+    }
+}
+
+/* Horizontal pass: blend neighbouring samples of a row. Each pair
+ * of outputs takes two adjacent input pairs, which are transposed
+ * into left and right neighbours. */
+local void blend_cols(coeff_t *in, coeff_t *out, int *index,
+                      double *weight, int width)
+{
+    int j = 0;
+
+#ifdef RESAMPLE_SSE2
+    __m128d one = _mm_set1_pd(1.0);
+
+    for (; j + 2 <= width; j += 2) {
+        __m128d p0 = _mm_loadu_pd(in + index[j]);
+        __m128d p1 = _mm_loadu_pd(in + index[j + 1]);
+        __m128d t = _mm_loadu_pd(weight + j);
+        __m128d a = _mm_mul_pd(_mm_unpacklo_pd(p0, p1), _mm_sub_pd(one, t));
+        __m128d b = _mm_mul_pd(_mm_unpackhi_pd(p0, p1), t);
+
+        _mm_storeu_pd(out + j, _mm_add_pd(a, b));
+    }
+#endif
+
+    for (; j < width; j++) {
+        out[j] = in[index[j]] * (1.0 - weight[j]) +
+                 in[index[j] + 1] * weight[j];
+    }
+}
 
 void bilinear_resample_channel(coeff_t **input_channel, coeff_t **output_channel,
                                int input_width, int input_height,
                                int output_width, int output_height)
 {
-    coeff_t t, u;
-    coeff_t tmp;
+    double *col_weight, *row_weight, *tmp;
+    int *col_index, *row_index;
+    coeff_t *row;
 
-    int i, j;
-    int l, c;
+    int i;
 
     /* Sanity checks */
     assert((input_width > 1) && (input_height > 1));
     assert((output_width > 1) && (output_height > 1));
 
-    for (i = 0; i < output_height; i++) {
-        for (j = 0; j < output_width; j++) {
-            tmp = (double) (input_height - 1) *
-                ((double) i / (double) (output_height - 1));
-
-            l = (int) tmp;
-
-            if (l < 0) {
-                l = 0;
-            } else if (l >= input_height - 1) {
-                l = input_height - 2;
-            }
-
-            u = tmp - (double) l;
+    /* Fast path for the exact 2:1 case */
+    if ((input_width - 1 == 2 * (output_width - 1)) &&
+        (input_height - 1 == 2 * (output_height - 1)))
+    {
+        downsample_2to1(input_channel, output_channel,
+                        output_width, output_height);
+        return;
+    }
 
-            tmp = (double) (input_width - 1) *
-                ((double) j / (double) (output_width - 1));
+    /* Fast path for the exact 1:2 case */
+    if ((output_width - 1 == 2 * (input_width - 1)) &&
+        (output_height - 1 == 2 * (input_height - 1)))
+    {
+        upsample_1to2(input_channel, output_channel,
+                      input_width, input_height);
+        return;
+    }
 
-            c = (int) tmp;
+    /* Generic case: weights depend only on the row or column index,
+     * so they are computed once per axis. */
+    col_weight = (double *) xmalloc(sizeof(double) *
+        (output_width + output_height + input_width));
+    row_weight = col_weight + output_width;
+    tmp = row_weight + output_height;
 
-            if (c < 0) {
-                c = 0;
-            } else if (c >= input_width - 1) {
-                c = input_width - 2;
-            }
+    col_index = (int *) xmalloc(sizeof(int) *
+        (output_width + output_height));
+    row_index = col_index + output_width;
 
-            t = tmp - (double) c;
+    axis_weights(input_width, output_width, col_index, col_weight);
+    axis_weights(input_height, output_height, row_index, row_weight);
 
-            output_channel[i][j] =
-                input_channel[l][c] * (1 - t) * (1 - u) +
-                input_channel[l + 1][c] * (1 - t) * u +
-                input_channel[l][c + 1] * t * (1 - u) +
-                input_channel[l + 1][c + 1] * t * u;
+    for (i = 0; i < output_height; i++) {
+        /* Vertical pass */
+        if (row_weight[i] == 0.0) {
+            row = input_channel[row_index[i]];
+        } else {
+            blend_rows(input_channel[row_index[i]],
+                       input_channel[row_index[i] + 1],
+                       tmp, row_weight[i], input_width);
+            row = tmp;
         }
+
+        /* Horizontal pass */
+        blend_cols(row, output_channel[i], col_index, col_weight,
+                   output_width);
     }
+
+    free(col_weight);
+    free(col_index);
 }
@@ -66,7 +66,12 @@ extern "C" {
  *
  *  \return \c VOID
  *
- *  \note Input and output dimensions must be greater than 1. */
+ *  \note Input and output dimensions must be greater than 1.
+ *
+ *  \note Resampling is separable: interpolation weights are computed
+ *  once per row and per column. Exact 2:1 and 1:2 ratios, which
+ *  4:2:0 resampling in OTLPF mode produces, take a faster path.
+ *  On x86 both passes of the generic path use SSE2 as well. */
 void bilinear_resample_channel(coeff_t **input_channel, coeff_t **output_channel,
                                int input_width, int input_height,
                                int output_width, int output_height);
@@ -996,8 +996,44 @@ local void speck_init(linked_list **LIS_slots, pixel_set *I,
     }
 }
 
+local double plane_distortion(int **channel, int channel_size,
+                              int threshold)
+{
+    double dist;
+    int mask;
+    int i, j;
+
+    mask = ~(threshold - 1);
+    dist = 0.0;
+
+    for (i = 0; i < channel_size; i++) {
+        for (j = 0; j < channel_size; j++) {
+            int coeff = ABS(channel[i][j]);
+            int err;
+
+            /* Decoder reconstructs significant coefficients
+             * at the middle of the uncertainty interval */
+            if (coeff < threshold) {
+                err = coeff;
+            } else {
+                err = coeff - ((coeff & mask) | (threshold >> 1));
+            }
+
+            dist += (double) err * err;
+        }
+    }
+
+    return dist;
+}
+
 int speck_encode(int **channel, int channel_size,
                  unsigned char *buf, int buf_size)
+{
+    return speck_encode_rd(channel, channel_size, buf, buf_size, NULL);
+}
+
+int speck_encode_rd(int **channel, int channel_size,
+                    unsigned char *buf, int buf_size, speck_rd *rd)
 {
     int threshold_bits;
     int threshold;
@@ -1038,6 +1074,14 @@ int speck_encode(int **channel, int channel_size,
     /* Setup encoder */
     speck_init(LIS_slots, I, channel_size, mode);
 
+    /* Nothing is decoded yet */
+    if (rd) {
+        rd->n_points = 1;
+        rd->bytes[0] = 0;
+        rd->dist[0] = plane_distortion(channel, channel_size,
+                                       1 << threshold_bits);
+    }
+
     /* Travels through all bit planes */
     while (threshold > 0) {
         /* Sorting pass */
@@ -1048,10 +1092,42 @@ int speck_encode(int **channel, int channel_size,
         result = encode_refinement_pass(channel, LSP, bb, threshold);
         BREAK_IF_OVERFLOW(result);
 
+        /* Bit plane is complete */
+        if (rd) {
+            assert(rd->n_points < SPECK_MAX_RD_POINTS);
+
+            rd->bytes[rd->n_points] = (bb->next - bb->start) +
+                (bb->pending + 7) / 8;
+            rd->dist[rd->n_points] = plane_distortion(channel,
+                channel_size, threshold);
+            rd->n_points++;
+        }
+
         /* Proceed to the next bit plane */
         threshold >>= 1;
     }
 
+    /* Bit plane is cut by the buffer end. Assume that it is
+     * as efficient as the previous one, but never better than
+     * the complete plane. */
+    if (rd && (threshold > 0)) {
+        int n = rd->n_points;
+        double slope = 0.0;
+        double dist;
+
+        if (n > 1) {
+            slope = (rd->dist[n - 2] - rd->dist[n - 1]) /
+                MAX(rd->bytes[n - 1] - rd->bytes[n - 2], 1);
+        }
+
+        dist = rd->dist[n - 1] - slope * (buf_size - rd->bytes[n - 1]);
+
+        rd->bytes[n] = buf_size;
+        rd->dist[n] = MAX(dist, plane_distortion(channel,
+            channel_size, threshold));
+        rd->n_points++;
+    }
+
     /* Flush bit-buffer */
     flush_bits(bb);
     n_bytes = bb->next - bb->start;
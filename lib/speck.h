@@ -79,6 +79,8 @@ extern "C" {
 #define MIN_SPECK_BUF_SIZE      1
 /** Reserve 6 bits for \a theshold_bits parameter */
 #define THRESHOLD_BITS          6
+/** Maximal number of rate-distortion points per channel */
+#define SPECK_MAX_RD_POINTS     34
 
 /** Cast data pointer as \ref pixel_set structure */
 #define PIXEL_SET(_set)         ((pixel_set *) (_set->data))
@@ -110,6 +112,21 @@ typedef struct pixel_set_tag {
     short height;
 } pixel_set;
 
+/** Rate-distortion curve
+ *
+ *  This structure holds rate-distortion points collected by
+ *  the encoder: one initial point (nothing is encoded) and one
+ *  point at the end of each bit plane. If the buffer overflows
+ *  in the middle of a bit plane, the last point is an estimate. */
+typedef struct speck_rd_tag {
+    /** Number of points */
+    int n_points;
+    /** Number of encoded bytes at each point */
+    int bytes[SPECK_MAX_RD_POINTS];
+    /** Squared reconstruction error at each point */
+    double dist[SPECK_MAX_RD_POINTS];
+} speck_rd;
+
 /** Find maximal coefficient
  *
  *  This function returns absolute value of maximal
@@ -444,6 +461,20 @@ local int decode_refinement_pass(int **channel, linked_list *LSP,
 local void speck_init(linked_list **LIS_slots, pixel_set *I,
                       int channel_size, int mode);
 
+/** Compute squared reconstruction error
+ *
+ *  This function computes squared error between the \a channel
+ *  and its reconstruction by the decoder after all bit planes
+ *  down to the \a threshold are decoded.
+ *
+ *  \param channel Channel
+ *  \param channel_size Channel size
+ *  \param threshold Threshold of the last decoded bit plane
+ *
+ *  \return Squared reconstruction error */
+local double plane_distortion(int **channel, int channel_size,
+                              int threshold);
+
 /** Encode channel using SPECK algorithm
  *
  *  This function encodes \a channel of size \a channel_size
@@ -464,6 +495,21 @@ local void speck_init(linked_list **LIS_slots, pixel_set *I,
 int speck_encode(int **channel, int channel_size,
                  unsigned char *buf, int buf_size);
 
+/** Encode channel and collect rate-distortion points
+ *
+ *  This function is the same as \ref speck_encode, but
+ *  also fills the \a rd structure unless it is \c NULL.
+ *
+ *  \param channel Channel
+ *  \param channel_size Channel size
+ *  \param buf Buffer
+ *  \param buf_size Buffer size
+ *  \param rd Rate-distortion points
+ *
+ *  \return Number of bytes in \a buf actualy used by encoder */
+int speck_encode_rd(int **channel, int channel_size,
+                    unsigned char *buf, int buf_size, speck_rd *rd);
+
 /** Decode channel using SPECK algorithm
  *
  *  This function decodes \a channel of size \a channel_size
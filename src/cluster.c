@@ -0,0 +1,1351 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006,2007,2010 Alexander Simakov, <xander@entropyware.info>
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef ENABLE_CLUSTER
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <errno.h>
+#include <epsilon.h>
+#include <options.h>
+#include <misc.h>
+#include <cluster.h>
+
+static int run_loop(cluster *cl);
+static int handle_events(cluster *cl, cluster_conn *c, int events);
+static int fail_connection(cluster *cl, cluster_conn *c);
+static void report_failures(cluster *cl);
+static double get_time(void);
+static void mark_done(cluster *cl, int idx);
+static double expected_time(cluster_conn *c);
+static int is_critical(cluster *cl);
+static int is_best(cluster *cl, cluster_conn *c);
+static int find_straggler(cluster *cl, cluster_conn *c, double now);
+static int take_requeued(cluster *cl);
+static int send_request(cluster *cl, cluster_conn *c, int idx);
+static int finish_block(cluster *cl, cluster_conn *c, cluster_slot *slot,
+                        unsigned char *payload, int size);
+static int gather_request(cluster_slot *slot, struct iovec *iov, int max,
+                          int skip);
+static void update_stats(cluster_conn *c, cluster_slot *slot);
+static int start_connect(cluster *cl, cluster_conn *c);
+static int finish_connect(cluster_conn *c);
+static int watch_events(cluster *cl, cluster_conn *c, int events);
+static int dispatch_blocks(cluster *cl, cluster_conn *c);
+static int flush_output(cluster *cl, cluster_conn *c);
+static int read_input(cluster *cl, cluster_conn *c);
+static int parse_input(cluster *cl, cluster_conn *c);
+static int check_connections(cluster *cl);
+#ifdef ENABLE_PTHREADS
+static int start_workers(cluster *cl);
+static void stop_workers(cluster *cl);
+static void *local_worker(void *arg);
+static int queue_local(cluster *cl, cluster_conn *c, int tag);
+static int collect_local(cluster *cl, cluster_conn *c);
+#endif
+
+/* Prepare dispatcher for `n_blocks' blocks */
+void cluster_init(cluster *cl, cluster_nodes *nodes, int n_blocks,
+                  int quiet)
+{
+    cluster_conn *c;
+    int i, j;
+
+    memset(cl, 0, sizeof(cluster));
+
+    cl->epoll_fd = -1;
+    cl->wake_fd = -1;
+    cl->n_conns = nodes->n_nodes + (nodes->n_local > 0);
+    cl->window = nodes->window;
+    cl->n_blocks = n_blocks;
+    cl->quiet = quiet;
+
+    cl->finished = (unsigned char *) eps_xmalloc(n_blocks *
+        sizeof(unsigned char));
+    memset(cl->finished, 0, n_blocks * sizeof(unsigned char));
+
+    cl->copies = (unsigned char *) eps_xmalloc(n_blocks *
+        sizeof(unsigned char));
+    memset(cl->copies, 0, n_blocks * sizeof(unsigned char));
+
+    cl->failures = (unsigned char *) eps_xmalloc(n_blocks *
+        sizeof(unsigned char));
+    memset(cl->failures, 0, n_blocks * sizeof(unsigned char));
+
+    /* Each block in flight may need to be sent again */
+    cl->requeued = (int *) eps_xmalloc(cl->n_conns * cl->window *
+        sizeof(int));
+
+    cl->conns = (cluster_conn *) eps_xmalloc(cl->n_conns *
+        sizeof(cluster_conn));
+
+    for (i = 0; i < cl->n_conns; i++) {
+        c = &cl->conns[i];
+        memset(c, 0, sizeof(cluster_conn));
+
+        c->fd = -1;
+
+        if (i < nodes->n_nodes) {
+            c->addr = &nodes->addr[i];
+            c->window = c->n_slots = cl->window;
+
+            node_addr_name(c->addr, c->name, sizeof(c->name));
+
+            c->in_size = CLUSTER_BUF_SIZE;
+            c->in_buf = (unsigned char *) eps_xmalloc(c->in_size *
+                sizeof(unsigned char));
+        } else {
+            /* Local workers, started along with the dispatcher */
+            c->local = 1;
+            c->state = CONN_DEAD;
+            c->window = c->n_slots = nodes->n_local;
+
+            snprintf(c->name, sizeof(c->name), "local");
+
+            cl->local = c;
+            cl->n_workers = nodes->n_local;
+            cl->local_done = (int *) eps_xmalloc(c->n_slots * sizeof(int));
+        }
+
+        c->slots = (cluster_slot *) eps_xmalloc(c->n_slots *
+            sizeof(cluster_slot));
+        c->out_fifo = (int *) eps_xmalloc(c->n_slots * sizeof(int));
+
+        for (j = 0; j < c->n_slots; j++) {
+            c->slots[j].idx = -1;
+            c->slots[j].req = NULL;
+            c->slots[j].segs = NULL;
+            c->slots[j].answer = NULL;
+        }
+    }
+
+    /* Pipelined protocol handshake */
+    cluster_hello_value(cl, PROTOCOL_MAGIC);
+    cluster_hello_value(cl, PROTOCOL_VERSION);
+    cluster_hello_value(cl, cl->window);
+}
+
+/* Append integer value to the general parameters */
+void cluster_hello_value(cluster *cl, int value)
+{
+    uint32_t x = htonl(value);
+
+    cluster_hello_buf(cl, &x, sizeof(uint32_t));
+}
+
+/* Append buffer to the general parameters */
+void cluster_hello_buf(cluster *cl, void *buf, int len)
+{
+    if (cl->hello_len + len > cl->hello_size) {
+        unsigned char *hello;
+
+        cl->hello_size = MAX(2 * cl->hello_size, cl->hello_len + len);
+        hello = (unsigned char *) eps_xmalloc(cl->hello_size *
+            sizeof(unsigned char));
+
+        if (cl->hello) {
+            memcpy(hello, cl->hello, cl->hello_len);
+            free(cl->hello);
+        }
+
+        cl->hello = hello;
+    }
+
+    memcpy(cl->hello + cl->hello_len, buf, len);
+    cl->hello_len += len;
+}
+
+/* Close connections and release all buffers */
+void cluster_free(cluster *cl)
+{
+    cluster_conn *c;
+    int i, j;
+
+    for (i = 0; i < cl->n_conns; i++) {
+        c = &cl->conns[i];
+
+        if (c->fd != -1) {
+            close(c->fd);
+        }
+
+        for (j = 0; j < c->n_slots; j++) {
+            free(c->slots[j].req);
+            free(c->slots[j].segs);
+            free(c->slots[j].answer);
+        }
+
+        free(c->slots);
+        free(c->out_fifo);
+        free(c->in_buf);
+    }
+
+    if (cl->epoll_fd != -1) {
+        close(cl->epoll_fd);
+    }
+
+    if (cl->wake_fd != -1) {
+        close(cl->wake_fd);
+    }
+
+    free(cl->conns);
+    free(cl->local_done);
+    free(cl->hello);
+    free(cl->finished);
+    free(cl->copies);
+    free(cl->failures);
+    free(cl->requeued);
+}
+
+/* Process all blocks. Blocks of failed connections are sent to
+ * other ones, failures are reported once all blocks are done. */
+int cluster_run(cluster *cl)
+{
+    int rc = run_loop(cl);
+
+#ifdef ENABLE_PTHREADS
+    stop_workers(cl);
+#endif
+
+    report_failures(cl);
+
+    return rc;
+}
+
+/* Event loop of the dispatcher */
+static int run_loop(cluster *cl)
+{
+    struct epoll_event events[MAX_EVENTS];
+    cluster_conn *c;
+    int quiet = cl->quiet;
+    int n, i;
+    int rc;
+
+    if ((cl->epoll_fd = epoll_create(MAX_EVENTS)) == -1) {
+        printf("%sCannot create event loop: %m\n", QUIET);
+        return CLUSTER_ERROR;
+    }
+
+    /* Do not halt on `Broken pipe' error */
+    set_signal(SIGPIPE, SIG_IGN);
+
+#ifdef ENABLE_PTHREADS
+    /* Local workers take blocks from the same queue */
+    if (cl->local && (start_workers(cl) != CLUSTER_OK)) {
+        return CLUSTER_ERROR;
+    }
+#endif
+
+    for (i = 0; i < cl->n_conns; i++) {
+        c = &cl->conns[i];
+
+        if (c->local) {
+            continue;
+        }
+
+        if ((rc = start_connect(cl, c)) == CLUSTER_FAILED) {
+            rc = fail_connection(cl, c);
+        }
+
+        if (rc != CLUSTER_OK) {
+            return CLUSTER_ERROR;
+        }
+    }
+
+    for (;;) {
+        /* Hand out blocks to connections with free slots */
+        for (i = 0; i < cl->n_conns; i++) {
+            c = &cl->conns[i];
+
+            if ((c->state == CONN_READY) && (c->n_busy < c->window)) {
+                if ((rc = dispatch_blocks(cl, c)) == CLUSTER_FAILED) {
+                    rc = fail_connection(cl, c);
+                }
+
+                if (rc != CLUSTER_OK) {
+                    return CLUSTER_ERROR;
+                }
+            }
+        }
+
+        if (cl->n_done == cl->n_blocks) {
+            break;
+        }
+
+        if ((n = epoll_wait(cl->epoll_fd, events, MAX_EVENTS, 1000)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            printf("%sCannot wait for events: %m\n", QUIET);
+            return CLUSTER_ERROR;
+        }
+
+        for (i = 0; i < n; i++) {
+            c = (cluster_conn *) events[i].data.ptr;
+
+            /* Connection failed while handling previous events */
+            if (c->fd == -1) {
+                continue;
+            }
+
+            if ((rc = handle_events(cl, c, events[i].events)) ==
+                CLUSTER_FAILED)
+            {
+                rc = fail_connection(cl, c);
+            }
+
+            if (rc != CLUSTER_OK) {
+                return CLUSTER_ERROR;
+            }
+        }
+
+        if (check_connections(cl) != CLUSTER_OK) {
+            return CLUSTER_ERROR;
+        }
+    }
+
+    return CLUSTER_OK;
+}
+
+/* Handle events reported for the connection */
+static int handle_events(cluster *cl, cluster_conn *c, int events)
+{
+    int rc;
+
+#ifdef ENABLE_PTHREADS
+    if (c->local) {
+        return collect_local(cl, c);
+    }
+#endif
+
+    if (c->state == CONN_CONNECTING) {
+        if ((rc = finish_connect(c)) != CLUSTER_OK) {
+            return rc;
+        }
+    }
+
+    if (events & EPOLLOUT) {
+        if ((rc = flush_output(cl, c)) != CLUSTER_OK) {
+            return rc;
+        }
+    }
+
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        if ((rc = read_input(cl, c)) != CLUSTER_OK) {
+            return rc;
+        }
+    }
+
+    return CLUSTER_OK;
+}
+
+/* Close failed connection and queue its blocks for sending to
+ * other connections. The connection is opened again later. */
+static int fail_connection(cluster *cl, cluster_conn *c)
+{
+    cluster_slot *slot;
+    int quiet = cl->quiet;
+    int idx;
+    int j;
+
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+
+    c->events = 0;
+    c->n_failures++;
+
+    for (j = 0; j < c->n_slots; j++) {
+        slot = &c->slots[j];
+
+        if (slot->idx == -1) {
+            continue;
+        }
+
+        idx = slot->idx;
+        slot->idx = -1;
+
+        free(slot->req);
+        slot->req = NULL;
+
+        /* Block may still be answered by another connection */
+        if (--cl->copies[idx] || cl->finished[idx]) {
+            continue;
+        }
+
+        if (++cl->failures[idx] > MAX_BLOCK_RETRIES) {
+            printf("%sBlock %d failed on %d connections, giving up\n",
+                QUIET, idx, cl->failures[idx]);
+            return CLUSTER_ERROR;
+        }
+
+        cl->requeued[cl->n_requeued++] = idx;
+        c->n_resent++;
+    }
+
+    /* Start from scratch */
+    c->window = cl->window;
+    c->n_busy = 0;
+    c->out_head = c->out_count = c->out_pos = 0;
+    c->in_pos = c->in_len = 0;
+    c->service = c->latency = 0.0;
+    c->n_done = 0;
+
+    if (c->n_failures > MAX_RECONNECTS) {
+        c->state = CONN_DEAD;
+    } else {
+        c->state = CONN_FAILED;
+        c->retry_at = time(NULL) + RECONNECT_DELAY;
+    }
+
+    return CLUSTER_OK;
+}
+
+/* Report nodes whose connections failed at least once */
+static void report_failures(cluster *cl)
+{
+    int quiet = cl->quiet;
+    cluster_conn *c, *x;
+    int n_failures, n_resent, n_dead;
+    char *error;
+    int shown = 0;
+    int i, j;
+
+    for (i = 0; i < cl->n_conns; i++) {
+        c = &cl->conns[i];
+
+        /* Node is reported with its first connection */
+        for (j = 0; j < i; j++) {
+            if (!strcmp(cl->conns[j].name, c->name)) {
+                break;
+            }
+        }
+
+        if (j < i) {
+            continue;
+        }
+
+        n_failures = n_resent = n_dead = 0;
+        error = NULL;
+
+        for (j = i; j < cl->n_conns; j++) {
+            x = &cl->conns[j];
+
+            if (strcmp(x->name, c->name) || !x->n_failures) {
+                continue;
+            }
+
+            n_failures += x->n_failures;
+            n_resent += x->n_resent;
+            n_dead += x->state == CONN_DEAD;
+            error = x->error;
+        }
+
+        if (!n_failures) {
+            continue;
+        }
+
+        printf("%sNode %s: %d failure(s), %d connection(s) dropped, "
+            "%d block(s) resent (%s)\n", shown++ ? "" : QUIET, c->name,
+            n_failures, n_dead, n_resent, error);
+    }
+}
+
+/* Current time in seconds */
+static double get_time(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (double) tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Mark block as finished and advance the low-water mark */
+static void mark_done(cluster *cl, int idx)
+{
+    cl->finished[idx] = 1;
+    cl->n_done++;
+
+    while ((cl->low < cl->n_blocks) && cl->finished[cl->low]) {
+        cl->low++;
+    }
+}
+
+/* Start non-blocking connect */
+static int start_connect(cluster *cl, cluster_conn *c)
+{
+    int flags;
+
+    if ((c->fd = socket(c->addr->sa.sa_family, SOCK_STREAM, 0)) == -1) {
+        snprintf(c->error, sizeof(c->error), "Cannot create socket: %m");
+        return CLUSTER_FAILED;
+    }
+
+    if (((flags = fcntl(c->fd, F_GETFL, 0)) == -1) ||
+        (fcntl(c->fd, F_SETFL, flags | O_NONBLOCK) == -1))
+    {
+        snprintf(c->error, sizeof(c->error), "Cannot set up socket: %m");
+        return CLUSTER_FAILED;
+    }
+
+    /* Each request is sent with a single write */
+    if (c->addr->sa.sa_family == AF_INET) {
+        set_nodelay(c->fd);
+    }
+
+    if (connect(c->fd, &c->addr->sa, node_addr_len(c->addr)) == 0) {
+        c->state = CONN_HELLO;
+    } else if (errno == EINPROGRESS) {
+        c->state = CONN_CONNECTING;
+    } else {
+        snprintf(c->error, sizeof(c->error), "Cannot connect: %m");
+        return CLUSTER_FAILED;
+    }
+
+    c->last_active = time(NULL);
+
+    /* Wait until connected, then send general parameters */
+    return watch_events(cl, c, EPOLLOUT);
+}
+
+/* Check result of non-blocking connect */
+static int finish_connect(cluster_conn *c)
+{
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        err = errno;
+    }
+
+    if (err) {
+        errno = err;
+        snprintf(c->error, sizeof(c->error), "Cannot connect: %m");
+        return CLUSTER_FAILED;
+    }
+
+    c->state = CONN_HELLO;
+    c->last_active = time(NULL);
+
+    return CLUSTER_OK;
+}
+
+/* Change set of watched events */
+static int watch_events(cluster *cl, cluster_conn *c, int events)
+{
+    struct epoll_event ev;
+    int op;
+
+    if (events == c->events) {
+        return CLUSTER_OK;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = events;
+    ev.data.ptr = c;
+
+    op = c->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    if (epoll_ctl(cl->epoll_fd, op, c->fd, &ev) == -1) {
+        snprintf(c->error, sizeof(c->error), "Cannot watch connection: %m");
+        return CLUSTER_FAILED;
+    }
+
+    c->events = events;
+
+    return CLUSTER_OK;
+}
+
+/* Expected time to finish one more block on the connection.
+ * Round trip covers nodes which work on several blocks of the
+ * connection at once, time per block covers the rest. */
+static double expected_time(cluster_conn *c)
+{
+    return MAX(c->latency, (c->n_busy + 1) * c->service);
+}
+
+/* Check whether the queue is almost empty */
+static int is_critical(cluster *cl)
+{
+    int capacity = 0;
+    int i;
+
+    for (i = 0; i < cl->n_conns; i++) {
+        if (cl->conns[i].state == CONN_READY) {
+            capacity += cl->conns[i].window;
+        }
+    }
+
+    return cl->n_blocks - cl->next_block + cl->n_requeued <= capacity;
+}
+
+/* Check that no other connection is expected to finish
+ * next block sooner. Connections not measured yet are
+ * given the benefit of the doubt. */
+static int is_best(cluster *cl, cluster_conn *c)
+{
+    cluster_conn *x;
+    double t;
+    int i;
+
+    if (!c->latency) {
+        return 1;
+    }
+
+    t = expected_time(c);
+
+    for (i = 0; i < cl->n_conns; i++) {
+        x = &cl->conns[i];
+
+        if ((x != c) && (x->state == CONN_READY) && x->latency &&
+            (expected_time(x) < t))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Find block which is stuck on another connection and would be
+ * finished much sooner on this one. Return -1 if there is none. */
+static int find_straggler(cluster *cl, cluster_conn *c, double now)
+{
+    cluster_conn *x;
+    cluster_slot *slot;
+    double elapsed, left;
+    double worst = 0.0;
+    int idx = -1;
+    int i, j;
+
+    if (!c->latency) {
+        return -1;
+    }
+
+    for (i = 0; i < cl->n_conns; i++) {
+        x = &cl->conns[i];
+
+        if ((x == c) || !x->n_busy) {
+            continue;
+        }
+
+        for (j = 0; j < x->window; j++) {
+            slot = &x->slots[j];
+
+            if ((slot->idx == -1) || cl->finished[slot->idx] ||
+                (cl->copies[slot->idx] > 1))
+            {
+                continue;
+            }
+
+            /* Overdue block takes at least as long again */
+            elapsed = now - slot->sent;
+            left = MAX(x->latency - elapsed, elapsed);
+
+            if (left > worst) {
+                worst = left;
+                idx = slot->idx;
+            }
+        }
+    }
+
+    if (worst > SPECULATE_GAIN * expected_time(c)) {
+        return idx;
+    }
+
+    return -1;
+}
+
+/* Take the lowest block sent to a failed connection */
+static int take_requeued(cluster *cl)
+{
+    int idx;
+    int i, k;
+
+    for (k = 0, i = 1; i < cl->n_requeued; i++) {
+        if (cl->requeued[i] < cl->requeued[k]) {
+            k = i;
+        }
+    }
+
+    idx = cl->requeued[k];
+    cl->requeued[k] = cl->requeued[--cl->n_requeued];
+
+    return idx;
+}
+
+/* Prepare request for block `idx' and queue it for sending */
+static int send_request(cluster *cl, cluster_conn *c, int idx)
+{
+    cluster_payload payload;
+    cluster_slot *slot;
+    block_frame frame;
+    int tag;
+    int rc;
+
+    for (tag = 0; c->slots[tag].idx != -1; tag++);
+    slot = &c->slots[tag];
+
+    /* Local workers take the block as it is */
+    if (!c->local) {
+        slot->req = (unsigned char *) eps_xmalloc((FRAME_HDR_SIZE +
+            cl->max_request) * sizeof(unsigned char));
+
+        /* Segment list is kept with the slot */
+        if (cl->max_segs && !slot->segs) {
+            slot->segs = (struct iovec *) eps_xmalloc(cl->max_segs *
+                sizeof(struct iovec));
+        }
+
+        payload.buf = slot->req + FRAME_HDR_SIZE;
+        payload.segs = slot->segs;
+        payload.n_segs = 0;
+
+        memset(&frame, 0, sizeof(frame));
+        rc = cl->fill(cl->user, idx, &frame, &payload);
+
+        if (rc != CLUSTER_OK) {
+            free(slot->req);
+            slot->req = NULL;
+
+            return rc;
+        }
+
+        frame.tag = tag;
+        pack_frame(&frame, slot->req);
+        slot->frame = frame;
+
+        slot->req_len = FRAME_HDR_SIZE + frame.size;
+        slot->n_segs = payload.n_segs;
+    }
+
+    slot->idx = idx;
+    slot->sent = get_time();
+
+    /* Time per block is measured while the connection is busy */
+    if (!c->n_busy++) {
+        c->mark = slot->sent;
+    }
+
+    cl->copies[idx]++;
+
+#ifdef ENABLE_PTHREADS
+    if (c->local) {
+        return queue_local(cl, c, tag);
+    }
+#endif
+
+    c->out_fifo[(c->out_head + c->out_count) % c->n_slots] = tag;
+    c->out_count++;
+
+    return CLUSTER_OK;
+}
+
+/* Update connection speed with the block just answered */
+static void update_stats(cluster_conn *c, cluster_slot *slot)
+{
+    double now = get_time();
+    double service = now - c->mark;
+    double latency = now - slot->sent;
+
+    if (c->n_done++) {
+        c->service += EWMA_WEIGHT * (service - c->service);
+        c->latency += EWMA_WEIGHT * (latency - c->latency);
+    } else {
+        c->service = service;
+        c->latency = latency;
+    }
+
+    c->mark = now;
+}
+
+/* Fill free slots with next blocks from the queue. Once the
+ * queue is empty, duplicate blocks stuck on slow connections. */
+static int dispatch_blocks(cluster *cl, cluster_conn *c)
+{
+    double now = get_time();
+    int idx;
+    int rc;
+
+    while (c->n_busy < c->window) {
+        if (cl->n_requeued) {
+            /* Blocks of failed connections go first */
+            if (is_critical(cl) && !is_best(cl, c)) {
+                break;
+            }
+
+            idx = take_requeued(cl);
+        } else if ((cl->next_block < cl->n_blocks) &&
+            (!cl->horizon || (cl->next_block < cl->low + cl->horizon)))
+        {
+            /* Leave the tail to faster connections */
+            if (is_critical(cl) && !is_best(cl, c)) {
+                break;
+            }
+
+            idx = cl->next_block++;
+        } else if ((idx = find_straggler(cl, c, now)) == -1) {
+            break;
+        }
+
+        rc = send_request(cl, c, idx);
+
+        if (rc == CLUSTER_SKIP) {
+            mark_done(cl, idx);
+        } else if (rc != CLUSTER_OK) {
+            return CLUSTER_ERROR;
+        }
+    }
+
+    return c->local ? CLUSTER_OK : flush_output(cl, c);
+}
+
+/* Send as much pending data as the socket takes */
+static int flush_output(cluster *cl, cluster_conn *c)
+{
+    struct iovec iov[CLUSTER_MAX_IOV];
+    cluster_slot *slot;
+    ssize_t nwritten;
+    int n_vecs;
+    int k;
+
+    if (c->state == CONN_HELLO) {
+        while (c->out_pos < cl->hello_len) {
+            nwritten = write(c->fd, cl->hello + c->out_pos,
+                             cl->hello_len - c->out_pos);
+
+            if (nwritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                    return watch_events(cl, c, EPOLLOUT);
+                }
+
+                snprintf(c->error, sizeof(c->error),
+                    "Cannot send parameters: %m");
+                return CLUSTER_FAILED;
+            }
+
+            c->out_pos += nwritten;
+            c->last_active = time(NULL);
+        }
+
+        /* Wait for the window */
+        c->out_pos = 0;
+        c->state = CONN_ACK;
+
+        return watch_events(cl, c, EPOLLIN);
+    }
+
+    if (c->state != CONN_READY) {
+        return CLUSTER_OK;
+    }
+
+    while (c->out_count) {
+        /* Gather pending requests, the first one may be partially sent */
+        for (n_vecs = k = 0; (k < c->out_count) &&
+            (n_vecs < CLUSTER_MAX_IOV); k++)
+        {
+            slot = &c->slots[c->out_fifo[(c->out_head + k) % c->n_slots]];
+            n_vecs += gather_request(slot, iov + n_vecs,
+                CLUSTER_MAX_IOV - n_vecs, k ? 0 : c->out_pos);
+        }
+
+        if ((nwritten = writev(c->fd, iov, n_vecs)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+
+            snprintf(c->error, sizeof(c->error), "Cannot send block: %m");
+            return CLUSTER_FAILED;
+        }
+
+        c->last_active = time(NULL);
+
+        /* Release requests which are sent completely */
+        while (c->out_count && (nwritten > 0)) {
+            slot = &c->slots[c->out_fifo[c->out_head]];
+
+            if (nwritten < slot->req_len - c->out_pos) {
+                c->out_pos += nwritten;
+                break;
+            }
+
+            nwritten -= slot->req_len - c->out_pos;
+
+            free(slot->req);
+            slot->req = NULL;
+
+            c->out_head = (c->out_head + 1) % c->n_slots;
+            c->out_count--;
+            c->out_pos = 0;
+        }
+    }
+
+    return watch_events(cl, c, c->out_count ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+/* Describe unsent part of the request: header with copied
+ * payload and then segments, `skip' bytes are already sent.
+ * Return number of vectors used, at most `max'. */
+static int gather_request(cluster_slot *slot, struct iovec *iov, int max,
+                          int skip)
+{
+    int len = slot->n_segs ? FRAME_HDR_SIZE : slot->req_len;
+    int n = 0;
+    int j;
+
+    if (skip < len) {
+        iov[n].iov_base = slot->req + skip;
+        iov[n].iov_len = len - skip;
+        skip = 0;
+        n++;
+    } else {
+        skip -= len;
+    }
+
+    for (j = 0; (j < slot->n_segs) && (n < max); j++) {
+        if (skip >= (int) slot->segs[j].iov_len) {
+            skip -= slot->segs[j].iov_len;
+            continue;
+        }
+
+        iov[n].iov_base = (char *) slot->segs[j].iov_base + skip;
+        iov[n].iov_len = slot->segs[j].iov_len - skip;
+        skip = 0;
+        n++;
+    }
+
+    return n;
+}
+
+/* Read whatever the node has sent */
+static int read_input(cluster *cl, cluster_conn *c)
+{
+    ssize_t nread;
+
+    /* Keep unparsed data at the beginning of the buffer */
+    if (c->in_pos) {
+        memmove(c->in_buf, c->in_buf + c->in_pos, c->in_len - c->in_pos);
+        c->in_len -= c->in_pos;
+        c->in_pos = 0;
+    }
+
+    nread = read(c->fd, c->in_buf + c->in_len, c->in_size - c->in_len);
+
+    if (nread == -1) {
+        if ((errno == EINTR) || (errno == EAGAIN) ||
+            (errno == EWOULDBLOCK))
+        {
+            return CLUSTER_OK;
+        }
+
+        snprintf(c->error, sizeof(c->error), "Cannot receive answer: %m");
+        return CLUSTER_FAILED;
+    }
+
+    if (nread == 0) {
+        snprintf(c->error, sizeof(c->error), "Connection closed");
+        return CLUSTER_FAILED;
+    }
+
+    c->in_len += nread;
+    c->last_active = time(NULL);
+
+    return parse_input(cl, c);
+}
+
+/* Handle all complete answers in the buffer */
+static int parse_input(cluster *cl, cluster_conn *c)
+{
+    block_frame frame;
+    unsigned char *p;
+    int avail;
+
+    for (;;) {
+        p = c->in_buf + c->in_pos;
+        avail = c->in_len - c->in_pos;
+
+        /* The node may accept a narrower window */
+        if (c->state == CONN_ACK) {
+            uint32_t x;
+
+            if (avail < (int) sizeof(uint32_t)) {
+                return CLUSTER_OK;
+            }
+
+            memcpy(&x, p, sizeof(uint32_t));
+            c->window = ntohl(x);
+            c->in_pos += sizeof(uint32_t);
+
+            if ((c->window < 1) || (c->window > cl->window)) {
+                snprintf(c->error, sizeof(c->error),
+                    "Incorrect window size (%d)", c->window);
+                return CLUSTER_FAILED;
+            }
+
+            c->state = CONN_READY;
+            continue;
+        }
+
+        if (avail < FRAME_HDR_SIZE) {
+            return CLUSTER_OK;
+        }
+
+        unpack_frame(p, &frame);
+
+        if ((frame.tag < 0) || (frame.tag >= c->window) ||
+            (c->slots[frame.tag].idx == -1) || c->slots[frame.tag].req)
+        {
+            snprintf(c->error, sizeof(c->error),
+                "Unexpected block tag (%d)", frame.tag);
+            return CLUSTER_FAILED;
+        }
+
+        if ((frame.size < 0) || (frame.size > cl->max_answer)) {
+            snprintf(c->error, sizeof(c->error),
+                "Incorrect block size (%d)", frame.size);
+            return CLUSTER_FAILED;
+        }
+
+        /* Wait for the rest of the frame */
+        if (avail < FRAME_HDR_SIZE + frame.size) {
+            if (FRAME_HDR_SIZE + frame.size > c->in_size) {
+                unsigned char *buf;
+
+                c->in_size = FRAME_HDR_SIZE + frame.size;
+                buf = (unsigned char *) eps_xmalloc(c->in_size *
+                    sizeof(unsigned char));
+
+                memcpy(buf, p, avail);
+                free(c->in_buf);
+
+                c->in_buf = buf;
+                c->in_pos = 0;
+                c->in_len = avail;
+            }
+
+            return CLUSTER_OK;
+        }
+
+        if (finish_block(cl, c, &c->slots[frame.tag], p + FRAME_HDR_SIZE,
+            frame.size) != CLUSTER_OK)
+        {
+            return CLUSTER_ERROR;
+        }
+
+        c->in_pos += FRAME_HDR_SIZE + frame.size;
+    }
+}
+
+/* Free the slot of answered block and consume the answer */
+static int finish_block(cluster *cl, cluster_conn *c, cluster_slot *slot,
+                        unsigned char *payload, int size)
+{
+    int idx = slot->idx;
+
+    update_stats(c, slot);
+
+    slot->idx = -1;
+    c->n_busy--;
+    cl->copies[idx]--;
+
+    /* Duplicate may have been answered already */
+    if (!cl->finished[idx]) {
+        if (cl->done(cl->user, idx, &slot->frame, payload,
+            size) != CLUSTER_OK)
+        {
+            return CLUSTER_ERROR;
+        }
+
+        mark_done(cl, idx);
+    }
+
+    return CLUSTER_OK;
+}
+
+/* Fail connections which do not answer for too long and
+ * reopen failed ones. Give up if no connections are left. */
+static int check_connections(cluster *cl)
+{
+    time_t now = time(NULL);
+    int quiet = cl->quiet;
+    cluster_conn *c;
+    int alive = 0;
+    int rc;
+    int i;
+
+    for (i = 0; i < cl->n_conns; i++) {
+        c = &cl->conns[i];
+        rc = CLUSTER_OK;
+
+        /* Local workers never fail */
+        if (c->local) {
+            alive++;
+            continue;
+        } else if (c->state == CONN_DEAD) {
+            continue;
+        } else if (c->state == CONN_FAILED) {
+            if (now >= c->retry_at) {
+                rc = start_connect(cl, c);
+            }
+        } else if (((c->state != CONN_READY) || c->n_busy) &&
+            (now - c->last_active > IO_TIMEOUT))
+        {
+            snprintf(c->error, sizeof(c->error), "Connection timed out");
+            rc = CLUSTER_FAILED;
+        }
+
+        if (rc == CLUSTER_FAILED) {
+            rc = fail_connection(cl, c);
+        }
+
+        if (rc != CLUSTER_OK) {
+            return CLUSTER_ERROR;
+        }
+
+        if (c->state != CONN_DEAD) {
+            alive++;
+        }
+    }
+
+    if (!alive) {
+        printf("%sAll cluster nodes failed\n", QUIET);
+        return CLUSTER_ERROR;
+    }
+
+    return CLUSTER_OK;
+}
+
+#ifdef ENABLE_PTHREADS
+/* Start local workers and watch their wake-up pipe */
+static int start_workers(cluster *cl)
+{
+    cluster_conn *c = cl->local;
+    cluster_worker *w;
+    int quiet = cl->quiet;
+    int fds[2];
+    int flags;
+    int i;
+
+    if (pipe(fds) == -1) {
+        printf("%sCannot create pipe: %m\n", QUIET);
+        return CLUSTER_ERROR;
+    }
+
+    c->fd = fds[0];
+    cl->wake_fd = fds[1];
+
+    /* Wake-ups are drained without blocking */
+    if (((flags = fcntl(c->fd, F_GETFL, 0)) == -1) ||
+        (fcntl(c->fd, F_SETFL, flags | O_NONBLOCK) == -1))
+    {
+        printf("%sCannot set up pipe: %m\n", QUIET);
+        return CLUSTER_ERROR;
+    }
+
+    if (watch_events(cl, c, EPOLLIN) != CLUSTER_OK) {
+        printf("%s%s\n", QUIET, c->error);
+        return CLUSTER_ERROR;
+    }
+
+    for (i = 0; i < c->n_slots; i++) {
+        c->slots[i].answer = (unsigned char *) eps_xmalloc(cl->max_answer *
+            sizeof(unsigned char));
+    }
+
+    assert(!pthread_mutex_init(&cl->lock, NULL));
+    assert(!pthread_cond_init(&cl->cond, NULL));
+
+    cl->workers = (cluster_worker *) eps_xmalloc(cl->n_workers *
+        sizeof(cluster_worker));
+
+    for (i = 0; i < cl->n_workers; i++) {
+        w = &cl->workers[i];
+        w->cl = cl;
+        w->idx = i;
+
+        assert(!pthread_create(&w->tid, NULL, local_worker, (void *) w));
+    }
+
+    c->state = CONN_READY;
+    c->last_active = time(NULL);
+
+    return CLUSTER_OK;
+}
+
+/* Stop local workers. Blocks being processed are finished first. */
+static void stop_workers(cluster *cl)
+{
+    int i;
+
+    if (!cl->workers) {
+        return;
+    }
+
+    LOCK(cl->lock);
+    cl->stopping = 1;
+    assert(!pthread_cond_broadcast(&cl->cond));
+    UNLOCK(cl->lock);
+
+    for (i = 0; i < cl->n_workers; i++) {
+        assert(!pthread_join(cl->workers[i].tid, NULL));
+    }
+
+    assert(!pthread_mutex_destroy(&cl->lock));
+    assert(!pthread_cond_destroy(&cl->cond));
+
+    free(cl->workers);
+    cl->workers = NULL;
+}
+
+/* Process queued blocks and hand answers over to the dispatcher */
+static void *local_worker(void *arg)
+{
+    cluster_worker *w = (cluster_worker *) arg;
+    cluster *cl = w->cl;
+    cluster_conn *c = cl->local;
+    cluster_slot *slot;
+    char x = 0;
+    int tag;
+
+    LOCK(cl->lock);
+
+    for (;;) {
+        while (!c->out_count && !cl->stopping) {
+            assert(!pthread_cond_wait(&cl->cond, &cl->lock));
+        }
+
+        if (cl->stopping) {
+            break;
+        }
+
+        tag = c->out_fifo[c->out_head];
+        c->out_head = (c->out_head + 1) % c->n_slots;
+        c->out_count--;
+
+        UNLOCK(cl->lock);
+
+        slot = &c->slots[tag];
+        memset(&slot->frame, 0, sizeof(block_frame));
+        slot->frame.tag = tag;
+        slot->rc = cl->run(cl->user, w->idx, slot->idx, &slot->frame,
+                           slot->answer);
+
+        LOCK(cl->lock);
+
+        /* The dispatcher is woken up once for a batch of answers */
+        if (!cl->n_local_done) {
+            while ((write(cl->wake_fd, &x, 1) == -1) && (errno == EINTR));
+        }
+
+        cl->local_done[cl->n_local_done++] = tag;
+    }
+
+    UNLOCK(cl->lock);
+
+    return NULL;
+}
+
+/* Hand block over to local workers */
+static int queue_local(cluster *cl, cluster_conn *c, int tag)
+{
+    LOCK(cl->lock);
+
+    c->out_fifo[(c->out_head + c->out_count) % c->n_slots] = tag;
+    c->out_count++;
+    assert(!pthread_cond_signal(&cl->cond));
+
+    UNLOCK(cl->lock);
+
+    return CLUSTER_OK;
+}
+
+/* Consume answers of local workers */
+static int collect_local(cluster *cl, cluster_conn *c)
+{
+    cluster_slot *slot;
+    char buf[64];
+    ssize_t nread;
+    int tag;
+
+    /* Drain wake-ups before looking for answers,
+     * so that no answer is left unnoticed */
+    do {
+        nread = read(c->fd, buf, sizeof(buf));
+    } while ((nread > 0) || ((nread == -1) && (errno == EINTR)));
+
+    c->last_active = time(NULL);
+
+    for (;;) {
+        LOCK(cl->lock);
+
+        if (!cl->n_local_done) {
+            UNLOCK(cl->lock);
+            break;
+        }
+
+        tag = cl->local_done[--cl->n_local_done];
+
+        UNLOCK(cl->lock);
+
+        slot = &c->slots[tag];
+
+        if (slot->rc != CLUSTER_OK) {
+            return CLUSTER_ERROR;
+        }
+
+        if (finish_block(cl, c, slot, slot->answer,
+            slot->frame.size) != CLUSTER_OK)
+        {
+            return CLUSTER_ERROR;
+        }
+    }
+
+    return CLUSTER_OK;
+}
+#endif
+
+#endif /* ENABLE_CLUSTER */
@@ -0,0 +1,259 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006,2007,2010 Alexander Simakov, <xander@entropyware.info>
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+#ifndef __CLUSTER_H__
+#define __CLUSTER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef ENABLE_CLUSTER
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <time.h>
+#include <cmd_start_node.h>
+
+#ifdef ENABLE_PTHREADS
+# include <pthread.h>
+#endif
+
+/* Return codes of the dispatcher and its callbacks */
+#define CLUSTER_OK              0
+#define CLUSTER_SKIP            1
+#define CLUSTER_ERROR           2
+/* Connection failed, its blocks can be sent elsewhere */
+#define CLUSTER_FAILED          3
+
+/* Connection states */
+#define CONN_CONNECTING         0
+#define CONN_HELLO              1
+#define CONN_ACK                2
+#define CONN_READY              3
+#define CONN_FAILED             4
+#define CONN_DEAD               5
+
+/* Initial size of the answer buffer */
+#define CLUSTER_BUF_SIZE        65536
+
+/* Vectors per write, IOV_MAX on Linux */
+#define CLUSTER_MAX_IOV         1024
+
+/* Size of the last error message of a connection */
+#define CLUSTER_MSG_SIZE        256
+
+/* Number of times a block lost with a connection is sent again */
+#define MAX_BLOCK_RETRIES       3
+
+/* Number of times a failed connection is opened again */
+#define MAX_RECONNECTS          3
+
+/* Seconds to wait before reconnecting */
+#define RECONNECT_DELAY         5
+
+/* Weight of the newest sample in moving averages */
+#define EWMA_WEIGHT             0.25
+
+/* A block still in flight is sent to another connection as well
+ * if that connection is expected to finish it this many times
+ * sooner */
+#define SPECULATE_GAIN          2.0
+
+/* Cluster configuration. Local worker threads of the MASTER
+ * may process blocks along with the nodes. */
+typedef struct cluster_nodes_tag {
+    node_addr addr[MAX_CLUSTER_NODES];
+    int n_nodes;
+    int window;
+    int n_local;
+} cluster_nodes;
+
+/* Request payload. The fill callback either copies payload
+ * into `buf' or points `segs' at memory which stays valid
+ * while the dispatcher runs: such payload is sent straight
+ * from there. */
+typedef struct cluster_payload_tag {
+    unsigned char *buf;
+    struct iovec *segs;
+    int n_segs;
+} cluster_payload;
+
+/* Block in flight */
+typedef struct cluster_slot_tag {
+    /* Block index or -1 if the slot is free */
+    int idx;
+    /* Request header, kept until answered */
+    block_frame frame;
+    /* Answer of a local worker and its return code */
+    unsigned char *answer;
+    int rc;
+    /* Frame header followed by copied payload, freed once
+     * sent, and payload segments */
+    unsigned char *req;
+    int req_len;
+    struct iovec *segs;
+    int n_segs;
+    /* Dispatch time */
+    double sent;
+} cluster_slot;
+
+/* Connection to a cluster node. Local workers are driven
+ * as a connection too: requests are queued to the worker
+ * threads, which wake up the dispatcher through a pipe. */
+typedef struct cluster_conn_tag {
+    node_addr *addr;
+    char name[MAX_NODE_NAME];
+    int local;
+    int fd;
+    int state;
+    int events;
+    time_t last_active;
+    /* Accepted window and blocks in flight, indexed by tag */
+    int window;
+    cluster_slot *slots;
+    int n_slots;
+    int n_busy;
+    /* Requests waiting to be sent (or taken by a local worker):
+     * slot numbers, oldest first */
+    int *out_fifo;
+    int out_head;
+    int out_count;
+    int out_pos;
+    /* Answers: unparsed data is in_buf[in_pos..in_len) */
+    unsigned char *in_buf;
+    int in_size;
+    int in_pos;
+    int in_len;
+    /* Moving averages of the time per block while the connection
+     * is busy and of the round trip time, in seconds (0 if not
+     * measured yet). The first one is measured from `mark'. */
+    double service;
+    double latency;
+    double mark;
+    int n_done;
+    /* Failure statistics and last error message */
+    int n_failures;
+    int n_resent;
+    time_t retry_at;
+    char error[CLUSTER_MSG_SIZE];
+} cluster_conn;
+
+/* Local worker thread */
+typedef struct cluster_worker_tag {
+    struct cluster_tag *cl;
+    int idx;
+#ifdef ENABLE_PTHREADS
+    pthread_t tid;
+#endif
+} cluster_worker;
+
+/* Block dispatcher. All connections are driven from a single
+ * thread with non-blocking I/O. Blocks are taken from a shared
+ * queue in ascending order, so a slow connection only holds
+ * back blocks it is working on. Near the end of the queue blocks
+ * go to connections expected to finish them first, and blocks
+ * stuck on slow connections are duplicated on fast ones. Blocks
+ * of failed connections are sent again to the other ones. */
+typedef struct cluster_tag {
+    int epoll_fd;
+    cluster_conn *conns;
+    int n_conns;
+    int window;
+    /* Local workers, their connection (NULL if there are no
+     * workers) and the write end of its wake-up pipe */
+    cluster_worker *workers;
+    int n_workers;
+    cluster_conn *local;
+    int wake_fd;
+    /* Blocks processed by local workers, slot numbers */
+    int *local_done;
+    int n_local_done;
+    int stopping;
+#ifdef ENABLE_PTHREADS
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+    /* General parameters, sent after the protocol handshake */
+    unsigned char *hello;
+    int hello_len;
+    int hello_size;
+    /* Block queue */
+    int n_blocks;
+    int next_block;
+    int n_done;
+    int low;
+    unsigned char *finished;
+    /* Number of connections working on each block */
+    unsigned char *copies;
+    /* Number of failed attempts for each block */
+    unsigned char *failures;
+    /* Blocks of failed connections waiting to be sent again */
+    int *requeued;
+    int n_requeued;
+    /* A block is not dispatched unless it is less than `horizon'
+     * blocks ahead of the first unfinished one (0 for no limit) */
+    int horizon;
+    /* Payload limits: bytes and segments of a request */
+    int max_request;
+    int max_answer;
+    int max_segs;
+    /* Prepare request for block `idx': fill frame fields and
+     * payload (at most `max_request' bytes). May return
+     * CLUSTER_SKIP to drop the block. */
+    int (*fill)(void *user, int idx, block_frame *frame,
+                cluster_payload *payload);
+    /* Consume answer of `size' bytes for block `idx', which
+     * was requested with `frame' */
+    int (*done)(void *user, int idx, block_frame *frame,
+                unsigned char *payload, int size);
+    /* Process block `idx' in local worker `worker' (runs in that
+     * worker's thread): fill frame fields and write the answer
+     * a node would send (at most `max_answer' bytes, its size
+     * goes to frame->size). Required if there are local workers. */
+    int (*run)(void *user, int worker, int idx, block_frame *frame,
+               unsigned char *answer);
+    void *user;
+    int quiet;
+} cluster;
+
+void cluster_init(cluster *cl, cluster_nodes *nodes, int n_blocks,
+                  int quiet);
+void cluster_hello_value(cluster *cl, int value);
+void cluster_hello_buf(cluster *cl, void *buf, int len);
+int cluster_run(cluster *cl);
+void cluster_free(cluster *cl);
+
+#endif /* ENABLE_CLUSTER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CLUSTER_H__ */
@@ -33,8 +33,8 @@
 #ifdef ENABLE_CLUSTER
 # include <sys/socket.h>
 # include <sys/types.h>
-# include <signal.h>
 # include <cmd_start_node.h>
+# include <cluster.h>
 #endif
 
 #ifdef ENABLE_MPI
@@ -88,30 +88,70 @@ static void replace_psi_to_pbm(char *file, int pbm_type)
     }
 }
 
-/* Decode subset of blocks */
-static void *decode_blocks(void *arg) {
-    /* All arguments are packed into this structure */
-    decode_ctx *ctx = (decode_ctx *) arg;
+#ifdef ENABLE_PTHREADS
+/* Print mutex */
+static pthread_mutex_t p_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
+/* Report decoding progress */
+static void decode_progress(decode_ctx *ctx)
+{
     /* Text buffers to render decoding progress */
     char progress_buf[MAX_LINE];
     char timer_buf[MAX_TIMER_LINE];
+    time_t cur_time;
+
+    if (ctx->quiet == OPT_YES) {
+        return;
+    }
+
+    LOCK(p_lock);
+    cur_time = time(NULL);
+
+    snprintf(progress_buf, sizeof(progress_buf),
+        "Decoding file (%d of %d): %s - %.2f%% done in %s",
+        ctx->current + 1, ctx->total, ctx->psi_file,
+        (100.0 * MIN(atomic_get(ctx->done_blocks), ctx->n_blocks) /
+        ctx->n_blocks),
+        format_time((int)(cur_time - ctx->start_time),
+        timer_buf, sizeof(timer_buf)));
+
+    print_blank_line(*ctx->clear_len);
+    *ctx->clear_len = strlen(progress_buf);
+    printf("%s\r", progress_buf);
+    fflush(stdout);
+    UNLOCK(p_lock);
+}
+
+#ifndef ENABLE_CLUSTER
+/* Decode subset of blocks */
+static void *decode_blocks(void *arg) {
+    /* All arguments are packed into this structure */
+    decode_ctx *ctx = (decode_ctx *) arg;
 
 #ifdef ENABLE_PTHREADS
-    /* Print mutex */
-    static pthread_mutex_t p_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifndef PSI_MMAP
     /* Read mutex */
     static pthread_mutex_t r_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#ifndef PBM_PREAD
     /* Write mutex */
     static pthread_mutex_t w_lock = PTHREAD_MUTEX_INITIALIZER;
-    /* Stop mutex */
-    static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
-    /* EOF-check mutex */
-    static pthread_mutex_t e_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 #endif
 
     /* Input buffer */
-    unsigned char *buf;
+    unsigned char *buf = NULL;
+    unsigned char *block;
+    int buf_alloc = 0;
+
+    /* Current batch of blocks */
+    unsigned char *batch[DECODE_BATCH];
+    int batch_sizes[DECODE_BATCH];
+    int first = 0;
+    int n_batch = 0;
+    int n_avail = 0;
+    int k = 0;
 
     /* Output buffers */
     unsigned char **Y;
@@ -119,23 +159,9 @@ static void *decode_blocks(void *arg) {
     unsigned char **G;
     unsigned char **B;
 
-#ifdef ENABLE_CLUSTER
-    unsigned char *Y0;
-
-    int sock_fd;
-    int action = ctx->pbm->type == PBM_TYPE_PGM ?
-        ACTION_DECODE_GS : ACTION_DECODE_TC;
-
-    char ip_addr[INET_ADDRSTRLEN];
-    int port;
-#endif
-
     /* Handy shortcuts */
     int max_block_w = ctx->psi->max_block_w;
     int max_block_h = ctx->psi->max_block_h;
-#ifdef ENABLE_CLUSTER
-    int block_size = MAX(max_block_w, max_block_h);
-#endif
     int W = ctx->W;
     int H = ctx->H;
     int quiet = ctx->quiet;
@@ -143,10 +169,6 @@ static void *decode_blocks(void *arg) {
     /* Error flag */
     int error_flag = 0;
 
-    /* Allocate input buffer */
-    buf = (unsigned char *) eps_xmalloc(ctx->buf_size *
-        sizeof(unsigned char));
-
     /* Allocate output buffers */
     if (ctx->pbm->type == PBM_TYPE_PGM) {
         Y = (unsigned char **) eps_malloc_2D(max_block_w, max_block_h,
@@ -162,58 +184,15 @@ static void *decode_blocks(void *arg) {
             sizeof(unsigned char));
     }
 
-#ifdef ENABLE_CLUSTER
-    Y0 = (unsigned char *) xmalloc(block_size * block_size *
-        sizeof(unsigned char));
-
-    /* Get IP address and port number */
-    inet_ntop(AF_INET, &ctx->node->sin_addr, ip_addr, INET_ADDRSTRLEN);
-    port = ntohs(ctx->node->sin_port);
-
-    /* Create socket */
-    if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        LOCK(p_lock);
-        printf("%sCannot create socket for %s port %d: %m\n",
-            QUIET, ip_addr, port);
-        UNLOCK(p_lock);
-
-        /* Stop this thread and ask to stop other threads */
-        error_flag = 1;
-        goto error;
-    }
-
-    /* Connect to the cluster node */
-    if (connect(sock_fd, (CSA *) ctx->node, sizeof(struct sockaddr_in)) != 0) {
-        LOCK(p_lock);
-        printf("%sCannot connect to %s port %d: %m\n",
-            QUIET, ip_addr, port);
-        UNLOCK(p_lock);
-
-        /* Stop this thread and ask to stop other threads */
-        error_flag = 1;
-        goto error;
-    }
-
-    /* Do not halt on `Broken pipe' error */
-    set_signal(SIGPIPE, SIG_IGN);
-
-    /* Send parameters that are common for GS and TC images */
-    SEND_VALUE_TO_SLAVE(action);
-    SEND_VALUE_TO_SLAVE(ctx->buf_size);
-    SEND_VALUE_TO_SLAVE(block_size);
-#endif
-
     /* Process blocks */
     while (1) {
         eps_block_header hdr;
-        int real_buf_size = ctx->buf_size;
-        int rc;
+        int real_buf_size;
+        int rc = PSI_OK;
 
 #ifdef ENABLE_PTHREADS
         /* Check stop flag */
-        LOCK(s_lock);
-        error_flag = *ctx->stop_flag;
-        UNLOCK(s_lock);
+        error_flag = atomic_get(ctx->stop_flag);
 
         /* Stop the thread */
         if (error_flag) {
@@ -221,20 +200,58 @@ static void *decode_blocks(void *arg) {
         }
 #endif
 
-        /* Are there any unprocessed blocks? */
-        LOCK(e_lock);
-        if (*ctx->done_blocks == ctx->n_blocks) {
-            UNLOCK(e_lock);
-            break;
-        } else {
-            (*ctx->done_blocks)++;
+        /* Claim next batch of unprocessed blocks */
+        if (k == n_batch) {
+            int size;
+
+            /* Update progress indicator once the previous
+             * batch is done */
+            if (n_batch) {
+                atomic_add(ctx->done_blocks, n_batch);
+                decode_progress(ctx);
+            }
+
+            first = atomic_add(ctx->next_block, DECODE_BATCH);
+
+            if (first >= ctx->n_blocks) {
+                break;
+            }
+
+            n_batch = MIN(DECODE_BATCH, ctx->n_blocks - first);
+            n_avail = MAX(0, MIN(n_batch, ctx->psi->n_blocks - first));
+            k = 0;
+
+            size = psi_blocks_size(ctx->psi, first, n_avail,
+                                   ctx->buf_size);
+
+            if (size > buf_alloc) {
+                free(buf);
+                buf = (unsigned char *) eps_xmalloc(size *
+                    sizeof(unsigned char));
+                buf_alloc = size;
+            }
+
+            /* Read the whole batch at once */
+#ifndef PSI_MMAP
+            LOCK(r_lock);
+#endif
+            rc = psi_get_blocks(ctx->psi, first, n_avail, ctx->buf_size,
+                                buf, batch, batch_sizes);
+#ifndef PSI_MMAP
+            UNLOCK(r_lock);
+#endif
+        }
+
+        /* Block list is shorter than expected */
+        if ((rc == PSI_OK) && (k == n_avail)) {
+            rc = PSI_EOF;
         }
-        UNLOCK(e_lock);
 
-        /* Read next input block */
-        LOCK(r_lock);
-        rc = psi_read_next_block(ctx->psi, buf, &real_buf_size);
-        UNLOCK(r_lock);
+        if (rc == PSI_OK) {
+            block = batch[k];
+            real_buf_size = batch_sizes[k];
+            k++;
+        }
 
         if (rc != PSI_OK) {
             error_flag = 1;
@@ -266,7 +283,7 @@ static void *decode_blocks(void *arg) {
         }
 
         /* Parse and check block header */
-        rc = eps_read_block_header(buf, real_buf_size, &hdr);
+        rc = eps_read_block_header(block, real_buf_size, &hdr);
 
         if (rc != EPS_OK) {
             switch (rc) {
@@ -294,7 +311,9 @@ static void *decode_blocks(void *arg) {
         }
 
         /* Check header CRC flag */
-        if ((hdr.chk_flag == EPS_BAD_CRC) && (ctx->ignore_hdr_crc == OPT_NO)) {
+        if ((hdr.chk_flag == EPS_BAD_CRC) &&
+            (ctx->ignore_hdr_crc == OPT_NO))
+        {
             error_flag = 1;
 
             LOCK(p_lock);
@@ -305,7 +324,9 @@ static void *decode_blocks(void *arg) {
         }
 
         /* Check data CRC flag */
-        if ((hdr.crc_flag == EPS_BAD_CRC) && (ctx->ignore_data_crc == OPT_NO)) {
+        if ((hdr.crc_flag == EPS_BAD_CRC) &&
+            (ctx->ignore_data_crc == OPT_NO))
+        {
             error_flag = 1;
 
             LOCK(p_lock);
@@ -315,74 +336,32 @@ static void *decode_blocks(void *arg) {
             goto error;
         }
 
+        /* Skip over broken blocks and blocks that do not fit
+         * buffers sized from the block index */
         if (ctx->pbm->type == PBM_TYPE_PGM) {
-            /* Skip over broken blocks */
-            if ((hdr.hdr_data.gs.W != W) || (hdr.hdr_data.gs.H != H)) {
+            if ((hdr.hdr_data.gs.W != W) || (hdr.hdr_data.gs.H != H) ||
+                (hdr.hdr_data.gs.w > max_block_w) ||
+                (hdr.hdr_data.gs.h > max_block_h))
+            {
                 continue;
             }
+        } else {
+            if ((hdr.hdr_data.tc.W != W) || (hdr.hdr_data.tc.H != H) ||
+                (hdr.hdr_data.tc.w > max_block_w) ||
+                (hdr.hdr_data.tc.h > max_block_h))
+            {
+                continue;
+            }
+        }
 
-#ifdef ENABLE_CLUSTER
-            /* Send encoded data */
-            SEND_VALUE_TO_SLAVE(real_buf_size);
-            SEND_BUF_TO_SLAVE(buf, real_buf_size);
-
-            /* Receive raw data */
-            RECV_BUF_FROM_SLAVE(Y0, hdr.hdr_data.gs.w * hdr.hdr_data.gs.h);
-            transform_1D_to_2D(Y0, Y, hdr.hdr_data.gs.w, hdr.hdr_data.gs.h);
-#else
+        /* Decode block */
+        if (ctx->pbm->type == PBM_TYPE_PGM) {
             /* All function parameters are checked at the moment,
              * so everything except EPS_OK is a logical error. */
-            rc = eps_decode_grayscale_block(Y, buf, &hdr);
+            rc = eps_decode_grayscale_block(Y, block, &hdr);
             assert(rc == EPS_OK);
-#endif
-
-            LOCK(w_lock);
-            rc = pbm_write_pgm(ctx->pbm, Y,
-                               hdr.hdr_data.gs.x, hdr.hdr_data.gs.y,
-                               hdr.hdr_data.gs.w, hdr.hdr_data.gs.h);
-            UNLOCK(w_lock);
-
-            if (rc != PBM_OK) {
-                error_flag = 1;
-
-                switch (rc) {
-                    case PBM_SYSTEM_ERROR:
-                    {
-                        LOCK(p_lock);
-                        printf("%sCannot write block to %s: %m\n", QUIET, ctx->pbm_file);
-                        UNLOCK(p_lock);
-
-                        goto error;
-                    }
-                    default:
-                    {
-                        assert(0);
-                    }
-                }
-            }
         } else {
-            /* Skip over broken blocks */
-            if ((hdr.hdr_data.tc.W != W) || (hdr.hdr_data.tc.H != H)) {
-                continue;
-            }
-
-#ifdef ENABLE_CLUSTER
-            /* Send encoded data */
-            SEND_VALUE_TO_SLAVE(real_buf_size);
-            SEND_BUF_TO_SLAVE(buf, real_buf_size);
-
-            /* Receive raw data */
-            RECV_BUF_FROM_SLAVE(Y0, hdr.hdr_data.tc.w * hdr.hdr_data.tc.h);
-            transform_1D_to_2D(Y0, R, hdr.hdr_data.tc.w, hdr.hdr_data.tc.h);
-
-            RECV_BUF_FROM_SLAVE(Y0, hdr.hdr_data.tc.w * hdr.hdr_data.tc.h);
-            transform_1D_to_2D(Y0, G, hdr.hdr_data.tc.w, hdr.hdr_data.tc.h);
-
-            RECV_BUF_FROM_SLAVE(Y0, hdr.hdr_data.tc.w * hdr.hdr_data.tc.h);
-            transform_1D_to_2D(Y0, B, hdr.hdr_data.tc.w, hdr.hdr_data.tc.h);
-#else
-            /* Decode block */
-            rc = eps_decode_truecolor_block(R, G, B, buf, &hdr);
+            rc = eps_decode_truecolor_block(R, G, B, block, &hdr);
 
             if (rc != EPS_OK) {
                 switch (rc) {
@@ -397,54 +376,43 @@ static void *decode_blocks(void *arg) {
                     }
                 }
             }
-#endif
+        }
 
-            /* Write encoded block */
-            LOCK(w_lock);
+        /* Write decoded block */
+#ifndef PBM_PREAD
+        LOCK(w_lock);
+#endif
+        if (ctx->pbm->type == PBM_TYPE_PGM) {
+            rc = pbm_write_pgm(ctx->pbm, Y,
+                               hdr.hdr_data.gs.x, hdr.hdr_data.gs.y,
+                               hdr.hdr_data.gs.w, hdr.hdr_data.gs.h);
+        } else {
             rc = pbm_write_ppm(ctx->pbm, R, G, B,
                                hdr.hdr_data.tc.x, hdr.hdr_data.tc.y,
                                hdr.hdr_data.tc.w, hdr.hdr_data.tc.h);
-            UNLOCK(w_lock);
+        }
+#ifndef PBM_PREAD
+        UNLOCK(w_lock);
+#endif
 
-            if (rc != PBM_OK) {
-                error_flag = 1;
+        if (rc != PBM_OK) {
+            error_flag = 1;
 
-                switch (rc) {
-                    case PBM_SYSTEM_ERROR:
-                    {
-                        LOCK(p_lock);
-                        printf("%sCannot write block to %s: %m\n", QUIET, ctx->pbm_file);
-                        UNLOCK(p_lock);
+            switch (rc) {
+                case PBM_SYSTEM_ERROR:
+                {
+                    LOCK(p_lock);
+                    printf("%sCannot write block to %s: %m\n", QUIET, ctx->pbm_file);
+                    UNLOCK(p_lock);
 
-                        goto error;
-                    }
-                    default:
-                    {
-                        assert(0);
-                    }
+                    goto error;
+                }
+                default:
+                {
+                    assert(0);
                 }
             }
         }
-
-        /* Update progress indicator */
-        if (quiet != OPT_YES) {
-            time_t cur_time;
-            LOCK(p_lock);
-            cur_time = time(NULL);
-
-            snprintf(progress_buf, sizeof(progress_buf),
-                "Decoding file (%d of %d): %s - %.2f%% done in %s",
-                ctx->current + 1, ctx->total, ctx->psi_file,
-                (100.0 * *ctx->done_blocks / ctx->n_blocks),
-                format_time((int)(cur_time - ctx->start_time),
-                timer_buf, sizeof(timer_buf)));
-
-            print_blank_line(*ctx->clear_len);
-            *ctx->clear_len = strlen(progress_buf);
-            printf("%s\r", progress_buf);
-            fflush(stdout);
-            UNLOCK(p_lock);
-        }
     }
 
 error:
@@ -452,17 +420,10 @@ error:
 #ifdef ENABLE_PTHREADS
     /* Ask other threads to stop */
     if (error_flag) {
-        LOCK(s_lock);
-        *ctx->stop_flag = 1;
-        UNLOCK(s_lock);
+        atomic_set(ctx->stop_flag, 1);
     }
 #endif
 
-#ifdef ENABLE_CLUSTER
-    /* Close connection */
-    close(sock_fd);
-#endif
-
     /* Free input buffer */
     free(buf);
 
@@ -475,14 +436,259 @@ error:
         eps_free_2D((void **) B, max_block_w, max_block_h);
     }
 
-#ifdef ENABLE_CLUSTER
-    free(Y0);
-#endif
-
     /* Return 0 for success or 0 for error */
     return (void *) error_flag;
 }
 
+#else
+/* Read block and check its header before sending it to a node */
+static int decode_fill(void *arg, int idx, block_frame *frame,
+                       cluster_payload *payload)
+{
+    decode_ctx *ctx = (decode_ctx *) arg;
+    eps_block_header hdr;
+    unsigned char *block;
+    int real_buf_size;
+    int quiet = ctx->quiet;
+    int rc = PSI_OK;
+    int k;
+
+    /* Blocks are requested in ascending order, except
+     * for duplicates of blocks stuck on slow nodes */
+    if ((idx < ctx->first) || (idx >= ctx->first + ctx->n_batch)) {
+        int size;
+
+        ctx->first = idx;
+        ctx->n_batch = MIN(DECODE_BATCH, ctx->n_blocks - idx);
+        ctx->n_avail = MAX(0, MIN(ctx->n_batch, ctx->psi->n_blocks - idx));
+
+        size = psi_blocks_size(ctx->psi, idx, ctx->n_avail, ctx->buf_size);
+
+        if (size > ctx->buf_alloc) {
+            free(ctx->buf);
+            ctx->buf = (unsigned char *) eps_xmalloc(size *
+                sizeof(unsigned char));
+            ctx->buf_alloc = size;
+        }
+
+        /* Read the whole batch at once */
+        rc = psi_get_blocks(ctx->psi, idx, ctx->n_avail, ctx->buf_size,
+                            ctx->buf, ctx->batch, ctx->batch_sizes);
+    }
+
+    k = idx - ctx->first;
+
+    /* Block list is shorter than expected */
+    if ((rc == PSI_OK) && (k >= ctx->n_avail)) {
+        rc = PSI_EOF;
+    }
+
+    if (rc != PSI_OK) {
+        /* Do not reuse broken batch */
+        ctx->n_batch = 0;
+
+        switch (rc) {
+            case PSI_SYSTEM_ERROR:
+            {
+                printf("%sCannot read block from %s: %m\n",
+                    QUIET, ctx->psi_file);
+                return CLUSTER_ERROR;
+            }
+            case PSI_EOF:
+            {
+                printf("%sUnexpected end of file: %s\n",
+                    QUIET, ctx->psi_file);
+                return CLUSTER_ERROR;
+            }
+            default:
+            {
+                assert(0);
+            }
+        }
+    }
+
+    block = ctx->batch[k];
+    real_buf_size = ctx->batch_sizes[k];
+
+    /* Parse and check block header */
+    rc = eps_read_block_header(block, real_buf_size, &hdr);
+
+    if (rc != EPS_OK) {
+        switch (rc) {
+            case EPS_FORMAT_ERROR:
+            {
+                if (ctx->ignore_format_err == OPT_NO) {
+                    printf("%sMalformed block: %s\n",
+                        QUIET, ctx->psi_file);
+                    return CLUSTER_ERROR;
+                }
+
+                /* Skip over malformed block */
+                (*ctx->done_blocks)++;
+                return CLUSTER_SKIP;
+            }
+            default:
+            {
+                assert(0);
+            }
+        }
+    }
+
+    /* Check header CRC flag */
+    if ((hdr.chk_flag == EPS_BAD_CRC) && (ctx->ignore_hdr_crc == OPT_NO)) {
+        printf("%sIncorrect header CRC: %s\n", QUIET, ctx->psi_file);
+        return CLUSTER_ERROR;
+    }
+
+    /* Check data CRC flag */
+    if ((hdr.crc_flag == EPS_BAD_CRC) && (ctx->ignore_data_crc == OPT_NO)) {
+        printf("%sIncorrect data CRC: %s\n", QUIET, ctx->psi_file);
+        return CLUSTER_ERROR;
+    }
+
+    /* Skip over broken blocks and blocks that do not fit buffers
+     * sized from the block index. Block geometry stays with the
+     * request until the answer comes. */
+    if (ctx->pbm->type == PBM_TYPE_PGM) {
+        if ((hdr.hdr_data.gs.W != ctx->W) || (hdr.hdr_data.gs.H != ctx->H) ||
+            (hdr.hdr_data.gs.w > ctx->psi->max_block_w) ||
+            (hdr.hdr_data.gs.h > ctx->psi->max_block_h))
+        {
+            (*ctx->done_blocks)++;
+            return CLUSTER_SKIP;
+        }
+
+        frame->x = hdr.hdr_data.gs.x;
+        frame->y = hdr.hdr_data.gs.y;
+        frame->w = hdr.hdr_data.gs.w;
+        frame->h = hdr.hdr_data.gs.h;
+    } else {
+        if ((hdr.hdr_data.tc.W != ctx->W) || (hdr.hdr_data.tc.H != ctx->H) ||
+            (hdr.hdr_data.tc.w > ctx->psi->max_block_w) ||
+            (hdr.hdr_data.tc.h > ctx->psi->max_block_h))
+        {
+            (*ctx->done_blocks)++;
+            return CLUSTER_SKIP;
+        }
+
+        frame->x = hdr.hdr_data.tc.x;
+        frame->y = hdr.hdr_data.tc.y;
+        frame->w = hdr.hdr_data.tc.w;
+        frame->h = hdr.hdr_data.tc.h;
+    }
+
+    memcpy(payload->buf, block, real_buf_size);
+    frame->size = real_buf_size;
+
+    return CLUSTER_OK;
+}
+
+/* Write block decoded by a cluster node */
+static int decode_done(void *arg, int idx, block_frame *frame,
+                       unsigned char *payload, int size)
+{
+    decode_ctx *ctx = (decode_ctx *) arg;
+    int quiet = ctx->quiet;
+    int w = frame->w;
+    int h = frame->h;
+    int rc;
+
+    /* Raw data comes channel after channel */
+    if (ctx->pbm->type == PBM_TYPE_PGM) {
+        if (size != w * h) {
+            goto size_error;
+        }
+
+        transform_1D_to_2D(payload, ctx->block[0], w, h);
+        rc = pbm_write_pgm(ctx->pbm, ctx->block[0], frame->x, frame->y,
+                           w, h);
+    } else {
+        if (size != 3 * w * h) {
+            goto size_error;
+        }
+
+        transform_1D_to_2D(payload, ctx->block[0], w, h);
+        transform_1D_to_2D(payload + w * h, ctx->block[1], w, h);
+        transform_1D_to_2D(payload + 2 * w * h, ctx->block[2], w, h);
+        rc = pbm_write_ppm(ctx->pbm, ctx->block[0], ctx->block[1],
+                           ctx->block[2], frame->x, frame->y, w, h);
+    }
+
+    if (rc != PBM_OK) {
+        switch (rc) {
+            case PBM_SYSTEM_ERROR:
+            {
+                printf("%sCannot write block to %s: %m\n",
+                    QUIET, ctx->pbm_file);
+                return CLUSTER_ERROR;
+            }
+            default:
+            {
+                assert(0);
+            }
+        }
+    }
+
+    /* Update progress indicator */
+    (*ctx->done_blocks)++;
+    decode_progress(ctx);
+
+    return CLUSTER_OK;
+
+size_error:
+
+    printf("%sIncorrect size (%d) of block %d\n", QUIET, size, idx);
+    return CLUSTER_ERROR;
+}
+
+/* Decode all blocks on cluster nodes */
+static int decode_cluster(decode_ctx *ctx, cluster_nodes *nodes)
+{
+    int block_size = MAX(ctx->psi->max_block_w, ctx->psi->max_block_h);
+    int n_channels;
+    cluster cl;
+    int rc;
+    int k;
+
+    n_channels = ctx->pbm->type == PBM_TYPE_PGM ? 1 : 3;
+
+    for (k = 0; k < n_channels; k++) {
+        ctx->block[k] = (unsigned char **) eps_malloc_2D(block_size,
+            block_size, sizeof(unsigned char));
+    }
+
+    ctx->buf = NULL;
+    ctx->buf_alloc = 0;
+    ctx->first = ctx->n_batch = ctx->n_avail = 0;
+
+    cluster_init(&cl, nodes, ctx->n_blocks, ctx->quiet);
+
+    /* Parameters that are common for GS and TC images */
+    cluster_hello_value(&cl, n_channels == 1 ?
+        ACTION_DECODE_GS : ACTION_DECODE_TC);
+    cluster_hello_value(&cl, ctx->buf_size);
+    cluster_hello_value(&cl, block_size);
+
+    /* Blocks are written in place, so there is no horizon */
+    cl.max_request = ctx->buf_size;
+    cl.max_answer = n_channels * block_size * block_size;
+    cl.fill = decode_fill;
+    cl.done = decode_done;
+    cl.user = ctx;
+
+    rc = cluster_run(&cl);
+    cluster_free(&cl);
+
+    for (k = 0; k < n_channels; k++) {
+        eps_free_2D((void **) ctx->block[k], block_size, block_size);
+    }
+
+    free(ctx->buf);
+
+    return rc != CLUSTER_OK;
+}
+#endif
+
 #ifdef ENABLE_MPI
 static void decode_file_mpi(int n_threads, int halt_on_errors, int quiet,
                             int ignore_hdr_crc, int ignore_data_crc,
@@ -904,14 +1110,16 @@ static void decode_file(int n_threads, void *cluster, int halt_on_errors,
 #ifdef ENABLE_PTHREADS
     /* Arrays for thread CTXs and IDs */
     decode_ctx ctx[MAX_N_THREADS];
+#ifndef ENABLE_CLUSTER
     pthread_t tid[MAX_N_THREADS];
+#endif
 #else
     /* Single context for thread-unaware version */
     decode_ctx ctx[1];
 #endif
 
 #ifdef ENABLE_CLUSTER
-    struct sockaddr_in *nodes = (struct sockaddr_in *) cluster;
+    cluster_nodes *nodes = (cluster_nodes *) cluster;
 #endif
 
     /* Input buffer size */
@@ -921,6 +1129,7 @@ static void decode_file(int n_threads, void *cluster, int halt_on_errors,
     int max_block_w, max_block_h;
     int x_blocks, y_blocks;
     int n_blocks, done_blocks;
+    int next_block;
 
     int clear_len;
     int stop_flag;
@@ -1049,13 +1258,14 @@ static void decode_file(int n_threads, void *cluster, int halt_on_errors,
         fflush(stdout);
     }
 
-    done_blocks = stop_flag = 0;
+    done_blocks = next_block = stop_flag = 0;
 
     /* Prepare CTXs */
     for (i = 0; i < n_threads; i++) {
         ctx[i].buf_size = buf_size;
         ctx[i].n_blocks = n_blocks;
         ctx[i].done_blocks = &done_blocks;
+        ctx[i].next_block = &next_block;
         ctx[i].clear_len = &clear_len;
         ctx[i].W = W;
         ctx[i].H = H;
@@ -1064,9 +1274,6 @@ static void decode_file(int n_threads, void *cluster, int halt_on_errors,
         ctx[i].pbm_file = pbm_file;
         ctx[i].psi = &psi;
         ctx[i].pbm = &pbm;
-#ifdef ENABLE_CLUSTER
-        ctx[i].node = &nodes[i];
-#endif
         ctx[i].current = current;
         ctx[i].total = total;
         ctx[i].ignore_hdr_crc = ignore_hdr_crc;
@@ -1076,7 +1283,10 @@ static void decode_file(int n_threads, void *cluster, int halt_on_errors,
         ctx[i].stop_flag = &stop_flag;
     }
 
-#ifdef ENABLE_PTHREADS
+#ifdef ENABLE_CLUSTER
+    /* Dispatch blocks to cluster nodes */
+    rc = decode_cluster(&ctx[0], nodes);
+#elif defined(ENABLE_PTHREADS)
     /* Set concurrency level */
     assert(!pthread_setconcurrency(n_threads));
 
@@ -1113,9 +1323,10 @@ static void decode_file(int n_threads, void *cluster, int halt_on_errors,
 }
 
 /* Decode files */
-void cmd_decode_file(int n_threads, char *node_list, int halt_on_errors,
-                     int quiet, int ignore_hdr_crc, int ignore_data_crc,
-                     int ignore_format_err, char *output_dir, char **files)
+void cmd_decode_file(int n_threads, char *node_list, int window,
+                     int halt_on_errors, int quiet, int ignore_hdr_crc,
+                     int ignore_data_crc, int ignore_format_err,
+                     char *output_dir, char **files)
 {
     char timer_buf[MAX_TIMER_LINE];
     time_t total_time;
@@ -1123,36 +1334,29 @@ void cmd_decode_file(int n_threads, char *node_list, int halt_on_errors,
     int i, n;
 
 #ifdef ENABLE_CLUSTER
-    struct sockaddr_in nodes[MAX_CLUSTER_NODES];
+    cluster_nodes nodes;
 
     /* Load list of cluster nodes */
-    if (node_list) {
-        /* File is specified explicitly */
-        n_threads = load_cluster_nodes(node_list, nodes);
-    } else if (file_exists(DEFAULT_NODE_LIST)) {
-        /* Try file in the currect directory */
-        n_threads = load_cluster_nodes(DEFAULT_NODE_LIST, nodes);
-    } else {
-        if (getenv("HOME")) {
-            char pathname[MAX_PATH];
+    nodes.n_nodes = find_cluster_nodes(node_list, nodes.addr);
 
-            /* Try file in user directory */
-            snprintf(pathname, sizeof(pathname), "%s%c%s",
-                getenv("HOME"), DIR_SEPARATOR, DEFAULT_NODE_LIST);
-
-            if (file_exists(pathname)) {
-                n_threads = load_cluster_nodes(pathname, nodes);
-            } else {
-                /* Giving up */
-                printf("You should specify list of cluster nodes.\n");
-                exit(1);
-            }
-        } else {
-            /* Giving up */
-            printf("You should specify list of cluster nodes.\n");
+    /* Check window size */
+    if (window == OPT_NA) {
+        window = DEF_WINDOW;
+    } else {
+        if ((window < 1) || (window > MAX_WINDOW)) {
+            printf("Incorrect value for the window size.\n");
             exit(1);
         }
     }
+
+    nodes.window = window;
+    nodes.n_local = 0;
+
+    /* All connections are driven from a single thread */
+    n_threads = 1;
+#else
+    /* Window applies to cluster nodes only */
+    (void) window;
 #endif
 
     /* Get number of files */
@@ -1175,7 +1379,7 @@ void cmd_decode_file(int n_threads, char *node_list, int halt_on_errors,
     for (i = 0; i < n; i++) {
         void *cluster = NULL;
 #ifdef ENABLE_CLUSTER
-        cluster = nodes;
+        cluster = &nodes;
 #endif
 
 #ifdef ENABLE_MPI
@@ -1183,9 +1387,9 @@ void cmd_decode_file(int n_threads, char *node_list, int halt_on_errors,
                     ignore_data_crc, ignore_format_err, output_dir,
                     files[i], i, n);
 #else
-        decode_file(n_threads, cluster, halt_on_errors, quiet, ignore_hdr_crc,
-                    ignore_data_crc, ignore_format_err, output_dir,
-                    files[i], i, n);
+        decode_file(n_threads, cluster, halt_on_errors, quiet,
+                    ignore_hdr_crc, ignore_data_crc, ignore_format_err,
+                    output_dir, files[i], i, n);
 #endif
     }
 
@@ -29,8 +29,15 @@
 extern "C" {
 #endif
 
+#ifdef ENABLE_CLUSTER
+# include <cluster.h>
+#endif
+
 #include <time.h>
 
+/* Number of blocks a thread claims and reads at once */
+#define DECODE_BATCH            8
+
 /* Decoding context for multi-theaded environment.
  * This code is designed to be compatible with
  * thread-unaware program version. */
@@ -38,6 +45,8 @@ typedef struct decode_ctx_tag {
     int buf_size;
     int n_blocks;
     int *done_blocks;
+    /* Next block to be claimed */
+    int *next_block;
     int W;
     int H;
     int *clear_len;
@@ -46,9 +55,6 @@ typedef struct decode_ctx_tag {
     char *pbm_file;
     psi_image *psi;
     pbm_image *pbm;
-#ifdef ENABLE_CLUSTER
-    struct sockaddr_in *node;
-#endif
     int current;
     int total;
     int ignore_hdr_crc;
@@ -56,15 +62,35 @@ typedef struct decode_ctx_tag {
     int ignore_format_err;
     int quiet;
     int *stop_flag;
+#ifdef ENABLE_CLUSTER
+    /* Dispatcher buffers and current batch of blocks */
+    unsigned char **block[3];
+    unsigned char *buf;
+    int buf_alloc;
+    unsigned char *batch[DECODE_BATCH];
+    int batch_sizes[DECODE_BATCH];
+    int first;
+    int n_batch;
+    int n_avail;
+#endif
 } decode_ctx;
 
 int check_psi_ext(char *file);
 static void replace_psi_to_pbm(char *file, int pbm_type);
+static void decode_progress(decode_ctx *ctx);
+#ifndef ENABLE_CLUSTER
 static void *decode_blocks(void *arg);
+#else
+static int decode_fill(void *arg, int idx, block_frame *frame,
+                       cluster_payload *payload);
+static int decode_done(void *arg, int idx, block_frame *frame,
+                       unsigned char *payload, int size);
+static int decode_cluster(decode_ctx *ctx, cluster_nodes *nodes);
+#endif
 static void decode_file(int n_threads, void *cluster, int halt_on_errors,
                         int quiet, int ignore_hdr_crc, int ignore_data_crc,
-                        int ignore_format_err, char *file,
-                        char *output_dir, int current, int total);
+                        int ignore_format_err, char *output_dir,
+                        char *file, int current, int total);
 
 #ifdef ENABLE_MPI
 void cmd_decode_file_mpi(int n_threads, char *node_list, int halt_on_errors,
@@ -73,10 +99,10 @@ void cmd_decode_file_mpi(int n_threads, char *node_list, int halt_on_errors,
                          char **files);
 #endif
 
-void cmd_decode_file(int n_threads, char *node_list, int halt_on_errors,
-                     int quiet, int ignore_hdr_crc, int ignore_data_crc,
-                     int ignore_format_err, char *output_dir,
-                     char **files);
+void cmd_decode_file(int n_threads, char *node_list, int window,
+                     int halt_on_errors, int quiet, int ignore_hdr_crc,
+                     int ignore_data_crc, int ignore_format_err,
+                     char *output_dir, char **files);
 
 #ifdef __cplusplus
 }
@@ -33,8 +33,9 @@
 #ifdef ENABLE_CLUSTER
 # include <sys/socket.h>
 # include <sys/types.h>
-# include <signal.h>
+# include <arpa/inet.h>
 # include <cmd_start_node.h>
+# include <cluster.h>
 #endif
 
 #ifdef ENABLE_MPI
@@ -46,6 +47,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <time.h>
 #include <options.h>
 #include <misc.h>
@@ -90,9 +92,9 @@ static void replace_pbm_to_psi(char *file)
 static void encode_file_mpi(char *filter_id, int block_size, int mode,
                             double ratio, int two_pass, int n_threads,
                             int Y_ratio, int Cb_ratio, int Cr_ratio,
-                            int resample, int halt_on_errors,
-                            int quiet, char *output_dir, char *file,
-                            int current, int total)
+                            int resample, int flags, int block_index,
+                            int halt_on_errors, int quiet, char *output_dir,
+                            char *file, int current, int total)
 {
     /* Text buffers for file names */
     char pbm_file[MAX_PATH];
@@ -197,6 +199,11 @@ static void encode_file_mpi(char *filter_id, int block_size, int mode,
         }
     }
 
+    /* Collect block index */
+    if (block_index == OPT_YES) {
+        psi_enable_index(&psi);
+    }
+
     /* Allocate input buffers */
     if (pbm.type == PBM_TYPE_PGM)  {
         Y = (unsigned char **) eps_malloc_2D(block_size, block_size,
@@ -365,6 +372,11 @@ static void encode_file_mpi(char *filter_id, int block_size, int mode,
                     (MPI_Request *) &dummy) == MPI_SUCCESS);
                 FREE_DUMMY_HANDLE();
 
+                /* Encoding flags */
+                assert(MPI_Isend(&flags, 1, MPI_INT, i + 1, 0, MPI_COMM_WORLD,
+                    (MPI_Request *) &dummy) == MPI_SUCCESS);
+                FREE_DUMMY_HANDLE();
+
                 /* Image data */
                 assert(MPI_Isend(ctx[i].Y0, ctx[i].w * ctx[i].h,
                     MPI_UNSIGNED_CHAR, i + 1, 0, MPI_COMM_WORLD,
@@ -465,6 +477,11 @@ static void encode_file_mpi(char *filter_id, int block_size, int mode,
                     (MPI_Request *) &dummy) == MPI_SUCCESS);
                 FREE_DUMMY_HANDLE();
 
+                /* Encoding flags */
+                assert(MPI_Isend(&flags, 1, MPI_INT, i + 1, 0, MPI_COMM_WORLD,
+                    (MPI_Request *) &dummy) == MPI_SUCCESS);
+                FREE_DUMMY_HANDLE();
+
                 /* R image channel */
                 assert(MPI_Isend(ctx[i].R0, ctx[i].w * ctx[i].h,
                     MPI_UNSIGNED_CHAR, i + 1, 0, MPI_COMM_WORLD,
@@ -560,6 +577,11 @@ static void encode_file_mpi(char *filter_id, int block_size, int mode,
         eps_free_2D((void **) B, block_size, block_size);
     }
 
+    /* Append block index */
+    if (psi_write_index(&psi) != PSI_OK) {
+        printf("Cannot write block index to %s: %m\n", psi_file);
+    }
+
     /* Close files */
     pbm_close(&pbm);
     psi_close(&psi);
@@ -588,14 +610,289 @@ static void encode_file_mpi(char *filter_id, int block_size, int mode,
 
 #else
 
-/* Encode subset of blocks */
-static void *encode_blocks(void *arg) {
-    /* All arguments are packed into this structure */
-    encode_ctx *ctx = (encode_ctx *) arg;
+#ifdef ENABLE_PTHREADS
+/* Write encoded blocks in raster order. Runs of ready blocks
+ * are written with a single call. */
+static void *writer_thread(void *arg) {
+    block_writer *wr = (block_writer *) arg;
+    int rc;
+    int i, n;
+
+    LOCK(wr->lock);
+
+    while (wr->next < wr->n_blocks) {
+        /* Collect run of ready blocks */
+        for (n = 0; (n < wr->n_slots) && (wr->next + n < wr->n_blocks); n++) {
+            writer_slot *slot = &wr->slots[(wr->next + n) % wr->n_slots];
+
+            if (!slot->ready) {
+                break;
+            }
+
+            wr->bufs[n] = slot->data;
+            wr->buf_sizes[n] = slot->size;
+        }
+
+        if (n == 0) {
+            /* Nothing more will come */
+            if (wr->closing || wr->stopped) {
+                break;
+            }
+
+            assert(!pthread_cond_wait(&wr->ready_cond, &wr->lock));
+            continue;
+        }
+
+        /* Slots stay busy while being written */
+        UNLOCK(wr->lock);
+        rc = psi_write_blocks(wr->psi, wr->bufs, wr->buf_sizes, n);
+        LOCK(wr->lock);
+
+        if (rc != PSI_OK) {
+            wr->rc = rc;
+            wr->err = errno;
+            wr->stopped = 1;
+            atomic_set(wr->stop_flag, 1);
+            assert(!pthread_cond_broadcast(&wr->free_cond));
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            wr->slots[(wr->next + i) % wr->n_slots].ready = 0;
+        }
+
+        wr->next += n;
+        assert(!pthread_cond_broadcast(&wr->free_cond));
+    }
+
+    UNLOCK(wr->lock);
+
+    return NULL;
+}
+#else
+/* Write run of ready blocks starting at the next one */
+static int writer_flush(block_writer *wr)
+{
+    int i, n;
+
+    for (n = 0; (n < wr->n_slots) && (wr->next + n < wr->n_blocks); n++) {
+        writer_slot *slot = &wr->slots[(wr->next + n) % wr->n_slots];
+
+        if (!slot->ready) {
+            break;
+        }
+
+        wr->bufs[n] = slot->data;
+        wr->buf_sizes[n] = slot->size;
+    }
+
+    if (n == 0) {
+        return PSI_OK;
+    }
+
+    for (i = 0; i < n; i++) {
+        wr->slots[(wr->next + i) % wr->n_slots].ready = 0;
+    }
+
+    wr->next += n;
+
+    return psi_write_blocks(wr->psi, wr->bufs, wr->buf_sizes, n);
+}
+#endif
+
+/* Start ordered writer */
+static void writer_init(block_writer *wr, psi_image *psi, int n_blocks,
+                        int n_slots, int buf_size, int *stop_flag)
+{
+    int i;
+
+    wr->psi = psi;
+    wr->n_blocks = n_blocks;
+
+    wr->n_slots = MIN(n_slots, n_blocks);
+    wr->slots = (writer_slot *) eps_xmalloc(wr->n_slots *
+        sizeof(writer_slot));
+
+    for (i = 0; i < wr->n_slots; i++) {
+        wr->slots[i].data = (unsigned char *) eps_xmalloc(buf_size *
+            sizeof(unsigned char));
+        wr->slots[i].size = 0;
+        wr->slots[i].ready = 0;
+    }
+
+    wr->bufs = (unsigned char **) eps_xmalloc(wr->n_slots *
+        sizeof(unsigned char *));
+    wr->buf_sizes = (int *) eps_xmalloc(wr->n_slots * sizeof(int));
+    wr->next = 0;
+    wr->stop_flag = stop_flag;
+
+#ifdef ENABLE_PTHREADS
+    wr->stopped = wr->closing = 0;
+    wr->rc = PSI_OK;
+    wr->err = wr->reported = 0;
+
+    assert(!pthread_mutex_init(&wr->lock, NULL));
+    assert(!pthread_cond_init(&wr->ready_cond, NULL));
+    assert(!pthread_cond_init(&wr->free_cond, NULL));
+    assert(!pthread_create(&wr->tid, NULL, writer_thread, (void *) wr));
+#endif
+}
+
+/* Hand encoded block over to the writer. The caller gets a spare
+ * buffer in exchange. Blocks are dropped once the writer stops;
+ * write error is reported to the first caller only. */
+static int writer_put(block_writer *wr, int idx, unsigned char **buf,
+                      int buf_size)
+{
+    writer_slot *slot = &wr->slots[idx % wr->n_slots];
+    unsigned char *spare;
+#ifdef ENABLE_PTHREADS
+    int rc = PSI_OK;
+    int err = 0;
+
+    LOCK(wr->lock);
+
+    /* Bounded reorder window */
+    while (!wr->stopped && (idx >= wr->next + wr->n_slots)) {
+        assert(!pthread_cond_wait(&wr->free_cond, &wr->lock));
+    }
+
+    if (wr->stopped) {
+        if ((wr->rc != PSI_OK) && !wr->reported) {
+            wr->reported = 1;
+            rc = wr->rc;
+            err = wr->err;
+        }
+
+        UNLOCK(wr->lock);
+
+        /* Let the caller print the right error message */
+        if (rc != PSI_OK) {
+            errno = err;
+        }
+
+        return rc;
+    }
+#else
+    /* The only thread never gets that far ahead */
+    assert(idx < wr->next + wr->n_slots);
+#endif
+
+    spare = slot->data;
+    slot->data = *buf;
+    slot->size = buf_size;
+    slot->ready = 1;
+    *buf = spare;
 
+#ifdef ENABLE_PTHREADS
+    if (idx == wr->next) {
+        assert(!pthread_cond_signal(&wr->ready_cond));
+    }
+
+    UNLOCK(wr->lock);
+
+    return PSI_OK;
+#else
+    return writer_flush(wr);
+#endif
+}
+
+#if defined(ENABLE_PTHREADS) || defined(ENABLE_CLUSTER)
+/* Ask the writer to give up */
+static void writer_stop(block_writer *wr)
+{
+#ifdef ENABLE_PTHREADS
+    LOCK(wr->lock);
+    wr->stopped = 1;
+    assert(!pthread_cond_broadcast(&wr->free_cond));
+    assert(!pthread_cond_signal(&wr->ready_cond));
+    UNLOCK(wr->lock);
+#endif
+}
+#endif
+
+/* Write remaining blocks and stop the writer. Returns
+ * write error unless it was already reported. */
+static int writer_finish(block_writer *wr)
+{
+    int rc = PSI_OK;
+    int i;
+
+#ifdef ENABLE_PTHREADS
+    LOCK(wr->lock);
+    wr->closing = 1;
+    assert(!pthread_cond_signal(&wr->ready_cond));
+    UNLOCK(wr->lock);
+
+    assert(!pthread_join(wr->tid, NULL));
+
+    if ((wr->rc != PSI_OK) && !wr->reported) {
+        rc = wr->rc;
+        errno = wr->err;
+    }
+
+    assert(!pthread_mutex_destroy(&wr->lock));
+    assert(!pthread_cond_destroy(&wr->ready_cond));
+    assert(!pthread_cond_destroy(&wr->free_cond));
+#endif
+
+    for (i = 0; i < wr->n_slots; i++) {
+        free(wr->slots[i].data);
+    }
+
+    free(wr->slots);
+    free(wr->bufs);
+    free(wr->buf_sizes);
+
+    return rc;
+}
+
+#ifdef ENABLE_PTHREADS
+/* Print mutex */
+static pthread_mutex_t p_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Report encoding progress */
+static void encode_progress(encode_ctx *ctx)
+{
     /* Text buffers to render encoding progress */
     char progress_buf[MAX_LINE];
     char timer_buf[MAX_TIMER_LINE];
+    time_t cur_time;
+
+    if (ctx->quiet == OPT_YES) {
+        return;
+    }
+
+    LOCK(p_lock);
+    cur_time = time(NULL);
+
+    /* Increment counter of processed blocks */
+    (*ctx->done_blocks)++;
+
+    /* Format text string */
+    snprintf(progress_buf, sizeof(progress_buf),
+        "Encoding file (%d of %d): %s - %.2f%% done in %s",
+        ctx->current + 1, ctx->total, ctx->pbm_file,
+        (100.0 * *ctx->done_blocks / (ctx->n_blocks * ctx->n_passes)),
+        format_time((int)cur_time - ctx->start_time,
+        timer_buf, sizeof(timer_buf)));
+
+    /* Clear old string */
+    print_blank_line(*ctx->clear_len);
+    *ctx->clear_len = strlen(progress_buf);
+
+    /* Print next progress report and flush stdout */
+    printf("%s\r", progress_buf);
+    fflush(stdout);
+    UNLOCK(p_lock);
+}
+
+#ifndef ENABLE_CLUSTER
+/* Encode subset of blocks */
+static void *encode_blocks(void *arg) {
+    /* All arguments are packed into this structure */
+    encode_ctx *ctx = (encode_ctx *) arg;
 
     /* Input buffers */
     unsigned char **Y;
@@ -604,35 +901,24 @@ static void *encode_blocks(void *arg) {
     unsigned char **G;
     unsigned char **B;
 
-#ifdef ENABLE_CLUSTER
-    unsigned char *Y0;
-#endif
+    /* Mapped input image, encoded in place */
+    unsigned char *raster = NULL;
+    eps_image image;
 
     /* Output buffer */
     unsigned char *buf;
     int buf_size;
 
+    /* Truncated block, two-pass mode */
+    unsigned char *trunc_buf = NULL;
+    eps_block_header hdr;
+
     int x, y;
     int w, h;
 
-#ifdef ENABLE_PTHREADS
-    /* Print mutex */
-    static pthread_mutex_t p_lock = PTHREAD_MUTEX_INITIALIZER;
+#if defined(ENABLE_PTHREADS) && !defined(PBM_PREAD)
     /* Read mutex */
     static pthread_mutex_t r_lock = PTHREAD_MUTEX_INITIALIZER;
-    /* Write mutex */
-    static pthread_mutex_t w_lock = PTHREAD_MUTEX_INITIALIZER;
-    /* Stop mutex */
-    static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
-#endif
-
-#ifdef ENABLE_CLUSTER
-    int sock_fd;
-    int action = ctx->pbm->type == PBM_TYPE_PGM ?
-        ACTION_ENCODE_GS : ACTION_ENCODE_TC;
-
-    char ip_addr[INET_ADDRSTRLEN];
-    int port;
 #endif
 
     /* Handy shortcuts */
@@ -641,6 +927,9 @@ static void *encode_blocks(void *arg) {
     int W = ctx->W;
     int H = ctx->H;
 
+    /* Blocks per row */
+    int nbx = (W + block_size - 1) / block_size;
+
     /* Error flag */
     int error_flag = 0;
 
@@ -662,300 +951,192 @@ static void *encode_blocks(void *arg) {
             sizeof(unsigned char));
     }
 
-#ifdef ENABLE_CLUSTER
-    Y0 = (unsigned char *) xmalloc(block_size * block_size *
-        sizeof(unsigned char));
-#endif
-
     /* Allocate output buffer */
     buf = (unsigned char *) eps_xmalloc(ctx->bytes_per_block *
         sizeof(unsigned char));
 
-#ifdef ENABLE_CLUSTER
-    /* Get IP address and port number */
-    inet_ntop(AF_INET, &ctx->node->sin_addr, ip_addr, INET_ADDRSTRLEN);
-    port = ntohs(ctx->node->sin_port);
-
-    /* Create socket */
-    if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        LOCK(p_lock);
-        printf("%sCannot create socket for %s port %d: %m\n",
-            QUIET, ip_addr, port);
-        UNLOCK(p_lock);
-
-        /* Stop this thread and ask to stop other threads */
-        error_flag = 1;
-        goto error;
-    }
-
-    /* Connect to the cluster node */
-    if (connect(sock_fd, (CSA *) ctx->node, sizeof(struct sockaddr_in)) != 0) {
-        LOCK(p_lock);
-        printf("%sCannot connect to %s port %d: %m\n",
-            QUIET, ip_addr, port);
-        UNLOCK(p_lock);
-
-        /* Stop this thread and ask to stop other threads */
-        error_flag = 1;
-        goto error;
-    }
-
-    /* Do not halt on `Broken pipe' error */
-    set_signal(SIGPIPE, SIG_IGN);
-
-    /* Send parameters that are common for GS and TC images */
-    SEND_VALUE_TO_SLAVE(action);
-    SEND_VALUE_TO_SLAVE(W);
-    SEND_VALUE_TO_SLAVE(H);
-    SEND_VALUE_TO_SLAVE(block_size);
-    SEND_VALUE_TO_SLAVE(ctx->bytes_per_block);
-    SEND_VALUE_TO_SLAVE(ctx->mode);
-    {
-        int len = strlen(ctx->filter_id);
-        SEND_VALUE_TO_SLAVE(len);
-        SEND_BUF_TO_SLAVE(ctx->filter_id, len);
+    if (ctx->block_budgets) {
+        trunc_buf = (unsigned char *) eps_xmalloc(ctx->bytes_per_block *
+            sizeof(unsigned char));
     }
 
-    /* Send parameters that are specific for TC images only */
-    if (action == ACTION_ENCODE_TC) {
-        SEND_VALUE_TO_SLAVE(ctx->resample);
-        SEND_VALUE_TO_SLAVE(ctx->Y_ratio);
-        SEND_VALUE_TO_SLAVE(ctx->Cb_ratio);
-        SEND_VALUE_TO_SLAVE(ctx->Cr_ratio);
+    /* Encode blocks straight from the mapped file */
+    if ((raster = pbm_get_raster(ctx->pbm)) != NULL) {
+        if (ctx->pbm->type == PBM_TYPE_PGM) {
+            eps_image_gray(&image, raster, W, H, W);
+        } else {
+            eps_image_rgb(&image, raster, W, H, W * 3);
+        }
     }
-#endif
 
     /* Process all blocks */
-    for (i = y = 0; y < H; y += block_size) {
-        for (x = 0; x < W; x += block_size, i++) {
+    for (i = ctx->thread_idx; i < ctx->n_blocks; i += ctx->n_threads) {
 #ifdef ENABLE_PTHREADS
-            /* Check stop flag */
-            LOCK(s_lock);
-            error_flag = *ctx->stop_flag;
-            UNLOCK(s_lock);
-
-            /* Stop the thread */
-            if (error_flag) {
-                goto error;
-            }
+        /* Check stop flag */
+        error_flag = atomic_get(ctx->stop_flag);
+
+        /* Stop the thread */
+        if (error_flag) {
+            goto error;
+        }
 #endif
-            /* Skip over blocks not assigned to this thread */
-            if ((i % ctx->n_threads) != ctx->thread_idx) {
-                continue;
-            }
 
-            /* Block width */
-            if (x + block_size > W) {
-                w = W - x;
-            } else {
-                w = block_size;
-            }
+        x = (i % nbx) * block_size;
+        y = (i / nbx) * block_size;
 
-            /* Block height */
-            if (y + block_size > H) {
-                h = H - y;
+        /* Block width */
+        if (x + block_size > W) {
+            w = W - x;
+        } else {
+            w = block_size;
+        }
+
+        /* Block height */
+        if (y + block_size > H) {
+            h = H - y;
+        } else {
+            h = block_size;
+        }
+
+        /* Read next block unless it is encoded in place */
+        if (raster) {
+            rc = PBM_OK;
+        } else {
+#ifndef PBM_PREAD
+            LOCK(r_lock);
+#endif
+            if (ctx->pbm->type == PBM_TYPE_PGM) {
+                rc = pbm_read_pgm(ctx->pbm, Y, x, y, w, h);
             } else {
-                h = block_size;
+                rc = pbm_read_ppm(ctx->pbm, R, G, B, x, y, w, h);
             }
-
-#ifdef ENABLE_CLUSTER
-            SEND_VALUE_TO_SLAVE(x);
-            SEND_VALUE_TO_SLAVE(y);
-            SEND_VALUE_TO_SLAVE(w);
-            SEND_VALUE_TO_SLAVE(h);
+#ifndef PBM_PREAD
+            UNLOCK(r_lock);
 #endif
+        }
 
-            /* Output buffer size (not including marker) */
-            buf_size = ctx->bytes_per_block - 1;
+        if (rc != PBM_OK) {
+            error_flag = 1;
 
-            if (ctx->pbm->type == PBM_TYPE_PGM) {
-                /* Read next block */
-                LOCK(r_lock);
-                rc = pbm_read_pgm(ctx->pbm, Y, x, y, w, h);
-                UNLOCK(r_lock);
-
-                if (rc != PBM_OK) {
-                    error_flag = 1;
-
-                    switch (rc) {
-                        case PBM_SYSTEM_ERROR:
-                        {
-                            LOCK(p_lock);
-                            printf("%sCannot read block from %s: %m\n",
-                                QUIET, ctx->pbm_file);
-                            UNLOCK(p_lock);
-
-                            goto error;
-                        }
-                        default:
-                        {
-                            assert(0);
-                        }
-                    }
+            switch (rc) {
+                case PBM_SYSTEM_ERROR:
+                {
+                    LOCK(p_lock);
+                    printf("%sCannot read block from %s: %m\n",
+                        QUIET, ctx->pbm_file);
+                    UNLOCK(p_lock);
+
+                    goto error;
                 }
+                default:
+                {
+                    assert(0);
+                }
+            }
+        }
 
-#ifdef ENABLE_CLUSTER
-                /* Send raw data */
-                transform_2D_to_1D(Y, Y0, w, h);
-                SEND_BUF_TO_SLAVE(Y0, w * h);
+        /* Output buffer size (not including marker) */
+        buf_size = ctx->bytes_per_block - 1;
+
+        /* Encode block */
+        if (ctx->pbm->type == PBM_TYPE_PGM) {
+            if (raster) {
+                rc = eps_encode_grayscale_block_strided(&image, W, H,
+                    w, h, x, y, buf, &buf_size, ctx->filter_id,
+                    ctx->mode, ctx->flags, ctx->rd ? &ctx->rd[i] : NULL);
+            } else if (ctx->rd) {
+                rc = eps_encode_grayscale_block_rd(Y, W, H, w, h, x, y,
+                    buf, &buf_size, ctx->filter_id, ctx->mode,
+                    ctx->flags, &ctx->rd[i]);
+            } else {
+                rc = eps_encode_grayscale_block_ex(Y, W, H, w, h, x, y,
+                    buf, &buf_size, ctx->filter_id, ctx->mode,
+                    ctx->flags);
+            }
+        } else {
+            if (raster) {
+                rc = eps_encode_truecolor_block_strided(&image, W, H,
+                    w, h, x, y, ctx->resample, buf, &buf_size,
+                    (int)(ctx->Y_ratio), (int)(ctx->Cb_ratio),
+                    (int)(ctx->Cr_ratio), ctx->filter_id,
+                    ctx->mode, ctx->flags, ctx->rd ? &ctx->rd[i] : NULL);
+            } else if (ctx->rd) {
+                rc = eps_encode_truecolor_block_rd(R, G, B, W, H, w, h,
+                    x, y, ctx->resample, buf, &buf_size,
+                    (int)(ctx->Y_ratio), (int)(ctx->Cb_ratio),
+                    (int)(ctx->Cr_ratio), ctx->filter_id,
+                    ctx->mode, ctx->flags, &ctx->rd[i]);
+            } else {
+                rc = eps_encode_truecolor_block_ex(R, G, B, W, H, w, h,
+                    x, y, ctx->resample, buf, &buf_size,
+                    (int)(ctx->Y_ratio), (int)(ctx->Cb_ratio),
+                    (int)(ctx->Cr_ratio), ctx->filter_id,
+                    ctx->mode, ctx->flags);
+            }
+        }
 
-                /* Receive encoded data */
-                RECV_VALUE_FROM_SLAVE(&buf_size);
-                RECV_BUF_FROM_SLAVE(buf, buf_size);
-#else
-                /* Encode block */
-                rc = eps_encode_grayscale_block(Y, W, H, w, h, x, y,
-                    buf, &buf_size, ctx->filter_id, ctx->mode);
+        /* All function parameters are checked at the moment,
+         * so everything except EPS_OK is a logical error. */
+        assert(rc == EPS_OK);
 
-                /* All function parameters are checked at the moment,
-                 * so everything except EPS_OK is a logical error. */
-                assert(rc == EPS_OK);
-#endif
+        /* The second pass encodes the block just like the first
+         * one did and cuts it at its share of the bit-budget */
+        if (ctx->block_budgets && (ctx->block_budgets[i] < buf_size)) {
+            unsigned char *tmp;
 
-                /* Write encoded block */
-                LOCK(w_lock);
-                rc = psi_write_next_block(ctx->psi, buf, buf_size);
-                UNLOCK(w_lock);
-
-                if (rc != PSI_OK) {
-                    error_flag = 1;
-
-                    switch (rc) {
-                        case PSI_SYSTEM_ERROR:
-                        {
-                            LOCK(p_lock);
-                            printf("%sCannot write block to %s: %m\n",
-                                QUIET, ctx->psi_file);
-                            UNLOCK(p_lock);
-
-                            goto error;
-                        }
-                        default:
-                        {
-                            assert(0);
-                        }
-                    }
-                }
-            } else {
-                /* Read next block */
-                LOCK(r_lock);
-                rc = pbm_read_ppm(ctx->pbm, R, G, B, x, y, w, h);
-                UNLOCK(r_lock);
-
-                if (rc != PBM_OK) {
-                    error_flag = 1;
-
-                    switch (rc) {
-                        case PBM_SYSTEM_ERROR:
-                        {
-                            LOCK(p_lock);
-                            printf("%sCannot read block from %s: %m\n",
-                                QUIET, ctx->pbm_file);
-                            UNLOCK(p_lock);
-
-                            goto error;
-                        }
-                        default:
-                        {
-                            assert(0);
-                        }
-                    }
-                }
+            rc = eps_read_block_header(buf, buf_size, &hdr);
+            assert(rc == EPS_OK);
 
-#ifdef ENABLE_CLUSTER
-                /* Send raw data */
-                transform_2D_to_1D(R, Y0, w, h);
-                SEND_BUF_TO_SLAVE(Y0, w * h);
+            buf_size = ctx->block_budgets[i];
+            rc = eps_truncate_block(buf, trunc_buf, &hdr, &buf_size);
+            assert(rc == EPS_OK);
 
-                transform_2D_to_1D(G, Y0, w, h);
-                SEND_BUF_TO_SLAVE(Y0, w * h);
+            tmp = buf;
+            buf = trunc_buf;
+            trunc_buf = tmp;
+        }
 
-                transform_2D_to_1D(B, Y0, w, h);
-                SEND_BUF_TO_SLAVE(Y0, w * h);
+        /* The first of two passes needs the curve only */
+        if (!ctx->rd) {
+            /* Hand encoded block over to the writer */
+            rc = writer_put(ctx->writer, i, &buf, buf_size);
 
-                /* Receive encoded data */
-                RECV_VALUE_FROM_SLAVE(&buf_size);
-                RECV_BUF_FROM_SLAVE(buf, buf_size);
-#else
-                /* Encode block */
-                rc = eps_encode_truecolor_block(R, G, B, W, H, w, h,
-                    x, y, ctx->resample, buf, &buf_size, (int)(ctx->Y_ratio),
-                    (int)(ctx->Cb_ratio), (int)(ctx->Cr_ratio), ctx->filter_id, ctx->mode);
-
-                /* All function parameters are checked at the moment,
-                 * so everything except EPS_OK is a logical error. */
-                assert(rc == EPS_OK);
-#endif
+            if (rc != PSI_OK) {
+                error_flag = 1;
+
+                switch (rc) {
+                    case PSI_SYSTEM_ERROR:
+                    {
+                        LOCK(p_lock);
+                        printf("%sCannot write block to %s: %m\n",
+                            QUIET, ctx->psi_file);
+                        UNLOCK(p_lock);
 
-                /* Write encoded block */
-                LOCK(w_lock);
-                rc = psi_write_next_block(ctx->psi, buf, buf_size);
-                UNLOCK(w_lock);
-
-                if (rc != PSI_OK) {
-                    error_flag = 1;
-
-                    switch (rc) {
-                        case PSI_SYSTEM_ERROR:
-                        {
-                            LOCK(p_lock);
-                            printf("%sCannot write block to %s: %m\n",
-                                QUIET, ctx->psi_file);
-                            UNLOCK(p_lock);
-
-                            goto error;
-                        }
-                        default:
-                        {
-                            assert(0);
-                        }
+                        goto error;
+                    }
+                    default:
+                    {
+                        assert(0);
                     }
                 }
             }
-
-            /* Update progress indicator */
-            if (ctx->quiet != OPT_YES) {
-                time_t cur_time;
-                LOCK(p_lock);
-                cur_time = time(NULL);
-
-                /* Increment counter of processed blocks */
-                (*ctx->done_blocks)++;
-
-                /* Format text string */
-                snprintf(progress_buf, sizeof(progress_buf),
-                    "Encoding file (%d of %d): %s - %.2f%% done in %s",
-                    ctx->current + 1, ctx->total, ctx->pbm_file,
-                    (100.0 * *ctx->done_blocks / ctx->n_blocks),
-                    format_time((int)cur_time - ctx->start_time,
-                    timer_buf, sizeof(timer_buf)));
-
-                /* Clear old string */
-                print_blank_line(*ctx->clear_len);
-                *ctx->clear_len = strlen(progress_buf);
-
-                /* Print next progress report and flush stdout */
-                printf("%s\r", progress_buf);
-                fflush(stdout);
-                UNLOCK(p_lock);
-            }
         }
+
+        /* Update progress indicator */
+        encode_progress(ctx);
     }
 
 error:
 
 #ifdef ENABLE_PTHREADS
-    /* Ask other threads to stop */
+    /* Ask other threads and the writer to stop */
     if (error_flag) {
-        LOCK(s_lock);
-        *ctx->stop_flag = 1;
-        UNLOCK(s_lock);
-    }
-#endif
+        atomic_set(ctx->stop_flag, 1);
 
-#ifdef ENABLE_CLUSTER
-    /* Close connection */
-    close(sock_fd);
+        if (ctx->writer) {
+            writer_stop(ctx->writer);
+        }
+    }
 #endif
 
     /* Free input buffers */
@@ -967,24 +1148,448 @@ error:
         eps_free_2D((void **) B, block_size, block_size);
     }
 
-#ifdef ENABLE_CLUSTER
-    free(Y0);
-#endif
-
-    /* Free output buffer */
+    /* Free output buffers */
     free(buf);
+    free(trunc_buf);
 
     /* Return 0 for success or 0 for error */
     return (void *) error_flag;
 }
 
+#else
+
+#if defined(ENABLE_PTHREADS) && !defined(PBM_PREAD)
+/* Read mutex of the dispatcher and local workers */
+static pthread_mutex_t r_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Get position and size of strip `idx' */
+static void get_strip(encode_ctx *ctx, int idx, int *x, int *y,
+                      int *w, int *h)
+{
+    int block_size = ctx->block_size;
+
+    *x = (idx % ctx->strips_per_row) * ctx->strip * block_size;
+    *y = (idx / ctx->strips_per_row) * block_size;
+    *w = MIN(ctx->strip * block_size, ctx->W - *x);
+    *h = MIN(block_size, ctx->H - *y);
+}
+
+/* Read strip of blocks and flatten it into a cluster request */
+static int encode_fill(void *arg, int idx, block_frame *frame,
+                       cluster_payload *payload)
+{
+    encode_ctx *ctx = (encode_ctx *) arg;
+    int quiet = ctx->quiet;
+    int n_channels = ctx->pbm->type == PBM_TYPE_PGM ? 1 : 3;
+    unsigned char *raster;
+    int x, y, w, h;
+    int row_len;
+    int rc;
+    int j;
+
+    get_strip(ctx, idx, &x, &y, &w, &h);
+
+    row_len = n_channels * w;
+
+    /* Rows go as they are stored in the file. Mapped rows are
+     * sent straight from the mapping, rows of full-width strips
+     * make a single segment. */
+    if ((raster = pbm_get_raster(ctx->pbm)) != NULL) {
+        raster += ((size_t) y * ctx->W + x) * n_channels;
+
+        if (w == ctx->W) {
+            payload->segs[0].iov_base = raster;
+            payload->segs[0].iov_len = row_len * h;
+            payload->n_segs = 1;
+        } else {
+            for (j = 0; j < h; j++) {
+                payload->segs[j].iov_base = raster +
+                    (size_t) j * ctx->W * n_channels;
+                payload->segs[j].iov_len = row_len;
+            }
+
+            payload->n_segs = h;
+        }
+    } else {
+        for (j = 0; j < h; j++) {
+            ctx->rows[j] = payload->buf + j * row_len;
+        }
+
+#ifndef PBM_PREAD
+        LOCK(r_lock);
+#endif
+        rc = pbm_read_rows(ctx->pbm, ctx->rows, x, y, w, h);
+#ifndef PBM_PREAD
+        UNLOCK(r_lock);
+#endif
+
+        if (rc != PBM_OK) {
+            switch (rc) {
+                case PBM_SYSTEM_ERROR:
+                {
+                    printf("%sCannot read strip from %s: %m\n",
+                        QUIET, ctx->pbm_file);
+                    return CLUSTER_ERROR;
+                }
+                default:
+                {
+                    assert(0);
+                }
+            }
+        }
+    }
+
+    frame->x = x;
+    frame->y = y;
+    frame->w = w;
+    frame->h = h;
+    frame->size = row_len * h;
+
+    return CLUSTER_OK;
+}
+
+/* Encode strip of blocks in a local worker thread. The answer
+ * is the same a cluster node would send. */
+static int encode_local(void *arg, int worker, int idx,
+                        block_frame *frame, unsigned char *answer)
+{
+    encode_ctx *ctx = (encode_ctx *) arg;
+    int block_size = ctx->block_size;
+    int quiet = ctx->quiet;
+    int W = ctx->W;
+    int H = ctx->H;
+    unsigned char **Y, **R, **G, **B;
+    unsigned char *raster;
+    eps_image image;
+    unsigned char *buf;
+    int buf_size;
+    int x, y, w, h;
+    int bx, bw;
+    int pos = 0;
+    uint32_t size;
+    int rc;
+
+    get_strip(ctx, idx, &x, &y, &w, &h);
+
+    /* Blocks are encoded straight from the mapped file */
+    if ((raster = pbm_get_raster(ctx->pbm)) != NULL) {
+        if (ctx->pbm->type == PBM_TYPE_PGM) {
+            eps_image_gray(&image, raster, W, H, W);
+        } else {
+            eps_image_rgb(&image, raster, W, H, W * 3);
+        }
+    } else {
+        Y = R = ctx->local_block[3 * worker];
+        G = ctx->local_block[3 * worker + 1];
+        B = ctx->local_block[3 * worker + 2];
+    }
+
+    for (bx = x; bx < x + w; bx += block_size) {
+        bw = MIN(block_size, x + w - bx);
+
+        /* Leave room for the size field */
+        buf = answer + pos + SIZE_FIELD_LEN;
+        buf_size = ctx->bytes_per_block - 1;
+
+        if (!raster) {
+#ifndef PBM_PREAD
+            LOCK(r_lock);
+#endif
+            if (ctx->pbm->type == PBM_TYPE_PGM) {
+                rc = pbm_read_pgm(ctx->pbm, Y, bx, y, bw, h);
+            } else {
+                rc = pbm_read_ppm(ctx->pbm, R, G, B, bx, y, bw, h);
+            }
+#ifndef PBM_PREAD
+            UNLOCK(r_lock);
+#endif
+
+            if (rc != PBM_OK) {
+                switch (rc) {
+                    case PBM_SYSTEM_ERROR:
+                    {
+                        LOCK(p_lock);
+                        printf("%sCannot read block from %s: %m\n",
+                            QUIET, ctx->pbm_file);
+                        UNLOCK(p_lock);
+
+                        return CLUSTER_ERROR;
+                    }
+                    default:
+                    {
+                        assert(0);
+                    }
+                }
+            }
+        }
+
+        if (ctx->pbm->type == PBM_TYPE_PGM) {
+            if (raster) {
+                rc = eps_encode_grayscale_block_strided(&image, W, H,
+                    bw, h, bx, y, buf, &buf_size, ctx->filter_id,
+                    ctx->mode, ctx->flags, NULL);
+            } else {
+                rc = eps_encode_grayscale_block_ex(Y, W, H, bw, h, bx, y,
+                    buf, &buf_size, ctx->filter_id, ctx->mode,
+                    ctx->flags);
+            }
+        } else {
+            if (raster) {
+                rc = eps_encode_truecolor_block_strided(&image, W, H,
+                    bw, h, bx, y, ctx->resample, buf, &buf_size,
+                    (int)(ctx->Y_ratio), (int)(ctx->Cb_ratio),
+                    (int)(ctx->Cr_ratio), ctx->filter_id,
+                    ctx->mode, ctx->flags, NULL);
+            } else {
+                rc = eps_encode_truecolor_block_ex(R, G, B, W, H, bw, h,
+                    bx, y, ctx->resample, buf, &buf_size,
+                    (int)(ctx->Y_ratio), (int)(ctx->Cb_ratio),
+                    (int)(ctx->Cr_ratio), ctx->filter_id,
+                    ctx->mode, ctx->flags);
+            }
+        }
+
+        /* All function parameters are checked at the moment,
+         * so everything except EPS_OK is a logical error. */
+        assert(rc == EPS_OK);
+
+        size = htonl(buf_size);
+        memcpy(answer + pos, &size, SIZE_FIELD_LEN);
+        pos += SIZE_FIELD_LEN + buf_size;
+    }
+
+    frame->x = x;
+    frame->y = y;
+    frame->w = w;
+    frame->h = h;
+    frame->size = pos;
+
+    return CLUSTER_OK;
+}
+
+/* Hand blocks of a strip encoded by a cluster node over
+ * to the writer. Each block is preceded by its size. */
+static int encode_done(void *arg, int idx, block_frame *frame,
+                       unsigned char *payload, int size)
+{
+    encode_ctx *ctx = (encode_ctx *) arg;
+    int block_size = ctx->block_size;
+    int quiet = ctx->quiet;
+    int nbx = (ctx->W + block_size - 1) / block_size;
+    int first, n;
+    int pos, len;
+    uint32_t x;
+    int rc;
+    int k;
+
+    first = (idx / ctx->strips_per_row) * nbx +
+        (idx % ctx->strips_per_row) * ctx->strip;
+    n = (frame->w + block_size - 1) / block_size;
+
+    /* Check the whole strip before writing any block */
+    for (pos = k = 0; k < n; k++) {
+        if (size - pos < SIZE_FIELD_LEN) {
+            goto size_error;
+        }
+
+        memcpy(&x, payload + pos, SIZE_FIELD_LEN);
+        len = ntohl(x);
+
+        if ((len < 1) || (len > ctx->bytes_per_block - 1) ||
+            (len > size - pos - SIZE_FIELD_LEN))
+        {
+            goto size_error;
+        }
+
+        pos += SIZE_FIELD_LEN + len;
+    }
+
+    if (pos != size) {
+        goto size_error;
+    }
+
+    for (pos = k = 0; k < n; k++) {
+        memcpy(&x, payload + pos, SIZE_FIELD_LEN);
+        len = ntohl(x);
+        pos += SIZE_FIELD_LEN;
+
+        memcpy(ctx->cluster_buf, payload + pos, len);
+        rc = writer_put(ctx->writer, first + k, &ctx->cluster_buf, len);
+        pos += len;
+
+        if (rc != PSI_OK) {
+            switch (rc) {
+                case PSI_SYSTEM_ERROR:
+                {
+                    printf("%sCannot write block to %s: %m\n",
+                        QUIET, ctx->psi_file);
+                    return CLUSTER_ERROR;
+                }
+                default:
+                {
+                    assert(0);
+                }
+            }
+        }
+
+        /* Update progress indicator */
+        encode_progress(ctx);
+    }
+
+    return CLUSTER_OK;
+
+size_error:
+
+    printf("%sIncorrect size (%d) of strip %d\n", QUIET, size, idx);
+    return CLUSTER_ERROR;
+}
+
+/* Encode all blocks on cluster nodes */
+static int encode_cluster(encode_ctx *ctx, cluster_nodes *nodes,
+                          int horizon)
+{
+    int block_size = ctx->block_size;
+    int n_strips;
+    int n_channels;
+    cluster cl;
+    int len;
+    int rc;
+    int i, k;
+
+    n_channels = ctx->pbm->type == PBM_TYPE_PGM ? 1 : 3;
+
+    /* Pixels are sent straight from the mapped image if possible */
+    pbm_map(ctx->pbm);
+
+    ctx->rows = (unsigned char **) eps_xmalloc(block_size *
+        sizeof(unsigned char *));
+
+    /* Local workers read blocks themselves unless the image is mapped */
+    ctx->local_block = NULL;
+
+    if (nodes->n_local && !pbm_get_raster(ctx->pbm)) {
+        ctx->local_block = (unsigned char ***) eps_xmalloc(3 *
+            nodes->n_local * sizeof(unsigned char **));
+
+        for (i = 0; i < nodes->n_local; i++) {
+            for (k = 0; k < 3; k++) {
+                ctx->local_block[3 * i + k] = k < n_channels ?
+                    (unsigned char **) eps_malloc_2D(block_size, block_size,
+                    sizeof(unsigned char)) : NULL;
+            }
+        }
+    }
+
+    ctx->cluster_buf = (unsigned char *) eps_xmalloc(ctx->bytes_per_block *
+        sizeof(unsigned char));
+
+    /* Requests are strips of blocks */
+    n_strips = ctx->strips_per_row *
+        ((ctx->H + block_size - 1) / block_size);
+
+    cluster_init(&cl, nodes, n_strips, ctx->quiet);
+
+    /* Parameters that are common for GS and TC images */
+    cluster_hello_value(&cl, n_channels == 1 ?
+        ACTION_ENCODE_GS : ACTION_ENCODE_TC);
+    cluster_hello_value(&cl, ctx->W);
+    cluster_hello_value(&cl, ctx->H);
+    cluster_hello_value(&cl, block_size);
+    cluster_hello_value(&cl, ctx->strip);
+    cluster_hello_value(&cl, ctx->bytes_per_block);
+    cluster_hello_value(&cl, ctx->mode);
+    cluster_hello_value(&cl, ctx->flags);
+
+    len = strlen(ctx->filter_id);
+    cluster_hello_value(&cl, len);
+    cluster_hello_buf(&cl, ctx->filter_id, len);
+
+    /* Parameters that are specific for TC images only */
+    if (n_channels == 3) {
+        cluster_hello_value(&cl, ctx->resample);
+        cluster_hello_value(&cl, (int) ctx->Y_ratio);
+        cluster_hello_value(&cl, (int) ctx->Cb_ratio);
+        cluster_hello_value(&cl, (int) ctx->Cr_ratio);
+    }
+
+    cl.horizon = horizon;
+    cl.max_request = n_channels * ctx->strip * block_size * block_size;
+    cl.max_answer = ctx->strip * (SIZE_FIELD_LEN + ctx->bytes_per_block);
+    cl.max_segs = block_size;
+    cl.fill = encode_fill;
+    cl.done = encode_done;
+    cl.run = encode_local;
+    cl.user = ctx;
+
+    rc = cluster_run(&cl);
+    cluster_free(&cl);
+
+    /* Ask the writer to stop */
+    if (rc != CLUSTER_OK) {
+        writer_stop(ctx->writer);
+    }
+
+    if (ctx->local_block) {
+        for (i = 0; i < 3 * nodes->n_local; i++) {
+            if (ctx->local_block[i]) {
+                eps_free_2D((void **) ctx->local_block[i], block_size,
+                    block_size);
+            }
+        }
+
+        free(ctx->local_block);
+    }
+
+    free(ctx->rows);
+    free(ctx->cluster_buf);
+
+    return rc != CLUSTER_OK;
+}
+#endif
+
+#ifndef ENABLE_CLUSTER
+/* Run encoding threads over all blocks */
+static int encode_pass(encode_ctx *ctx)
+{
+#ifdef ENABLE_PTHREADS
+    pthread_t tid[MAX_N_THREADS];
+    int n_threads = ctx->n_threads;
+    int rc;
+    int i;
+
+    /* Set concurrency level */
+    assert(!pthread_setconcurrency(n_threads));
+
+    /* Create threads */
+    for (i = 0; i < n_threads; i++) {
+        assert(!pthread_create(&tid[i], NULL, encode_blocks, (void *) &ctx[i]));
+    }
+
+    /* Join all threads */
+    for (rc = i = 0; i < n_threads; i++) {
+        void *thread_return;
+
+        assert(!pthread_join(tid[i], &thread_return));
+        rc |= (int) thread_return;
+    }
+
+    return rc;
+#else
+    /* Encode blocks */
+    return (int) encode_blocks((void *) &ctx[0]);
+#endif
+}
+#endif
+
 /* Encode one file */
 static void encode_file(char *filter_id, int block_size, int mode,
                         double ratio, int two_pass, int n_threads,
                         void *cluster, int Y_ratio, int Cb_ratio,
-                        int Cr_ratio, int resample, int halt_on_errors,
-                        int quiet, char *output_dir, char *file,
-                        int current, int total)
+                        int Cr_ratio, int resample, int flags,
+                        int block_index, int halt_on_errors, int quiet,
+                        char *output_dir, char *file, int current,
+                        int total)
 {
     /* Text buffers for file names */
     char pbm_file[MAX_PATH];
@@ -997,19 +1602,27 @@ static void encode_file(char *filter_id, int block_size, int mode,
     pbm_image pbm;
     psi_image psi;
 
+    /* Ordered writer */
+    block_writer writer;
+
 #ifdef ENABLE_PTHREADS
-    /* Arrays for thread CTXs and IDs */
+    /* Array for thread CTXs */
     encode_ctx ctx[MAX_N_THREADS];
-    pthread_t tid[MAX_N_THREADS];
 #else
     /* Single context for thread-unaware version */
     encode_ctx ctx[1];
 #endif
 
 #ifdef ENABLE_CLUSTER
-    struct sockaddr_in *nodes = (struct sockaddr_in *) cluster;
+    cluster_nodes *nodes = (cluster_nodes *) cluster;
+    int strips_per_row;
+    int strip;
 #endif
 
+    /* Two-pass mode: block curves and budgets */
+    eps_rd_info *rd = NULL;
+    int *budgets = NULL;
+
     int bytes_per_block;
 
     int x_blocks, y_blocks;
@@ -1083,6 +1696,11 @@ static void encode_file(char *filter_id, int block_size, int mode,
         }
     }
 
+    /* Collect block index */
+    if (block_index == OPT_YES) {
+        psi_enable_index(&psi);
+    }
+
     /* Get image width and height */
     W = pbm.width;
     H = pbm.height;
@@ -1105,6 +1723,24 @@ static void encode_file(char *filter_id, int block_size, int mode,
     bytes_per_block = (int) ((double) (pbm.hdr_size + pbm.data_size) /
         ((two_pass == OPT_YES ? 1.0 : ratio) * n_blocks));
 
+#ifndef ENABLE_CLUSTER
+    /* Two-pass mode: the first pass collects rate-distortion
+     * curves of the blocks, the second one encodes them again
+     * and truncates them at points of equal slope, so that the
+     * file hits the desired size. Blocks never go below the
+     * minimal buffer size, so the slack is counted from it. */
+    if (two_pass == OPT_YES) {
+        double slack_bytes = RD_BUDGET_SLACK *
+            MAX((double) (pbm.hdr_size + pbm.data_size) /
+            (ratio * n_blocks), MAX(EPS_MIN_GRAYSCALE_BUF,
+            EPS_MIN_TRUECOLOR_BUF) + 1);
+
+        bytes_per_block = (int) MIN(bytes_per_block, slack_bytes);
+
+        rd = (eps_rd_info *) eps_xmalloc(n_blocks * sizeof(eps_rd_info));
+    }
+#endif
+
     /* Clip buffer size if needed */
     if (pbm.type == PBM_TYPE_PGM)  {
         bytes_per_block = MAX(bytes_per_block, EPS_MIN_GRAYSCALE_BUF + 1);
@@ -1114,6 +1750,14 @@ static void encode_file(char *filter_id, int block_size, int mode,
 
     done_blocks = clear_len = stop_flag = 0;
 
+#ifdef ENABLE_CLUSTER
+    /* Cluster requests hold strips of adjacent blocks of a block
+     * row; rows too long for a single request are cut into strips
+     * of nearly equal length */
+    strips_per_row = (x_blocks + MAX_STRIP_BLOCKS - 1) / MAX_STRIP_BLOCKS;
+    strip = (x_blocks + strips_per_row - 1) / strips_per_row;
+#endif
+
     /* Initialize progress report */
     if (quiet != OPT_YES) {
         snprintf(progress_buf, sizeof(progress_buf),
@@ -1135,15 +1779,14 @@ static void encode_file(char *filter_id, int block_size, int mode,
         ctx[i].Cb_ratio = Cb_ratio;
         ctx[i].Cr_ratio = Cr_ratio;
         ctx[i].resample = resample;
+        ctx[i].flags = flags;
         ctx[i].W = W;
         ctx[i].H = H;
         ctx[i].n_blocks = n_blocks;
+        ctx[i].n_passes = rd ? 2 : 1;
         ctx[i].done_blocks = &done_blocks;
         ctx[i].n_threads = n_threads;
         ctx[i].thread_idx = i;
-#ifdef ENABLE_CLUSTER
-        ctx[i].node = &nodes[i];
-#endif
         ctx[i].start_time = start_time;
         ctx[i].pbm_file = pbm_file;
         ctx[i].psi_file = psi_file;
@@ -1154,31 +1797,73 @@ static void encode_file(char *filter_id, int block_size, int mode,
         ctx[i].quiet = quiet;
         ctx[i].clear_len = &clear_len;
         ctx[i].stop_flag = &stop_flag;
+        ctx[i].writer = rd ? NULL : &writer;
+        ctx[i].rd = rd;
+        ctx[i].block_budgets = NULL;
+#ifdef ENABLE_CLUSTER
+        ctx[i].strip = strip;
+        ctx[i].strips_per_row = strips_per_row;
+#endif
     }
 
-#ifdef ENABLE_PTHREADS
-    /* Set concurrency level */
-    assert(!pthread_setconcurrency(n_threads));
+    /* Blocks are written in raster order as they become ready.
+     * Cluster nodes may answer out of order within the window. */
+#ifdef ENABLE_CLUSTER
+    writer_init(&writer, &psi, n_blocks,
+                ((WRITER_SLOTS_PER_THREAD + nodes->window) *
+                nodes->n_nodes + nodes->n_local) * strip,
+                bytes_per_block, &stop_flag);
+
+    /* Dispatch blocks to cluster nodes. Strips may be answered
+     * out of order, but no further ahead than the writer holds. */
+    rc = encode_cluster(&ctx[0], nodes, writer.n_slots / strip);
+#else
+    rc = 0;
 
-    /* Create threads */
-    for (i = 0; i < n_threads; i++) {
-        assert(!pthread_create(&tid[i], NULL, encode_blocks, (void *) &ctx[i]));
+    /* Collect curves and allocate bit-budget */
+    if (rd) {
+        double desired_size = (pbm.hdr_size + pbm.data_size) / ratio;
+
+        if (!(rc = encode_pass(ctx))) {
+            budgets = (int *) eps_xmalloc(n_blocks * sizeof(int));
+
+            /* Each block is followed by a marker */
+            rc = eps_allocate_rate(rd, n_blocks, desired_size - n_blocks,
+                                   budgets);
+            assert(rc == EPS_OK);
+
+            for (i = 0; i < n_threads; i++) {
+                ctx[i].writer = &writer;
+                ctx[i].rd = NULL;
+                ctx[i].block_budgets = budgets;
+            }
+        }
     }
-#else
-    /* Encode blocks */
-    rc = (int) encode_blocks((void *) &ctx[0]);
-#endif
 
-#ifdef ENABLE_PTHREADS
-    /* Join all threads */
-    for (rc = i = 0; i < n_threads; i++) {
-        void *thread_return;
+    if (!rc) {
+        writer_init(&writer, &psi, n_blocks,
+                    WRITER_SLOTS_PER_THREAD * n_threads,
+                    bytes_per_block, &stop_flag);
 
-        assert(!pthread_join(tid[i], &thread_return));
-        rc |= (int) thread_return;
+        rc = encode_pass(ctx);
     }
 #endif
 
+    /* Flush the writer */
+    if (ctx[0].writer && (writer_finish(&writer) != PSI_OK) && !rc) {
+        printf("%sCannot write block to %s: %m\n", QUIET, psi_file);
+        rc = 1;
+    }
+
+    free(budgets);
+    free(rd);
+
+    /* Append block index */
+    if (!rc && (psi_write_index(&psi) != PSI_OK)) {
+        printf("Cannot write block index to %s: %m\n", psi_file);
+        rc = 1;
+    }
+
     /* Close files */
     pbm_close(&pbm);
     psi_close(&psi);
@@ -1192,6 +1877,7 @@ static void encode_file(char *filter_id, int block_size, int mode,
     } else {
         printf("%s", QUIET);
 
+#ifdef ENABLE_CLUSTER
         /* Optimize file */
         if (two_pass == OPT_YES) {
             off_t original_size = pbm.hdr_size + pbm.data_size;
@@ -1210,6 +1896,7 @@ static void encode_file(char *filter_id, int block_size, int mode,
             truncate_file(truncation_ratio, halt_on_errors, quiet,
                           NULL, psi_file, current, total, OPTIMIZE_MSG);
         }
+#endif
     }
 }
 
@@ -1218,47 +1905,55 @@ static void encode_file(char *filter_id, int block_size, int mode,
 /* Encode files */
 void cmd_encode_file(char *filter_id, int block_size, int mode,
                      double ratio, int two_pass, int n_threads,
-                     char *node_list, int Y_ratio, int Cb_ratio,
-                     int Cr_ratio, int resample, int halt_on_errors,
-                     int quiet, char *output_dir, char **files)
+                     char *node_list, int window, int local_threads,
+                     int Y_ratio, int Cb_ratio, int Cr_ratio,
+                     int resample, int binary_header, int checksum,
+                     int block_index, int halt_on_errors, int quiet,
+                     char *output_dir, char **files)
 {
     int filter_type;
+    int flags;
     int i, n;
 
     char timer_buf[MAX_TIMER_LINE];
     time_t total_time;
 
 #ifdef ENABLE_CLUSTER
-    struct sockaddr_in nodes[MAX_CLUSTER_NODES];
+    cluster_nodes nodes;
 
     /* Load list of cluster nodes */
-    if (node_list) {
-        /* File is specified explicitly */
-        n_threads = load_cluster_nodes(node_list, nodes);
-    } else if (file_exists(DEFAULT_NODE_LIST)) {
-        /* Try file in the currect directory */
-        n_threads = load_cluster_nodes(DEFAULT_NODE_LIST, nodes);
+    nodes.n_nodes = find_cluster_nodes(node_list, nodes.addr);
+
+    /* Check window size */
+    if (window == OPT_NA) {
+        window = DEF_WINDOW;
     } else {
-        if (getenv("HOME")) {
-            char pathname[MAX_PATH];
+        if ((window < 1) || (window > MAX_WINDOW)) {
+            printf("Incorrect value for the window size.\n");
+            exit(1);
+        }
+    }
 
-            /* Try file in user directory */
-            snprintf(pathname, sizeof(pathname), "%s%c%s",
-                getenv("HOME"), DIR_SEPARATOR, DEFAULT_NODE_LIST);
+    nodes.window = window;
 
-            if (file_exists(pathname)) {
-                n_threads = load_cluster_nodes(pathname, nodes);
-            } else {
-                /* Giving up */
-                printf("You should specify list of cluster nodes.\n");
-                exit(1);
-            }
-        } else {
-            /* Giving up */
-            printf("You should specify list of cluster nodes.\n");
+    /* Check the number of local worker threads */
+    if (local_threads == OPT_NA) {
+        local_threads = 0;
+    } else {
+        if ((local_threads < 0) || (local_threads > MAX_N_THREADS)) {
+            printf("Incorrect value for the number of local threads.\n");
             exit(1);
         }
     }
+
+    nodes.n_local = local_threads;
+
+    /* All connections are driven from a single thread */
+    n_threads = 1;
+#else
+    /* Window and local threads apply to cluster nodes only */
+    (void) window;
+    (void) local_threads;
 #endif
 
     /* Check filter */
@@ -1387,6 +2082,20 @@ void cmd_encode_file(char *filter_id, int block_size, int mode,
         resample = EPS_RESAMPLE_444;
     }
 
+    /* Check block header format */
+    if (binary_header == OPT_YES) {
+        flags = EPS_BINARY_HEADER;
+    } else {
+        flags = 0;
+    }
+
+    /* Check data checksum type */
+    if (checksum == OPT_CHECKSUM_CRC32C) {
+        flags |= EPS_CHECKSUM_CRC32C;
+    } else if (checksum == OPT_CHECKSUM_ADLER32) {
+        flags |= EPS_CHECKSUM_ADLER32;
+    }
+
     n = get_number_of_files(files);
 
     if (!n) {
@@ -1400,19 +2109,19 @@ void cmd_encode_file(char *filter_id, int block_size, int mode,
     for (i = 0; i < n; i++) {
         void *cluster = NULL;
 #ifdef ENABLE_CLUSTER
-        cluster = nodes;
+        cluster = &nodes;
 #endif
 
 #ifdef ENABLE_MPI
         encode_file_mpi(filter_id, block_size, mode, ratio, two_pass,
                         n_threads, Y_ratio, Cb_ratio, Cr_ratio,
-                        resample, halt_on_errors, quiet, output_dir,
-                        files[i], i, n);
+                        resample, flags, block_index, halt_on_errors,
+                        quiet, output_dir, files[i], i, n);
 #else
         encode_file(filter_id, block_size, mode, ratio, two_pass,
                     n_threads, cluster, Y_ratio, Cb_ratio, Cr_ratio,
-                    resample, halt_on_errors, quiet, output_dir,
-                    files[i], i, n);
+                    resample, flags, block_index, halt_on_errors, quiet,
+                    output_dir, files[i], i, n);
 #endif
     }
 
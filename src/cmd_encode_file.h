@@ -40,8 +40,10 @@ extern "C" {
 #ifdef ENABLE_CLUSTER
 # include <sys/socket.h>
 # include <sys/types.h>
+# include <cluster.h>
 #endif
 
+#include <epsilon.h>
 #include <pbm.h>
 #include <psi.h>
 #include <time.h>
@@ -49,6 +51,45 @@ extern "C" {
 #define ORTHOGONAL              0
 #define BIORTHOGONAL            1
 
+/* In two-pass mode each block may take up to this
+ * many times the average bit-budget */
+#define RD_BUDGET_SLACK         8
+
+/* Reorder window of the ordered writer, in blocks per thread */
+#define WRITER_SLOTS_PER_THREAD 4
+
+/* Encoded block waiting to be written */
+typedef struct writer_slot_tag {
+    unsigned char *data;
+    int size;
+    int ready;
+} writer_slot;
+
+/* Ordered writer. Workers hand encoded blocks over and carry on,
+ * a dedicated thread writes them to the file in raster order.
+ * Thread-unaware version writes runs of ready blocks in place. */
+typedef struct block_writer_tag {
+    psi_image *psi;
+    int n_blocks;
+    writer_slot *slots;
+    int n_slots;
+    unsigned char **bufs;
+    int *buf_sizes;
+    int next;
+    int *stop_flag;
+#ifdef ENABLE_PTHREADS
+    int stopped;
+    int closing;
+    int rc;
+    int err;
+    int reported;
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;
+    pthread_cond_t free_cond;
+    pthread_t tid;
+#endif
+} block_writer;
+
 /* Encoding context for multi-theaded environment.
  * This code is designed to be compatible with
  * thread-unaware program version. */
@@ -61,14 +102,13 @@ typedef struct encode_ctx_tag {
     double Cb_ratio;
     double Cr_ratio;
     int resample;
+    int flags;
     int W;
     int H;
     int n_blocks;
+    int n_passes;
     int *done_blocks;
     int n_threads;
-#ifdef ENABLE_CLUSTER
-    struct sockaddr_in *node;
-#endif
     int thread_idx;
     time_t start_time;
     char *pbm_file;
@@ -80,32 +120,79 @@ typedef struct encode_ctx_tag {
     int quiet;
     int *clear_len;
     int *stop_flag;
+    block_writer *writer;
+    eps_rd_info *rd;
+    int *block_budgets;
+#ifdef ENABLE_CLUSTER
+    /* Blocks are sent in strips of `strip' adjacent blocks */
+    int strip;
+    int strips_per_row;
+    /* Dispatcher buffers */
+    unsigned char **rows;
+    unsigned char *cluster_buf;
+    /* Input buffers of local workers, three per worker,
+     * unless the image is mapped */
+    unsigned char ***local_block;
+#endif
 } encode_ctx;
 
 static int check_pbm_ext(char *file);
 static void replace_pbm_to_psi(char *file);
+#ifdef ENABLE_PTHREADS
+static void *writer_thread(void *arg);
+#else
+static int writer_flush(block_writer *wr);
+#endif
+static void writer_init(block_writer *wr, psi_image *psi, int n_blocks,
+                        int n_slots, int buf_size, int *stop_flag);
+static int writer_put(block_writer *wr, int idx, unsigned char **buf,
+                      int buf_size);
+#if defined(ENABLE_PTHREADS) || defined(ENABLE_CLUSTER)
+static void writer_stop(block_writer *wr);
+#endif
+static int writer_finish(block_writer *wr);
+static void encode_progress(encode_ctx *ctx);
+#ifndef ENABLE_CLUSTER
 static void *encode_blocks(void *arg);
+#else
+static void get_strip(encode_ctx *ctx, int idx, int *x, int *y,
+                      int *w, int *h);
+static int encode_fill(void *arg, int idx, block_frame *frame,
+                       cluster_payload *payload);
+static int encode_local(void *arg, int worker, int idx,
+                        block_frame *frame, unsigned char *answer);
+static int encode_done(void *arg, int idx, block_frame *frame,
+                       unsigned char *payload, int size);
+static int encode_cluster(encode_ctx *ctx, cluster_nodes *nodes,
+                          int horizon);
+#endif
+#ifndef ENABLE_CLUSTER
+static int encode_pass(encode_ctx *ctx);
+#endif
 static void encode_file(char *filter_id, int block_size, int mode,
                         double ratio, int two_pass, int n_threads,
                         void *cluster, int Y_ratio, int Cb_ratio,
-                        int Cr_ratio, int resample, int halt_on_errors,
-                        int quiet, char *output_dir, char *file,
-                        int current, int total);
+                        int Cr_ratio, int resample, int flags,
+                        int block_index, int halt_on_errors, int quiet,
+                        char *output_dir, char *file, int current,
+                        int total);
 
 #ifdef ENABLE_MPI
 static void encode_file_mpi(char *filter_id, int block_size, int mode,
                             double ratio, int two_pass, int n_threads,
                             int Y_ratio, int Cb_ratio, int Cr_ratio,
-                            int resample, int halt_on_errors,
-                            int quiet, char *output_dir, char *file,
-                            int current, int total);
+                            int resample, int flags, int block_index,
+                            int halt_on_errors, int quiet, char *output_dir,
+                            char *file, int current, int total);
 #endif
 
 void cmd_encode_file(char *filter_id, int block_size, int mode,
                      double ratio, int two_pass, int n_threads,
-                     char *node_list, int Y_ratio, int Cb_ratio,
-                     int Cr_ratio, int resample, int halt_on_errors,
-                     int quiet, char *output_dir, char **files);
+                     char *node_list, int window, int local_threads,
+                     int Y_ratio, int Cb_ratio, int Cr_ratio,
+                     int resample, int binary_header, int checksum,
+                     int block_index, int halt_on_errors, int quiet,
+                     char *output_dir, char **files);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,127 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006,2007,2010 Alexander Simakov, <xander@entropyware.info>
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef ENABLE_CLUSTER
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <options.h>
+#include <misc.h>
+#include <cmd_start_node.h>
+#include <cmd_node_stats.h>
+
+/* Ask node for its statistics. Return text length or -1 on error. */
+static int query_node(node_addr *addr, char *buf, int size)
+{
+    struct timeval timeout;
+    block_frame frame;
+    int sock_fd;
+    int rc;
+
+    timeout.tv_sec = IO_TIMEOUT;
+    timeout.tv_usec = 0;
+
+    if ((sock_fd = socket(addr->sa.sa_family, SOCK_STREAM, 0)) == -1) {
+        return -1;
+    }
+
+    /* Do not wait forever for dead nodes */
+    if ((setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+        sizeof(timeout)) == -1) ||
+        (setsockopt(sock_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+        sizeof(timeout)) == -1) ||
+        (connect(sock_fd, &addr->sa, node_addr_len(addr)) == -1) ||
+        (send_value(sock_fd, ACTION_STATS) != 0))
+    {
+        close(sock_fd);
+        return -1;
+    }
+
+    rc = receive_frame(sock_fd, &frame, buf, size - 1);
+    close(sock_fd);
+
+    if (rc != 1) {
+        /* Older nodes just close the connection */
+        if (rc == 0) {
+            errno = EPROTONOSUPPORT;
+        }
+
+        return -1;
+    }
+
+    buf[frame.size] = 0;
+
+    return frame.size;
+}
+
+/* Print statistics of all cluster nodes */
+void cmd_node_stats(char *node_list)
+{
+    node_addr nodes[MAX_CLUSTER_NODES];
+    char buf[MAX_STATS_SIZE];
+    char name[MAX_NODE_NAME];
+    char other[MAX_NODE_NAME];
+    int n_nodes;
+    int i, j;
+
+    /* Load list of cluster nodes */
+    n_nodes = find_cluster_nodes(node_list, nodes);
+
+    for (i = 0; i < n_nodes; i++) {
+        /* Node is listed once per connection */
+        node_addr_name(&nodes[i], name, sizeof(name));
+
+        for (j = 0; j < i; j++) {
+            node_addr_name(&nodes[j], other, sizeof(other));
+
+            if (!strcmp(name, other)) {
+                break;
+            }
+        }
+
+        if (j < i) {
+            continue;
+        }
+
+        if (query_node(&nodes[i], buf, sizeof(buf)) == -1) {
+            printf("# Cannot query node %s: %m\n", name);
+            continue;
+        }
+
+        printf("# Node %s\n%s", name, buf);
+    }
+}
+
+#endif /* ENABLE_CLUSTER */
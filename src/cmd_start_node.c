@@ -34,12 +34,16 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
-#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <time.h>
 #include <string.h>
@@ -47,10 +51,73 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <epsilon.h>
 #include <options.h>
 #include <misc.h>
 
+static void daemon_init();
+static void sigterm_handler(int sig);
+static void start_server(int port, int metrics_port, char *unix_socket,
+                         int n_threads);
+static int bind_listener(node_addr *addr);
+static int open_listener(int port, unsigned long addr);
+static int open_unix_listener(char *pathname);
+static void watch_listener(int listen_fd, void *marker);
+static void accept_connections(int listen_fd, int http);
+static void open_connection(int conn_fd, node_addr *cli_addr, int http);
+static void close_connection(node_conn *conn);
+static void release_connection(node_conn *conn);
+static int update_events(node_conn *conn);
+static int serve_connection(node_conn *conn, int events);
+static int receive_requests(node_conn *conn);
+static int parse_requests(node_conn *conn);
+static int grow_input(node_conn *conn, int size);
+static unsigned char *queue_reply(node_conn *conn, int len);
+static int parse_request(node_conn *conn, unsigned char *p, int avail);
+static int alloc_slots(node_conn *conn);
+static int grow_slot(node_conn *conn, node_slot *slot, int n_jobs,
+                     int n_bytes);
+static int parse_block(node_conn *conn, unsigned char *p, int avail);
+static void drop_jobs(node_conn *conn, node_slot *slot, int first);
+static int make_answer(node_conn *conn, node_slot *slot);
+static void block_done(eps_job *job);
+static int gather_answer(node_slot *slot, struct iovec *iov, int skip);
+static int send_answers(node_conn *conn);
+static void stats_add(stats_hist *hist, double value);
+static void stats_printf(char *buf, int size, int *len, char *fmt, ...);
+static void stats_print_hist(char *buf, int size, int *len,
+                             stats_hist *hist, char *stage);
+static int format_stats(char *buf, int size);
+static int send_stats(node_conn *conn);
+static int serve_metrics(node_conn *conn);
+
+/* Event loop descriptor and block processing pool */
+static int epoll_fd = -1;
+static eps_pool *pool = NULL;
+
+/* Unix domain socket and metrics listeners, their
+ * addresses mark events of the listeners */
+static int unix_fd = -1;
+static int metrics_fd = -1;
+
+/* Node statistics */
+static node_stats stats;
+
+#ifdef ENABLE_PTHREADS
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Upper bounds of time histogram buckets, in seconds */
+static const double stats_bounds[STATS_BUCKETS] = {
+    0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0
+};
+
+/* Metric labels of block actions */
+static const char *action_labels[N_ACTIONS] = {
+    "encode_gs", "encode_tc", "decode_gs", "decode_tc"
+};
+
 /*
  * Set signal handler 'sig_handler' for signal 'sig'.
  * Try to restart interupted system calls automaticaly.
@@ -166,6 +233,137 @@ int receive_value(int fd, int *value) {
     return 1;
 }
 
+/* Convert frame header to network byte order */
+void pack_frame(block_frame *frame, unsigned char *hdr)
+{
+    uint32_t x[FRAME_FIELDS];
+
+    x[0] = htonl(frame->tag);
+    x[1] = htonl(frame->x);
+    x[2] = htonl(frame->y);
+    x[3] = htonl(frame->w);
+    x[4] = htonl(frame->h);
+    x[5] = htonl(frame->size);
+
+    memcpy(hdr, x, FRAME_HDR_SIZE);
+}
+
+/* Convert frame header from network byte order */
+void unpack_frame(unsigned char *hdr, block_frame *frame)
+{
+    uint32_t x[FRAME_FIELDS];
+
+    memcpy(x, hdr, FRAME_HDR_SIZE);
+
+    frame->tag = ntohl(x[0]);
+    frame->x = ntohl(x[1]);
+    frame->y = ntohl(x[2]);
+    frame->w = ntohl(x[3]);
+    frame->h = ntohl(x[4]);
+    frame->size = ntohl(x[5]);
+}
+
+/* Send frame header and payload with a single system call */
+int send_frame(int fd, block_frame *frame, void *payload)
+{
+    unsigned char hdr[FRAME_HDR_SIZE];
+    struct iovec iov[2];
+    struct iovec *v = iov;
+    int n_vecs = 2;
+    ssize_t nwritten;
+
+    pack_frame(frame, hdr);
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = FRAME_HDR_SIZE;
+    iov[1].iov_base = payload;
+    iov[1].iov_len = frame->size;
+
+    while (n_vecs > 0) {
+        if ((nwritten = writev(fd, v, n_vecs)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        /* Skip over written part */
+        while ((n_vecs > 0) && (nwritten >= (ssize_t) v->iov_len)) {
+            nwritten -= v->iov_len;
+            v++;
+            n_vecs--;
+        }
+
+        if (n_vecs > 0) {
+            v->iov_base = (char *) v->iov_base + nwritten;
+            v->iov_len -= nwritten;
+        }
+    }
+
+    return 0;
+}
+
+/* Receive frame header and at most `max_size' bytes of payload.
+ * Return 1 on success, 0 on EOF (between frames) and -1 on error. */
+int receive_frame(int fd, block_frame *frame, void *payload, int max_size)
+{
+    unsigned char hdr[FRAME_HDR_SIZE];
+    ssize_t nbytes;
+
+    nbytes = readn(fd, hdr, FRAME_HDR_SIZE);
+
+    if (nbytes == 0) {
+        return 0;
+    }
+
+    if (nbytes != FRAME_HDR_SIZE) {
+        return -1;
+    }
+
+    unpack_frame(hdr, frame);
+
+    if ((frame->size < 0) || (frame->size > max_size)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (readn(fd, payload, frame->size) != frame->size) {
+        return -1;
+    }
+
+    return 1;
+}
+
+/* Each frame goes out with a single write, do not delay it */
+void set_nodelay(int fd)
+{
+    int on = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+/* Printable node address */
+void node_addr_name(node_addr *addr, char *name, int size)
+{
+    char ip_addr[INET_ADDRSTRLEN];
+
+    if (addr->sa.sa_family == AF_UNIX) {
+        snprintf(name, size, "%s", addr->un.sun_path);
+    } else {
+        inet_ntop(AF_INET, &addr->in.sin_addr, ip_addr, INET_ADDRSTRLEN);
+        snprintf(name, size, "%s port %d", ip_addr,
+            ntohs(addr->in.sin_port));
+    }
+}
+
+/* Size of the actual address structure */
+socklen_t node_addr_len(node_addr *addr)
+{
+    return addr->sa.sa_family == AF_UNIX ? sizeof(struct sockaddr_un) :
+        sizeof(struct sockaddr_in);
+}
+
 /* Daemonize cluster node */
 static void daemon_init()
 {
@@ -207,34 +405,18 @@ static void daemon_init()
 /* Shutdown cluster node */
 static void sigterm_handler(int sig)
 {
+    (void) sig;
+
     syslog(LOG_INFO, "EPSILON cluster node is DOWN");
     exit(0);
 }
 
-/* Wait for children processes */
-static void sigchld_handler(int sig)
-{
-    pid_t pid;
-    int stat;
-
-    while ((pid = waitpid(-1, &stat, WNOHANG)) > 0);
-}
-
-/*
- * Listen incoming client connections. For each client new
- * process is forked and called client_request().
- */
-
-static void start_server(int port)
+/* Create non-blocking listening socket bound to `addr' */
+static int bind_listener(node_addr *addr)
 {
-    struct sockaddr_in cli_addr, srv_addr;
-    int listen_fd, conn_fd, opt;
-    struct timeval timeout;
-    socklen_t cli_len;
-    sigset_t sig_block;
-    pid_t pid;
+    int listen_fd, opt;
 
-    if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+    if ((listen_fd = socket(addr->sa.sa_family, SOCK_STREAM, 0)) == -1) {
         syslog(LOG_ERR, "socket(): %m");
         exit(1);
     }
@@ -242,18 +424,14 @@ static void start_server(int port)
     opt = 1;
 
     /* Re-use local address */
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+    if ((addr->sa.sa_family == AF_INET) &&
+        (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1))
+    {
         syslog(LOG_ERR, "setsockopt(): %m");
         exit(1);
     }
 
-    memset(&srv_addr, 0, sizeof(srv_addr));
-
-    srv_addr.sin_family = AF_INET;
-    srv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    srv_addr.sin_port = htons(port);
-
-    if (bind(listen_fd, (SA *) &srv_addr, sizeof(srv_addr)) == -1) {
+    if (bind(listen_fd, &addr->sa, node_addr_len(addr)) == -1) {
         syslog(LOG_ERR, "bind(): %m");
         exit(1);
     }
@@ -263,563 +441,1548 @@ static void start_server(int port)
         exit(1);
     }
 
+    /* All pending connections are accepted at once */
+    if (fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK) == -1) {
+        syslog(LOG_ERR, "fcntl(): %m");
+        exit(1);
+    }
+
+    return listen_fd;
+}
+
+/* Listen TCP port on the given interface */
+static int open_listener(int port, unsigned long addr)
+{
+    node_addr srv_addr;
+
+    memset(&srv_addr, 0, sizeof(srv_addr));
+
+    srv_addr.in.sin_family = AF_INET;
+    srv_addr.in.sin_addr.s_addr = htonl(addr);
+    srv_addr.in.sin_port = htons(port);
+
+    return bind_listener(&srv_addr);
+}
+
+/* Listen Unix domain socket, stale socket file is removed */
+static int open_unix_listener(char *pathname)
+{
+    node_addr srv_addr;
+
+    memset(&srv_addr, 0, sizeof(srv_addr));
+
+    srv_addr.un.sun_family = AF_UNIX;
+    strcpy(srv_addr.un.sun_path, pathname);
+
+    unlink(pathname);
+
+    return bind_listener(&srv_addr);
+}
+
+/* Add listening socket to the event loop. Events
+ * of the listener carry the `marker' pointer. */
+static void watch_listener(int listen_fd, void *marker)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = marker;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+        syslog(LOG_ERR, "epoll_ctl(): %m");
+        exit(1);
+    }
+}
+
+/*
+ * Listen incoming client connections. Connections are
+ * multiplexed with epoll and never block: requests are
+ * assembled as data arrives and passed to the worker pool.
+ * Processed blocks are queued by the worker threads and
+ * sent back by the event loop as the socket takes them.
+ * MASTERs on the same host may connect to
+ * a Unix domain socket. Metrics are served on a separate
+ * port bound to the loopback interface.
+ */
+
+static void start_server(int port, int metrics_port, char *unix_socket,
+                         int n_threads)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int listen_fd;
+    int i, n;
+
+    listen_fd = open_listener(port, INADDR_ANY);
+
+    if ((epoll_fd = epoll_create(MAX_EVENTS)) == -1) {
+        syslog(LOG_ERR, "epoll_create(): %m");
+        exit(1);
+    }
+
+    watch_listener(listen_fd, NULL);
+
+    if (unix_socket) {
+        unix_fd = open_unix_listener(unix_socket);
+        watch_listener(unix_fd, &unix_fd);
+    }
+
+    if (metrics_port != OPT_NA) {
+        metrics_fd = open_listener(metrics_port, INADDR_LOOPBACK);
+        watch_listener(metrics_fd, &metrics_fd);
+    }
+
     /* Set signal handlers */
     set_signal(SIGTERM, sigterm_handler);
-    set_signal(SIGCHLD, sigchld_handler);
     set_signal(SIGPIPE, SIG_IGN);
 
-    /* Choose signals to block before forking child process.
-     * Those signals will be unblocked for server process
-     * after forking new child. For child process those
-     * signals have no sence and will be reset to default
-     * (i.e. process termination). */
-    sigemptyset(&sig_block);
-    sigaddset(&sig_block, SIGTERM);
-    sigaddset(&sig_block, SIGCHLD);
+    /* Start worker threads */
+    if ((pool = eps_pool_create(n_threads)) == NULL) {
+        syslog(LOG_ERR, "Cannot start %d worker threads", n_threads);
+        exit(1);
+    }
+
+    /* A serial pool would encode on the event loop thread
+     * and stall every connection while doing it */
+    if (eps_pool_threads(pool) == 0) {
+        syslog(LOG_ERR, "Library is built without thread support");
+        exit(1);
+    }
+
+    stats.start_time = time(NULL);
+    stats.n_threads = n_threads;
+
+    syslog(LOG_INFO, "EPSILON cluster node is UP (%d threads)", n_threads);
+
+    for (;;) {
+        if ((n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            } else {
+                syslog(LOG_ERR, "epoll_wait(): %m");
+                exit(1);
+            }
+        }
 
-    timeout.tv_sec = IO_TIMEOUT;
-    timeout.tv_usec = 0;
+        for (i = 0; i < n; i++) {
+            node_conn *conn = (node_conn *) events[i].data.ptr;
+
+            if (!conn) {
+                accept_connections(listen_fd, 0);
+            } else if (events[i].data.ptr == &unix_fd) {
+                accept_connections(unix_fd, 0);
+            } else if (events[i].data.ptr == &metrics_fd) {
+                accept_connections(metrics_fd, 1);
+            } else if (serve_connection(conn, events[i].events) != 0) {
+                close_connection(conn);
+            }
+        }
+    }
+}
 
-    syslog(LOG_INFO, "EPSILON cluster node is UP");
+/* Accept all pending connections */
+static void accept_connections(int listen_fd, int http)
+{
+    node_addr cli_addr;
+    socklen_t cli_len;
+    int conn_fd;
 
     for (;;) {
         cli_len = sizeof(cli_addr);
 
-        if ((conn_fd = accept(listen_fd, (SA *) &cli_addr, &cli_len)) == -1) {
+        if ((conn_fd = accept(listen_fd, &cli_addr.sa, &cli_len)) == -1) {
             if (errno == EINTR) {
                 continue;
+            } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+                (errno == ECONNABORTED))
+            {
+                return;
             } else {
                 syslog(LOG_ERR, "accept(): %m");
                 exit(1);
             }
         }
 
-        /* Block SIGTERM, SIGHUP and SIGCHLD */
-        sigprocmask(SIG_BLOCK, &sig_block, NULL);
-
-        /* Set receive time-out */
-        if (setsockopt(conn_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
-            syslog(LOG_ERR, "setsockopt(): %m");
+        /* Connections never block the event loop */
+        if (fcntl(conn_fd, F_SETFL, fcntl(conn_fd, F_GETFL) | O_NONBLOCK) == -1) {
+            syslog(LOG_ERR, "fcntl(): %m");
             exit(1);
         }
 
-        /* Set send time-out */
-        if (setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1) {
-            syslog(LOG_ERR, "setsockopt(): %m");
-            exit(1);
-        }
+        open_connection(conn_fd, &cli_addr, http);
+    }
+}
 
-        /* Fork new process for client */
-        if ((pid = fork()) == -1) {
-            syslog(LOG_ERR, "fork(): %m");
-            exit(1);
-        }
+/* Register new connection */
+static void open_connection(int conn_fd, node_addr *cli_addr, int http)
+{
+    node_conn *conn;
+    int rc;
 
-        if (pid == 0) {
-            /* Reset signal handlers to defaults and unblock them */
-            set_signal(SIGTERM, SIG_DFL);
-            set_signal(SIGCHLD, SIG_DFL);
-            sigprocmask(SIG_UNBLOCK, &sig_block, NULL);
+    if ((conn = (node_conn *) calloc(1, sizeof(node_conn))) == NULL) {
+        syslog(LOG_ERR, "calloc(): %m");
+        close(conn_fd);
+        return;
+    }
 
-            /* Close unnecessary (for child) descriptor */
-            close(listen_fd);
-            client_request(conn_fd, &cli_addr);
+    if ((conn->in_buf = (unsigned char *) malloc(NODE_BUF_SIZE)) == NULL) {
+        syslog(LOG_ERR, "malloc(): %m");
+        free(conn);
+        close(conn_fd);
+        return;
+    }
 
-            exit(0);
-        }
+    conn->sock_fd = conn_fd;
+    conn->http = http;
+    conn->action = ACTION_NONE;
+    conn->in_size = NODE_BUF_SIZE;
 
-        /* Unblock 'sig_block' signals for server */
-        sigprocmask(SIG_UNBLOCK, &sig_block, NULL);
+#ifdef ENABLE_PTHREADS
+    assert(!pthread_mutex_init(&conn->lock, NULL));
+#endif
 
-        close(conn_fd);
+    /* Peers of Unix domain sockets have no address */
+    if (cli_addr->sa.sa_family == AF_INET) {
+        inet_ntop(AF_INET, &cli_addr->in.sin_addr, conn->ip_addr,
+            INET_ADDRSTRLEN);
+        conn->port = ntohs(cli_addr->in.sin_port);
+    } else {
+        strcpy(conn->ip_addr, "local");
+        conn->port = 0;
     }
-}
-
-/* Handle client request */
-static void client_request(int sock_fd, struct sockaddr_in *cli_addr)
-{
-    char ip_addr[INET_ADDRSTRLEN];
-    int port;
-    int action;
 
-    inet_ntop(AF_INET, &cli_addr->sin_addr, ip_addr, INET_ADDRSTRLEN);
-    port = ntohs(cli_addr->sin_port);
+    /* Scrapes are neither logged nor counted */
+    if (!http) {
+        syslog(LOG_INFO, "Connection from %s port %d",
+            conn->ip_addr, conn->port);
 
-    syslog(LOG_INFO, "Connection from %s port %d", ip_addr, port);
+        LOCK(stats_lock);
+        stats.n_conns++;
+        stats.active_conns++;
+        UNLOCK(stats_lock);
+    }
 
-    /* Get core parameters */
-    RECV_VALUE_FROM_MASTER(&action);
+    LOCK(conn->lock);
+    rc = update_events(conn);
+    UNLOCK(conn->lock);
 
-    switch (action) {
-        case ACTION_ENCODE_GS:
-        {
-            action_encode_gs(sock_fd, ip_addr, port);
-            break;
-        }
-        case ACTION_ENCODE_TC:
-        {
-            action_encode_tc(sock_fd, ip_addr, port);
-            break;
-        }
-        case ACTION_DECODE_GS:
-        {
-            action_decode_gs(sock_fd, ip_addr, port);
-            break;
-        }
-        case ACTION_DECODE_TC:
-        {
-            action_decode_tc(sock_fd, ip_addr, port);
-            break;
-        }
-        default:
-        {
-            syslog(LOG_ERR,
-                "Unsupported action (%d) from %s port %d",
-                action, ip_addr, ntohs(cli_addr->sin_port));
-            return;
-        }
+    if (rc != 0) {
+        close_connection(conn);
     }
 }
 
-/* Encode GS blocks */
-static void action_encode_gs(int sock_fd, char *ip_addr, int port)
+/* Stop serving the connection. Queued answers are dropped,
+ * connection is released as soon as all blocks still being
+ * processed are done. */
+static void close_connection(node_conn *conn)
 {
-    int bytes_per_block;
-    int block_size;
-    int mode;
+    node_slot *slot;
+    int n_dropped = 0;
+    int idle;
 
-    int W, H;
-    int w, h;
-    int x, y;
+    LOCK(conn->lock);
 
-    char filter[64];
-    int filter_len;
+    conn->closing = 1;
 
-    unsigned char *Y0;
-    unsigned char **Y;
-    unsigned char *buf;
+    while (conn->out_count) {
+        slot = &conn->slots[conn->out_fifo[conn->out_head]];
+        conn->out_head = (conn->out_head + 1) % conn->window;
+        conn->out_count--;
+
+        slot->busy = 0;
+        conn->n_busy--;
+        n_dropped += slot->n_jobs;
+    }
 
-    /* Receive general parameters */
-    RECV_VALUE_FROM_MASTER(&W);
-    RECV_VALUE_FROM_MASTER(&H);
-    RECV_VALUE_FROM_MASTER(&block_size);
-    RECV_VALUE_FROM_MASTER(&bytes_per_block);
-    RECV_VALUE_FROM_MASTER(&mode);
-    RECV_VALUE_FROM_MASTER(&filter_len);
+    /* Closing descriptor is delayed, so stop watching it */
+    if (conn->events) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sock_fd, NULL);
+        conn->events = 0;
+    }
 
-    if (filter_len >= sizeof(filter)) {
-        syslog(LOG_ERR,
-            "Filter length (%d) from from %s port %d too large",
-            filter_len, ip_addr, port);
-        return;
+    idle = conn->n_busy == 0;
+
+    UNLOCK(conn->lock);
+
+    if (n_dropped) {
+        LOCK(stats_lock);
+        stats.queue_depth -= n_dropped;
+        stats.n_failed += n_dropped;
+        UNLOCK(stats_lock);
     }
 
-    RECV_BUF_FROM_MASTER(&filter, filter_len);
-    filter[filter_len] = 0;
-
-    /* Allocate memory (it will be released implicitly at exit) */
-    Y0 = (unsigned char *) xmalloc(block_size * block_size,
-        sizeof(unsigned char));
-    Y = (unsigned char **) eps_malloc_2D(block_size, block_size,
-        sizeof(unsigned char));
-    buf = (unsigned char *) xmalloc(bytes_per_block,
-        sizeof(unsigned char));
-
-    /* Process all incoming blocks */
-    while (1) {
-        /* Read/Write/Encode timers */
-        struct timeval r_time_start, r_time_stop;
-        struct timeval w_time_start, w_time_stop;
-        struct timeval e_time_start, e_time_stop;
-
-        /* Total timers */
-        double read_time = 0.0;
-        double write_time = 0.0;
-        double encode_time = 0.0;
-
-        int buf_size;
-        int rc;
-
-        /* Get block-specific parameters */
-        RECV_VALUE_FROM_MASTER(&x);
-        TIMER_START(r_time_start);
-        RECV_VALUE_FROM_MASTER(&y);
-        RECV_VALUE_FROM_MASTER(&w);
-        RECV_VALUE_FROM_MASTER(&h);
-        RECV_BUF_FROM_MASTER(Y0, w * h);
-        TIMER_STOP(r_time_start, r_time_stop, read_time);
-
-        /* Transform Y channel */
-        TIMER_START(e_time_start);
-        transform_1D_to_2D(Y0, Y, w, h);
-        buf_size = bytes_per_block - 1;
-
-        /* Encode GS block */
-        rc = eps_encode_grayscale_block(Y, W, H, w, h, x, y,
-            buf, &buf_size, filter, mode);
-
-        assert(rc == EPS_OK);
-        TIMER_STOP(e_time_start, e_time_stop, encode_time);
-
-        /* Send encoded data to the MASTER */
-        TIMER_START(w_time_start);
-        SEND_VALUE_TO_MASTER(buf_size);
-        SEND_BUF_TO_MASTER(buf, buf_size);
-        TIMER_STOP(w_time_start, w_time_stop, write_time);
-
-        /* Syslog statistics */
-        syslog(LOG_INFO,
-            "[ENCODE GS] W=%d H=%d w=%d h=%d x=%d y=%d rtime=%.3f "
-            "wtime=%.3f etime=%.3f bs=%d bpb=%d m=%s f=%s",
-            W, H, w, h, x, y, read_time, write_time, encode_time,
-            block_size, bytes_per_block,
-            mode == EPS_MODE_NORMAL ? "normal" : "otlpf", filter);
+    if (idle) {
+        release_connection(conn);
     }
 }
 
-/* Encode TC blocks */
-static void action_encode_tc(int sock_fd, char *ip_addr, int port)
+/* Log statistics, close connection and release its buffers */
+static void release_connection(node_conn *conn)
 {
-    int bytes_per_block;
-    int block_size;
-    int resample;
-    int mode;
+    int i, k;
 
-    int W, H;
-    int x, y;
-    int w, h;
+    if (conn->n_blocks) {
+        syslog(LOG_INFO,
+            "[%s] %s port %d: blocks=%d window=%d rtime=%.3f "
+            "wtime=%.3f ptime=%.3f",
+            conn->action == ACTION_ENCODE_GS ? "ENCODE GS" :
+            conn->action == ACTION_ENCODE_TC ? "ENCODE TC" :
+            conn->action == ACTION_DECODE_GS ? "DECODE GS" : "DECODE TC",
+            conn->ip_addr, conn->port, conn->n_blocks, conn->window,
+            conn->read_time, conn->write_time, conn->proc_time);
+    }
 
-    char filter[64];
-    int filter_len;
+    if (!conn->http) {
+        LOCK(stats_lock);
+        stats.active_conns--;
+        UNLOCK(stats_lock);
+    }
 
-    int Y_ratio;
-    int Cb_ratio;
-    int Cr_ratio;
+    close(conn->sock_fd);
 
-    unsigned char *Y0;
-    unsigned char **R;
-    unsigned char **G;
-    unsigned char **B;
-    unsigned char *buf;
+    if (conn->slots) {
+        for (i = 0; i < conn->window; i++) {
+            free(conn->slots[i].pixels);
+            free(conn->slots[i].buf);
+            free(conn->slots[i].jobs);
 
-    /* Receive general parameters */
-    RECV_VALUE_FROM_MASTER(&W);
-    RECV_VALUE_FROM_MASTER(&H);
-    RECV_VALUE_FROM_MASTER(&block_size);
-    RECV_VALUE_FROM_MASTER(&bytes_per_block);
-    RECV_VALUE_FROM_MASTER(&mode);
-    RECV_VALUE_FROM_MASTER(&filter_len);
+            for (k = 0; k < 3; k++) {
+                free(conn->slots[i].rows[k]);
+            }
+        }
 
-    if (filter_len >= sizeof(filter)) {
-        syslog(LOG_ERR,
-            "Filter length (%d) from from %s port %d too large",
-            filter_len, ip_addr, port);
-        return;
+        free(conn->slots);
     }
 
-    RECV_BUF_FROM_MASTER(&filter, filter_len);
-    filter[filter_len] = 0;
-
-    RECV_VALUE_FROM_MASTER(&resample);
-    RECV_VALUE_FROM_MASTER(&Y_ratio);
-    RECV_VALUE_FROM_MASTER(&Cb_ratio);
-    RECV_VALUE_FROM_MASTER(&Cr_ratio);
-
-    /* Allocate memory (it will be released implicitly at exit) */
-    Y0 = (unsigned char *) xmalloc(block_size * block_size,
-        sizeof(unsigned char));
-    R = (unsigned char **) eps_malloc_2D(block_size, block_size,
-        sizeof(unsigned char));
-    G = (unsigned char **) eps_malloc_2D(block_size, block_size,
-        sizeof(unsigned char));
-    B = (unsigned char **) eps_malloc_2D(block_size, block_size,
-        sizeof(unsigned char));
-    buf = (unsigned char *) xmalloc(bytes_per_block,
-        sizeof(unsigned char));
-
-    /* Process all incoming blocks */
-    while (1) {
-        /* Read/Write/Encode timers */
-        struct timeval r_time_start, r_time_stop;
-        struct timeval w_time_start, w_time_stop;
-        struct timeval e_time_start, e_time_stop;
-
-        /* Total timers */
-        double read_time = 0.0;
-        double write_time = 0.0;
-        double encode_time = 0.0;
-
-        int buf_size;
-        int rc;
-
-        /* Receive block-specific parameters */
-        RECV_VALUE_FROM_MASTER(&x);
-        TIMER_START(r_time_start);
-        RECV_VALUE_FROM_MASTER(&y);
-        RECV_VALUE_FROM_MASTER(&w);
-        RECV_VALUE_FROM_MASTER(&h);
-        RECV_BUF_FROM_MASTER(Y0, w * h);
-        TIMER_STOP(r_time_start, r_time_stop, read_time);
-
-        /* Transform R channel */
-        TIMER_START(e_time_start);
-        transform_1D_to_2D(Y0, R, w, h);
-        TIMER_STOP(e_time_start, e_time_stop, encode_time);
-
-        /* Receive G channel */
-        TIMER_START(r_time_start);
-        RECV_BUF_FROM_MASTER(Y0, w * h);
-        TIMER_STOP(r_time_start, r_time_stop, read_time);
-
-        /* Transform G channel */
-        TIMER_START(e_time_start);
-        transform_1D_to_2D(Y0, G, w, h);
-        TIMER_STOP(e_time_start, e_time_stop, encode_time);
-
-        /* Receive B channel */
-        TIMER_START(r_time_start);
-        RECV_BUF_FROM_MASTER(Y0, w * h);
-        TIMER_STOP(r_time_start, r_time_stop, read_time);
-
-        /* Transform B channel */
-        TIMER_START(e_time_start);
-        transform_1D_to_2D(Y0, B, w, h);
-
-        buf_size = bytes_per_block - 1;
-
-        /* Encode TC block */
-        rc = eps_encode_truecolor_block(R, G, B, W, H, w, h,
-            x, y, resample, buf, &buf_size, Y_ratio,
-            Cb_ratio, Cr_ratio, filter, mode);
-
-        assert(rc == EPS_OK);
-        TIMER_STOP(e_time_start, e_time_stop, encode_time);
-
-        /* Send encoded data to the MASTER */
-        TIMER_START(w_time_start);
-        SEND_VALUE_TO_MASTER(buf_size);
-        SEND_BUF_TO_MASTER(buf, buf_size);
-        TIMER_STOP(w_time_start, w_time_stop, write_time);
-
-        /* Syslog statistics */
-        syslog(LOG_INFO,
-            "[ENCODE TC] W=%d H=%d w=%d h=%d x=%d y=%d rtime=%.3f "
-            "wtime=%.3f etime=%.3f bs=%d bpb=%d m=%s f=%s "
-            "Y_rt=%d Cb_rt=%d Cr_rt=%d resample=%s",
-            W, H, w, h, x, y, read_time, write_time, encode_time,
-            block_size, bytes_per_block,
-            mode == EPS_MODE_NORMAL ? "normal" : "otlpf", filter,
-            Y_ratio, Cb_ratio, Cr_ratio,
-            resample == EPS_RESAMPLE_444 ? "no" : "yes");
-    }
+    free(conn->in_buf);
+    free(conn->out_fifo);
+    free(conn->reply);
+
+#ifdef ENABLE_PTHREADS
+    assert(!pthread_mutex_destroy(&conn->lock));
+#endif
+
+    free(conn);
 }
 
-/* Decode GS blocks */
-static void action_decode_gs(int sock_fd, char *ip_addr, int port)
+/* Watch connection for requests and, while there are answers
+ * to send, for room in the socket buffer. Answers are queued
+ * by worker threads, so the connection lock must be held. */
+static int update_events(node_conn *conn)
 {
-    unsigned char *Y0;
-    unsigned char **Y;
-    unsigned char *buf;
-    int block_size;
-    int buf_size;
-
-    /* Receive general parameters */
-    RECV_VALUE_FROM_MASTER(&buf_size);
-    RECV_VALUE_FROM_MASTER(&block_size);
-
-    /* Allocate memory (it will be released implicitly at exit) */
-    Y0 = (unsigned char *) xmalloc(block_size * block_size,
-        sizeof(unsigned char));
-    Y = (unsigned char **) eps_malloc_2D(block_size, block_size,
-        sizeof(unsigned char));
-    buf = (unsigned char *) xmalloc(buf_size,
-        sizeof(unsigned char));
-
-    /* Process all incoming blocks */
-    while (1) {
-        /* Read/Write/Decode timers */
-        struct timeval r_time_start, r_time_stop;
-        struct timeval w_time_start, w_time_stop;
-        struct timeval d_time_start, d_time_stop;
-
-        /* Total timers */
-        double read_time = 0.0;
-        double write_time = 0.0;
-        double decode_time = 0.0;
-
-        /* PSI header */
-        eps_block_header hdr;
-
-        int real_buf_size;
-        int rc;
-
-        /* Receive block-specific parameters */
-        RECV_VALUE_FROM_MASTER(&real_buf_size);
-        TIMER_START(r_time_start);
-        RECV_BUF_FROM_MASTER(buf, real_buf_size);
-        TIMER_STOP(r_time_start, r_time_stop, read_time);
+    struct epoll_event ev;
+    int events = EPOLLIN;
+    int op;
 
-        /* Parse header (also it should be checked at MASTER side) */
-        TIMER_START(d_time_start);
-        rc = eps_read_block_header(buf, real_buf_size, &hdr);
-        assert(rc == EPS_OK);
+    if (conn->closing) {
+        return 0;
+    }
+
+    /* The event loop closes failed connections */
+    if (conn->out_count || conn->failed ||
+        (conn->reply_pos < conn->reply_len))
+    {
+        events |= EPOLLOUT;
+    }
+
+    if (events == conn->events) {
+        return 0;
+    }
 
-        /* Decode GS block */
-        rc = eps_decode_grayscale_block(Y, buf, &hdr);
-        assert(rc == EPS_OK);
+    memset(&ev, 0, sizeof(ev));
 
-        /* Transform Y channel */
-        transform_2D_to_1D(Y, Y0, hdr.hdr_data.gs.w, hdr.hdr_data.gs.h);
-        TIMER_STOP(d_time_start, d_time_stop, decode_time);
+    ev.events = events;
+    ev.data.ptr = conn;
 
-        /* Send decoded data to the MASTER */
-        TIMER_START(w_time_start);
-        SEND_BUF_TO_MASTER(Y0, hdr.hdr_data.gs.w * hdr.hdr_data.gs.h);
-        TIMER_STOP(w_time_start, w_time_stop, write_time);
+    op = conn->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
 
-        /* Syslog statistics */
-        syslog(LOG_INFO,
-            "[DECODE GS] W=%d H=%d w=%d h=%d x=%d y=%d rtime=%.3f "
-            "wtime=%.3f dtime=%.3f bpb=%d m=%s f=%s ",
-            hdr.hdr_data.gs.W, hdr.hdr_data.gs.H,
-            hdr.hdr_data.gs.w, hdr.hdr_data.gs.h,
-            hdr.hdr_data.gs.x, hdr.hdr_data.gs.y,
-            read_time, write_time, decode_time,
-            hdr.hdr_size + hdr.data_size,
-            hdr.hdr_data.gs.mode == EPS_MODE_NORMAL ? "normal" : "otlpf",
-            hdr.hdr_data.gs.fb_id);
+    if (epoll_ctl(epoll_fd, op, conn->sock_fd, &ev) == -1) {
+        syslog(LOG_ERR, "epoll_ctl(): %m");
+        return -1;
     }
+
+    conn->events = events;
+
+    return 0;
 }
 
-/* Decode TC blocks */
-static void action_decode_tc(int sock_fd, char *ip_addr, int port)
+/* Handle connection events: read requests, then send queued
+ * answers. Complete requests are passed over to the worker
+ * pool, partial ones are kept until the rest arrives. */
+static int serve_connection(node_conn *conn, int events)
 {
-    unsigned char *Y0;
-    unsigned char **R;
-    unsigned char **G;
-    unsigned char **B;
-    unsigned char *buf;
-    int buf_size;
-    int block_size;
-
-    /* Receive general parameters */
-    RECV_VALUE_FROM_MASTER(&buf_size);
-    RECV_VALUE_FROM_MASTER(&block_size);
-
-    /* Allocate memory (it will be released implicitly at exit) */
-    Y0 = (unsigned char *) xmalloc(block_size * block_size,
-        sizeof(unsigned char));
-    R = (unsigned char **) eps_malloc_2D(block_size, block_size,
-        sizeof(unsigned char));
-    G = (unsigned char **) eps_malloc_2D(block_size, block_size,
-        sizeof(unsigned char));
-    B = (unsigned char **) eps_malloc_2D(block_size, block_size,
-        sizeof(unsigned char));
-    buf = (unsigned char *) xmalloc(buf_size,
-        sizeof(unsigned char));
-
-    /* Process all incoming blocks */
-    while (1) {
-        /* Read/Write/Decode timers */
-        struct timeval r_time_start, r_time_stop;
-        struct timeval w_time_start, w_time_stop;
-        struct timeval d_time_start, d_time_stop;
-
-        /* Total timers */
-        double read_time = 0.0;
-        double write_time = 0.0;
-        double decode_time = 0.0;
-
-        /* PSI header */
-        eps_block_header hdr;
-
-        int real_buf_size;
-        int rc;
-
-        /* Receive block-specific parameters */
-        RECV_VALUE_FROM_MASTER(&real_buf_size);
-        TIMER_START(r_time_start);
-        RECV_BUF_FROM_MASTER(buf, real_buf_size);
-        TIMER_STOP(r_time_start, r_time_stop, read_time);
+    int failed;
 
-        /* Parse header (also it should be checked at MASTER side) */
-        TIMER_START(d_time_start);
-        rc = eps_read_block_header(buf, real_buf_size, &hdr);
-        assert(rc == EPS_OK);
-
-        /* Decode TC block */
-        rc = eps_decode_truecolor_block(R, G, B, buf, &hdr);
-        assert(rc == EPS_OK || rc == EPS_FORMAT_ERROR);
-
-        /* Transform R channel */
-        transform_2D_to_1D(R, Y0, hdr.hdr_data.tc.w, hdr.hdr_data.tc.h);
-        TIMER_STOP(d_time_start, d_time_stop, decode_time);
-
-        /* Send R channel to the MASTER */
-        TIMER_START(w_time_start);
-        SEND_BUF_TO_MASTER(Y0, hdr.hdr_data.tc.w * hdr.hdr_data.tc.h);
-        TIMER_STOP(w_time_start, w_time_stop, write_time);
-
-        /* Transform G channel */
-        TIMER_START(d_time_start);
-        transform_2D_to_1D(G, Y0, hdr.hdr_data.tc.w, hdr.hdr_data.tc.h);
-        TIMER_STOP(d_time_start, d_time_stop, decode_time);
-
-        /* Send G channel to the MASTER */
-        TIMER_START(w_time_start);
-        SEND_BUF_TO_MASTER(Y0, hdr.hdr_data.tc.w * hdr.hdr_data.tc.h);
-        TIMER_STOP(w_time_start, w_time_stop, write_time);
-
-        /* Transform B channel */
-        TIMER_START(d_time_start);
-        transform_2D_to_1D(B, Y0, hdr.hdr_data.tc.w, hdr.hdr_data.tc.h);
-        TIMER_STOP(d_time_start, d_time_stop, decode_time);
-
-        /* Send B channel to the MASTER */
-        TIMER_START(w_time_start);
-        SEND_BUF_TO_MASTER(Y0, hdr.hdr_data.tc.w * hdr.hdr_data.tc.h);
-        TIMER_STOP(w_time_start, w_time_stop, write_time);
-
-        /* Syslog statistics */
-        syslog(LOG_INFO,
-            "[DECODE TC] W=%d H=%d w=%d h=%d x=%d y=%d rtime=%.3f "
-            "wtime=%.3f dtime=%.3f bpb=%d m=%s f=%s resample=%s",
-            hdr.hdr_data.tc.W, hdr.hdr_data.tc.H,
-            hdr.hdr_data.tc.w, hdr.hdr_data.tc.h,
-            hdr.hdr_data.tc.x, hdr.hdr_data.tc.y,
-            read_time, write_time, decode_time,
-            hdr.hdr_size + hdr.data_size,
-            hdr.hdr_data.tc.mode == EPS_MODE_NORMAL ? "normal" : "otlpf",
-            hdr.hdr_data.tc.fb_id,
-            hdr.hdr_data.tc.resample == EPS_RESAMPLE_444 ? "no" : "yes");
+    if (conn->http) {
+        serve_metrics(conn);
+        return -1;
     }
-}
 
-/* Check for file existence */
-int file_exists(char *pathname) {
-    struct stat st;
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+        (receive_requests(conn) != 0))
+    {
+        return -1;
+    }
 
-    if (stat((const char *) pathname, &st) != 0) {
-        return 0;
+    /* Replies and answers of blocks processed right away
+     * are sent without waiting for the next event */
+    if (send_answers(conn) != 0) {
+        return -1;
     }
 
-    return 1;
+    LOCK(conn->lock);
+    failed = conn->failed;
+    UNLOCK(conn->lock);
+
+    /* Either an answer could not be made or the query is answered */
+    if (failed || ((conn->action == ACTION_STATS) &&
+        (conn->reply_pos == conn->reply_len)))
+    {
+        return -1;
+    }
+
+    return 0;
 }
 
-/* Load list of cluster nodes */
-int load_cluster_nodes(char *pathname, struct sockaddr_in *nodes) {
-    char buf[MAX_NODE_LINE];
-    int line = 1;
-    int i = 0;
-    FILE *f;
+/* Read available data and handle all complete requests */
+static int receive_requests(node_conn *conn)
+{
+    ssize_t nread;
 
-    if ((f = fopen(pathname, "rb")) == NULL) {
-        printf("Cannot open %s: %m\n", pathname);
-        exit(1);
+    /* Keep unparsed data at the beginning of the buffer */
+    if (conn->in_pos) {
+        memmove(conn->in_buf, conn->in_buf + conn->in_pos,
+            conn->in_len - conn->in_pos);
+        conn->in_len -= conn->in_pos;
+        conn->in_pos = 0;
+    }
+
+    nread = read(conn->sock_fd, conn->in_buf + conn->in_len,
+        conn->in_size - conn->in_len);
+
+    if (nread == -1) {
+        if ((errno == EINTR) || (errno == EAGAIN) ||
+            (errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+
+        syslog(LOG_ERR, "Cannot receive data from %s port %d: %m",
+            conn->ip_addr, conn->port);
+        return -1;
+    }
+
+    if (nread == 0) {
+        if (conn->in_len) {
+            syslog(LOG_ERR, "Connection to %s port %d closed "
+                "in the middle of a request", conn->ip_addr, conn->port);
+        } else {
+            syslog(LOG_INFO, "Connection to %s port %d closed",
+                conn->ip_addr, conn->port);
+        }
+
+        return -1;
+    }
+
+    /* Read time is measured from the first byte of a request */
+    if (!conn->in_len) {
+        TIMER_START(conn->r_time_start);
+    }
+
+    conn->in_len += nread;
+
+    return parse_requests(conn);
+}
+
+/* Handle all complete requests in the buffer */
+static int parse_requests(node_conn *conn)
+{
+    unsigned char *p;
+    int avail;
+    int n;
+
+    while (conn->in_pos < conn->in_len) {
+        p = conn->in_buf + conn->in_pos;
+        avail = conn->in_len - conn->in_pos;
+
+        if (!conn->accepted) {
+            n = parse_request(conn, p, avail);
+        } else if (conn->action == ACTION_STATS) {
+            /* Nothing is expected after the query */
+            n = avail;
+        } else {
+            n = parse_block(conn, p, avail);
+        }
+
+        if (n < 0) {
+            return -1;
+        }
+
+        /* Wait for the rest of the request */
+        if (n == 0) {
+            break;
+        }
+
+        conn->in_pos += n;
+        TIMER_START(conn->r_time_start);
+    }
+
+    return 0;
+}
+
+/* Make room for a request of `size' bytes */
+static int grow_input(node_conn *conn, int size)
+{
+    unsigned char *buf;
+
+    if (size <= conn->in_size) {
+        return 0;
+    }
+
+    if ((buf = (unsigned char *) realloc(conn->in_buf, size)) == NULL) {
+        syslog(LOG_ERR, "realloc(): %m");
+        return -1;
+    }
+
+    conn->in_buf = buf;
+    conn->in_size = size;
+
+    return 0;
+}
+
+/* Queue reply to the general parameters: `len' bytes
+ * of reply buffer are to be filled by the caller */
+static unsigned char *queue_reply(node_conn *conn, int len)
+{
+    if ((conn->reply = (unsigned char *) malloc(len)) == NULL) {
+        syslog(LOG_ERR, "malloc(): %m");
+        return NULL;
+    }
+
+    conn->reply_len = len;
+    conn->reply_pos = 0;
+
+    return conn->reply;
+}
+
+/* Parse action and general parameters, allocate buffers.
+ * Returns the number of bytes taken from the buffer, 0 if
+ * the request is not complete yet and -1 on error. */
+static int parse_request(node_conn *conn, unsigned char *p, int avail)
+{
+    unsigned char *reply;
+    double slot_size;
+    uint32_t x;
+    int filter_len;
+    int pos = 0;
+    int rc;
+
+    /* Get core parameters */
+    TAKE_VALUE(conn->action);
+
+    /* Pipelined protocol */
+    if (conn->action == PROTOCOL_MAGIC) {
+        TAKE_VALUE(conn->version);
+        TAKE_VALUE(conn->window);
+        TAKE_VALUE(conn->action);
+
+        if ((conn->version != PROTOCOL_VERSION) || (conn->window < 1)) {
+            syslog(LOG_ERR,
+                "Unsupported protocol version (%d) or window (%d) "
+                "from %s port %d", conn->version, conn->window,
+                conn->ip_addr, conn->port);
+            return -1;
+        }
+
+        conn->window = MIN(conn->window, MAX_WINDOW);
+    } else {
+        conn->version = 1;
+        conn->window = 1;
+    }
+
+    switch (conn->action) {
+        case ACTION_ENCODE_GS:
+        case ACTION_ENCODE_TC:
+        {
+            TAKE_VALUE(conn->W);
+            TAKE_VALUE(conn->H);
+            TAKE_VALUE(conn->block_size);
+
+            /* Blocks per request */
+            if (conn->version > 1) {
+                TAKE_VALUE(conn->strip);
+            } else {
+                conn->strip = 1;
+            }
+
+            TAKE_VALUE(conn->bytes_per_block);
+            TAKE_VALUE(conn->mode);
+            TAKE_VALUE(conn->flags);
+            TAKE_VALUE(filter_len);
+
+            if ((filter_len < 0) ||
+                (filter_len >= (int) sizeof(conn->filter)))
+            {
+                syslog(LOG_ERR,
+                    "Filter length (%d) from from %s port %d too large",
+                    filter_len, conn->ip_addr, conn->port);
+                return -1;
+            }
+
+            TAKE_BUF(conn->filter, filter_len);
+            conn->filter[filter_len] = 0;
+
+            if (conn->action == ACTION_ENCODE_TC) {
+                TAKE_VALUE(conn->resample);
+                TAKE_VALUE(conn->Y_ratio);
+                TAKE_VALUE(conn->Cb_ratio);
+                TAKE_VALUE(conn->Cr_ratio);
+            }
+
+            break;
+        }
+        case ACTION_DECODE_GS:
+        case ACTION_DECODE_TC:
+        {
+            TAKE_VALUE(conn->bytes_per_block);
+            TAKE_VALUE(conn->block_size);
+            conn->strip = 1;
+            break;
+        }
+        case ACTION_STATS:
+        {
+            conn->accepted = 1;
+
+            if ((rc = send_stats(conn)) != 0) {
+                return rc;
+            }
+
+            return pos;
+        }
+        default:
+        {
+            syslog(LOG_ERR,
+                "Unsupported action (%d) from %s port %d",
+                conn->action, conn->ip_addr, conn->port);
+            return -1;
+        }
+    }
+
+    if ((conn->block_size < 1) ||
+        (conn->block_size > EPS_MAX_BLOCK_SIZE) ||
+        (conn->strip < 1) || (conn->strip > MAX_STRIP_BLOCKS) ||
+        (conn->bytes_per_block < 1) ||
+        (conn->bytes_per_block > INT_MAX / conn->strip - SIZE_FIELD_LEN))
+    {
+        syslog(LOG_ERR,
+            "Incorrect block size (%d), blocks per request (%d) or "
+            "buffer size (%d) from %s port %d", conn->block_size,
+            conn->strip, conn->bytes_per_block, conn->ip_addr, conn->port);
+        return -1;
+    }
+
+    /* Keep buffers of the largest requests within the limit */
+    slot_size = 3.0 * conn->strip * conn->block_size * conn->block_size +
+        (double) conn->strip * (SIZE_FIELD_LEN + conn->bytes_per_block);
+
+    conn->window = MAX(1, MIN(conn->window,
+        (int) (MAX_CONN_BUFFERS / slot_size)));
+
+    if (alloc_slots(conn) != 0) {
+        return -1;
+    }
+
+    conn->accepted = 1;
+
+    /* Tell the MASTER how many blocks it may send ahead */
+    if (conn->version > 1) {
+        if ((reply = queue_reply(conn, sizeof(uint32_t))) == NULL) {
+            return -1;
+        }
+
+        x = htonl(conn->window);
+        memcpy(reply, &x, sizeof(uint32_t));
+
+        set_nodelay(conn->sock_fd);
+    }
+
+    return pos;
+}
+
+/* Allocate slots for blocks in flight and fill constant
+ * part of their jobs. Request buffers are allocated as
+ * requests arrive, see grow_slot. */
+static int alloc_slots(node_conn *conn)
+{
+    node_slot *slot;
+    eps_job *job;
+    int i, j;
+
+    if ((conn->slots = (node_slot *) calloc(conn->window,
+        sizeof(node_slot))) == NULL)
+    {
+        syslog(LOG_ERR, "calloc(): %m");
+        return -1;
+    }
+
+    if ((conn->out_fifo = (int *) malloc(conn->window *
+        sizeof(int))) == NULL)
+    {
+        syslog(LOG_ERR, "malloc(): %m");
+        return -1;
+    }
+
+    for (i = 0; i < conn->window; i++) {
+        slot = &conn->slots[i];
+        slot->conn = conn;
+
+        if ((slot->jobs = (eps_job *) calloc(conn->strip,
+            sizeof(eps_job))) == NULL)
+        {
+            syslog(LOG_ERR, "calloc(): %m");
+            return -1;
+        }
+
+        for (j = 0; j < conn->strip; j++) {
+            job = &slot->jobs[j];
+
+            job->W = conn->W;
+            job->H = conn->H;
+            job->fb_id = conn->filter;
+            job->mode = conn->mode;
+            job->flags = conn->flags;
+            job->resample = conn->resample;
+            job->Y_rt = conn->Y_ratio;
+            job->Cb_rt = conn->Cb_ratio;
+            job->Cr_rt = conn->Cr_ratio;
+            job->rd = NULL;
+            job->callback = block_done;
+            job->user_data = slot;
+
+            switch (conn->action) {
+                case ACTION_ENCODE_GS:
+                    job->type = EPS_JOB_ENCODE_GS;
+                    break;
+                case ACTION_ENCODE_TC:
+                    job->type = EPS_JOB_ENCODE_TC;
+                    break;
+                default:
+                    job->type = EPS_JOB_DECODE;
+                    break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Make room for `n_jobs' blocks and `n_bytes' bytes of pixels
+ * in the slot. Buffers only grow, so they fit the largest
+ * request received rather than the largest one allowed. */
+static int grow_slot(node_conn *conn, node_slot *slot, int n_jobs,
+                     int n_bytes)
+{
+    int block_size = conn->block_size;
+    unsigned char **rows;
+    unsigned char *buf;
+    eps_job *job;
+    int j, k;
+
+    if (n_bytes > slot->pixels_size) {
+        if ((buf = (unsigned char *) realloc(slot->pixels,
+            n_bytes)) == NULL)
+        {
+            syslog(LOG_ERR, "realloc(): %m");
+            return -1;
+        }
+
+        slot->pixels = buf;
+        slot->pixels_size = n_bytes;
+    }
+
+    if (n_jobs <= slot->n_blocks) {
+        return 0;
+    }
+
+    /* Each block buffer leaves room for the size field
+     * which precedes the block in the answer */
+    if ((buf = (unsigned char *) realloc(slot->buf, n_jobs *
+        (SIZE_FIELD_LEN + conn->bytes_per_block))) == NULL)
+    {
+        syslog(LOG_ERR, "realloc(): %m");
+        return -1;
+    }
+
+    slot->buf = buf;
+
+    /* Row pointers are set for each request */
+    for (k = 0; k < 3; k++) {
+        if ((rows = (unsigned char **) realloc(slot->rows[k], n_jobs *
+            block_size * sizeof(unsigned char *))) == NULL)
+        {
+            syslog(LOG_ERR, "realloc(): %m");
+            return -1;
+        }
+
+        slot->rows[k] = rows;
+    }
+
+    slot->n_blocks = n_jobs;
+
+    for (j = 0; j < n_jobs; j++) {
+        job = &slot->jobs[j];
+
+        for (k = 0; k < 3; k++) {
+            job->block[k] = slot->rows[k] + j * block_size;
+        }
+
+        job->buf = slot->buf + j * (SIZE_FIELD_LEN +
+            conn->bytes_per_block) + SIZE_FIELD_LEN;
+    }
+
+    return 0;
+}
+
+/* Parse next request, split it into jobs and pass them over
+ * to the worker pool. Returns the number of bytes taken from
+ * the buffer, 0 if the request is not complete yet and -1
+ * on error. */
+static int parse_block(node_conn *conn, unsigned char *p, int avail)
+{
+    struct timeval r_time_stop;
+    double read_time = 0.0;
+    block_frame frame;
+    node_slot *slot = NULL;
+    unsigned char *payload;
+    int block_size = conn->block_size;
+    int decode = (conn->action == ACTION_DECODE_GS) ||
+        (conn->action == ACTION_DECODE_TC);
+    eps_job *job;
+    int max_size;
+    int n_channels;
+    int pos = 0;
+    int k, i, j;
+
+    if (decode) {
+        max_size = conn->bytes_per_block;
+    } else {
+        max_size = 3 * conn->strip * block_size * block_size;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+
+    if (conn->version > 1) {
+        if (avail < FRAME_HDR_SIZE) {
+            return 0;
+        }
+
+        unpack_frame(p, &frame);
+        pos = FRAME_HDR_SIZE;
+    } else {
+        /* Lock-step protocol: parameters come one by one */
+        if (decode) {
+            TAKE_VALUE(frame.size);
+        } else {
+            TAKE_VALUE(frame.x);
+            TAKE_VALUE(frame.y);
+            TAKE_VALUE(frame.w);
+            TAKE_VALUE(frame.h);
+
+            n_channels = conn->action == ACTION_ENCODE_GS ? 1 : 3;
+
+            if ((frame.w < 1) || (frame.w > conn->block_size) ||
+                (frame.h < 1) || (frame.h > conn->block_size))
+            {
+                syslog(LOG_ERR,
+                    "Incorrect block size (%dx%d) from %s port %d",
+                    frame.w, frame.h, conn->ip_addr, conn->port);
+                return -1;
+            }
+
+            frame.size = n_channels * frame.w * frame.h;
+        }
+    }
+
+    if ((frame.size < 1) || (frame.size > max_size)) {
+        syslog(LOG_ERR,
+            "Incorrect buffer size (%d) from %s port %d",
+            frame.size, conn->ip_addr, conn->port);
+        return -1;
+    }
+
+    /* Wait for the payload, the whole request is kept in the buffer */
+    if (avail - pos < frame.size) {
+        return grow_input(conn, pos + frame.size);
+    }
+
+    payload = p + pos;
+    pos += frame.size;
+
+    TIMER_STOP(conn->r_time_start, r_time_stop, read_time);
+
+    LOCK(conn->lock);
+
+    for (i = 0; i < conn->window; i++) {
+        if (!conn->slots[i].busy) {
+            slot = &conn->slots[i];
+            break;
+        }
+    }
+
+    UNLOCK(conn->lock);
+
+    /* The MASTER has sent more blocks than the window allows */
+    if (!slot) {
+        syslog(LOG_ERR, "Window (%d) exceeded by %s port %d",
+            conn->window, conn->ip_addr, conn->port);
+        return -1;
+    }
+
+    conn->read_time += read_time;
+
+    LOCK(stats_lock);
+    stats.bytes_in += frame.size;
+    stats_add(&stats.read_time, read_time);
+    UNLOCK(stats_lock);
+
+    slot->tag = frame.tag;
+
+    if (decode) {
+        if (grow_slot(conn, slot, 1, 0) != 0) {
+            return -1;
+        }
+
+        job = &slot->jobs[0];
+        memcpy(job->buf, payload, frame.size);
+
+        /* Parse header (also it should be checked at MASTER side) */
+        if (eps_read_block_header(job->buf, frame.size,
+            &job->hdr) != EPS_OK)
+        {
+            syslog(LOG_ERR, "Malformed block from %s port %d",
+                conn->ip_addr, conn->port);
+            return -1;
+        }
+
+        if (job->hdr.block_type == EPS_GRAYSCALE_BLOCK) {
+            frame.w = job->hdr.hdr_data.gs.w;
+            frame.h = job->hdr.hdr_data.gs.h;
+            n_channels = 1;
+        } else {
+            frame.w = job->hdr.hdr_data.tc.w;
+            frame.h = job->hdr.hdr_data.tc.h;
+            n_channels = 3;
+        }
+
+        if ((n_channels == 1) != (conn->action == ACTION_DECODE_GS)) {
+            syslog(LOG_ERR, "Unexpected block type from %s port %d",
+                conn->ip_addr, conn->port);
+            return -1;
+        }
+    } else {
+        n_channels = conn->action == ACTION_ENCODE_GS ? 1 : 3;
+    }
+
+    if ((frame.w < 1) || (frame.w > conn->strip * block_size) ||
+        (frame.h < 1) || (frame.h > block_size) ||
+        (!decode && (frame.size != n_channels * frame.w * frame.h)))
+    {
+        syslog(LOG_ERR, "Incorrect block size (%dx%d) from %s port %d",
+            frame.w, frame.h, conn->ip_addr, conn->port);
+        return -1;
+    }
+
+    /* A run of blocks is cut into jobs of a block each */
+    slot->n_jobs = slot->pending = (frame.w + block_size - 1) / block_size;
+
+    if (grow_slot(conn, slot, slot->n_jobs,
+        n_channels * frame.w * frame.h) != 0)
+    {
+        return -1;
+    }
+
+    if (!decode) {
+        if ((n_channels == 3) && (conn->version > 1)) {
+            /* Split interleaved pixels into channels */
+            for (i = 0; i < frame.w * frame.h; i++) {
+                for (k = 0; k < 3; k++) {
+                    slot->pixels[k * frame.w * frame.h + i] =
+                        payload[3 * i + k];
+                }
+            }
+        } else {
+            memcpy(slot->pixels, payload, frame.size);
+        }
+    }
+
+    for (j = 0; j < slot->n_jobs; j++) {
+        job = &slot->jobs[j];
+
+        /* Channels are stored one after another */
+        for (k = 0; k < n_channels; k++) {
+            for (i = 0; i < frame.h; i++) {
+                job->block[k][i] = slot->pixels +
+                    (k * frame.h + i) * frame.w + j * block_size;
+            }
+        }
+
+        if (!decode) {
+            job->x = frame.x + j * block_size;
+            job->y = frame.y;
+            job->buf_size = conn->bytes_per_block - 1;
+        }
+
+        job->w = MIN(block_size, frame.w - j * block_size);
+        job->h = frame.h;
+    }
+
+    LOCK(conn->lock);
+    slot->busy = 1;
+    conn->n_busy++;
+    UNLOCK(conn->lock);
+
+    LOCK(stats_lock);
+    stats.queue_depth += slot->n_jobs;
+    UNLOCK(stats_lock);
+
+    TIMER_START(slot->p_time_start);
+
+    for (j = 0; j < slot->n_jobs; j++) {
+        if (eps_pool_submit(pool, &slot->jobs[j]) != EPS_OK) {
+            syslog(LOG_ERR, "Cannot process block from %s port %d",
+                conn->ip_addr, conn->port);
+            break;
+        }
+    }
+
+    if (j < slot->n_jobs) {
+        drop_jobs(conn, slot, j);
+        return -1;
+    }
+
+    return pos;
+}
+
+/* Fail the request whose jobs starting from `first' could not be
+ * submitted. Jobs already submitted complete the slot as usual and
+ * make_answer fails it, otherwise the slot is freed right away.
+ * Either way the connection is closed, so the MASTER sends the
+ * blocks elsewhere instead of waiting for the answer. */
+static void drop_jobs(node_conn *conn, node_slot *slot, int first)
+{
+    int n_failed = 0;
+    int j;
+
+    for (j = first; j < slot->n_jobs; j++) {
+        slot->jobs[j].rc = EPS_PARAM_ERROR;
+    }
+
+    LOCK(conn->lock);
+
+    conn->failed = 1;
+    slot->pending -= slot->n_jobs - first;
+
+    if (slot->pending == 0) {
+        slot->busy = 0;
+        conn->n_busy--;
+        n_failed = slot->n_jobs;
+    }
+
+    UNLOCK(conn->lock);
+
+    if (n_failed) {
+        LOCK(stats_lock);
+        stats.queue_depth -= n_failed;
+        stats.n_failed += n_failed;
+        UNLOCK(stats_lock);
+    }
+}
+
+/* Make answer of processed blocks: frame header
+ * (if any) followed by the payload */
+static int make_answer(node_conn *conn, node_slot *slot)
+{
+    block_frame frame;
+    eps_job *job = &slot->jobs[0];
+    unsigned char *out;
+    uint32_t x;
+    int j;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.tag = slot->tag;
+
+    if (job->type != EPS_JOB_DECODE) {
+        for (j = 0; j < slot->n_jobs; j++) {
+            if (slot->jobs[j].rc != EPS_OK) {
+                syslog(LOG_ERR,
+                    "Cannot encode block (%d) from %s port %d",
+                    slot->jobs[j].rc, conn->ip_addr, conn->port);
+                return -1;
+            }
+        }
+
+        if (conn->version > 1) {
+            /* Pack blocks one after another, each one preceded by
+             * its size. Blocks only move towards the buffer start. */
+            for (out = slot->buf, j = 0; j < slot->n_jobs; j++) {
+                job = &slot->jobs[j];
+                x = htonl(job->buf_size);
+
+                memcpy(out, &x, SIZE_FIELD_LEN);
+                memmove(out + SIZE_FIELD_LEN, job->buf, job->buf_size);
+                out += SIZE_FIELD_LEN + job->buf_size;
+            }
+
+            slot->out = slot->buf;
+            frame.size = out - slot->buf;
+        } else {
+            /* Lock-step protocol: size goes first */
+            slot->out = job->buf;
+            frame.size = job->buf_size;
+        }
+    } else {
+        if ((job->rc != EPS_OK) && (job->rc != EPS_FORMAT_ERROR)) {
+            syslog(LOG_ERR,
+                "Cannot decode block (%d) from %s port %d",
+                job->rc, conn->ip_addr, conn->port);
+            return -1;
+        }
+
+        /* Decoded channels */
+        frame.w = job->w;
+        frame.h = job->h;
+        frame.size = (conn->action == ACTION_DECODE_GS ? 1 : 3) *
+            frame.w * frame.h;
+
+        slot->out = slot->pixels;
+    }
+
+    slot->size = frame.size;
+
+    if (conn->version > 1) {
+        pack_frame(&frame, slot->hdr);
+        slot->hdr_len = FRAME_HDR_SIZE;
+    } else if (job->type != EPS_JOB_DECODE) {
+        x = htonl(frame.size);
+        memcpy(slot->hdr, &x, sizeof(uint32_t));
+        slot->hdr_len = sizeof(uint32_t);
+    } else {
+        slot->hdr_len = 0;
+    }
+
+    return 0;
+}
+
+/* Job completion callback, runs in a worker thread. Once all
+ * jobs of the request are completed, the answer is queued and
+ * the event loop sends it. */
+static void block_done(eps_job *job)
+{
+    node_slot *slot = (node_slot *) job->user_data;
+    node_conn *conn = slot->conn;
+    struct timeval p_time_stop;
+    double proc_time = 0.0;
+    int release = 0;
+    int n_failed = 0;
+    int last;
+    int rc;
+
+    LOCK(conn->lock);
+    last = --slot->pending == 0;
+    UNLOCK(conn->lock);
+
+    if (!last) {
+        return;
+    }
+
+    TIMER_STOP(slot->p_time_start, p_time_stop, proc_time);
+
+    rc = make_answer(conn, slot);
+
+    LOCK(conn->lock);
+
+    if (rc != 0) {
+        conn->failed = 1;
+    }
+
+    if ((rc != 0) || conn->closing) {
+        slot->busy = 0;
+        conn->n_busy--;
+        n_failed = slot->n_jobs;
+        release = conn->closing && (conn->n_busy == 0);
+    } else {
+        conn->out_fifo[(conn->out_head + conn->out_count) %
+            conn->window] = slot - conn->slots;
+        conn->out_count++;
+        conn->proc_time += proc_time;
+        TIMER_START(slot->w_time_start);
+    }
+
+    /* Wake up the event loop: either the answer is to be
+     * sent or the connection is useless now */
+    if (update_events(conn) != 0) {
+        shutdown(conn->sock_fd, SHUT_RDWR);
+    }
+
+    /* The connection may be released by the event loop as
+     * soon as the lock is dropped */
+    UNLOCK(conn->lock);
+
+    LOCK(stats_lock);
+
+    if (n_failed) {
+        stats.queue_depth -= n_failed;
+        stats.n_failed += n_failed;
+    } else {
+        stats_add(&stats.proc_time, proc_time);
+    }
+
+    UNLOCK(stats_lock);
+
+    if (release) {
+        release_connection(conn);
+    }
+}
+
+/* Gather answer of the slot into `iov', skipping
+ * `skip' bytes already sent. Returns number of vectors. */
+static int gather_answer(node_slot *slot, struct iovec *iov, int skip)
+{
+    int n_vecs = 0;
+
+    if (skip < slot->hdr_len) {
+        iov[n_vecs].iov_base = slot->hdr + skip;
+        iov[n_vecs].iov_len = slot->hdr_len - skip;
+        n_vecs++;
+        skip = 0;
+    } else {
+        skip -= slot->hdr_len;
+    }
+
+    iov[n_vecs].iov_base = slot->out + skip;
+    iov[n_vecs].iov_len = slot->size - skip;
+    n_vecs++;
+
+    return n_vecs;
+}
+
+/* Send reply to the general parameters and queued answers
+ * while the socket takes them. Slots of answers which are
+ * sent completely are freed. */
+static int send_answers(node_conn *conn)
+{
+    struct iovec iov[2 * MAX_WINDOW];
+    struct timeval w_time_stop;
+    double write_time;
+    node_slot *slot;
+    ssize_t nwritten;
+    int n_vecs;
+    int rc;
+    int k;
+
+    while (conn->reply_pos < conn->reply_len) {
+        nwritten = write(conn->sock_fd, conn->reply + conn->reply_pos,
+            conn->reply_len - conn->reply_pos);
+
+        if (nwritten == -1) {
+            if (errno == EINTR) {
+                continue;
+            } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return 0;
+            }
+
+            syslog(LOG_ERR, "Cannot send reply to %s port %d: %m",
+                conn->ip_addr, conn->port);
+            return -1;
+        }
+
+        conn->reply_pos += nwritten;
+    }
+
+    for (;;) {
+        /* Queued answers do not change until sent */
+        LOCK(conn->lock);
+
+        for (n_vecs = k = 0; k < conn->out_count; k++) {
+            slot = &conn->slots[conn->out_fifo[(conn->out_head + k) %
+                conn->window]];
+            n_vecs += gather_answer(slot, iov + n_vecs,
+                k ? 0 : conn->out_pos);
+        }
+
+        UNLOCK(conn->lock);
+
+        if (!n_vecs) {
+            break;
+        }
+
+        if ((nwritten = writev(conn->sock_fd, iov, n_vecs)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+
+            syslog(LOG_ERR, "Cannot send answer to %s port %d: %m",
+                conn->ip_addr, conn->port);
+            return -1;
+        }
+
+        LOCK(conn->lock);
+
+        /* Free slots of answers which are sent completely */
+        while (conn->out_count && (nwritten > 0)) {
+            slot = &conn->slots[conn->out_fifo[conn->out_head]];
+
+            if (nwritten < slot->hdr_len + slot->size - conn->out_pos) {
+                conn->out_pos += nwritten;
+                break;
+            }
+
+            nwritten -= slot->hdr_len + slot->size - conn->out_pos;
+
+            conn->out_head = (conn->out_head + 1) % conn->window;
+            conn->out_count--;
+            conn->out_pos = 0;
+
+            write_time = 0.0;
+            TIMER_STOP(slot->w_time_start, w_time_stop, write_time);
+
+            slot->busy = 0;
+            conn->n_busy--;
+            conn->n_blocks += slot->n_jobs;
+            conn->write_time += write_time;
+
+            LOCK(stats_lock);
+            stats.queue_depth -= slot->n_jobs;
+            stats.n_blocks[conn->action] += slot->n_jobs;
+            stats.bytes_out += slot->size;
+            stats_add(&stats.write_time, write_time);
+            UNLOCK(stats_lock);
+        }
+
+        UNLOCK(conn->lock);
+    }
+
+    LOCK(conn->lock);
+    rc = update_events(conn);
+    UNLOCK(conn->lock);
+
+    return rc;
+}
+
+/* Account time sample in the histogram */
+static void stats_add(stats_hist *hist, double value)
+{
+    int i;
+
+    for (i = 0; (i < STATS_BUCKETS) && (value > stats_bounds[i]); i++) {
+        /* Nothing */
+    }
+
+    hist->count[i]++;
+    hist->sum += value;
+}
+
+/* Append formatted text to the buffer, text which does not
+ * fit is dropped */
+static void stats_printf(char *buf, int size, int *len, char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (*len >= size - 1) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+
+    *len = n < 0 ? *len : MIN(*len + n, size - 1);
+}
+
+/* Append histogram with cumulative bucket counts */
+static void stats_print_hist(char *buf, int size, int *len,
+                             stats_hist *hist, char *stage)
+{
+    unsigned long total = 0;
+    int i;
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        total += hist->count[i];
+        stats_printf(buf, size, len,
+            "epsilon_node_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %lu\n",
+            stage, stats_bounds[i], total);
+    }
+
+    total += hist->count[STATS_BUCKETS];
+
+    stats_printf(buf, size, len,
+        "epsilon_node_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n"
+        "epsilon_node_stage_seconds_sum{stage=\"%s\"} %.6f\n"
+        "epsilon_node_stage_seconds_count{stage=\"%s\"} %lu\n",
+        stage, total, stage, hist->sum, stage, total);
+}
+
+/* Format node statistics in Prometheus text format,
+ * return text length */
+static int format_stats(char *buf, int size)
+{
+    node_stats st;
+    int len = 0;
+    int i;
+
+    /* Take a consistent snapshot */
+    LOCK(stats_lock);
+    st = stats;
+    UNLOCK(stats_lock);
+
+    stats_printf(buf, size, &len,
+        "# HELP epsilon_node_uptime_seconds Time since the node was started.\n"
+        "# TYPE epsilon_node_uptime_seconds gauge\n"
+        "epsilon_node_uptime_seconds %ld\n"
+        "# HELP epsilon_node_threads Number of worker threads.\n"
+        "# TYPE epsilon_node_threads gauge\n"
+        "epsilon_node_threads %d\n"
+        "# HELP epsilon_node_connections_total Accepted connections.\n"
+        "# TYPE epsilon_node_connections_total counter\n"
+        "epsilon_node_connections_total %lu\n"
+        "# HELP epsilon_node_active_connections Open connections.\n"
+        "# TYPE epsilon_node_active_connections gauge\n"
+        "epsilon_node_active_connections %d\n"
+        "# HELP epsilon_node_queue_depth Blocks received and not answered yet.\n"
+        "# TYPE epsilon_node_queue_depth gauge\n"
+        "epsilon_node_queue_depth %d\n",
+        (long) (time(NULL) - st.start_time), st.n_threads,
+        st.n_conns, st.active_conns, st.queue_depth);
+
+    stats_printf(buf, size, &len,
+        "# HELP epsilon_node_blocks_total Answered blocks.\n"
+        "# TYPE epsilon_node_blocks_total counter\n");
+
+    for (i = 0; i < N_ACTIONS; i++) {
+        stats_printf(buf, size, &len,
+            "epsilon_node_blocks_total{action=\"%s\"} %lu\n",
+            action_labels[i], st.n_blocks[i]);
+    }
+
+    stats_printf(buf, size, &len,
+        "# HELP epsilon_node_failed_blocks_total Blocks which could not be "
+        "processed or sent.\n"
+        "# TYPE epsilon_node_failed_blocks_total counter\n"
+        "epsilon_node_failed_blocks_total %lu\n"
+        "# HELP epsilon_node_received_bytes_total Received payload.\n"
+        "# TYPE epsilon_node_received_bytes_total counter\n"
+        "epsilon_node_received_bytes_total %.0f\n"
+        "# HELP epsilon_node_sent_bytes_total Sent payload.\n"
+        "# TYPE epsilon_node_sent_bytes_total counter\n"
+        "epsilon_node_sent_bytes_total %.0f\n"
+        "# HELP epsilon_node_stage_seconds Time per request spent in each "
+        "stage, process includes waiting for a worker.\n"
+        "# TYPE epsilon_node_stage_seconds histogram\n",
+        st.n_failed, st.bytes_in, st.bytes_out);
+
+    stats_print_hist(buf, size, &len, &st.read_time, "read");
+    stats_print_hist(buf, size, &len, &st.proc_time, "process");
+    stats_print_hist(buf, size, &len, &st.write_time, "write");
+
+    return len;
+}
+
+/* Answer statistics query */
+static int send_stats(node_conn *conn)
+{
+    unsigned char *reply;
+    block_frame frame;
+
+    if ((reply = queue_reply(conn, FRAME_HDR_SIZE +
+        MAX_STATS_SIZE)) == NULL)
+    {
+        return -1;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    frame.size = format_stats((char *) reply + FRAME_HDR_SIZE,
+        MAX_STATS_SIZE);
+    pack_frame(&frame, reply);
+
+    conn->reply_len = FRAME_HDR_SIZE + frame.size;
+
+    return 0;
+}
+
+/* Answer metrics scrape. Any GET request gets the
+ * statistics, the connection is closed afterwards. */
+static int serve_metrics(node_conn *conn)
+{
+    char request[MAX_HTTP_REQUEST];
+    char body[MAX_STATS_SIZE];
+    char hdr[MAX_LINE];
+    struct iovec iov[2];
+    ssize_t nread;
+    int body_len = 0;
+    int hdr_len;
+
+    if ((nread = read(conn->sock_fd, request, sizeof(request))) <= 0) {
+        return -1;
+    }
+
+    if ((nread < 4) || strncmp(request, "GET ", 4)) {
+        hdr_len = snprintf(hdr, sizeof(hdr),
+            "HTTP/1.0 405 Method Not Allowed\r\n"
+            "Allow: GET\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n\r\n");
+    } else {
+        body_len = format_stats(body, sizeof(body));
+        hdr_len = snprintf(hdr, sizeof(hdr),
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %d\r\n"
+            "Connection: close\r\n\r\n", body_len);
+    }
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = hdr_len;
+    iov[1].iov_base = body;
+    iov[1].iov_len = body_len;
+
+    /* Answer fits into the socket buffer */
+    if (writev(conn->sock_fd, iov, 2) != hdr_len + body_len) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Check for file existence */
+int file_exists(char *pathname) {
+    struct stat st;
+
+    if (stat((const char *) pathname, &st) != 0) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Load list of cluster nodes */
+int load_cluster_nodes(char *pathname, node_addr *nodes) {
+    char buf[MAX_NODE_LINE];
+    int line = 1;
+    int i = 0;
+    FILE *f;
+
+    if ((f = fopen(pathname, "rb")) == NULL) {
+        printf("Cannot open %s: %m\n", pathname);
+        exit(1);
     }
 
     while (fgets(buf, sizeof(buf), f)) {
-        struct hostent *he;
+        struct hostent *he = NULL;
+        char path[sizeof(nodes->un.sun_path)];
         char user[32];
         char host[64];
         int port;
@@ -827,15 +1990,25 @@ int load_cluster_nodes(char *pathname, struct sockaddr_in *nodes) {
         int n, j;
 
         n = sscanf(buf, "%31[a-zA-Z0-9._-]@%63[a-zA-Z0-9._-]:%d^%d",
-            &user, &host, &port, &cpu);
+            user, host, &port, &cpu);
+
+        /* Unix domain socket of a node on the same host */
+        if ((n != 4) && (sscanf(buf, "%31[a-zA-Z0-9._-]@/%106[^^]^%d",
+            user, path + 1, &cpu) == 3))
+        {
+            path[0] = '/';
+            n = 4;
+        } else {
+            path[0] = 0;
+        }
 
         if (n != 4) {
             printf("Error in %s on line %d: %s", pathname, line, buf);
-            printf("Format: user@host:port^cpu\n");
+            printf("Format: user@host:port^cpu or user@/path/to/socket^cpu\n");
             exit(1);
         }
 
-        if (!(he = gethostbyname((const char *) &host))) {
+        if (!path[0] && !(he = gethostbyname((const char *) &host))) {
             printf("Cannot resolve host: %s\n", host);
             exit(1);
         }
@@ -848,10 +2021,17 @@ int load_cluster_nodes(char *pathname, struct sockaddr_in *nodes) {
             }
 
             /* Fill next socket address structure */
-            memset(&nodes[i], 0, sizeof(struct sockaddr_in));
-            nodes[i].sin_family = AF_INET;
-            nodes[i].sin_port = htons(port);
-            memcpy(&nodes[i].sin_addr, he->h_addr_list[0], he->h_length);
+            memset(&nodes[i], 0, sizeof(node_addr));
+
+            if (path[0]) {
+                nodes[i].un.sun_family = AF_UNIX;
+                strcpy(nodes[i].un.sun_path, path);
+            } else {
+                nodes[i].in.sin_family = AF_INET;
+                nodes[i].in.sin_port = htons(port);
+                memcpy(&nodes[i].in.sin_addr, he->h_addr_list[0],
+                    he->h_length);
+            }
         }
 
         line++;
@@ -861,11 +2041,81 @@ int load_cluster_nodes(char *pathname, struct sockaddr_in *nodes) {
     return i;
 }
 
+/* Load list of cluster nodes from the specified file or
+ * from the default one in the current or home directory */
+int find_cluster_nodes(char *node_list, node_addr *nodes) {
+    char pathname[MAX_PATH];
+    int n_nodes;
+
+    if (node_list) {
+        /* File is specified explicitly */
+        n_nodes = load_cluster_nodes(node_list, nodes);
+    } else if (file_exists(DEFAULT_NODE_LIST)) {
+        /* Try file in the currect directory */
+        n_nodes = load_cluster_nodes(DEFAULT_NODE_LIST, nodes);
+    } else {
+        if (!getenv("HOME")) {
+            /* Giving up */
+            printf("You should specify list of cluster nodes.\n");
+            exit(1);
+        }
+
+        /* Try file in user directory */
+        snprintf(pathname, sizeof(pathname), "%s%c%s",
+            getenv("HOME"), DIR_SEPARATOR, DEFAULT_NODE_LIST);
+
+        if (!file_exists(pathname)) {
+            /* Giving up */
+            printf("You should specify list of cluster nodes.\n");
+            exit(1);
+        }
+
+        n_nodes = load_cluster_nodes(pathname, nodes);
+    }
+
+    if (n_nodes < 1) {
+        printf("List of cluster nodes is empty.\n");
+        exit(1);
+    }
+
+    return n_nodes;
+}
+
 /* Start cluster node */
-void cmd_start_node(int port)
+void cmd_start_node(int port, int metrics_port, char *unix_socket,
+                    int n_threads)
 {
+    /* One worker thread per CPU by default */
+    if (n_threads == OPT_NA) {
+        n_threads = MAX(1, MIN((int) sysconf(_SC_NPROCESSORS_ONLN),
+            MAX_N_THREADS));
+    }
+
+    /* Check the number of threads */
+    if ((n_threads < 1) || (n_threads > MAX_N_THREADS)) {
+        printf("Incorrect value for the number of threads.\n");
+        exit(1);
+    }
+
+    /* Check metrics port */
+    if ((metrics_port != OPT_NA) &&
+        ((metrics_port < 1) || (metrics_port > 65535)))
+    {
+        printf("Incorrect value for the metrics port.\n");
+        exit(1);
+    }
+
+    /* Check socket path */
+    if (unix_socket && ((unix_socket[0] != '/') ||
+        (strlen(unix_socket) >= sizeof(((node_addr *) 0)->un.sun_path))))
+    {
+        printf("Socket path should be absolute and short enough.\n");
+        exit(1);
+    }
+
     daemon_init();
-    start_server(port == OPT_NA ? DEFAULT_PORT : port);
+    start_server(port == OPT_NA ? DEFAULT_PORT : port, metrics_port,
+                 unix_socket, n_threads);
 }
 
 #endif /* ENABLE_CLUSTER */
@@ -37,7 +37,15 @@ extern "C" {
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <epsilon.h>
+
+#ifdef ENABLE_PTHREADS
+# include <pthread.h>
+#endif
 
 /* Shutcuts for ease of casting */
 #define SA                      struct sockaddr
@@ -54,6 +62,7 @@ extern "C" {
 /* Limits */
 #define MAX_NODE_LINE           512
 #define MAX_CLUSTER_NODES       512
+#define MAX_NODE_NAME           128
 
 /* Available node actions */
 #define ACTION_ENCODE_GS        0
@@ -61,6 +70,198 @@ extern "C" {
 #define ACTION_DECODE_GS        2
 #define ACTION_DECODE_TC        3
 
+/* Statistics query: sent alone, the node answers with a single
+ * frame holding its counters in Prometheus text format */
+#define ACTION_STATS            4
+
+/* Number of block actions */
+#define N_ACTIONS               4
+
+/* Action is not received yet */
+#define ACTION_NONE             -1
+
+/* Pipelined protocol. The MASTER starts with PROTOCOL_MAGIC,
+ * protocol version and window size; the node answers with the
+ * window it accepts once general parameters are received. Each
+ * block request and answer is then sent as a single frame (see
+ * block_frame below), so up to `window' blocks may be in flight
+ * and answers may come in any order. Old (lock-step) protocol
+ * has no handshake and sends block parameters one by one.
+ * Since version 4 truecolor pixels are sent as they are
+ * stored in PPM files (interleaved), so the MASTER can send
+ * rows straight from the input file. Since version 5 an
+ * encoding request covers a run of adjacent blocks of a block
+ * row; the node splits it and answers with all encoded blocks
+ * in a single frame. */
+#define PROTOCOL_MAGIC          0x45505332
+#define PROTOCOL_VERSION        5
+
+/* Blocks in flight per connection */
+#define DEF_WINDOW              4
+#define MAX_WINDOW              32
+
+/* Blocks per encoding request */
+#define MAX_STRIP_BLOCKS        64
+
+/* Request buffers of a connection may take up to that many
+ * bytes, the window is narrowed to fit */
+#define MAX_CONN_BUFFERS        (64 * 1024 * 1024)
+
+/* Maximal number of events per epoll_wait() call */
+#define MAX_EVENTS              64
+
+/* Initial size of the request buffer, general parameters
+ * always fit into it */
+#define NODE_BUF_SIZE           4096
+
+/* Statistics: time histogram buckets and text size limits */
+#define STATS_BUCKETS           10
+#define MAX_STATS_SIZE          16384
+#define MAX_HTTP_REQUEST        1024
+
+/* Number of header fields in a block frame and header size */
+#define FRAME_FIELDS            6
+#define FRAME_HDR_SIZE          (FRAME_FIELDS * 4)
+
+/* Size field preceding each encoded block of a run */
+#define SIZE_FIELD_LEN          4
+
+/* Block frame header. The header is followed by `size' bytes of
+ * payload: raw pixels or encoded blocks. Encoded blocks of a run
+ * are sent one after another, each one preceded by its size.
+ * Fields are sent in network byte order in this very order;
+ * fields which have no sense for the message are zero. */
+typedef struct block_frame_tag {
+    int tag;
+    int x, y;
+    int w, h;
+    int size;
+} block_frame;
+
+/* Address of a cluster node: TCP port or Unix domain socket */
+typedef union node_addr_tag {
+    struct sockaddr sa;
+    struct sockaddr_in in;
+    struct sockaddr_un un;
+} node_addr;
+
+struct node_conn_tag;
+
+/* Request in flight: a single block or a run of blocks */
+typedef struct node_slot_tag {
+    struct node_conn_tag *conn;
+    int busy;
+    int tag;
+    /* Request buffers, reused for all requests and grown as
+     * needed: bytes of pixels and blocks of the other ones */
+    unsigned char *pixels;
+    unsigned char **rows[3];
+    unsigned char *buf;
+    int pixels_size;
+    int n_blocks;
+    /* Blocks being processed and jobs not completed yet */
+    eps_job *jobs;
+    int n_jobs;
+    int pending;
+    /* Answer: header followed by `size' bytes at `out' */
+    unsigned char hdr[FRAME_HDR_SIZE];
+    int hdr_len;
+    unsigned char *out;
+    int size;
+    struct timeval p_time_start;
+    struct timeval w_time_start;
+} node_slot;
+
+/* Connection to the MASTER node */
+typedef struct node_conn_tag {
+    /* Socket and peer address */
+    int sock_fd;
+    /* Metrics scrape rather than a MASTER */
+    int http;
+    char ip_addr[INET_ADDRSTRLEN];
+    int port;
+    /* Requested action */
+    int action;
+    /* Protocol version and window size */
+    int version;
+    int window;
+    /* General parameters */
+    int W, H;
+    int block_size;
+    int strip;
+    int bytes_per_block;
+    int mode;
+    int flags;
+    int resample;
+    int Y_ratio;
+    int Cb_ratio;
+    int Cr_ratio;
+    char filter[64];
+    /* General parameters are received */
+    int accepted;
+    /* Requests: unparsed data is in_buf[in_pos..in_len) */
+    unsigned char *in_buf;
+    int in_size;
+    int in_pos;
+    int in_len;
+    struct timeval r_time_start;
+    /* Reply to the general parameters */
+    unsigned char *reply;
+    int reply_len;
+    int reply_pos;
+    /* Blocks in flight */
+    node_slot *slots;
+    int n_busy;
+    /* Answers waiting to be sent: slot numbers, oldest first */
+    int *out_fifo;
+    int out_head;
+    int out_count;
+    int out_pos;
+    /* Watched events */
+    int events;
+    /* Connection is to be released when all slots are freed */
+    int closing;
+    /* Answer could not be made */
+    int failed;
+#ifdef ENABLE_PTHREADS
+    /* Connection state lock */
+    pthread_mutex_t lock;
+#endif
+    /* Statistics */
+    int n_blocks;
+    double read_time;
+    double write_time;
+    double proc_time;
+} node_conn;
+
+/* Time histogram. The last bucket counts samples above all
+ * bounds; counts are not cumulative. */
+typedef struct stats_hist_tag {
+    unsigned long count[STATS_BUCKETS + 1];
+    double sum;
+} stats_hist;
+
+/* Node-wide statistics */
+typedef struct node_stats_tag {
+    time_t start_time;
+    int n_threads;
+    /* Connections: accepted and currently open */
+    unsigned long n_conns;
+    int active_conns;
+    /* Blocks received and not answered yet */
+    int queue_depth;
+    /* Answered and failed blocks */
+    unsigned long n_blocks[N_ACTIONS];
+    unsigned long n_failed;
+    /* Payload traffic */
+    double bytes_in;
+    double bytes_out;
+    /* Time per request spent in each stage */
+    stats_hist read_time;
+    stats_hist proc_time;
+    stats_hist write_time;
+} node_stats;
+
 /* Start timer */
 #define TIMER_START(_start) {                                           \
     gettimeofday(&_start, NULL);                                        \
@@ -73,100 +274,27 @@ extern "C" {
         (_stop.tv_usec - _start.tv_usec) / 1000000.0);                  \
 }
 
-/* Very helpful shutcuts to reduce typing */
-#define RECV_VALUE_FROM_MASTER(_x) {                                    \
-    switch (receive_value(sock_fd, _x)) {                               \
-        case -1:                                                        \
-            syslog(LOG_ERR, "Cannot receive value from %s port %d: %m", \
-                ip_addr, port);                                         \
-            return;                                                     \
-        case 0:                                                         \
-            syslog(LOG_INFO, "Connection to %s port %d closed",         \
-                ip_addr, port);                                         \
-            return;                                                     \
-        case 1:                                                         \
-            /* Nothing */                                               \
-            break;                                                      \
-        default:                                                        \
-            assert(0);                                                  \
-    }                                                                   \
-}
-
-#define RECV_BUF_FROM_MASTER(_x, _len) {                                \
-    ssize_t _nread = readn(sock_fd, _x, _len);                          \
+/* Take next value or `_len' bytes of a request from `p';
+ * wait for more data if they are not received yet */
+#define TAKE_VALUE(_x) {                                                \
+    uint32_t _v;                                                        \
                                                                         \
-    if (_nread == 0) {                                                  \
-        syslog(LOG_INFO, "Connection to %s port %d closed",             \
-            ip_addr, port);                                             \
-    } else if (_nread != _len) {                                        \
-        syslog(LOG_ERR, "Cannot receive buffer from %s port %d: %m",    \
-            ip_addr, port);                                             \
-        return;                                                         \
+    if (avail - pos < (int) sizeof(uint32_t)) {                         \
+        return 0;                                                       \
     }                                                                   \
-}
-
-#define SEND_VALUE_TO_MASTER(_x) {                                      \
-    if (send_value(sock_fd, _x) != 0) {                                 \
-        syslog(LOG_ERR, "Cannot send value to %s port %d: %m",          \
-            ip_addr, port);                                             \
-        return;                                                         \
-    }                                                                   \
-}
-
-#define SEND_BUF_TO_MASTER(_x, _len) {                                  \
-    if (writen(sock_fd, _x, _len) != _len) {                            \
-        syslog(LOG_ERR, "Cannot send buffer to %s port %d: %m",         \
-            ip_addr, port);                                             \
-        return;                                                         \
-    }                                                                   \
-}
-
-#define RECV_VALUE_FROM_SLAVE(_x) {                                     \
-    if (receive_value(sock_fd, _x) != 1) {                              \
-        LOCK(p_lock);                                                   \
-        printf("%sCannot receive value from %s port %d: %m\n",          \
-            QUIET, ip_addr, port);                                      \
-        UNLOCK(p_lock);                                                 \
-                                                                        \
-        error_flag = 1;                                                 \
-        goto error;                                                     \
-    }                                                                   \
-}
-
-#define RECV_BUF_FROM_SLAVE(_x, _len) {                                 \
-    if (readn(sock_fd, _x, _len) != _len) {                             \
-        LOCK(p_lock);                                                   \
-        printf("%sCannot receive buffer from %s port %d: %m\n",         \
-            QUIET, ip_addr, port);                                      \
-        UNLOCK(p_lock);                                                 \
                                                                         \
-        error_flag = 1;                                                 \
-        goto error;                                                     \
-    }                                                                   \
+    memcpy(&_v, p + pos, sizeof(uint32_t));                             \
+    _x = ntohl(_v);                                                     \
+    pos += sizeof(uint32_t);                                            \
 }
 
-#define SEND_VALUE_TO_SLAVE(_x) {                                       \
-    if (send_value(sock_fd, _x) != 0) {                                 \
-        LOCK(p_lock);                                                   \
-        printf("%sCannot send value to %s port %d: %m\n",               \
-            QUIET, ip_addr, port);                                      \
-        UNLOCK(p_lock);                                                 \
-                                                                        \
-        error_flag = 1;                                                 \
-        goto error;                                                     \
+#define TAKE_BUF(_x, _len) {                                            \
+    if (avail - pos < (_len)) {                                         \
+        return 0;                                                       \
     }                                                                   \
-}
-
-#define SEND_BUF_TO_SLAVE(_x, _len) {                                   \
-    if (writen(sock_fd, _x, _len) != _len) {                            \
-        LOCK(p_lock);                                                   \
-        printf("%sCannot send buffer to %s port %d: %m\n",              \
-            QUIET, ip_addr, port);                                      \
-        UNLOCK(p_lock);                                                 \
                                                                         \
-        error_flag = 1;                                                 \
-        goto error;                                                     \
-    }                                                                   \
+    memcpy(_x, p + pos, _len);                                          \
+    pos += _len;                                                        \
 }
 
 void set_signal(int sig, void (*sig_handler)(int));
@@ -174,18 +302,18 @@ ssize_t readn(int fd, void *buf, size_t nbytes);
 ssize_t writen(int fd, void *buf, size_t nbytes);
 int send_value(int fd, int value);
 int receive_value(int fd, int *value);
-static void daemon_init();
-static void sigterm_handler(int sig);
-static void sigchld_handler(int sig);
-static void start_server(int port);
-static void client_request(int sock_fd, struct sockaddr_in *cli_addr);
-static void action_encode_gs(int sock_fd, char *ip_addr, int port);
-static void action_encode_tc(int sock_fd, char *ip_addr, int port);
-static void action_decode_gs(int sock_fd, char *ip_addr, int port);
-static void action_decode_tc(int sock_fd, char *ip_addr, int port);
+void pack_frame(block_frame *frame, unsigned char *hdr);
+void unpack_frame(unsigned char *hdr, block_frame *frame);
+int send_frame(int fd, block_frame *frame, void *payload);
+int receive_frame(int fd, block_frame *frame, void *payload, int max_size);
+void set_nodelay(int fd);
+void node_addr_name(node_addr *addr, char *name, int size);
+socklen_t node_addr_len(node_addr *addr);
 int file_exists(char *pathname);
-int load_cluster_nodes(char *pathname, struct sockaddr_in *nodes);
-void cmd_start_node(int port);
+int load_cluster_nodes(char *pathname, node_addr *nodes);
+int find_cluster_nodes(char *node_list, node_addr *nodes);
+void cmd_start_node(int port, int metrics_port, char *unix_socket,
+                    int n_threads);
 
 #endif /* ENABLE_CLUSTER */
 
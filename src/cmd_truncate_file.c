@@ -62,6 +62,7 @@ void truncate_file(double ratio, int halt_on_errors,
     pbm_image pbm_tmp;
 
     unsigned char *buf_in;
+    unsigned char *block;
     unsigned char *buf_out;
     int buf_size;
 
@@ -152,6 +153,11 @@ void truncate_file(double ratio, int halt_on_errors,
         }
     }
 
+    /* Rebuild block index if the input file has one */
+    if (psi_in.indexed) {
+        psi_enable_index(&psi_out);
+    }
+
     if (pbm_tmp.type == PBM_TYPE_PGM) {
         buf_size = EPS_MAX_GRAYSCALE_BUF;
     } else {
@@ -206,7 +212,7 @@ void truncate_file(double ratio, int halt_on_errors,
         int truncate_size;
 
         /* Read next input block */
-        if ((rc = psi_read_next_block(&psi_in, buf_in, &real_buf_size)) != PSI_OK) {
+        if ((rc = psi_get_next_block(&psi_in, buf_in, &real_buf_size, &block)) != PSI_OK) {
             error_flag = 1;
 
             switch (rc) {
@@ -228,7 +234,7 @@ void truncate_file(double ratio, int halt_on_errors,
         }
 
         /* Parse and check block header */
-        rc = eps_read_block_header(buf_in, real_buf_size, &hdr);
+        rc = eps_read_block_header(block, real_buf_size, &hdr);
 
         if (rc != EPS_OK) {
             switch (rc) {
@@ -251,7 +257,7 @@ void truncate_file(double ratio, int halt_on_errors,
         }
 
         /* Truncate block */
-        rc = eps_truncate_block(buf_in, buf_out, &hdr, &truncate_size);
+        rc = eps_truncate_block(block, buf_out, &hdr, &truncate_size);
         assert(rc == EPS_OK);
 
         /* Write truncated block */
@@ -289,6 +295,12 @@ void truncate_file(double ratio, int halt_on_errors,
         }
     }
 
+    /* Append block index */
+    if (psi_write_index(&psi_out) != PSI_OK) {
+        printf("%sCannot write block index to %s: %m\n", QUIET, psi_out_file);
+        error_flag = 1;
+    }
+
 error:
     /* Free input and output buffers */
     free(buf_in);
@@ -42,6 +42,7 @@
 
 #ifdef ENABLE_CLUSTER
 # include <cmd_start_node.h>
+# include <cmd_node_stats.h>
 #endif
 
 #ifdef ENABLE_MPI
@@ -62,6 +63,9 @@ void parse_options(int argc, char **argv)
     int opt_n_threads           = DEF_N_THREADS;
     int opt_resample            = OPT_YES;
     int opt_two_pass            = OPT_NO;
+    int opt_binary_header       = OPT_NO;
+    int opt_checksum            = OPT_CHECKSUM_CRC32;
+    int opt_block_index         = OPT_NO;
 #ifdef ENABLE_MPI
     int opt_halt_on_errors      = OPT_YES;
 #else
@@ -75,7 +79,12 @@ void parse_options(int argc, char **argv)
     char *opt_output_dir        = OPT_NA;
 #ifdef ENABLE_CLUSTER
     int opt_port                = OPT_NA;
+    int opt_node_threads        = OPT_NA;
+    int opt_metrics_port        = OPT_NA;
+    char *opt_unix_socket       = OPT_NA;
 #endif
+    int opt_window              = OPT_NA;
+    int opt_local_threads       = OPT_NA;
     char *opt_node_list         = OPT_NA;
 
     int rc;
@@ -91,6 +100,8 @@ void parse_options(int argc, char **argv)
 #ifdef ENABLE_CLUSTER
         { "start-node", 's', POPT_ARG_VAL, &opt_command,
            OPT_CMD_START_NODE, "Start cluster node", NULL },
+        { "node-stats", 'S', POPT_ARG_VAL, &opt_command,
+           OPT_CMD_NODE_STATS, "Show statistics of cluster nodes", NULL },
 #endif
         { "list-all-fb", 'a', POPT_ARG_VAL, &opt_command,
           OPT_CMD_LIST_ALL_FB, "List all available filterbanks", NULL },
@@ -120,6 +131,12 @@ void parse_options(int argc, char **argv)
 #ifdef ENABLE_CLUSTER
         { "node-list", 'N', POPT_ARG_STRING, &opt_node_list,
           0, "List of cluster nodes", "FILE" },
+        { "window", 'W', POPT_ARG_INT, &opt_window,
+          0, "Blocks in flight per node", "VALUE" },
+#endif
+#if defined(ENABLE_PTHREADS) && defined(ENABLE_CLUSTER)
+        { "local-threads", 'L', POPT_ARG_INT, &opt_local_threads,
+          0, "Local threads working along with the nodes", "VALUE" },
 #endif
         { "Y-ratio", '\0', POPT_ARG_INT, &opt_Y_ratio,
           0, "Bit-budget percent for the Y channel", "VALUE" },
@@ -129,6 +146,14 @@ void parse_options(int argc, char **argv)
           0, "Bit-budget percent for the Cr channel", "VALUE" },
         { "no-resampling", '\0', POPT_ARG_VAL, &opt_resample,
           OPT_NO, "Omit image resampling", NULL },
+        { "binary-header", '\0', POPT_ARG_VAL, &opt_binary_header,
+          OPT_YES, "Write compact binary block headers", NULL },
+        { "crc32c", '\0', POPT_ARG_VAL, &opt_checksum,
+          OPT_CHECKSUM_CRC32C, "Use CRC-32C data checksum", NULL },
+        { "adler32", '\0', POPT_ARG_VAL, &opt_checksum,
+          OPT_CHECKSUM_ADLER32, "Use ADLER-32 data checksum", NULL },
+        { "block-index", '\0', POPT_ARG_VAL, &opt_block_index,
+          OPT_YES, "Append block index to the output file", NULL },
         POPT_TABLEEND
     };
 
@@ -141,6 +166,8 @@ void parse_options(int argc, char **argv)
 #ifdef ENABLE_CLUSTER
         { "node-list", 'N', POPT_ARG_STRING, &opt_node_list,
           0, "List of cluster nodes", "FILE" },
+        { "window", 'W', POPT_ARG_INT, &opt_window,
+          0, "Blocks in flight per node", "VALUE" },
 #endif
         { "ignore-hdr-crc", '\0', POPT_ARG_VAL, &opt_ignore_hdr_crc,
           OPT_YES, "Ignore header CRC errors", NULL },
@@ -163,6 +190,12 @@ void parse_options(int argc, char **argv)
     struct poptOption start_node_options[] = {
         { "port", 'P', POPT_ARG_INT, &opt_port,
           0, "Port number", "VALUE" },
+        { "threads", 'T', POPT_ARG_INT, &opt_node_threads,
+          0, "Number of worker threads", "VALUE" },
+        { "unix-socket", 'U', POPT_ARG_STRING, &opt_unix_socket,
+          0, "Also listen on Unix domain socket", "PATH" },
+        { "metrics-port", 'M', POPT_ARG_INT, &opt_metrics_port,
+          0, "Serve metrics on local port", "VALUE" },
         POPT_TABLEEND
     };
 #endif
@@ -227,16 +260,19 @@ void parse_options(int argc, char **argv)
         {
             cmd_encode_file(opt_filter_id, opt_block_size, opt_mode,
                             opt_ratio, opt_two_pass, opt_n_threads,
-                            opt_node_list, opt_Y_ratio, opt_Cb_ratio,
-                            opt_Cr_ratio, opt_resample, opt_halt_on_errors,
-                            opt_quiet, opt_output_dir, opt_files);
+                            opt_node_list, opt_window, opt_local_threads,
+                            opt_Y_ratio, opt_Cb_ratio, opt_Cr_ratio,
+                            opt_resample, opt_binary_header, opt_checksum,
+                            opt_block_index, opt_halt_on_errors, opt_quiet,
+                            opt_output_dir, opt_files);
             break;
         }
         case OPT_CMD_DECODE_FILE:
         {
-            cmd_decode_file(opt_n_threads, opt_node_list, opt_halt_on_errors,
-                            opt_quiet, opt_ignore_hdr_crc, opt_ignore_data_crc,
-                            opt_ignore_format_err, opt_output_dir, opt_files);
+            cmd_decode_file(opt_n_threads, opt_node_list, opt_window,
+                            opt_halt_on_errors, opt_quiet, opt_ignore_hdr_crc,
+                            opt_ignore_data_crc, opt_ignore_format_err,
+                            opt_output_dir, opt_files);
             break;
         }
         case OPT_CMD_TRUNCATE_FILE:
@@ -249,7 +285,13 @@ void parse_options(int argc, char **argv)
         case OPT_CMD_START_NODE:
         {
 
-            cmd_start_node(opt_port);
+            cmd_start_node(opt_port, opt_metrics_port, opt_unix_socket,
+                           opt_node_threads);
+            break;
+        }
+        case OPT_CMD_NODE_STATS:
+        {
+            cmd_node_stats(opt_node_list);
             break;
         }
 #endif
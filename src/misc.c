@@ -29,6 +29,12 @@
 #include <misc.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
+
+#if defined(ENABLE_PTHREADS) && !defined(__GNUC__)
+/* Atomic operations mutex */
+static pthread_mutex_t a_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /* Check that the value is a power of two */
 int power_of_two(int value)
@@ -113,3 +119,46 @@ void transform_1D_to_2D(unsigned char *src, unsigned char **dst, int w, int h) {
         }
     }
 }
+
+/* Atomically add to shared counter, return previous value */
+int atomic_add(volatile int *value, int delta) {
+#ifdef __GNUC__
+    return __sync_fetch_and_add(value, delta);
+#else
+    int old;
+
+    LOCK(a_lock);
+    old = *value;
+    *value += delta;
+    UNLOCK(a_lock);
+
+    return old;
+#endif
+}
+
+/* Atomically read shared counter or flag */
+int atomic_get(volatile int *value) {
+#ifdef __GNUC__
+    return __sync_fetch_and_add(value, 0);
+#else
+    int cur;
+
+    LOCK(a_lock);
+    cur = *value;
+    UNLOCK(a_lock);
+
+    return cur;
+#endif
+}
+
+/* Atomically set shared counter or flag */
+void atomic_set(volatile int *value, int new_value) {
+#ifdef __GNUC__
+    __sync_synchronize();
+    __sync_lock_test_and_set(value, new_value);
+#else
+    LOCK(a_lock);
+    *value = new_value;
+    UNLOCK(a_lock);
+#endif
+}
@@ -108,6 +108,9 @@ char *format_time(int delta, char *buf, int nbytes);
 void print_blank_line(int len);
 void transform_2D_to_1D(unsigned char **src, unsigned char *dst, int w, int h);
 void transform_1D_to_2D(unsigned char *src, unsigned char **dst, int w, int h);
+int atomic_add(volatile int *value, int delta);
+int atomic_get(volatile int *value);
+void atomic_set(volatile int *value, int new_value);
 
 #ifdef __cplusplus
 }
@@ -42,11 +42,17 @@ extern "C" {
 #define OPT_CMD_TRUNCATE_FILE   5
 #define OPT_CMD_START_NODE      6
 #define OPT_CMD_STOP_NODE       7
+#define OPT_CMD_NODE_STATS      8
 
 /* Splitting mode */
 #define OPT_MODE_NORMAL         1
 #define OPT_MODE_OTLPF          2
 
+/* Data checksum */
+#define OPT_CHECKSUM_CRC32      0
+#define OPT_CHECKSUM_CRC32C     1
+#define OPT_CHECKSUM_ADLER32    2
+
 /* Default block size */
 #define OPT_DEF_BLOCK           256
 
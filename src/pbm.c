@@ -33,6 +33,14 @@
 #include <string.h>
 #include <pbm.h>
 #include <misc.h>
+#include <uring.h>
+
+#ifdef PBM_PREAD
+# include <unistd.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+#endif
 
 /* Get file size */
 int get_file_size(char *pathname, off_t *file_size)
@@ -48,6 +56,7 @@ int get_file_size(char *pathname, off_t *file_size)
     return PBM_OK;
 }
 
+#ifndef PBM_PREAD
 /* fseeko wrapper: either SEEK_SET or SEEK_CUR mode */
 static int fseeko_jumbo(FILE *f, off_t offset, int whence) {
     /* Set pointer at start position in SEEK_SET mode */
@@ -73,6 +82,7 @@ static int fseeko_jumbo(FILE *f, off_t offset, int whence) {
 
     return PBM_OK;
 }
+#endif
 
 /* Read next char */
 static int get_char(FILE *f)
@@ -127,6 +137,199 @@ static int get_integer(FILE *f, int *val)
     return PBM_OK;
 }
 
+/* Map the whole file into memory. Failure is not an error:
+ * positional reads are used instead. */
+static int map_image(pbm_image *pbm, off_t file_size)
+{
+#ifdef PBM_PREAD
+    void *map;
+
+    /* File does not fit into address space */
+    if (_OFF((size_t) file_size) != file_size) {
+        return PBM_SYSTEM_ERROR;
+    }
+
+    map = mmap(NULL, (size_t) file_size, PROT_READ, MAP_SHARED, pbm->fd, 0);
+
+    if (map == MAP_FAILED) {
+        return PBM_SYSTEM_ERROR;
+    }
+
+    pbm->map = (unsigned char *) map;
+    pbm->map_size = (size_t) file_size;
+
+    return PBM_OK;
+#else
+    return PBM_SYSTEM_ERROR;
+#endif
+}
+
+/* Get pointer to `len' bytes of image data starting at `offset'.
+ * Mapped data is returned in place, otherwise it is read into `buf'.
+ * Returns NULL on error. */
+static unsigned char *get_span(pbm_image *pbm, unsigned char *buf,
+                               off_t offset, size_t len)
+{
+#ifdef PBM_PREAD
+    size_t done = 0;
+    ssize_t rc;
+#endif
+
+    offset += pbm->hdr_size;
+
+    if (pbm->map) {
+        return pbm->map + offset;
+    }
+
+#ifdef PBM_PREAD
+    while (done < len) {
+        rc = pread(pbm->fd, buf + done, len - done, offset + _OFF(done));
+
+        if (rc > 0) {
+            done += rc;
+        } else if ((rc == 0) || (errno != EINTR)) {
+            return NULL;
+        }
+    }
+#else
+    if (fseeko_jumbo(pbm->f, offset, SEEK_SET) != PBM_OK) {
+        return NULL;
+    }
+
+    if (fread(buf, 1, len, pbm->f) != len) {
+        return NULL;
+    }
+#endif
+
+    return buf;
+}
+
+/* Store `len' bytes of image data starting at `offset' */
+static int put_span(pbm_image *pbm, unsigned char *buf,
+                    off_t offset, size_t len)
+{
+#ifdef PBM_PREAD
+    size_t done = 0;
+    ssize_t rc;
+#endif
+
+    offset += pbm->hdr_size;
+
+#ifdef PBM_PREAD
+    while (done < len) {
+        rc = pwrite(pbm->fd, buf + done, len - done, offset + _OFF(done));
+
+        if (rc > 0) {
+            done += rc;
+        } else if ((rc == 0) || (errno != EINTR)) {
+            return PBM_SYSTEM_ERROR;
+        }
+    }
+#else
+    if (fseeko_jumbo(pbm->f, offset, SEEK_SET) != PBM_OK) {
+        return PBM_SYSTEM_ERROR;
+    }
+
+    if (fwrite(buf, 1, len, pbm->f) != len) {
+        return PBM_SYSTEM_ERROR;
+    }
+#endif
+
+    return PBM_OK;
+}
+
+/* Read `n_rows' spans of `len' bytes; row j starts at `offset' +
+ * j * `stride'. With io_uring all the reads are in flight at once. */
+static int get_rows(pbm_image *pbm, unsigned char **rows, off_t offset,
+                    off_t stride, size_t len, int n_rows)
+{
+    unsigned char *row;
+    int j;
+
+#ifdef ENABLE_IO_URING
+    uring *ring = pbm->map ? NULL : uring_get();
+
+    if (ring) {
+        uring_req *reqs;
+        int rc;
+
+        reqs = (uring_req *) malloc(n_rows * sizeof(uring_req));
+
+        if (reqs == NULL) {
+            return PBM_SYSTEM_ERROR;
+        }
+
+        for (j = 0; j < n_rows; j++) {
+            reqs[j].buf = rows[j];
+            reqs[j].len = len;
+            reqs[j].offset = pbm->hdr_size + offset + _OFF(j) * stride;
+        }
+
+        rc = uring_batch(ring, URING_READ, pbm->fd, reqs, n_rows);
+        free(reqs);
+
+        return rc == URING_OK ? PBM_OK : PBM_SYSTEM_ERROR;
+    }
+#endif
+
+    for (j = 0; j < n_rows; j++) {
+        row = get_span(pbm, rows[j], offset + _OFF(j) * stride, len);
+
+        if (row == NULL) {
+            return PBM_SYSTEM_ERROR;
+        }
+
+        if (row != rows[j]) {
+            memcpy(rows[j], row, len);
+        }
+    }
+
+    return PBM_OK;
+}
+
+/* Store `n_rows' spans of `len' bytes, see get_rows */
+static int put_rows(pbm_image *pbm, unsigned char **rows, off_t offset,
+                    off_t stride, size_t len, int n_rows)
+{
+    int j;
+    int rc;
+
+#ifdef ENABLE_IO_URING
+    uring *ring = uring_get();
+
+    if (ring) {
+        uring_req *reqs;
+
+        reqs = (uring_req *) malloc(n_rows * sizeof(uring_req));
+
+        if (reqs == NULL) {
+            return PBM_SYSTEM_ERROR;
+        }
+
+        for (j = 0; j < n_rows; j++) {
+            reqs[j].buf = rows[j];
+            reqs[j].len = len;
+            reqs[j].offset = pbm->hdr_size + offset + _OFF(j) * stride;
+        }
+
+        rc = uring_batch(ring, URING_WRITE, pbm->fd, reqs, n_rows);
+        free(reqs);
+
+        return rc == URING_OK ? PBM_OK : PBM_SYSTEM_ERROR;
+    }
+#endif
+
+    for (j = 0; j < n_rows; j++) {
+        rc = put_span(pbm, rows[j], offset + _OFF(j) * stride, len);
+
+        if (rc != PBM_OK) {
+            return rc;
+        }
+    }
+
+    return PBM_OK;
+}
+
 /* Open PBM file */
 int pbm_open(char *pathname, pbm_image *pbm)
 {
@@ -134,6 +337,7 @@ int pbm_open(char *pathname, pbm_image *pbm)
     off_t hdr_size;
     int rc;
 
+    pbm->map = NULL;
     pbm->f = NULL;
     pbm->f = fopen(pathname, "rb");
 
@@ -141,6 +345,8 @@ int pbm_open(char *pathname, pbm_image *pbm)
         return PBM_SYSTEM_ERROR;
     }
 
+    pbm->fd = fileno(pbm->f);
+
     rc = get_file_size(pathname, &file_size);
 
     if (rc != PBM_OK) {
@@ -206,14 +412,27 @@ int pbm_open(char *pathname, pbm_image *pbm)
         return PBM_FORMAT_ERROR;
     }
 
+#ifdef ENABLE_IO_URING
+    /* Keep many reads in flight rather than fault pages in one by one */
+    if (uring_get()) {
+        return PBM_OK;
+    }
+#endif
+
+    /* Optional: fall back to reads if mapping fails */
+    map_image(pbm, file_size);
+
     return PBM_OK;
 }
 
 /* Create PBM file */
 int pbm_create(char *pathname, pbm_image *pbm)
 {
+#ifndef PBM_PREAD
     int rc;
+#endif
 
+    pbm->map = NULL;
     pbm->f = NULL;
 
     if ((pbm->type != PBM_TYPE_PGM) && (pbm->type != PBM_TYPE_PPM)) {
@@ -241,6 +460,26 @@ int pbm_create(char *pathname, pbm_image *pbm)
 
     pbm->max_val = 255;
 
+#ifdef PBM_PREAD
+    /* Image data is written with pwrite, bypassing stdio buffers */
+    if (fflush(pbm->f) == EOF) {
+        return PBM_SYSTEM_ERROR;
+    }
+
+    pbm->fd = fileno(pbm->f);
+
+    /* Prepare blank image. Reserve disk space where possible,
+     * fall back to a sparse file otherwise. */
+#ifdef __linux__
+    if (posix_fallocate(pbm->fd, 0, pbm->hdr_size + pbm->data_size) == 0) {
+        return PBM_OK;
+    }
+#endif
+
+    if (ftruncate(pbm->fd, pbm->hdr_size + pbm->data_size) == -1) {
+        return PBM_SYSTEM_ERROR;
+    }
+#else
     /* Prepare blank image */
     rc = fseeko_jumbo(pbm->f, _OFF(pbm->data_size) - _OFF(1), SEEK_CUR);
 
@@ -251,6 +490,7 @@ int pbm_create(char *pathname, pbm_image *pbm)
     if (fputc(0, pbm->f) == EOF) {
         return PBM_SYSTEM_ERROR;
     }
+#endif
 
     return PBM_OK;
 }
@@ -258,19 +498,44 @@ int pbm_create(char *pathname, pbm_image *pbm)
 /* Close PBM file */
 void pbm_close(pbm_image *pbm)
 {
+#ifdef PBM_PREAD
+    if (pbm->map) {
+        munmap(pbm->map, pbm->map_size);
+        pbm->map = NULL;
+    }
+#endif
+
     if (pbm->f) {
         fclose(pbm->f);
     }
 }
 
+/* Map image data even if it is read otherwise.
+ * Failure is not an error, see map_image. */
+int pbm_map(pbm_image *pbm)
+{
+    if (pbm->map) {
+        return PBM_OK;
+    }
+
+    return map_image(pbm, pbm->hdr_size + pbm->data_size);
+}
+
+/* Get image data in place: mapped images only. Returns NULL
+ * if image data is not available in memory. */
+unsigned char *pbm_get_raster(pbm_image *pbm)
+{
+    if (pbm->map == NULL) {
+        return NULL;
+    }
+
+    return pbm->map + pbm->hdr_size;
+}
+
 /* Read block from PGM file */
 int pbm_read_pgm(pbm_image *pbm, unsigned char **block,
                  int x, int y, int width, int height)
 {
-    off_t offset;
-    int i, j;
-    int rc;
-
     /* Check params for consistency */
     if ((x < 0) || (y < 0)) {
         return PBM_PARAM_ERROR;
@@ -292,46 +557,47 @@ int pbm_read_pgm(pbm_image *pbm, unsigned char **block,
         return PBM_PARAM_ERROR;
     }
 
-    /* Set file pointer */
-    offset = _OFF(pbm->hdr_size) + _OFF(y) * _OFF(pbm->width) + _OFF(x);
-    rc = fseeko_jumbo(pbm->f, offset, SEEK_SET);
+    /* Fetch desired block */
+    return get_rows(pbm, block, _OFF(y) * _OFF(pbm->width) + _OFF(x),
+                    _OFF(pbm->width), (size_t) width, height);
+}
 
-    if (rc != PBM_OK) {
-        return rc;
+/* Read block rows as they are stored: channels interleaved */
+int pbm_read_rows(pbm_image *pbm, unsigned char **rows,
+                  int x, int y, int width, int height)
+{
+    int n_channels = pbm->type == PBM_TYPE_PGM ? 1 : 3;
+
+    /* Check params for consistency */
+    if ((x < 0) || (y < 0)) {
+        return PBM_PARAM_ERROR;
     }
 
-    /* Fetch desired block from the file */
-    for (j = 0; j < height; j++) {
-        for (i = 0; i < width; i++) {
-            int ch = fgetc(pbm->f);
+    if ((x >= pbm->width) || (y >= pbm->height)) {
+        return PBM_PARAM_ERROR;
+    }
 
-            if (ch != EOF) {
-                block[j][i] = (unsigned char) ch;
-            } else {
-                return PBM_SYSTEM_ERROR;
-            }
-        }
+    if ((width <= 0) || (height <= 0)) {
+        return PBM_PARAM_ERROR;
+    }
 
-        /* Next scanline */
-        offset = _OFF(_OFF(pbm->width) - _OFF(width));
-        rc = fseeko_jumbo(pbm->f, offset, SEEK_CUR);
+    if (x + width > pbm->width) {
+        return PBM_PARAM_ERROR;
+    }
 
-        if (rc != PBM_OK) {
-            return rc;
-        }
+    if (y + height > pbm->height) {
+        return PBM_PARAM_ERROR;
     }
 
-    return PBM_OK;
+    return get_rows(pbm, rows, (_OFF(y) * _OFF(pbm->width) + _OFF(x)) *
+                    _OFF(n_channels), _OFF(pbm->width) * _OFF(n_channels),
+                    (size_t) width * n_channels, height);
 }
 
 /* Write block into the PGM file */
 int pbm_write_pgm(pbm_image *pbm, unsigned char **block,
                   int x, int y, int width, int height)
 {
-    off_t offset;
-    int i, j;
-    int rc;
-
     /* Check params for consistency */
     if ((x < 0) || (y < 0)) {
         return PBM_PARAM_ERROR;
@@ -353,31 +619,9 @@ int pbm_write_pgm(pbm_image *pbm, unsigned char **block,
         return PBM_PARAM_ERROR;
     }
 
-    offset = _OFF(pbm->hdr_size) + _OFF(y) * _OFF(pbm->width) + _OFF(x);
-    rc = fseeko_jumbo(pbm->f, offset, SEEK_SET);
-
-    if (rc != PBM_OK) {
-        return rc;
-    }
-
     /* Store desired block */
-    for (j = 0; j < height; j++) {
-        for (i = 0; i < width; i++) {
-            if (fputc(block[j][i], pbm->f) == EOF) {
-                return PBM_SYSTEM_ERROR;
-            }
-        }
-
-        /* Next scanline */
-        offset = _OFF(pbm->width) - _OFF(width);
-        rc = fseeko_jumbo(pbm->f, offset, SEEK_CUR);
-
-        if (rc != PBM_OK) {
-            return rc;
-        }
-    }
-
-    return PBM_OK;
+    return put_rows(pbm, block, _OFF(y) * _OFF(pbm->width) + _OFF(x),
+                    _OFF(pbm->width), (size_t) width, height);
 }
 
 /* Read block from PPM file */
@@ -385,9 +629,11 @@ int pbm_read_ppm(pbm_image *pbm, unsigned char **block_R,
                  unsigned char **block_G, unsigned char **block_B,
                  int x, int y, int width, int height)
 {
+    unsigned char *tmp = NULL;
+    unsigned char **rows = NULL;
+    unsigned char *row;
     off_t offset;
     int i, j;
-    int rc;
 
     /* Check params for consistency */
     if ((x < 0) || (y < 0)) {
@@ -410,46 +656,51 @@ int pbm_read_ppm(pbm_image *pbm, unsigned char **block_R,
         return PBM_PARAM_ERROR;
     }
 
-    offset = _OFF(pbm->hdr_size) + (_OFF(y) * _OFF(pbm->width) + _OFF(x)) * _OFF(3);
-    rc = fseeko_jumbo(pbm->f, offset, SEEK_SET);
+    offset = (_OFF(y) * _OFF(pbm->width) + _OFF(x)) * _OFF(3);
 
-    if (rc != PBM_OK) {
-        return PBM_SYSTEM_ERROR;
+    /* Unmapped images: fetch the whole block at once */
+    if (pbm->map == NULL) {
+        tmp = (unsigned char *) malloc(width * 3 * height);
+        rows = (unsigned char **) malloc(height * sizeof(unsigned char *));
+
+        if ((tmp == NULL) || (rows == NULL)) {
+            free(tmp);
+            free(rows);
+            return PBM_SYSTEM_ERROR;
+        }
+
+        for (j = 0; j < height; j++) {
+            rows[j] = tmp + j * width * 3;
+        }
+
+        if (get_rows(pbm, rows, offset, _OFF(pbm->width) * _OFF(3),
+            (size_t) width * 3, height) != PBM_OK)
+        {
+            free(tmp);
+            free(rows);
+            return PBM_SYSTEM_ERROR;
+        }
     }
 
-    /* Fetch desired block */
+    /* Split desired block into channels */
     for (j = 0; j < height; j++) {
-        for (i = 0; i < width; i++) {
-            int ch;
-
-            if ((ch = fgetc(pbm->f)) != EOF) {
-                block_R[j][i] = (unsigned char) ch;
-            } else {
-                return PBM_SYSTEM_ERROR;
-            }
-
-            if ((ch = fgetc(pbm->f)) != EOF) {
-                block_G[j][i] = (unsigned char) ch;
-            } else {
-                return PBM_SYSTEM_ERROR;
-            }
-
-            if ((ch = fgetc(pbm->f)) != EOF) {
-                block_B[j][i] = (unsigned char) ch;
-            } else {
-                return PBM_SYSTEM_ERROR;
-            }
+        if (rows) {
+            row = rows[j];
+        } else {
+            row = get_span(pbm, NULL, offset + _OFF(j) * _OFF(pbm->width) *
+                _OFF(3), (size_t) width * 3);
         }
 
-        /* Next scanline */
-        offset = (_OFF(pbm->width) - _OFF(width)) * _OFF(3);
-        rc = fseeko_jumbo(pbm->f, offset, SEEK_CUR);
-
-        if (rc != PBM_OK) {
-            return rc;
+        for (i = 0; i < width; i++) {
+            block_R[j][i] = row[3 * i + 0];
+            block_G[j][i] = row[3 * i + 1];
+            block_B[j][i] = row[3 * i + 2];
         }
     }
 
+    free(tmp);
+    free(rows);
+
     return PBM_OK;
 }
 
@@ -458,7 +709,9 @@ int pbm_write_ppm(pbm_image *pbm, unsigned char **block_R,
                   unsigned char **block_G, unsigned char **block_B,
                   int x, int y, int width, int height)
 {
-    off_t offset;
+    unsigned char *tmp;
+    unsigned char **rows;
+    unsigned char *row;
     int i, j;
     int rc;
 
@@ -483,36 +736,32 @@ int pbm_write_ppm(pbm_image *pbm, unsigned char **block_R,
         return PBM_PARAM_ERROR;
     }
 
-    offset = _OFF(pbm->hdr_size) + (_OFF(y) * _OFF(pbm->width) + _OFF(x)) * _OFF(3);
-    rc = fseeko_jumbo(pbm->f, offset, SEEK_SET);
+    /* Interleaved block buffer */
+    tmp = (unsigned char *) malloc(width * 3 * height);
+    rows = (unsigned char **) malloc(height * sizeof(unsigned char *));
 
-    if (rc != PBM_OK) {
-        return rc;
+    if ((tmp == NULL) || (rows == NULL)) {
+        free(tmp);
+        free(rows);
+        return PBM_SYSTEM_ERROR;
     }
 
-    /* Store desired block */
     for (j = 0; j < height; j++) {
-        for (i = 0; i < width; i++) {
-            if (fputc(block_R[j][i], pbm->f) == EOF) {
-                return PBM_SYSTEM_ERROR;
-            }
+        row = rows[j] = tmp + j * width * 3;
 
-            if (fputc(block_G[j][i], pbm->f) == EOF) {
-                return PBM_SYSTEM_ERROR;
-            }
-
-            if (fputc(block_B[j][i], pbm->f) == EOF) {
-                return PBM_SYSTEM_ERROR;
-            }
+        for (i = 0; i < width; i++) {
+            row[3 * i + 0] = block_R[j][i];
+            row[3 * i + 1] = block_G[j][i];
+            row[3 * i + 2] = block_B[j][i];
         }
+    }
 
-        offset = (_OFF(pbm->width) - _OFF(width)) * _OFF(3);
-        rc = fseeko_jumbo(pbm->f, offset, SEEK_CUR);
+    /* Store desired block */
+    rc = put_rows(pbm, rows, (_OFF(y) * _OFF(pbm->width) + _OFF(x)) * _OFF(3),
+                  _OFF(pbm->width) * _OFF(3), (size_t) width * 3, height);
 
-        if (rc != PBM_OK) {
-            return rc;
-        }
-    }
+    free(tmp);
+    free(rows);
 
-    return PBM_OK;
+    return rc;
 }
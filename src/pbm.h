@@ -37,6 +37,13 @@ extern "C" {
 #define fseeko fseek
 #endif
 
+/* On POSIX systems image data is memory mapped or accessed with
+ * positional I/O, so concurrent block reads and writes (of disjoint
+ * blocks) need no locking. */
+#ifndef _WIN32
+# define PBM_PREAD
+#endif
+
 /* PBM file type */
 #define PBM_TYPE_PGM            0
 #define PBM_TYPE_PPM            1
@@ -56,15 +63,33 @@ typedef struct pbm_image_tag {
     FILE *f;
     off_t hdr_size;
     off_t data_size;
+    int fd;
+    unsigned char *map;
+    size_t map_size;
 } pbm_image;
 
 int get_file_size(char *pathname, off_t *file_size);
+#ifndef PBM_PREAD
 static int fseeko_jumbo(FILE *f, off_t offset, int whence);
+#endif
 static int get_char(FILE *f);
 static int get_integer(FILE *f, int *val);
+static int map_image(pbm_image *pbm, off_t file_size);
+static unsigned char *get_span(pbm_image *pbm, unsigned char *buf,
+                               off_t offset, size_t len);
+static int put_span(pbm_image *pbm, unsigned char *buf,
+                    off_t offset, size_t len);
+static int get_rows(pbm_image *pbm, unsigned char **rows, off_t offset,
+                    off_t stride, size_t len, int n_rows);
+static int put_rows(pbm_image *pbm, unsigned char **rows, off_t offset,
+                    off_t stride, size_t len, int n_rows);
 int pbm_open(char *pathname, pbm_image *pbm);
 int pbm_create(char *pathname, pbm_image *pbm);
 void pbm_close(pbm_image *pbm);
+int pbm_map(pbm_image *pbm);
+unsigned char *pbm_get_raster(pbm_image *pbm);
+int pbm_read_rows(pbm_image *pbm, unsigned char **rows,
+                  int x, int y, int width, int height);
 int pbm_read_pgm(pbm_image *pbm, unsigned char **block,
                  int x, int y, int width, int height);
 int pbm_write_pgm(pbm_image *pbm, unsigned char **block,
@@ -28,14 +28,281 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <epsilon.h>
 #include <psi.h>
 #include <pbm.h>
 #include <misc.h>
 
+#ifdef PSI_MMAP
+# include <sys/mman.h>
+#endif
+
+#ifdef PSI_WRITEV
+# include <sys/uio.h>
+#endif
+
+#if defined(PSI_MMAP) || defined(PSI_WRITEV)
+# include <unistd.h>
+# include <errno.h>
+#endif
+
+/* Store zero-free variable length value. The value is biased by
+ * one, so the last byte is never zero. */
+static int put_value(unsigned char *buf, off_t value)
+{
+    off_t v = value + 1;
+    int n;
+
+    for (n = 0; v >= 0x80; v >>= 7) {
+        buf[n++] = (unsigned char) (0x80 | (v & 0x7f));
+    }
+
+    buf[n++] = (unsigned char) v;
+
+    return n;
+}
+
+/* Fetch value stored by put_value() */
+static int get_value(unsigned char *buf, int buf_size, int *pos, off_t *value)
+{
+    off_t v;
+    int shift;
+    int i;
+
+    for (i = *pos, v = 0, shift = 0; i < buf_size; i++, shift += 7) {
+        if (shift > 56) {
+            return PSI_GUESS_ERROR;
+        }
+
+        v |= _OFF(buf[i] & 0x7f) << shift;
+
+        if (!(buf[i] & 0x80)) {
+            if (v == 0) {
+                return PSI_GUESS_ERROR;
+            }
+
+            *value = v - 1;
+            *pos = i + 1;
+
+            return PSI_OK;
+        }
+    }
+
+    return PSI_GUESS_ERROR;
+}
+
+/* FNV-1a checksum of the index body */
+static unsigned long index_checksum(unsigned char *buf, int buf_size)
+{
+    unsigned long sum = 2166136261UL;
+    int i;
+
+    for (i = 0; i < buf_size; i++) {
+        sum = ((sum ^ buf[i]) * 16777619UL) & 0xffffffffUL;
+    }
+
+    return sum;
+}
+
+/* Parse fixed width hex number */
+static int get_hex(char *str, int len, off_t *value)
+{
+    int i;
+
+    for (*value = 0, i = 0; i < len; i++) {
+        char ch = str[i];
+
+        if ((ch >= '0') && (ch <= '9')) {
+            *value = (*value << 4) | (ch - '0');
+        } else if ((ch >= 'a') && (ch <= 'f')) {
+            *value = (*value << 4) | (ch - 'a' + 10);
+        } else {
+            return PSI_GUESS_ERROR;
+        }
+    }
+
+    return PSI_OK;
+}
+
+/* Print fixed width hex number */
+static void put_hex(char *str, int len, off_t value)
+{
+    int i;
+
+    for (i = len - 1; i >= 0; i--, value >>= 4) {
+        str[i] = "0123456789abcdef"[value & 0xf];
+    }
+}
+
+/* Order index entries by block position */
+static int compare_blocks(const void *a, const void *b)
+{
+    const psi_block *p = (const psi_block *) a;
+    const psi_block *q = (const psi_block *) b;
+
+    if (p->y != q->y) {
+        return p->y < q->y ? -1 : 1;
+    }
+
+    if (p->x != q->x) {
+        return p->x < q->x ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/* Load block index trailer if the file has a valid one */
+static void load_index(psi_image *psi, off_t file_size)
+{
+    char tail[PSI_INDEX_TAIL_SIZE];
+    unsigned char *body = NULL;
+    off_t body_size, sum, data_end;
+    off_t v[6];
+    int pos, i, j;
+
+    if (file_size < PSI_INDEX_TAIL_SIZE) {
+        return;
+    }
+
+    /* Fixed size tail */
+    if ((fseeko(psi->f, file_size - PSI_INDEX_TAIL_SIZE, SEEK_SET) != 0) ||
+        (fread(tail, 1, PSI_INDEX_TAIL_SIZE, psi->f) != PSI_INDEX_TAIL_SIZE))
+    {
+        goto error;
+    }
+
+    if ((memcmp(tail, "index-size=", 11) != 0) ||
+        (get_hex(tail + 11, 16, &body_size) != PSI_OK) ||
+        (memcmp(tail + 27, ";sum=", 5) != 0) ||
+        (get_hex(tail + 32, 8, &sum) != PSI_OK))
+    {
+        goto error;
+    }
+
+    if ((body_size < 8) || (body_size > file_size - PSI_INDEX_TAIL_SIZE) ||
+        (body_size > _OFF(0x7fffffff)))
+    {
+        goto error;
+    }
+
+    /* Index body */
+    if ((body = (unsigned char *) malloc((size_t) body_size)) == NULL) {
+        goto error;
+    }
+
+    if ((fseeko(psi->f, file_size - PSI_INDEX_TAIL_SIZE - body_size,
+        SEEK_SET) != 0) ||
+        (fread(body, 1, (size_t) body_size, psi->f) != (size_t) body_size))
+    {
+        goto error;
+    }
+
+    if ((memcmp(body, "index=1;", 8) != 0) ||
+        (_OFF(index_checksum(body, (int) body_size)) != sum))
+    {
+        goto error;
+    }
+
+    /* Image summary: type, W, H, max block w and h, number of blocks */
+    for (pos = 8, i = 0; i < 6; i++) {
+        if (get_value(body, (int) body_size, &pos, &v[i]) != PSI_OK) {
+            goto error;
+        }
+    }
+
+    if ((v[0] != PBM_TYPE_PGM) && (v[0] != PBM_TYPE_PPM)) {
+        goto error;
+    }
+
+    for (i = 1; i < 6; i++) {
+        if ((v[i] <= 0) || (v[i] > _OFF(0x7fffffff))) {
+            goto error;
+        }
+    }
+
+    /* Blocks never exceed the image */
+    if ((v[3] > v[1]) || (v[4] > v[2])) {
+        goto error;
+    }
+
+    psi->type = (int) v[0];
+    psi->width = (int) v[1];
+    psi->height = (int) v[2];
+    psi->max_block_w = (int) v[3];
+    psi->max_block_h = (int) v[4];
+    psi->n_blocks = psi->max_blocks = (int) v[5];
+
+    /* Block entries: offset, size, x, y */
+    if (psi->n_blocks > body_size / 4) {
+        goto error;
+    }
+
+    psi->blocks = (psi_block *) malloc(psi->n_blocks * sizeof(psi_block));
+
+    if (psi->blocks == NULL) {
+        goto error;
+    }
+
+    /* Block data ends where the index starts */
+    data_end = file_size - PSI_INDEX_TAIL_SIZE - body_size;
+
+    for (i = 0; i < psi->n_blocks; i++) {
+        for (j = 0; j < 4; j++) {
+            if (get_value(body, (int) body_size, &pos, &v[j]) != PSI_OK) {
+                goto error;
+            }
+        }
+
+        /* Blocks must lie before the index, written this way
+         * the check cannot overflow */
+        if ((v[0] > data_end) || (v[1] > data_end - v[0]) ||
+            (v[1] > _OFF(0x7fffffff)) || (v[2] >= psi->width) ||
+            (v[3] >= psi->height))
+        {
+            goto error;
+        }
+
+        psi->blocks[i].offset = v[0];
+        psi->blocks[i].size = (int) v[1];
+        psi->blocks[i].x = (int) v[2];
+        psi->blocks[i].y = (int) v[3];
+
+        /* Lookups rely on entries being sorted and unique */
+        if ((i > 0) &&
+            (compare_blocks(&psi->blocks[i - 1], &psi->blocks[i]) >= 0))
+        {
+            goto error;
+        }
+    }
+
+    psi->data_end = data_end;
+    psi->indexed = 1;
+    free(body);
+
+    return;
+
+error:
+    /* No index or a broken one: fall back to scanning */
+    free(body);
+    free(psi->blocks);
+    psi->blocks = NULL;
+    psi->n_blocks = psi->max_blocks = 0;
+}
+
 /* Open PSI file */
 int psi_open(char *pathname, psi_image *psi)
 {
+    off_t file_size;
+#ifdef PSI_MMAP
+    int use_map = 1;
+    void *map;
+#endif
+
+    memset(psi, 0, sizeof(psi_image));
+
     psi->f = NULL;
     psi->f = fopen(pathname, "rb");
 
@@ -43,12 +310,71 @@ int psi_open(char *pathname, psi_image *psi)
         return PSI_SYSTEM_ERROR;
     }
 
+    if (get_file_size(pathname, &file_size) != PBM_OK) {
+        fclose(psi->f);
+        psi->f = NULL;
+        return PSI_SYSTEM_ERROR;
+    }
+
+    /* Use block index if present */
+    psi->data_end = file_size;
+    load_index(psi, file_size);
+    rewind(psi->f);
+
+#ifdef ENABLE_IO_URING
+    /* Blocks are read in batches via io_uring instead */
+    use_map = uring_get() == NULL;
+#endif
+
+#ifdef PSI_MMAP
+    /* Map the whole file if possible */
+    if (use_map && (psi->data_end > 0) &&
+        (_OFF((size_t) psi->data_end) == psi->data_end))
+    {
+        map = mmap(NULL, (size_t) psi->data_end, PROT_READ, MAP_SHARED,
+                   fileno(psi->f), 0);
+
+        if (map != MAP_FAILED) {
+            psi->data = (unsigned char *) map;
+            psi->data_size = (size_t) psi->data_end;
+            psi->is_mapped = 1;
+
+            return PSI_OK;
+        }
+    }
+#endif
+
+    /* Fall back to buffered reads */
+    psi->data = (unsigned char *) malloc(PSI_IO_BUF_SIZE);
+
+    if (psi->data == NULL) {
+        psi_close(psi);
+        return PSI_SYSTEM_ERROR;
+    }
+
+#ifdef ENABLE_IO_URING
+    /* Sequential reads run one buffer ahead. Optional. */
+    psi->ring = (uring *) malloc(sizeof(uring));
+    psi->ahead = (unsigned char *) malloc(PSI_IO_BUF_SIZE);
+
+    if ((psi->ring == NULL) || (psi->ahead == NULL) ||
+        (uring_init(psi->ring, 2) != URING_OK))
+    {
+        free(psi->ring);
+        free(psi->ahead);
+        psi->ring = NULL;
+        psi->ahead = NULL;
+    }
+#endif
+
     return PSI_OK;
 }
 
 /* Create PSI file */
 int psi_create(char *pathname, psi_image *psi)
 {
+    memset(psi, 0, sizeof(psi_image));
+
     psi->f = NULL;
     psi->f = fopen(pathname, "wb");
 
@@ -59,64 +385,361 @@ int psi_create(char *pathname, psi_image *psi)
     return PSI_OK;
 }
 
+#ifdef ENABLE_IO_URING
+/* Start reading next chunk into the spare buffer */
+static void start_read_ahead(psi_image *psi)
+{
+    size_t len;
+
+    /* Do not read into the index trailer */
+    len = (size_t) MIN(_OFF(PSI_IO_BUF_SIZE), psi->data_end - psi->ahead_pos);
+
+    if (len == 0) {
+        return;
+    }
+
+    if (uring_queue(psi->ring, URING_READ, fileno(psi->f), psi->ahead, len,
+        psi->ahead_pos, 0) != URING_OK)
+    {
+        return;
+    }
+
+    /* Errors show up on completion */
+    uring_submit(psi->ring);
+    psi->ahead_pending = 1;
+}
+
+/* Wait for the read-ahead. Returns number of bytes read or -1. */
+static int finish_read_ahead(psi_image *psi)
+{
+    unsigned long long tag;
+    int res;
+
+    psi->ahead_pending = 0;
+
+    if (uring_wait(psi->ring, &tag, &res) != URING_OK) {
+        return -1;
+    }
+
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+
+    return res;
+}
+
+/* Make sure there is unread data using read-ahead */
+static int fill_buffer_ahead(psi_image *psi)
+{
+    unsigned char *spare;
+    int res;
+
+    /* First read or just rewound */
+    if (!psi->ahead_pending) {
+        psi->ahead_pos = psi->read_pos;
+        start_read_ahead(psi);
+    }
+
+    psi->pos = psi->data_size = 0;
+
+    if (!psi->ahead_pending) {
+        return 0;
+    }
+
+    if ((res = finish_read_ahead(psi)) <= 0) {
+        psi->io_error = res < 0;
+        return 0;
+    }
+
+    spare = psi->data;
+    psi->data = psi->ahead;
+    psi->ahead = spare;
+
+    psi->data_size = (size_t) res;
+    psi->read_pos = psi->ahead_pos + res;
+
+    /* Overlap next read with parsing of this chunk */
+    psi->ahead_pos = psi->read_pos;
+    start_read_ahead(psi);
+
+    return 1;
+}
+#endif
+
+/* Check for read errors */
+static int read_failed(psi_image *psi)
+{
+#ifdef ENABLE_IO_URING
+    if (psi->io_error) {
+        return 1;
+    }
+#endif
+
+    return ferror(psi->f);
+}
+
 /* Close PSI file */
 void psi_close(psi_image *psi)
 {
+#ifdef ENABLE_IO_URING
+    if (psi->ring) {
+        if (psi->ahead_pending) {
+            finish_read_ahead(psi);
+        }
+
+        uring_exit(psi->ring);
+        free(psi->ring);
+        psi->ring = NULL;
+    }
+
+    free(psi->ahead);
+    psi->ahead = NULL;
+#endif
+
+    if (psi->is_mapped) {
+#ifdef PSI_MMAP
+        munmap(psi->data, psi->data_size);
+#endif
+    } else {
+        free(psi->data);
+    }
+
+    psi->data = NULL;
+    psi->is_mapped = 0;
+
+    free(psi->blocks);
+    psi->blocks = NULL;
+    psi->n_blocks = psi->max_blocks = 0;
+    psi->indexed = 0;
+
     if (psi->f) {
         fclose(psi->f);
+        psi->f = NULL;
     }
 }
 
-/* Read next encoded block */
-int psi_read_next_block(psi_image *psi, unsigned char *buf, int *buf_size)
+/* Rewind input file */
+static void psi_rewind(psi_image *psi)
 {
-    unsigned char *next_byte;
-    int bytes_left;
-    int ch;
+    psi->pos = 0;
 
-    /* Copy no more than *buf_size bytes */
-    bytes_left = *buf_size;
-    next_byte = buf;
+    if (!psi->is_mapped) {
+        psi->data_size = 0;
+        psi->read_pos = 0;
+        rewind(psi->f);
+    }
+
+#ifdef ENABLE_IO_URING
+    /* Drop read-ahead */
+    if (psi->ring && psi->ahead_pending) {
+        finish_read_ahead(psi);
+    }
+
+    psi->io_error = 0;
+#endif
+}
+
+/* Make sure there is unread data. Returns zero at EOF. */
+static int fill_buffer(psi_image *psi)
+{
+    size_t len;
+
+    if (psi->pos < psi->data_size) {
+        return 1;
+    }
+
+    /* Mapped file: nothing more to read */
+    if (psi->is_mapped) {
+        return 0;
+    }
+
+#ifdef ENABLE_IO_URING
+    if (psi->ring) {
+        return fill_buffer_ahead(psi);
+    }
+#endif
+
+    /* Do not read into the index trailer */
+    len = (size_t) MIN(_OFF(PSI_IO_BUF_SIZE), psi->data_end - psi->read_pos);
+
+    psi->data_size = len ? fread(psi->data, 1, len, psi->f) : 0;
+    psi->read_pos += psi->data_size;
+    psi->pos = 0;
+
+    return psi->data_size > 0;
+}
+
+/* Get next encoded block. Blocks of mapped files are returned in
+ * place, otherwise they are copied into the buffer. Either way no
+ * more than *buf_size bytes are returned. */
+int psi_get_next_block(psi_image *psi, unsigned char *buf, int *buf_size,
+                       unsigned char **block)
+{
+    unsigned char *start, *marker;
+    size_t bytes_left;
+    size_t len;
 
     /* Find first non-marker byte */
     for (;;) {
-        ch = fgetc(psi->f);
-
-        if (ch == EOF) {
-            return PSI_EOF;
+        if (!fill_buffer(psi)) {
+            return read_failed(psi) ? PSI_SYSTEM_ERROR : PSI_EOF;
         }
 
-        if (ch != EPS_MARKER) {
-            *next_byte++ = (unsigned char) ch;
-            bytes_left--;
+        if (psi->data[psi->pos] != EPS_MARKER) {
             break;
         }
+
+        psi->pos++;
     }
 
-    /* Copy data until next marker, EOF or buffer end */
-    for (;;) {
-        ch = fgetc(psi->f);
+    psi->block_pos = psi->is_mapped ? _OFF(psi->pos) :
+        psi->read_pos - _OFF(psi->data_size) + _OFF(psi->pos);
 
-        if ((ch == EOF) || (ch == EPS_MARKER)) {
-            break;
+    /* Whole block is in the mapped file: no copying required */
+    if (psi->is_mapped) {
+        start = psi->data + psi->pos;
+        len = psi->data_size - psi->pos;
+        marker = (unsigned char *) memchr(start, EPS_MARKER, len);
+
+        if (marker) {
+            len = marker - start;
         }
 
-        /* No more space in the buffer or currupted data.
-         * Continue until EOF or syncronization marker */
-        if (!bytes_left) {
-            continue;
+        psi->pos += len;
+        *block = start;
+        *buf_size = (int) MIN(len, (size_t) *buf_size);
+
+        return PSI_OK;
+    }
+
+    /* Copy data until next marker, EOF or buffer end. Extra
+     * bytes of too long or corrupted blocks are skipped. */
+    bytes_left = *buf_size;
+    *buf_size = 0;
+
+    while (fill_buffer(psi)) {
+        start = psi->data + psi->pos;
+        len = psi->data_size - psi->pos;
+        marker = (unsigned char *) memchr(start, EPS_MARKER, len);
+
+        if (marker) {
+            len = marker - start;
+        }
+
+        if (bytes_left) {
+            size_t n = MIN(len, bytes_left);
+
+            memcpy(buf + *buf_size, start, n);
+            *buf_size += (int) n;
+            bytes_left -= n;
         }
 
-        *next_byte++ = (unsigned char) ch;
-        bytes_left--;
+        psi->pos += len;
+
+        if (marker) {
+            break;
+        }
+    }
+
+    if (read_failed(psi)) {
+        return PSI_SYSTEM_ERROR;
     }
 
-    /* Actual number of read bytes */
-    *buf_size = next_byte - buf;
+    *block = buf;
 
     return PSI_OK;
 }
 
+/* Read next encoded block */
+int psi_read_next_block(psi_image *psi, unsigned char *buf, int *buf_size)
+{
+    unsigned char *block;
+    int rc;
+
+    rc = psi_get_next_block(psi, buf, buf_size, &block);
+
+    if ((rc == PSI_OK) && (block != buf)) {
+        memcpy(buf, block, *buf_size);
+    }
+
+    return rc;
+}
+
+/* Make room for one more block list entry */
+static int grow_blocks(psi_image *psi)
+{
+    psi_block *blocks;
+    int max_blocks;
+
+    if (psi->n_blocks < psi->max_blocks) {
+        return PSI_OK;
+    }
+
+    max_blocks = MAX(2 * psi->max_blocks, 64);
+    blocks = (psi_block *) realloc(psi->blocks, max_blocks * sizeof(psi_block));
+
+    if (blocks == NULL) {
+        return PSI_SYSTEM_ERROR;
+    }
+
+    psi->blocks = blocks;
+    psi->max_blocks = max_blocks;
+
+    return PSI_OK;
+}
+
+/* Add block to the index being written */
+static void add_index_entry(psi_image *psi, unsigned char *buf, int buf_size)
+{
+    eps_block_header hdr;
+    psi_block *entry;
+    int type, W, H, w, h;
+
+    /* Blocks with broken headers are not indexed */
+    if (eps_read_block_header(buf, buf_size, &hdr) != EPS_OK) {
+        return;
+    }
+
+    if (hdr.block_type == EPS_GRAYSCALE_BLOCK) {
+        type = PBM_TYPE_PGM;
+        W = hdr.hdr_data.gs.W;
+        H = hdr.hdr_data.gs.H;
+        w = hdr.hdr_data.gs.w;
+        h = hdr.hdr_data.gs.h;
+    } else {
+        type = PBM_TYPE_PPM;
+        W = hdr.hdr_data.tc.W;
+        H = hdr.hdr_data.tc.H;
+        w = hdr.hdr_data.tc.w;
+        h = hdr.hdr_data.tc.h;
+    }
+
+    if (psi->n_blocks == 0) {
+        psi->type = type;
+        psi->width = W;
+        psi->height = H;
+    }
+
+    psi->max_block_w = MAX(psi->max_block_w, w);
+    psi->max_block_h = MAX(psi->max_block_h, h);
+
+    /* Out of memory: give up indexing */
+    if (grow_blocks(psi) != PSI_OK) {
+        free(psi->blocks);
+        psi->blocks = NULL;
+        psi->n_blocks = psi->max_blocks = 0;
+        psi->write_index = 0;
+        return;
+    }
+
+    entry = &psi->blocks[psi->n_blocks++];
+    entry->offset = psi->write_pos;
+    entry->size = buf_size;
+    entry->x = type == PBM_TYPE_PGM ? hdr.hdr_data.gs.x : hdr.hdr_data.tc.x;
+    entry->y = type == PBM_TYPE_PGM ? hdr.hdr_data.gs.y : hdr.hdr_data.tc.y;
+}
+
 /* Write next encoded block */
 int psi_write_next_block(psi_image *psi, unsigned char *buf, int buf_size)
 {
@@ -130,12 +753,353 @@ int psi_write_next_block(psi_image *psi, unsigned char *buf, int buf_size)
         return PSI_SYSTEM_ERROR;
     }
 
+    if (psi->write_index) {
+        add_index_entry(psi, buf, buf_size);
+    }
+
+    psi->write_pos += buf_size + 1;
+
+    return PSI_OK;
+}
+
+#ifdef PSI_WRITEV
+/* Write all iovecs, resuming after short writes */
+static int writev_all(int fd, struct iovec *iov, int n_iov)
+{
+    while (n_iov > 0) {
+        ssize_t n = writev(fd, iov, n_iov);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return PSI_SYSTEM_ERROR;
+        }
+
+        /* Skip over complete iovecs */
+        while ((n_iov > 0) && ((size_t) n >= iov->iov_len)) {
+            n -= iov->iov_len;
+            iov++;
+            n_iov--;
+        }
+
+        if (n_iov > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return PSI_OK;
+}
+#endif
+
+/* Write several encoded blocks in a row. Each block is followed
+ * by a marker, just like with psi_write_next_block. */
+int psi_write_blocks(psi_image *psi, unsigned char **bufs, int *buf_sizes,
+                     int n_bufs)
+{
+#ifdef PSI_WRITEV
+    static unsigned char marker = EPS_MARKER;
+    struct iovec iov[2 * PSI_MAX_BATCH];
+    int i, j, n;
+
+    /* Stdio buffer goes first */
+    if (fflush(psi->f) != 0) {
+        return PSI_SYSTEM_ERROR;
+    }
+
+    for (i = 0; i < n_bufs; i += n) {
+        n = MIN(n_bufs - i, PSI_MAX_BATCH);
+
+        for (j = 0; j < n; j++) {
+            iov[2 * j].iov_base = (void *) bufs[i + j];
+            iov[2 * j].iov_len = buf_sizes[i + j];
+            iov[2 * j + 1].iov_base = (void *) &marker;
+            iov[2 * j + 1].iov_len = 1;
+        }
+
+        if (writev_all(fileno(psi->f), iov, 2 * n) != PSI_OK) {
+            return PSI_SYSTEM_ERROR;
+        }
+
+        for (j = 0; j < n; j++) {
+            if (psi->write_index) {
+                add_index_entry(psi, bufs[i + j], buf_sizes[i + j]);
+            }
+
+            psi->write_pos += buf_sizes[i + j] + 1;
+        }
+    }
+
+    /* Keep stdio position in sync with the descriptor */
+    if (fseeko(psi->f, psi->write_pos, SEEK_SET) != 0) {
+        return PSI_SYSTEM_ERROR;
+    }
+
+    return PSI_OK;
+#else
+    int i;
+
+    for (i = 0; i < n_bufs; i++) {
+        if (psi_write_next_block(psi, bufs[i], buf_sizes[i]) != PSI_OK) {
+            return PSI_SYSTEM_ERROR;
+        }
+    }
+
+    return PSI_OK;
+#endif
+}
+
+/* Collect block index while writing */
+void psi_enable_index(psi_image *psi)
+{
+    psi->write_index = 1;
+}
+
+/* Append block index trailer. Readers which do not know about
+ * the index see it as a single broken block and skip it. */
+int psi_write_index(psi_image *psi)
+{
+    unsigned char *body;
+    char tail[PSI_INDEX_TAIL_SIZE];
+    int body_size;
+    int i;
+
+    if (!psi->write_index || !psi->n_blocks) {
+        return PSI_OK;
+    }
+
+    /* Entries are ordered by position for lookups */
+    qsort(psi->blocks, psi->n_blocks, sizeof(psi_block), compare_blocks);
+
+    /* Each value takes at most 10 bytes */
+    body = (unsigned char *) malloc(8 + 10 * 6 + 10 * 4 * psi->n_blocks);
+
+    if (body == NULL) {
+        return PSI_SYSTEM_ERROR;
+    }
+
+    memcpy(body, "index=1;", 8);
+    body_size = 8;
+
+    body_size += put_value(body + body_size, _OFF(psi->type));
+    body_size += put_value(body + body_size, _OFF(psi->width));
+    body_size += put_value(body + body_size, _OFF(psi->height));
+    body_size += put_value(body + body_size, _OFF(psi->max_block_w));
+    body_size += put_value(body + body_size, _OFF(psi->max_block_h));
+    body_size += put_value(body + body_size, _OFF(psi->n_blocks));
+
+    for (i = 0; i < psi->n_blocks; i++) {
+        body_size += put_value(body + body_size, psi->blocks[i].offset);
+        body_size += put_value(body + body_size, _OFF(psi->blocks[i].size));
+        body_size += put_value(body + body_size, _OFF(psi->blocks[i].x));
+        body_size += put_value(body + body_size, _OFF(psi->blocks[i].y));
+    }
+
+    memcpy(tail, "index-size=", 11);
+    put_hex(tail + 11, 16, _OFF(body_size));
+    memcpy(tail + 27, ";sum=", 5);
+    put_hex(tail + 32, 8, _OFF(index_checksum(body, body_size)));
+
+    if ((fwrite(body, 1, body_size, psi->f) != (size_t) body_size) ||
+        (fwrite(tail, 1, PSI_INDEX_TAIL_SIZE, psi->f) != PSI_INDEX_TAIL_SIZE))
+    {
+        free(body);
+        return PSI_SYSTEM_ERROR;
+    }
+
+    free(body);
+
+    return PSI_OK;
+}
+
+/* Find index entry of the block at (x, y). Returns -1 if the
+ * file has no index or the block is missing. */
+int psi_find_block(psi_image *psi, int x, int y)
+{
+    psi_block key;
+    psi_block *entry;
+    int idx;
+
+    if (!psi->indexed || !psi->n_blocks) {
+        return -1;
+    }
+
+    /* Complete index is a regular grid of blocks */
+    idx = (y / psi->max_block_h) *
+        ((psi->width + psi->max_block_w - 1) / psi->max_block_w) +
+        x / psi->max_block_w;
+
+    if ((idx < psi->n_blocks) && (psi->blocks[idx].x == x) &&
+        (psi->blocks[idx].y == y))
+    {
+        return idx;
+    }
+
+    /* Some blocks are missing */
+    key.x = x;
+    key.y = y;
+
+    entry = (psi_block *) bsearch(&key, psi->blocks, psi->n_blocks,
+        sizeof(psi_block), compare_blocks);
+
+    return entry ? (int) (entry - psi->blocks) : -1;
+}
+
+/* Get block from the block list. Blocks of mapped files are returned
+ * in place, otherwise they are read into the buffer. On POSIX systems
+ * positional reads are used, so several threads may call this function
+ * at once. Elsewhere the file position moves and calls must be
+ * serialized. No more than *buf_size bytes are returned. */
+int psi_get_block(psi_image *psi, int idx, unsigned char *buf, int *buf_size,
+                  unsigned char **block)
+{
+    psi_block *entry;
+    int len;
+
+    if ((idx < 0) || (idx >= psi->n_blocks)) {
+        return PSI_EOF;
+    }
+
+    entry = &psi->blocks[idx];
+    len = MIN(entry->size, *buf_size);
+
+    if (psi->is_mapped) {
+        *block = psi->data + entry->offset;
+    } else {
+#ifdef PSI_MMAP
+        int done = 0;
+
+        while (done < len) {
+            ssize_t n = pread(fileno(psi->f), buf + done, len - done,
+                              entry->offset + done);
+
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return PSI_SYSTEM_ERROR;
+            }
+
+            if (n == 0) {
+                return PSI_EOF;
+            }
+
+            done += (int) n;
+        }
+#else
+        if (fseeko(psi->f, entry->offset, SEEK_SET) != 0) {
+            return PSI_SYSTEM_ERROR;
+        }
+
+        if (fread(buf, 1, len, psi->f) != (size_t) len) {
+            return PSI_SYSTEM_ERROR;
+        }
+
+        /* Sequential reads continue from here */
+        psi->pos = psi->data_size = 0;
+        psi->read_pos = entry->offset + len;
+#endif
+
+        *block = buf;
+    }
+
+    *buf_size = len;
+
+    return PSI_OK;
+}
+
+/* Buffer size psi_get_blocks needs for the given blocks */
+int psi_blocks_size(psi_image *psi, int idx, int n_blocks, int max_size)
+{
+    int size = 0;
+    int i;
+
+    if (psi->is_mapped) {
+        return 0;
+    }
+
+    for (i = idx; (i < idx + n_blocks) && (i < psi->n_blocks); i++) {
+        size += MIN(psi->blocks[i].size, max_size);
+    }
+
+    return size;
+}
+
+/* Get several consecutive blocks from the block list, each no more
+ * than `max_size' bytes. Blocks of mapped files are returned in place,
+ * others are read into `buf' back to back; see psi_blocks_size.
+ * With io_uring all the reads are in flight at once. */
+int psi_get_blocks(psi_image *psi, int idx, int n_blocks, int max_size,
+                   unsigned char *buf, unsigned char **blocks, int *sizes)
+{
+    int i, rc;
+
+    if ((idx < 0) || (n_blocks < 0) || (idx + n_blocks > psi->n_blocks)) {
+        return PSI_EOF;
+    }
+
+    if (n_blocks == 0) {
+        return PSI_OK;
+    }
+
+#ifdef ENABLE_IO_URING
+    if (!psi->is_mapped) {
+        uring *ring = uring_get();
+
+        if (ring) {
+            uring_req *reqs;
+
+            reqs = (uring_req *) malloc(n_blocks * sizeof(uring_req));
+
+            if (reqs == NULL) {
+                return PSI_SYSTEM_ERROR;
+            }
+
+            for (i = 0; i < n_blocks; i++) {
+                sizes[i] = MIN(psi->blocks[idx + i].size, max_size);
+                blocks[i] = buf;
+                reqs[i].buf = buf;
+                reqs[i].len = sizes[i];
+                reqs[i].offset = psi->blocks[idx + i].offset;
+                buf += sizes[i];
+            }
+
+            rc = uring_batch(ring, URING_READ, fileno(psi->f), reqs, n_blocks);
+            free(reqs);
+
+            if (rc == URING_OK) {
+                return PSI_OK;
+            }
+
+            return rc == URING_EOF ? PSI_EOF : PSI_SYSTEM_ERROR;
+        }
+    }
+#endif
+
+    for (i = 0; i < n_blocks; i++) {
+        sizes[i] = max_size;
+        rc = psi_get_block(psi, idx + i, buf, &sizes[i], &blocks[i]);
+
+        if (rc != PSI_OK) {
+            return rc;
+        }
+
+        if (blocks[i] == buf) {
+            buf += sizes[i];
+        }
+    }
+
     return PSI_OK;
 }
 
 /* Try to guess target file type (PGM or PPM) and
- * main characteristics. NB: you should call this
- * function prior to actual decoding. */
+ * main characteristics. Unless the file has a block
+ * index, offsets of all blocks are collected on the
+ * way. NB: you should call this function prior to
+ * actual decoding. */
 int psi_guess_pbm_type(psi_image *psi, pbm_image *pbm)
 {
     /* Block buffer */
@@ -146,23 +1110,48 @@ int psi_guess_pbm_type(psi_image *psi, pbm_image *pbm)
     int W, H, w, h;
     int type;
 
+    /* Block index has everything */
+    if (psi->indexed) {
+        pbm->type = psi->type;
+        pbm->width = psi->width;
+        pbm->height = psi->height;
+
+        return PSI_OK;
+    }
+
     /* Allocate block buffer */
     buf_size = MAX(EPS_MAX_GRAYSCALE_BUF, EPS_MAX_TRUECOLOR_BUF);
     buf = (unsigned char *) eps_xmalloc(buf_size * sizeof(unsigned char));
 
     W = H = w = h = type = -1;
+    psi->n_blocks = 0;
 
     /* For all blocks */
     while (1) {
         eps_block_header hdr;
+        unsigned char *block;
+        int block_size = buf_size;
 
-        /* Read next block */
-        if (psi_read_next_block(psi, buf, &buf_size) != PSI_OK) {
+        /* Get next block */
+        if (psi_get_next_block(psi, buf, &block_size, &block) != PSI_OK) {
             break;
         }
 
+        /* Remember where it is, broken blocks included */
+        if (grow_blocks(psi) != PSI_OK) {
+            psi_rewind(psi);
+            free(buf);
+            return PSI_SYSTEM_ERROR;
+        }
+
+        psi->blocks[psi->n_blocks].offset = psi->block_pos;
+        psi->blocks[psi->n_blocks].size = block_size;
+        psi->blocks[psi->n_blocks].x = -1;
+        psi->blocks[psi->n_blocks].y = -1;
+        psi->n_blocks++;
+
         /* Parse block header */
-        if (eps_read_block_header(buf, buf_size, &hdr) != EPS_OK) {
+        if (eps_read_block_header(block, block_size, &hdr) != EPS_OK) {
             continue;
         }
 
@@ -176,7 +1165,7 @@ int psi_guess_pbm_type(psi_image *psi, pbm_image *pbm)
             type = hdr.block_type;
         } else {
             if (type != hdr.block_type) {
-                rewind(psi->f);
+                psi_rewind(psi);
                 free(buf);
                 return PSI_GUESS_ERROR;
             }
@@ -187,7 +1176,7 @@ int psi_guess_pbm_type(psi_image *psi, pbm_image *pbm)
             W = type == EPS_GRAYSCALE_BLOCK ? hdr.hdr_data.gs.W : hdr.hdr_data.tc.W;
         } else {
             if (type == EPS_GRAYSCALE_BLOCK ? W != hdr.hdr_data.gs.W : W != hdr.hdr_data.tc.W) {
-                rewind(psi->f);
+                psi_rewind(psi);
                 free(buf);
                 return PSI_GUESS_ERROR;
             }
@@ -198,7 +1187,7 @@ int psi_guess_pbm_type(psi_image *psi, pbm_image *pbm)
             H = type == EPS_GRAYSCALE_BLOCK ? hdr.hdr_data.gs.H : hdr.hdr_data.tc.H;
         } else {
             if (type == EPS_GRAYSCALE_BLOCK ? H != hdr.hdr_data.gs.H : H != hdr.hdr_data.tc.H) {
-                rewind(psi->f);
+                psi_rewind(psi);
                 free(buf);
                 return PSI_GUESS_ERROR;
             }
@@ -215,7 +1204,7 @@ int psi_guess_pbm_type(psi_image *psi, pbm_image *pbm)
     }
 
     /* Rewind file and free buffer */
-    rewind(psi->f);
+    psi_rewind(psi);
     free(buf);
 
     /* Buggy file */
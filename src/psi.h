@@ -31,6 +31,7 @@ extern "C" {
 
 #include <stdio.h>
 #include <pbm.h>
+#include <uring.h>
 
 /* Return codes */
 #define PSI_OK                  0
@@ -38,19 +39,88 @@ extern "C" {
 #define PSI_SYSTEM_ERROR        2
 #define PSI_GUESS_ERROR         3
 
+/* Read buffer size for files that cannot be mapped */
+#define PSI_IO_BUF_SIZE         262144
+
+/* Input files are memory mapped on POSIX systems */
+#ifndef _WIN32
+# define PSI_MMAP
+#endif
+
+/* Several blocks are written with one system call on POSIX systems */
+#ifndef _WIN32
+# define PSI_WRITEV
+#endif
+
+/* Maximal number of blocks per system call (two iovecs each) */
+#define PSI_MAX_BATCH           32
+
+/* Block index trailer: body is followed by a fixed size
+ * "index-size=<16 hex digits>;sum=<8 hex digits>" tail */
+#define PSI_INDEX_TAIL_SIZE     40
+
+/* Block index entry */
+typedef struct psi_block_tag {
+    off_t offset;
+    int size;
+    int x;
+    int y;
+} psi_block;
+
 /* PSI image context */
 typedef struct psi_image_tag {
     FILE *f;
     int max_block_w;
     int max_block_h;
+    /* Mapped file or read buffer */
+    unsigned char *data;
+    size_t data_size;
+    size_t pos;
+    int is_mapped;
+    /* Block data end and current read position */
+    off_t data_end;
+    off_t read_pos;
+    /* Offset of the last block returned by psi_get_next_block */
+    off_t block_pos;
+    /* Block list: index loaded on open, collected on write
+     * or found by psi_guess_pbm_type scan */
+    psi_block *blocks;
+    int n_blocks;
+    int max_blocks;
+    int indexed;
+    int write_index;
+    off_t write_pos;
+    int type;
+    int width;
+    int height;
+#ifdef ENABLE_IO_URING
+    /* Read-ahead for sequential reads */
+    uring *ring;
+    unsigned char *ahead;
+    off_t ahead_pos;
+    int ahead_pending;
+    int io_error;
+#endif
 } psi_image;
 
 int psi_open(char *pathname, psi_image *psi);
 int psi_create(char *pathname, psi_image *psi);
 void psi_close(psi_image *psi);
 int psi_read_next_block(psi_image *psi, unsigned char *buf, int *buf_size);
+int psi_get_next_block(psi_image *psi, unsigned char *buf, int *buf_size,
+                       unsigned char **block);
 int psi_write_next_block(psi_image *psi, unsigned char *buf, int buf_size);
+int psi_write_blocks(psi_image *psi, unsigned char **bufs, int *buf_sizes,
+                     int n_bufs);
 int psi_guess_pbm_type(psi_image *psi, pbm_image *pbm);
+void psi_enable_index(psi_image *psi);
+int psi_write_index(psi_image *psi);
+int psi_find_block(psi_image *psi, int x, int y);
+int psi_get_block(psi_image *psi, int idx, unsigned char *buf, int *buf_size,
+                  unsigned char **block);
+int psi_blocks_size(psi_image *psi, int idx, int n_blocks, int max_size);
+int psi_get_blocks(psi_image *psi, int idx, int n_blocks, int max_size,
+                   unsigned char *buf, unsigned char **blocks, int *sizes);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,379 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006,2007,2010 Alexander Simakov, <xander@entropyware.info>
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef ENABLE_IO_URING
+
+#ifdef ENABLE_PTHREADS
+# include <pthread.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <misc.h>
+#include <uring.h>
+
+/* Largest single transfer; longer requests are split */
+#define URING_MAX_LEN           (1 << 30)
+
+/* Set once io_uring turns out to be unusable */
+static int ring_unusable = 0;
+
+#ifdef ENABLE_PTHREADS
+/* Per-thread rings */
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+#else
+/* Ring of the thread-unaware version */
+static uring main_ring;
+static int main_ring_ready = 0;
+#endif
+
+/* Set up I/O ring with at least `entries' slots */
+int uring_init(uring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    unsigned char *sq, *cq;
+
+    memset(ring, 0, sizeof(uring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+
+    if (ring->fd < 0) {
+        return URING_ERROR;
+    }
+
+#ifdef IORING_FEAT_FAST_POLL
+    /* Plain read and write opcodes came along with this feature */
+    if (!(p.features & IORING_FEAT_FAST_POLL)) {
+        close(ring->fd);
+        errno = ENOSYS;
+        return URING_ERROR;
+    }
+#endif
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes +
+        p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQES);
+
+    if ((ring->sq_ring == MAP_FAILED) || (ring->cq_ring == MAP_FAILED) ||
+        (ring->sqes == (struct io_uring_sqe *) MAP_FAILED))
+    {
+        uring_exit(ring);
+        return URING_ERROR;
+    }
+
+    sq = (unsigned char *) ring->sq_ring;
+    cq = (unsigned char *) ring->cq_ring;
+
+    ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+
+    ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    ring->entries = p.sq_entries;
+
+    return URING_OK;
+}
+
+/* Tear down I/O ring. Outstanding requests are abandoned. */
+void uring_exit(uring *ring)
+{
+    if (ring->sqes && (ring->sqes != (struct io_uring_sqe *) MAP_FAILED)) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+
+    if (ring->cq_ring && (ring->cq_ring != MAP_FAILED)) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+
+    if (ring->sq_ring && (ring->sq_ring != MAP_FAILED)) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    memset(ring, 0, sizeof(uring));
+    ring->fd = -1;
+}
+
+/* Queue positional read or write. Returns URING_BUSY if the
+ * ring is full: wait for some completions first. */
+int uring_queue(uring *ring, int op, int fd, void *buf, size_t len,
+                off_t offset, unsigned long long tag)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail, idx;
+
+    if (ring->queued + ring->in_flight >= ring->entries) {
+        return URING_BUSY;
+    }
+
+    tail = *ring->sq_tail;
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = op == URING_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = (unsigned) MIN(len, (size_t) URING_MAX_LEN);
+    sqe->off = (unsigned long long) offset;
+    sqe->user_data = tag;
+
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+
+    return URING_OK;
+}
+
+/* Hand queued requests over to the kernel */
+int uring_submit(uring *ring)
+{
+    while (ring->queued) {
+        int n = (int) syscall(__NR_io_uring_enter, ring->fd, ring->queued,
+                              0, 0, NULL, 0);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return URING_ERROR;
+        }
+
+        ring->queued -= n;
+        ring->in_flight += n;
+    }
+
+    return URING_OK;
+}
+
+/* Submit queued requests and wait for one completion. Its tag and
+ * result (byte count or negated errno) are returned. */
+int uring_wait(uring *ring, unsigned long long *tag, int *res)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head;
+
+    if (uring_submit(ring) != URING_OK) {
+        return URING_ERROR;
+    }
+
+    if (!ring->in_flight) {
+        errno = EINVAL;
+        return URING_ERROR;
+    }
+
+    for (;;) {
+        head = *ring->cq_head;
+
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        if ((syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0) < 0) && (errno != EINTR))
+        {
+            return URING_ERROR;
+        }
+    }
+
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *tag = cqe->user_data;
+    *res = cqe->res;
+
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->in_flight--;
+
+    return URING_OK;
+}
+
+/* Transfer all requests, keeping the ring full. Short transfers
+ * are resumed, so `reqs' is modified. Returns URING_EOF if a read
+ * hits end of file. */
+int uring_batch(uring *ring, int op, int fd, uring_req *reqs, int n_reqs)
+{
+    unsigned long long tag;
+    int failed = 0;
+    int eof = 0;
+    int err = 0;
+    int next = 0;
+    int res;
+
+    while (ring->queued || ring->in_flight || (!failed && (next < n_reqs))) {
+        /* Keep the ring full */
+        while (!failed && (next < n_reqs)) {
+            if (reqs[next].len == 0) {
+                next++;
+                continue;
+            }
+
+            if (uring_queue(ring, op, fd, reqs[next].buf, reqs[next].len,
+                reqs[next].offset, (unsigned long long) next) != URING_OK)
+            {
+                break;
+            }
+
+            next++;
+        }
+
+        if (!ring->queued && !ring->in_flight) {
+            break;
+        }
+
+        if (uring_wait(ring, &tag, &res) != URING_OK) {
+            return URING_ERROR;
+        }
+
+        if ((res == -EINTR) || (res == -EAGAIN)) {
+            res = 0;
+        } else if (res < 0) {
+            failed = 1;
+            err = -res;
+            continue;
+        } else if (res == 0) {
+            failed = eof = 1;
+            continue;
+        }
+
+        reqs[tag].buf += res;
+        reqs[tag].len -= res;
+        reqs[tag].offset += res;
+
+        /* Resume short transfer, a slot has just been freed */
+        if (!failed && reqs[tag].len) {
+            uring_queue(ring, op, fd, reqs[tag].buf, reqs[tag].len,
+                        reqs[tag].offset, tag);
+        }
+    }
+
+    if (failed) {
+        if (err) {
+            errno = err;
+            return URING_ERROR;
+        }
+
+        return eof && (op == URING_READ) ? URING_EOF : URING_ERROR;
+    }
+
+    return URING_OK;
+}
+
+#ifdef ENABLE_PTHREADS
+/* Destroy ring of the exiting thread */
+static void free_ring(void *ring)
+{
+    uring_exit((uring *) ring);
+    free(ring);
+}
+
+/* Create per-thread ring key */
+static void create_ring_key(void)
+{
+    if (pthread_key_create(&ring_key, free_ring) != 0) {
+        atomic_set(&ring_unusable, 1);
+    }
+}
+#endif
+
+/* Get I/O ring of the calling thread. Returns NULL
+ * if io_uring is not available: use plain I/O then. */
+uring *uring_get(void)
+{
+    uring *ring;
+
+    if (atomic_get(&ring_unusable)) {
+        return NULL;
+    }
+
+#ifdef ENABLE_PTHREADS
+    pthread_once(&ring_once, create_ring_key);
+
+    if (atomic_get(&ring_unusable)) {
+        return NULL;
+    }
+
+    if ((ring = (uring *) pthread_getspecific(ring_key)) != NULL) {
+        return ring;
+    }
+
+    if ((ring = (uring *) malloc(sizeof(uring))) == NULL) {
+        return NULL;
+    }
+
+    if (uring_init(ring, URING_DEPTH) != URING_OK) {
+        free(ring);
+        atomic_set(&ring_unusable, 1);
+        return NULL;
+    }
+
+    if (pthread_setspecific(ring_key, ring) != 0) {
+        free_ring(ring);
+        return NULL;
+    }
+#else
+    ring = &main_ring;
+
+    if (!main_ring_ready) {
+        if (uring_init(ring, URING_DEPTH) != URING_OK) {
+            ring_unusable = 1;
+            return NULL;
+        }
+
+        main_ring_ready = 1;
+    }
+#endif
+
+    return ring;
+}
+
+#endif /* ENABLE_IO_URING */
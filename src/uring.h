@@ -0,0 +1,102 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006,2007,2010 Alexander Simakov, <xander@entropyware.info>
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef ENABLE_IO_URING
+
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+/* Number of submission queue entries */
+#define URING_DEPTH             64
+
+/* Operations */
+#define URING_READ              0
+#define URING_WRITE             1
+
+/* Return codes */
+#define URING_OK                0
+#define URING_EOF               1
+#define URING_BUSY              2
+#define URING_ERROR             3
+
+/* Kernel I/O ring */
+typedef struct uring_tag {
+    int fd;
+    unsigned entries;
+    /* Submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    /* Completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Mapped areas */
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    /* Queued but not submitted, submitted but not completed */
+    unsigned queued;
+    unsigned in_flight;
+} uring;
+
+/* Positional transfer request */
+typedef struct uring_req_tag {
+    unsigned char *buf;
+    size_t len;
+    off_t offset;
+} uring_req;
+
+int uring_init(uring *ring, unsigned entries);
+void uring_exit(uring *ring);
+int uring_queue(uring *ring, int op, int fd, void *buf, size_t len,
+                off_t offset, unsigned long long tag);
+int uring_submit(uring *ring);
+int uring_wait(uring *ring, unsigned long long *tag, int *res);
+int uring_batch(uring *ring, int op, int fd, uring_req *reqs, int n_reqs);
+uring *uring_get(void);
+
+#endif /* ENABLE_IO_URING */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __URING_H__ */
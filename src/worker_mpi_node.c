@@ -133,6 +133,7 @@ static void cmd_mpi_encode_gs() {
     int bytes_per_block;
     char filter_id[64];
     int mode;
+    int flags;
 
     MPI_Status status;
 
@@ -156,6 +157,8 @@ static void cmd_mpi_encode_gs() {
         (MPI_Status *) &status) == MPI_SUCCESS);
     assert(MPI_Recv(&mode, 1, MPI_INT, MPI_ANY_SOURCE, MPI_ANY_TAG,
         MPI_COMM_WORLD, (MPI_Status *) &status) == MPI_SUCCESS);
+    assert(MPI_Recv(&flags, 1, MPI_INT, MPI_ANY_SOURCE, MPI_ANY_TAG,
+        MPI_COMM_WORLD, (MPI_Status *) &status) == MPI_SUCCESS);
 
     /* Allocate memory buffers */
     Y0 = (unsigned char *) xmalloc(w * h);
@@ -168,8 +171,8 @@ static void cmd_mpi_encode_gs() {
 
     /* Transform and encode data */
     transform_1D_to_2D(Y0, Y, w, h);
-    assert(eps_encode_grayscale_block(Y, W, H, w, h, x, y,
-        data, &bytes_per_block, filter_id, mode) == EPS_OK);
+    assert(eps_encode_grayscale_block_ex(Y, W, H, w, h, x, y,
+        data, &bytes_per_block, filter_id, mode, flags) == EPS_OK);
 
     /* Send encoded data to the MASTER node */
     assert(MPI_Send(&bytes_per_block, 1, MPI_INT,
@@ -205,6 +208,7 @@ static void cmd_mpi_encode_tc() {
 
     char filter_id[64];
     int mode;
+    int flags;
 
     MPI_Status status;
 
@@ -236,6 +240,8 @@ static void cmd_mpi_encode_tc() {
         (MPI_Status *) &status) == MPI_SUCCESS);
     assert(MPI_Recv(&mode, 1, MPI_INT, MPI_ANY_SOURCE, MPI_ANY_TAG,
         MPI_COMM_WORLD, (MPI_Status *) &status) == MPI_SUCCESS);
+    assert(MPI_Recv(&flags, 1, MPI_INT, MPI_ANY_SOURCE, MPI_ANY_TAG,
+        MPI_COMM_WORLD, (MPI_Status *) &status) == MPI_SUCCESS);
 
     /* Allocate memory buffers */
     Y0 = (unsigned char *) xmalloc(w * h);
@@ -260,9 +266,9 @@ static void cmd_mpi_encode_tc() {
     transform_1D_to_2D(Y0, B, w, h);
 
     /* Encode block */
-    assert(eps_encode_truecolor_block(R, G, B, W, H, w, h,
+    assert(eps_encode_truecolor_block_ex(R, G, B, W, H, w, h,
         x, y, resample, data, &bytes_per_block, Y_ratio,
-        Cb_ratio, Cr_ratio, filter_id, mode) == EPS_OK);
+        Cb_ratio, Cr_ratio, filter_id, mode, flags) == EPS_OK);
 
     /* Send encoded data to the MASTER node */
     assert(MPI_Send(&bytes_per_block, 1, MPI_INT,
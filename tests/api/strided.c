@@ -0,0 +1,328 @@
+/*
+ * $Id$
+ *
+ * EPSILON - wavelet image compression library.
+ * Copyright (C) 2006-2011 Alexander Simakov, <xander@entropyware.info>
+ *
+ * Strided API test for EPSILON. A synthetic image is split into
+ * blocks which are encoded both from separate block arrays and
+ * straight from the image, then decoded both ways into interleaved,
+ * planar and bottom-up (negative stride) layouts. All results should
+ * be byte-identical. Blocks outside the image should be rejected.
+ *
+ * This file is part of EPSILON
+ *
+ * EPSILON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EPSILON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * http://epsilon-project.sourceforge.net
+ */
+
+#include <epsilon.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Image dimensions are not multiples of the block size */
+#define WIDTH           100
+#define HEIGHT          70
+#define BLOCK_SIZE      32
+#define BUF_SIZE        2048
+
+/* Number of failed checks */
+static int failures = 0;
+
+static void check(int condition, char *what, int x, int y)
+{
+    if (!condition) {
+        printf("FAIL: %s (block at %d,%d)\n", what, x, y);
+        failures++;
+    }
+}
+
+static unsigned char **alloc_block(void)
+{
+    return (unsigned char **) eps_malloc_2D(BLOCK_SIZE, BLOCK_SIZE,
+                                            sizeof(unsigned char));
+}
+
+static void free_block(unsigned char **block)
+{
+    eps_free_2D((void **) block, BLOCK_SIZE, BLOCK_SIZE);
+}
+
+/* Copy block out of the interleaved image channel k */
+static void get_block(unsigned char *rgb, int channels, int k,
+                      unsigned char **block, int x, int y, int w, int h)
+{
+    int i, j;
+
+    for (i = 0; i < h; i++) {
+        for (j = 0; j < w; j++) {
+            block[i][j] = rgb[((y + i) * WIDTH + x + j) * channels + k];
+        }
+    }
+}
+
+/* Check that the block matches the channel of the image */
+static int same_block(eps_image *image, int k, unsigned char **block,
+                      int x, int y, int w, int h)
+{
+    int i, j;
+
+    for (i = 0; i < h; i++) {
+        for (j = 0; j < w; j++) {
+            if (image->data[k][(y + i) * image->stride +
+                (x + j) * image->step] != block[i][j])
+            {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void test_grayscale(char *fb_id)
+{
+    unsigned char *gray;
+    unsigned char *flipped;
+    unsigned char **block;
+    unsigned char buf[BUF_SIZE];
+    unsigned char buf_strided[BUF_SIZE];
+    eps_block_header hdr;
+    eps_image image;
+    eps_image bottom_up;
+    int buf_size;
+    int buf_size_strided;
+    int x, y, w, h;
+    int i;
+
+    gray = (unsigned char *) malloc(WIDTH * HEIGHT);
+    flipped = (unsigned char *) malloc(WIDTH * HEIGHT);
+    block = alloc_block();
+
+    if (!gray || !flipped || !block) {
+        printf("FAIL: out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < WIDTH * HEIGHT; i++) {
+        gray[i] = (unsigned char) ((i % WIDTH) * 2 + (i / WIDTH) * 3 +
+                                   (i % 7) * 5);
+    }
+
+    eps_image_gray(&image, gray, WIDTH, HEIGHT, WIDTH);
+
+    /* Last row first, rows go upwards */
+    eps_image_gray(&bottom_up, flipped + (HEIGHT - 1) * WIDTH,
+                   WIDTH, HEIGHT, -WIDTH);
+
+    for (y = 0; y < HEIGHT; y += BLOCK_SIZE) {
+        for (x = 0; x < WIDTH; x += BLOCK_SIZE) {
+            w = (x + BLOCK_SIZE > WIDTH) ? WIDTH - x : BLOCK_SIZE;
+            h = (y + BLOCK_SIZE > HEIGHT) ? HEIGHT - y : BLOCK_SIZE;
+
+            get_block(gray, 1, 0, block, x, y, w, h);
+
+            buf_size = buf_size_strided = BUF_SIZE;
+
+            check(eps_encode_grayscale_block(block, WIDTH, HEIGHT, w, h,
+                x, y, buf, &buf_size, fb_id, EPS_MODE_NORMAL) == EPS_OK,
+                "grayscale encode", x, y);
+
+            check(eps_encode_grayscale_block_strided(&image, WIDTH, HEIGHT,
+                w, h, x, y, buf_strided, &buf_size_strided, fb_id,
+                EPS_MODE_NORMAL, 0, NULL) == EPS_OK,
+                "grayscale strided encode", x, y);
+
+            check((buf_size == buf_size_strided) &&
+                !memcmp(buf, buf_strided, buf_size),
+                "grayscale strided encode output", x, y);
+
+            check(eps_read_block_header(buf, buf_size, &hdr) == EPS_OK,
+                "grayscale header", x, y);
+
+            check(eps_decode_grayscale_block(block, buf, &hdr) == EPS_OK,
+                "grayscale decode", x, y);
+
+            check(eps_decode_grayscale_block_strided(&bottom_up, buf,
+                &hdr) == EPS_OK, "grayscale strided decode", x, y);
+
+            check(same_block(&bottom_up, 0, block, x, y, w, h),
+                "grayscale bottom-up decode output", x, y);
+        }
+    }
+
+    /* Image is one pixel too small for the last block */
+    eps_image_gray(&image, gray, WIDTH - 1, HEIGHT, WIDTH);
+
+    buf_size = BUF_SIZE;
+    check(eps_encode_grayscale_block_strided(&image, WIDTH, HEIGHT,
+        w, h, x - BLOCK_SIZE, y - BLOCK_SIZE, buf, &buf_size, fb_id,
+        EPS_MODE_NORMAL, 0, NULL) == EPS_PARAM_ERROR,
+        "grayscale strided encode outside the image",
+        x - BLOCK_SIZE, y - BLOCK_SIZE);
+
+    check(eps_decode_grayscale_block_strided(&image, buf_strided,
+        &hdr) == EPS_PARAM_ERROR,
+        "grayscale strided decode outside the image",
+        x - BLOCK_SIZE, y - BLOCK_SIZE);
+
+    free_block(block);
+    free(flipped);
+    free(gray);
+}
+
+static void test_truecolor(char *fb_id)
+{
+    unsigned char *rgb;
+    unsigned char *interleaved;
+    unsigned char *planes[3];
+    unsigned char **block[3];
+    unsigned char buf[BUF_SIZE];
+    unsigned char buf_strided[BUF_SIZE];
+    eps_block_header hdr;
+    eps_image image;
+    eps_image decoded[3];
+    int buf_size;
+    int buf_size_strided;
+    int x, y, w, h;
+    int i, k, n;
+
+    rgb = (unsigned char *) malloc(WIDTH * HEIGHT * 3);
+    interleaved = (unsigned char *) malloc(WIDTH * HEIGHT * 3);
+
+    for (k = 0; k < 3; k++) {
+        planes[k] = (unsigned char *) malloc(WIDTH * HEIGHT);
+        block[k] = alloc_block();
+
+        if (!planes[k] || !block[k]) {
+            printf("FAIL: out of memory\n");
+            exit(1);
+        }
+    }
+
+    if (!rgb || !interleaved) {
+        printf("FAIL: out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < WIDTH * HEIGHT; i++) {
+        rgb[3 * i + 0] = (unsigned char) ((i % WIDTH) * 2 + (i % 5) * 7);
+        rgb[3 * i + 1] = (unsigned char) ((i / WIDTH) * 3 + (i % 3) * 11);
+        rgb[3 * i + 2] = (unsigned char) ((i % WIDTH) + (i / WIDTH));
+    }
+
+    eps_image_rgb(&image, rgb, WIDTH, HEIGHT, WIDTH * 3);
+
+    /* Interleaved, planar and bottom-up planar outputs */
+    eps_image_rgb(&decoded[0], interleaved, WIDTH, HEIGHT, WIDTH * 3);
+    eps_image_planar(&decoded[1], planes[0], planes[1], planes[2],
+                     WIDTH, HEIGHT, WIDTH);
+    eps_image_planar(&decoded[2], planes[0] + (HEIGHT - 1) * WIDTH,
+                     planes[1] + (HEIGHT - 1) * WIDTH,
+                     planes[2] + (HEIGHT - 1) * WIDTH,
+                     WIDTH, HEIGHT, -WIDTH);
+
+    for (y = 0; y < HEIGHT; y += BLOCK_SIZE) {
+        for (x = 0; x < WIDTH; x += BLOCK_SIZE) {
+            w = (x + BLOCK_SIZE > WIDTH) ? WIDTH - x : BLOCK_SIZE;
+            h = (y + BLOCK_SIZE > HEIGHT) ? HEIGHT - y : BLOCK_SIZE;
+
+            for (k = 0; k < 3; k++) {
+                get_block(rgb, 3, k, block[k], x, y, w, h);
+            }
+
+            buf_size = buf_size_strided = BUF_SIZE;
+
+            check(eps_encode_truecolor_block(block[0], block[1], block[2],
+                WIDTH, HEIGHT, w, h, x, y, EPS_RESAMPLE_420, buf, &buf_size,
+                EPS_Y_RT, EPS_Cb_RT, EPS_Cr_RT, fb_id,
+                EPS_MODE_NORMAL) == EPS_OK,
+                "truecolor encode", x, y);
+
+            check(eps_encode_truecolor_block_strided(&image, WIDTH, HEIGHT,
+                w, h, x, y, EPS_RESAMPLE_420, buf_strided, &buf_size_strided,
+                EPS_Y_RT, EPS_Cb_RT, EPS_Cr_RT, fb_id, EPS_MODE_NORMAL, 0,
+                NULL) == EPS_OK,
+                "truecolor strided encode", x, y);
+
+            check((buf_size == buf_size_strided) &&
+                !memcmp(buf, buf_strided, buf_size),
+                "truecolor strided encode output", x, y);
+
+            check(eps_read_block_header(buf, buf_size, &hdr) == EPS_OK,
+                "truecolor header", x, y);
+
+            check(eps_decode_truecolor_block(block[0], block[1], block[2],
+                buf, &hdr) == EPS_OK, "truecolor decode", x, y);
+
+            for (n = 0; n < 3; n++) {
+                check(eps_decode_truecolor_block_strided(&decoded[n], buf,
+                    &hdr) == EPS_OK, "truecolor strided decode", x, y);
+
+                for (k = 0; k < 3; k++) {
+                    check(same_block(&decoded[n], k, block[k], x, y, w, h),
+                        n == 0 ? "truecolor interleaved decode output" :
+                        n == 1 ? "truecolor planar decode output" :
+                        "truecolor bottom-up decode output", x, y);
+                }
+            }
+        }
+    }
+
+    /* Image is one row too short for the last block */
+    eps_image_planar(&image, planes[0], planes[1], planes[2],
+                     WIDTH, HEIGHT - 1, WIDTH);
+
+    buf_size = BUF_SIZE;
+    check(eps_encode_truecolor_block_strided(&image, WIDTH, HEIGHT,
+        w, h, x - BLOCK_SIZE, y - BLOCK_SIZE, EPS_RESAMPLE_420, buf,
+        &buf_size, EPS_Y_RT, EPS_Cb_RT, EPS_Cr_RT, fb_id, EPS_MODE_NORMAL,
+        0, NULL) == EPS_PARAM_ERROR,
+        "truecolor strided encode outside the image",
+        x - BLOCK_SIZE, y - BLOCK_SIZE);
+
+    check(eps_decode_truecolor_block_strided(&image, buf_strided,
+        &hdr) == EPS_PARAM_ERROR,
+        "truecolor strided decode outside the image",
+        x - BLOCK_SIZE, y - BLOCK_SIZE);
+
+    for (k = 0; k < 3; k++) {
+        free_block(block[k]);
+        free(planes[k]);
+    }
+
+    free(interleaved);
+    free(rgb);
+}
+
+int main(void)
+{
+    char **fb_id;
+
+    fb_id = eps_get_fb_info(EPS_FB_ID);
+
+    test_grayscale(fb_id[0]);
+    test_truecolor(fb_id[0]);
+
+    eps_free_fb_info(fb_id);
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -58,6 +58,17 @@ Readonly my $VALIDATOR_BUILD_TAG =>
     { regex => qr/\Ageneric|mpi|cluster|pthreads\z/xms };
 Readonly my $MPI_CLEANUP_PAUSE => 15;
 
+# Block format options, each of them is tried on its own. Block
+# format does not depend on the transform, so the formats are tried
+# with a single representative combination of encoder options.
+Readonly my @BLOCK_FORMATS => qw(
+    binary-header
+    crc32c
+    adler32
+    block-index
+);
+Readonly my $BLOCK_FORMAT_OPTIONS => '--block-size 256 --mode-normal';
+
 sub write_to_file {
     my $file_path    = shift;
     my $file_content = shift;
@@ -214,6 +225,10 @@ sub epsilon_encoder_options_combinator {
             }
         }
     }
+
+    foreach my $format (@BLOCK_FORMATS) {
+        push @option_combinations, "$BLOCK_FORMAT_OPTIONS --$format";
+    }
     ### option_combinations: @option_combinations
 
     return \@option_combinations;
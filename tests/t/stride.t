@@ -0,0 +1,245 @@
+#!/usr/bin/perl
+
+#
+# $Id$
+#
+# EPSILON - wavelet image compression library.
+# Copyright (C) 2006-2011 Alexander Simakov, <xander@entropyware.info>
+#
+# Stride test for EPSILON. The encoder takes blocks straight from the
+# mapped image, so rows of a block are as far apart as the image is
+# wide. This test pads images on the right, encodes and decodes both
+# the original and the padded image with all available builds and
+# checks that the original part of the padded reconstruction is
+# byte-identical to the reconstruction of the tightly packed image.
+#
+# This file is part of EPSILON
+#
+# EPSILON is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# EPSILON is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with EPSILON.  If not, see <http://www.gnu.org/licenses/>.
+#
+# http://epsilon-project.sourceforge.net
+#
+
+use strict;
+use warnings;
+
+use Readonly;
+Readonly our $VERSION => qw($Revision: 1.1 $) [1];
+
+use English qw( -no_match_vars );
+use File::Temp qw(tempdir);
+use File::Spec::Functions;
+use File::Basename;
+use File::Compare;
+
+#use Smart::Comments;
+
+use FindBin qw($Bin);
+FindBin::again();
+
+use lib "$Bin/../lib";
+use EPSILON::Utils qw(
+    run_epsilon
+    get_image_path
+    get_available_build_tags
+    wait_for_mpi_to_cleanup
+);
+
+use Test::More qw(no_plan);
+use Test::Exception;
+
+Readonly my $TMP_DIR => tempdir( 'stride_XXXX', TMPDIR => 1, CLEANUP => 0 );
+### TMP_DIR: $TMP_DIR
+
+Readonly my $NUMBER_OF_THREADS  => 16;
+Readonly my $NUMBER_OF_MPI_CPUS => 8;
+Readonly my $CLUSTER_NODE_LIST =>
+    catfile( $Bin, q{..}, 'build', 'epsilon.nodes' );
+Readonly my $MPI_MACHINE_FILE =>
+    catfile( $Bin, q{..}, 'build', 'machines.MPICH' );
+
+# Image dimensions are multiples of the block size and the padding is
+# one block wide, so both images get the same byte budget per block.
+# Normal mode keeps blocks from overlapping into the padding.
+Readonly my $BLOCK_SIZE => 64;
+Readonly my $PAD_WIDTH  => $BLOCK_SIZE;
+Readonly my $ENCODE_OPTIONS =>
+    "--block-size $BLOCK_SIZE --mode-normal --ratio 1.001 --quiet";
+
+Readonly my @TEST_IMAGES => qw(
+    lena.pgm
+    nirvana.ppm
+);
+
+sub run_netpbm {
+    my $command = shift;
+
+    my $output = `$command 2>&1`;
+
+    if ( $CHILD_ERROR != 0 ) {
+        die "Netpbm exited with non-zero code.\n"
+            . "Command: '$command'\n"
+            . "Output: $output\n";
+    }
+
+    return;
+}
+
+sub get_build_options {
+    my $build_tag = shift;
+
+    my $epsilon_options = q{};
+    my $mpirun_options  = q{};
+
+    if ( $build_tag eq 'pthreads' ) {
+        $epsilon_options = "--threads $NUMBER_OF_THREADS";
+    }
+
+    if ( $build_tag eq 'cluster' ) {
+        $epsilon_options = "--node-list $CLUSTER_NODE_LIST";
+    }
+
+    if ( $build_tag eq 'mpi' ) {
+        $mpirun_options
+            = "-machinefile $MPI_MACHINE_FILE -np $NUMBER_OF_MPI_CPUS";
+    }
+
+    return ( $epsilon_options, $mpirun_options );
+}
+
+sub round_trip {
+    my %params = @_;
+
+    my ( $image, undef, $ext )
+        = fileparse( $params{'file'}, qr/[.](?:pgm|ppm)/xms );
+
+    lives_ok {
+        run_epsilon(
+            build_tag => $params{'build_tag'},
+            epsilon_options =>
+                "$params{'epsilon_options'} $ENCODE_OPTIONS "
+                . "--output-dir '$params{'dir'}'",
+            mpirun_options => $params{'mpirun_options'},
+            file           => $params{'file'},
+        );
+    }
+    "[$params{'build_tag'}] Encode '$params{'file'}'";
+
+    lives_ok {
+        run_epsilon(
+            build_tag => $params{'build_tag'},
+            epsilon_options =>
+                "--decode-file $params{'epsilon_options'} --quiet",
+            mpirun_options => $params{'mpirun_options'},
+            file           => catfile( $params{'dir'}, "$image.psi" ),
+        );
+    }
+    "[$params{'build_tag'}] Decode '$image.psi'";
+
+    return catfile( $params{'dir'}, "$image$ext" );
+}
+
+sub stride_tests {
+    my $build_tags = shift;
+
+    foreach my $build_tag ( @{$build_tags} ) {
+        my ( $epsilon_options, $mpirun_options )
+            = get_build_options($build_tag);
+
+        foreach my $image_ext (@TEST_IMAGES) {
+            my ( $image, undef, $ext )
+                = fileparse( $image_ext, qr/[.](?:pgm|ppm)/xms );
+
+            my $packed_dir
+                = tempdir( "${image}_packed_XXXX", DIR => $TMP_DIR );
+            my $padded_dir
+                = tempdir( "${image}_padded_XXXX", DIR => $TMP_DIR );
+
+            my $packed_image  = get_image_path($image_ext);
+            my $padded_image  = catfile( $padded_dir, $image_ext );
+            my $cropped_image = catfile( $padded_dir, "${image}_cropped$ext" );
+
+            # Widen the image, so that its rows are further apart
+            lives_ok {
+                run_netpbm( "pnmpad -black -right $PAD_WIDTH "
+                        . "'$packed_image' > '$padded_image'" );
+            }
+            "[$build_tag] Pad '$image_ext' by $PAD_WIDTH columns";
+
+            my $packed_reconstruction = round_trip(
+                build_tag       => $build_tag,
+                epsilon_options => $epsilon_options,
+                mpirun_options  => $mpirun_options,
+                file            => $packed_image,
+                dir             => $packed_dir,
+            );
+
+            # Decoding overwrites the padded source image
+            my $padded_reconstruction = round_trip(
+                build_tag       => $build_tag,
+                epsilon_options => $epsilon_options,
+                mpirun_options  => $mpirun_options,
+                file            => $padded_image,
+                dir             => $padded_dir,
+            );
+
+            # Cut the padding off, -1 is the rightmost column
+            lives_ok {
+                run_netpbm( 'pamcut -left 0 -right -'
+                        . ( $PAD_WIDTH + 1 )
+                        . " '$padded_reconstruction' > '$cropped_image'" );
+            }
+            "[$build_tag] Crop '$padded_reconstruction'";
+
+            my $result = is(
+                compare( $packed_reconstruction, $cropped_image ),
+                0,
+                "[$build_tag] '$cropped_image' is identical to "
+                    . "'$packed_reconstruction'"
+            );
+
+            if ($result) {
+
+                # Output is ok, unlink temporary files
+                unlink glob catfile( $packed_dir, q{*} );
+                unlink glob catfile( $padded_dir, q{*} );
+                rmdir $packed_dir;
+                rmdir $padded_dir;
+            }
+        }
+    }
+
+    return;
+}
+
+sub run_tests {
+    my $build_tags = get_available_build_tags();
+
+    if ( @{$build_tags} == 0 ) {
+        die "Please prepare at least one EPSILON build\n";
+    }
+
+    stride_tests($build_tags);
+
+    return;
+}
+
+run_tests();
+
+END {
+    wait_for_mpi_to_cleanup();
+
+    # Removes empty dir only
+    rmdir $TMP_DIR;
+}
@@ -8,8 +8,9 @@
 #
 # Verification test for EPSILON. This tests tries all available builds
 # (generic, pthreads, cluster, mpi) with all available wavelet filters
-# in all applicable modes all possible block sizes on a list of PGM
-# and PPM images. After encode/decode cycle this test compares PSNR
+# in all applicable modes and all possible block sizes, and all block
+# formats with one representative combination of these, on a list
+# of PGM and PPM images. After encode/decode cycle this test compares PSNR
 # with expected value - minimal common value for all option combinations.
 # Compression ratio is set near to 1 (no compression) to get higher
 # average PSNR for diffrerent filters, block sizes etc.
@@ -70,6 +71,9 @@ Readonly my $TMP_DIR =>
 Readonly my $RND_SUFFIX_LENGTH  => 4;
 Readonly my $NUMBER_OF_THREADS  => 16;
 Readonly my $NUMBER_OF_MPI_CPUS => 8;
+Readonly my $TRUNCATION_RATIO   => 1.001;
+Readonly my $CLUSTER_WINDOW     => 8;
+Readonly my $LOCAL_THREADS      => 2;
 Readonly my $CLUSTER_NODE_LIST =>
     catfile( $Bin, q{..}, 'build', 'epsilon.nodes' );
 Readonly my $MPI_MACHINE_FILE =>
@@ -111,10 +115,13 @@ sub common_case_tests {
                         .= " --threads $NUMBER_OF_THREADS";
                 }
 
-                # Speclify list of nodes for EPSILON cluster
+                # Speclify list of nodes for EPSILON cluster, let local
+                # threads encode along with the nodes
                 if ( $build_tag eq 'cluster' ) {
                     $epsilon_encode_options
-                        .= " --node-list $CLUSTER_NODE_LIST";
+                        .= " --node-list $CLUSTER_NODE_LIST"
+                        . " --window $CLUSTER_WINDOW"
+                        . " --local-threads $LOCAL_THREADS";
                 }
 
                 # Speclify machines file and number of CPUs MPI EPSILON
@@ -153,6 +160,25 @@ sub common_case_tests {
                 rename catfile( $TMP_DIR, "$image.psi" ),
                     catfile( $TMP_DIR, "$reconstructed_image.psi" );
 
+                # Truncate indexed file: the block index must be rebuilt
+                # and still lead the decoder to every block
+                if ( $option_combination =~ m{--block-index}xms ) {
+                    my $epsilon_truncate_options
+                        = "--truncate-file --ratio $TRUNCATION_RATIO --quiet";
+
+                    lives_ok {
+                        run_epsilon(
+                            build_tag       => $build_tag,
+                            epsilon_options => $epsilon_truncate_options,
+                            mpirun_options  => $mpirun_encode_options,
+                            file =>
+                                catfile( $TMP_DIR, "$reconstructed_image.psi" ),
+                        );
+                    }
+                    "[$build_tag] Truncate '$reconstructed_image.psi' with epsilon options: "
+                        . "'$epsilon_truncate_options'";
+                }
+
                 my $epsilon_decode_options = '--decode-file --quiet';
                 my $mpirun_decode_options  = q{};
 
@@ -163,7 +189,8 @@ sub common_case_tests {
 
                 if ( $build_tag eq 'cluster' ) {
                     $epsilon_decode_options
-                        .= " --node-list $CLUSTER_NODE_LIST";
+                        .= " --node-list $CLUSTER_NODE_LIST"
+                        . " --window $CLUSTER_WINDOW";
                 }
 
                 if ( $build_tag eq 'mpi' ) {